@@ -22,9 +22,63 @@ require 'image'
 
 figleaf = {}
 
+-- Reads a dataset packed by figleaf --dataset (see figleaf/dataset.h) in a few
+-- bulk reads, instead of decoding every image. Returns the geometry, the number
+-- of channels, the image names grouped by class as loadDataset lists files, and
+-- a function that gives the image with a given name.
+local function readPacked(fileName)
+   local f = torch.DiskFile(fileName, 'r'):binary()
+   f:littleEndianEncoding()
+   if f:readChar(8):string() ~= 'FIGLEAFD' then
+      error(fileName .. ' is not a figleaf dataset')
+   end
+   local header = f:readInt(6)
+   local count, channels, height, width, numClasses =
+      header[2], header[3], header[4], header[5], header[6]
+   if header[1] ~= 1 then
+      error(fileName .. ' is from a newer version of figleaf')
+   elseif count == 0 then
+      error(fileName .. ' has no images; did the figleaf run finish?')
+   end
+
+   local pixels = torch.ByteTensor(f:readByte(count * channels * height * width))
+   pixels = pixels:view(count, channels, height, width)
+   local labels = f:readInt(count)
+
+   -- The class names, then the image names, NUL-terminated
+   local here = f:position()
+   f:seekEnd()
+   local strings = {}
+   local rest = f:position() - here
+   f:seek(here)
+   for str in f:readChar(rest):string():gmatch('([^%z]*)%z') do
+      table.insert(strings, str)
+   end
+   f:close()
+
+   local allFiles = {}
+   local indexOf = {}
+   for class = 1, numClasses do
+      table.insert(allFiles, {})
+   end
+   for i = 1, count do
+      local name = strings[numClasses + i]
+      table.insert(allFiles[labels[i] + 1], name)
+      indexOf[name] = i
+   end
+   for _, class in pairs(allFiles) do
+      table.sort(class)
+   end
+
+   local function loadImage(name)
+      return pixels[indexOf[name]]:double():div(255)
+   end
+   return {height, width}, channels, allFiles, loadImage
+end
+
+-- filePath is either a directory of class directories of images, or a file
+-- packed by figleaf --dataset from one
 function figleaf.loadDataset(filePath, splitIdx)
-   -- Make sure filePath has a trailing slash
-   filePath = filePath .. '/'
 
    -- These are the hardcoded pseudorandom test/train splits
    local trainTestSplit =
@@ -41,29 +95,38 @@ function figleaf.loadDataset(filePath, splitIdx)
          [10] = {[1] = "train", [2] = "test", [3] = "test", [4] = "train", [5] = "test", [6] = "train", [7] = "train", [8] = "train", [9] = "train", [10] = "train"}
       }
 
-   -- TODO: Autodetect from input data
+   -- TODO: Autodetect from input data (packed datasets do)
    local geometry = {112,92}
+   local channels = 1
+   local loadImage = image.load
 
    local allClasses = {}
    local allFiles = {}
 
-   -- Get number of images to load
-   for classdir in lfs.dir(filePath) do
-      if lfs.attributes(filePath .. classdir,'mode') == 'directory' and classdir ~= '.' and classdir ~= '..' then
-         table.insert(allClasses, classdir)
-      end
-   end
-   table.sort(allClasses)
+   if lfs.attributes(filePath,'mode') == 'file' then
+      geometry, channels, allFiles, loadImage = readPacked(filePath)
+   else
+      -- Make sure filePath has a trailing slash
+      filePath = filePath .. '/'
 
-   for _, classdir in pairs(allClasses) do
-      table.insert(allFiles, {})
-      for imageFile in lfs.dir(filePath .. classdir) do
-         fullImagePath = filePath .. classdir .. '/' .. imageFile
-         if lfs.attributes(fullImagePath,'mode') == 'file' then
-            table.insert(allFiles[#allFiles], fullImagePath)
+      -- Get number of images to load
+      for classdir in lfs.dir(filePath) do
+         if lfs.attributes(filePath .. classdir,'mode') == 'directory' and classdir ~= '.' and classdir ~= '..' then
+            table.insert(allClasses, classdir)
+         end
+      end
+      table.sort(allClasses)
+
+      for _, classdir in pairs(allClasses) do
+         table.insert(allFiles, {})
+         for imageFile in lfs.dir(filePath .. classdir) do
+            fullImagePath = filePath .. classdir .. '/' .. imageFile
+            if lfs.attributes(fullImagePath,'mode') == 'file' then
+               table.insert(allFiles[#allFiles], fullImagePath)
+            end
          end
+         table.sort(allFiles[#allFiles])
       end
-      table.sort(allFiles[#allFiles])
    end
 
    local portionTrain = 0.7
@@ -72,14 +135,14 @@ function figleaf.loadDataset(filePath, splitIdx)
    local test_size = numImages - train_size
 
    trainData = {
-      data = torch.Tensor(train_size, 1, geometry[1], geometry[2]),
+      data = torch.Tensor(train_size, channels, geometry[1], geometry[2]),
       labels = torch.Tensor(train_size),
       size = function() return train_size end,
       numClasses = function() return #allFiles end,
    }
 
    testData = {
-      data = torch.Tensor(test_size, 1, geometry[1], geometry[2]),
+      data = torch.Tensor(test_size, channels, geometry[1], geometry[2]),
       labels = torch.Tensor(test_size),
       size = function() return test_size end,
       numClasses = function() return #allFiles end,
@@ -104,11 +167,11 @@ function figleaf.loadDataset(filePath, splitIdx)
          -- print(trainTestSplit[splitIdx][idxInClass] .. " - " .. imageFile)
          if trainTestSplit[splitIdx][idxInClass] == "train" then
                numTrain = numTrain + 1
-               trainData.data[numTrain] = image.load(imageFile)
+               trainData.data[numTrain] = loadImage(imageFile)
                trainData.labels[numTrain] = numClasses
          else
                numTest = numTest + 1
-               testData.data[numTest] = image.load(imageFile)
+               testData.data[numTest] = loadImage(imageFile)
                testData.labels[numTest] = numClasses
          end
       end
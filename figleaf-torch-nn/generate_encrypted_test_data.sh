@@ -12,35 +12,32 @@
 #--------------------------------------------------------------------
 
 ### Convert input images to JPEG
+# Each quality gets a tree of its own, laid out like ATT, so it can be
+# encrypted in one go below.  figleaf-mkjpeg does the colour conversion and
+# DCT once for all three qualities.
 rm -f tmp.parallel
 find ./ATT -name '*.pgm' | while read file; do
 	filenum="${file:t:r}"
-	filedir="${file:h}"
+	persondir="${file:h:t}"
 	#echo "$filenum"
-	#echo "$filedir"
+	#echo "$persondir"
 	for quality in 50 70 95; do
-		echo "convert '$file' -quality '$quality' '$filedir/${filenum}_quality_${quality}.jpg'" >> tmp.parallel
+		mkdir -p "ATT_quality_${quality}/$persondir"
 	done
+	echo "../figleaf/figleaf-mkjpeg -q 50,70,95 '$file' 'ATT_quality_%q/$persondir/${filenum}_quality_%q.jpg'" >> tmp.parallel
 done
 parallel -j 16 < tmp.parallel
 rm -f tmp.parallel
 
 ### Encrypt the resulting images
-rm -f tmp.parallel
+# One figleaf run per quality decodes each image once and encrypts it under
+# every combination of bits and blocksize, into
+# ATT_encrypted/quality_<quality>_bits_<bits>_block_<block>/<person>/
+# The same images are packed into ATT_packed/quality_..._block_<block>.fds,
+# which figleaf-nn-dataset.lua loads much faster than the directories.
 for quality in 50 70 95; do
-	for bits in 0 1 3 6; do
-		for block in 8 16 24 32; do
-			outputdir="ATT_encrypted/quality_${quality}_bits_${bits}_block_${block}"
-			mkdir -p "$outputdir"
-			find ./ATT -name "*quality_${quality}.jpg" | while read file; do
-				filename="${file:t}"
-				persondir="${file:h:t}"
-				mkdir -p "$outputdir/$persondir"
-				echo "../figleaf/figleaf -e -i '$(pwd)/$file' -o '$(pwd)/$outputdir/$persondir/$filename' -p 'figleaf' -b '$block' -s -a '$bits'" >> tmp.parallel
-			done
-		done
-	done
+	../figleaf/figleaf -e --sweep -a 0,1,3,6 -b 8,16,24,32 -p 'figleaf' -s -j 16 \
+		-i "ATT_quality_${quality}" \
+		-o "ATT_encrypted/quality_${quality}_bits_%a_block_%b" \
+		--dataset "ATT_packed/quality_${quality}_bits_%a_block_%b.fds"
 done
-parallel -j 16 < tmp.parallel
-rm -f tmp.parallel
-
@@ -14,7 +14,9 @@
 #
 #--------------------------------------------------------------------
 
-INDIR="./ATT_encrypted"
+# The packed datasets; ./ATT_encrypted holds the same images as JPEG files,
+# which take much longer to load
+INDIR="./ATT_packed"
 OUTDIR="./out"
 mkdir -p "$OUTDIR"
 rm -f alltasks.sh
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "figleaf.h"
+#include "worker.h"
+#include "batch.h"
+#include "stats.h"
+#include "sizes.h"
+#include "recover.h"
+
+struct batch_state {
+  struct figleaf_jobs *jobs;
+
+  char *passphrase;
+  struct figleaf_context *ctx;
+
+  int threads_per_worker; // Spare threads go to each image's entropy coding
+  int num_workers;
+};
+
+static void *
+batch_thread_main(void *arg)
+{
+  struct batch_state *state = (struct batch_state *) arg;
+  struct figleaf_worker worker;
+
+  figleaf_worker_init(&worker, state->threads_per_worker);
+  figleaf_worker_share_spare(&worker, state->num_workers);
+
+  struct figleaf_job job;
+  while (state->jobs->next(state->jobs, &job)) {
+    int rc;
+    if (state->ctx->sweep != NULL)
+      rc = figleaf_sweep_image(&worker, job.input_filename, job.output_filename,
+                               state->passphrase, state->ctx->sweep,
+                               state->ctx);
+    else if ((rc = figleaf_process_image(&worker, job.input_filename,
+                                         job.output_filename,
+                                         state->passphrase,
+                                         job.ctx ? job.ctx : state->ctx)) == 0)
+      rc = figleaf_export_image(&worker, state->ctx->dataset,
+                                job.input_filename);
+    if (rc != 0) {
+      // Skip it and carry on with the rest
+      figleaf_failures_add(state->ctx->failures, job.input_filename,
+                           worker.recover.message);
+      state->jobs->done(state->jobs, &job, NULL, 0);
+      continue;
+    }
+    figleaf_stats_log_file(state->ctx->stats_log, job.input_filename,
+                           &worker.stats);
+    figleaf_sizes_log_file(state->ctx->size_log, job.input_filename,
+                           &worker.sizes, worker.stats.bytes_in,
+                           worker.stats.bytes_out);
+    state->jobs->done(state->jobs, &job, worker.outbuf.data,
+                      worker.outbuf.size);
+  }
+
+  figleaf_worker_destroy(&worker);
+  return NULL;
+}
+
+void
+figleaf_run_batch(struct figleaf_jobs *jobs,
+                  char *passphrase, struct figleaf_context *ctx)
+{
+  struct batch_state state;
+  int num_threads = ctx->num_threads;
+
+  if (num_threads < 1)
+    num_threads = 1;
+  // Only the first few files need to be found to know whether there are
+  // enough to go around
+  size_t num_jobs = jobs->prefetch(jobs, num_threads);
+  if (num_jobs == 0)
+    return;
+  if ((size_t) num_threads > num_jobs)
+    num_threads = num_jobs;
+
+  state.jobs = jobs;
+  state.passphrase = passphrase;
+  state.ctx = ctx;
+  state.threads_per_worker = (ctx->num_threads > num_threads)
+                             ? ctx->num_threads / num_threads : 1;
+  state.num_workers = num_threads;
+
+  if (num_threads <= 1) {
+    // No need to spin up any threads; just do the work right here
+    batch_thread_main(&state);
+  } else {
+    pthread_t *threads = (pthread_t *) calloc(num_threads, sizeof(pthread_t));
+    if (threads == NULL)
+      err(1, "Couldn't allocate worker threads");
+
+    int t = 0;
+    for (t = 0; t < num_threads; t++) {
+      int rc = pthread_create(&threads[t], NULL, batch_thread_main, &state);
+      if (rc != 0)
+        errx(1, "Couldn't start worker thread %d; rc = %d", t, rc);
+    }
+    for (t = 0; t < num_threads; t++)
+      pthread_join(threads[t], NULL);
+
+    free(threads);
+  }
+}
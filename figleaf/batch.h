@@ -0,0 +1,47 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stddef.h>
+
+#include "figleaf.h"
+
+/* One input file to be encrypted/decrypted into one output file */
+struct figleaf_job {
+  char *input_filename;
+  char *output_filename;
+  struct figleaf_context *ctx;  // Settings for this job, or NULL for the
+                                // ones the whole batch was started with
+};
+
+/*
+ * Where a batch gets its jobs from: a directory walk (walk.h) or a
+ * manifest (manifest.h).  All three methods may be called from several
+ * threads at once.
+ *
+ *   next:     fill in the next job; returns 0 once there are no more
+ *   prefetch: read up to n jobs ahead and return how many are waiting,
+ *             which is fewer than n only if that's all there are.  Called
+ *             at most once, before any call to next.
+ *   done:     the job's output (which is output_size bytes long) has been
+ *             written; release the job.  output is NULL if the job
+ *             failed, in which case nothing was written.
+ */
+struct figleaf_jobs {
+  int (*next)(struct figleaf_jobs *jobs, struct figleaf_job *job);
+  size_t (*prefetch)(struct figleaf_jobs *jobs, size_t n);
+  void (*done)(struct figleaf_jobs *jobs, struct figleaf_job *job,
+               const void *output, size_t output_size);
+};
+
+/*
+ * Process every job from the source using ctx->num_threads worker
+ * threads.  Each thread keeps its own persistent JPEG codec state (see
+ * worker.h) and pulls the next job from the source until none are left.  If there are fewer jobs than threads, the
+ * leftover threads are shared out among the workers for splitting up
+ * each image's entropy coding.
+ */
+void
+figleaf_run_batch(struct figleaf_jobs *jobs,
+                  char *passphrase, struct figleaf_context *ctx);
+
+#endif
@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+# Throughput regression gate
+#
+# Runs bench/throughput and compares each figure against a baseline
+# recorded earlier on the same machine, failing if any has dropped by more
+# than THRESHOLD percent.  The baseline is a file of "name MB/s" lines, as
+# bench/throughput prints them.
+#
+# Usage: bench/check.sh [-u] [baseline]
+#
+# -u records a new baseline instead of checking against it.  Set THRESHOLD
+# (default 10) and SECONDS_PER_ROUND (default 1) in the environment to
+# change how strict and how long the measurement is.
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+THROUGHPUT=$HERE/throughput
+THRESHOLD=${THRESHOLD:-10}
+SECONDS_PER_ROUND=${SECONDS_PER_ROUND:-1}
+
+UPDATE=0
+if [ "$1" = "-u" ]; then
+  UPDATE=1
+  shift
+fi
+BASELINE=${1:-$HERE/baseline}
+
+if [ ! -x "$THROUGHPUT" ]; then
+  echo "Need $THROUGHPUT -- run make bench/throughput first" >&2
+  exit 1
+fi
+
+RESULTS=$(mktemp)
+trap 'rm -f "$RESULTS"' EXIT
+"$THROUGHPUT" "$SECONDS_PER_ROUND" > "$RESULTS" || exit 1
+
+if [ "$UPDATE" = 1 ]; then
+  cp "$RESULTS" "$BASELINE"
+  echo "Recorded baseline in $BASELINE:"
+  cat "$BASELINE"
+  exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+  echo "No baseline in $BASELINE -- run make bench-baseline on this machine first" >&2
+  exit 1
+fi
+
+# A figure missing from either side is reported but doesn't fail the check,
+# so adding a measurement doesn't need a new baseline everywhere at once
+awk -v threshold="$THRESHOLD" '
+  NR == FNR { base[$1] = $2; next }
+  {
+    seen[$1] = 1;
+    if (!($1 in base)) {
+      printf("%-16s %9.2f MB/s  (not in baseline)\n", $1, $2);
+      next;
+    }
+    change = base[$1] > 0 ? 100 * ($2 - base[$1]) / base[$1] : 0;
+    bad = change < -threshold;
+    printf("%-16s %9.2f MB/s  baseline %9.2f  %+6.1f%%%s\n",
+           $1, $2, base[$1], change, bad ? "  REGRESSION" : "");
+    if (bad)
+      failed++;
+  }
+  END {
+    for (name in base)
+      if (!(name in seen))
+        printf("%-16s missing from this run\n", name);
+    if (failed) {
+      printf("%d figure(s) more than %s%% below the baseline\n",
+             failed, threshold);
+      exit 1;
+    }
+  }
+' "$BASELINE" "$RESULTS"
@@ -0,0 +1,377 @@
+/*
+ * Time of each block kernel on its own, in ns per coefficient
+ *
+ * Runs the encryption kernels, the minmax functions and random_uints() on
+ * tiles of generated coefficients, one kernel at a time, with no JPEG
+ * decoding or encoding around them.  Tiles are 1, 4, 9, 16, 64 and 256
+ * coefficients long, which is what a band holds with -b 8, 16, 24, 32, 64
+ * and 128.  DC tiles are correlated values spread over the whole DC range,
+ * as neighbouring blocks of a photo give; AC tiles are mostly zero with a
+ * few small values of either sign.  Each kernel gets the band and range
+ * (from the minmax function) that tpe.c gives it in the module that uses
+ * it, and the decrypt kernels get tiles their encrypt kernel has already
+ * encrypted.
+ *
+ * Each figure is the best of ROUNDS rounds of about SECONDS seconds, less
+ * the time to copy a fresh tile into place before each call.  Prints a
+ * table with one row per kernel and one column per tile length.  Naming
+ * kernels on the command line runs just those.
+ *
+ * Usage: bench/kernels [seconds] [rounds] [kernel...]
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+#include "jpeglib.h"
+#include "stats.h"
+#include "fpe.h"
+#include "drpe.h"
+#include "drpe_lsb.h"
+#include "lsb.h"
+#include "gibbs.h"
+#include "fisheryates.h"
+#include "mosaic.h"
+#include "minmax.h"
+#include "random.h"
+
+/* Enough tiles that one round doesn't just run out of a warm L1 */
+#define NUM_TILES 256
+#define MAX_TILE_LEN 256
+
+static const int tile_lens[] = { 1, 4, 9, 16, 64, 256 };
+#define NUM_TILE_LENS ((int) (sizeof tile_lens / sizeof tile_lens[0]))
+
+typedef void (*kernel_fcn)(unsigned char *key, unsigned char *nonce,
+                           JCOEF *data, int datalen,
+                           JCOEF vmin, JCOEF vmax);
+typedef void (*minmax_fcn)(JCOEF *array, int arraylen,
+                           int min_param, int max_param,
+                           JCOEF *array_min, JCOEF *array_max,
+                           JCOEF *array_avg);
+
+enum band { DC, AC };
+
+/*
+ * The kernels, wrapped to one signature.  The fcn_user_arg each gets is
+ * the default the module would use.
+ */
+
+static void
+k_fpe_encrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+              int len, JCOEF vmin, JCOEF vmax)
+{
+  fpe_encrypt(key, nonce, data, len, vmin, vmax, 1);
+}
+
+static void
+k_fpe_decrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+              int len, JCOEF vmin, JCOEF vmax)
+{
+  fpe_decrypt(key, nonce, data, len, vmin, vmax, 1);
+}
+
+static void
+k_drpe(unsigned char *key, unsigned char *nonce, JCOEF *data, int len,
+       JCOEF vmin, JCOEF vmax)
+{
+  drpe_encrypt_decrypt(key, nonce, data, len, vmin, vmax, 0);
+}
+
+static void
+k_drpe_lsb_encrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+                   int len, JCOEF vmin, JCOEF vmax)
+{
+  drpe_lsb_encrypt_all(key, nonce, data, len, vmin, vmax,
+                       LSB_TPE_DEFAULT_NUM_BITS);
+}
+
+static void
+k_drpe_lsb_decrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+                   int len, JCOEF vmin, JCOEF vmax)
+{
+  drpe_lsb_decrypt_all(key, nonce, data, len, vmin, vmax,
+                       LSB_TPE_DEFAULT_NUM_BITS);
+}
+
+static void
+k_lsb_encrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+              int len, JCOEF vmin, JCOEF vmax)
+{
+  lsb_encrypt_dc(key, nonce, data, len, vmin, vmax, LSB_TPE_DEFAULT_NUM_BITS);
+}
+
+static void
+k_lsb_decrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+              int len, JCOEF vmin, JCOEF vmax)
+{
+  lsb_decrypt_dc(key, nonce, data, len, vmin, vmax, LSB_TPE_DEFAULT_NUM_BITS);
+}
+
+static void
+k_gibbs_encrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+                int len, JCOEF vmin, JCOEF vmax)
+{
+  gibbs_encrypt_block(key, nonce, data, len, vmin, vmax, 0);
+}
+
+static void
+k_gibbs_decrypt(unsigned char *key, unsigned char *nonce, JCOEF *data,
+                int len, JCOEF vmin, JCOEF vmax)
+{
+  gibbs_decrypt_block(key, nonce, data, len, vmin, vmax, 0);
+}
+
+static void
+k_shuffle(unsigned char *key, unsigned char *nonce, JCOEF *data, int len,
+          __attribute__((unused)) JCOEF vmin,
+          __attribute__((unused)) JCOEF vmax)
+{
+  fisheryates_shuffle(key, nonce, data, len);
+}
+
+static void
+k_unshuffle(unsigned char *key, unsigned char *nonce, JCOEF *data, int len,
+            __attribute__((unused)) JCOEF vmin,
+            __attribute__((unused)) JCOEF vmax)
+{
+  fisheryates_unshuffle(key, nonce, data, len);
+}
+
+static void
+k_mosaic_fuzzy(unsigned char *key, unsigned char *nonce, JCOEF *data,
+               int len, JCOEF vmin, JCOEF vmax)
+{
+  mosaic_fuzzy_block(key, nonce, data, len, vmin, vmax, 2);
+}
+
+static void
+k_random_uints(unsigned char *key, unsigned char *nonce,
+               __attribute__((unused)) JCOEF *data, int len,
+               __attribute__((unused)) JCOEF vmin,
+               __attribute__((unused)) JCOEF vmax)
+{
+  free(random_uints(key, nonce, len));
+}
+
+/* The minmax functions are timed on their own, with tpe.c's parameters */
+#define MINMAX_KERNEL(fcn)                                              \
+  static void                                                           \
+  k_##fcn(__attribute__((unused)) unsigned char *key,                   \
+          __attribute__((unused)) unsigned char *nonce,                 \
+          JCOEF *data, int len,                                         \
+          __attribute__((unused)) JCOEF vmin,                           \
+          __attribute__((unused)) JCOEF vmax)                           \
+  {                                                                     \
+    JCOEF min, max, avg;                                                \
+    fcn(data, len, 0, 10, &min, &max, &avg);                            \
+  }
+
+MINMAX_KERNEL(minmax_from_sample)
+MINMAX_KERNEL(minmax_poweroftwo)
+MINMAX_KERNEL(minmax_average_plusminus_poweroftwo)
+MINMAX_KERNEL(minmax_bitmask)
+MINMAX_KERNEL(minmax_fixedbase_plus_poweroftwo)
+MINMAX_KERNEL(minmax_raw)
+
+static const struct kernel {
+  const char *name;
+  kernel_fcn fcn;
+  enum band band;
+  minmax_fcn range;     // How tpe.c finds vmin and vmax for it, or NULL
+  kernel_fcn prepare;   // For decrypt kernels, its encrypt kernel
+} kernels[] = {
+  // shuffle and gibbs use fpe on the nonzero AC coefficients
+  { "fpe_encrypt", k_fpe_encrypt, AC, minmax_poweroftwo, NULL },
+  { "fpe_decrypt", k_fpe_decrypt, AC, minmax_poweroftwo, k_fpe_encrypt },
+  { "drpe_encrypt_decrypt", k_drpe, AC, minmax_raw, NULL },
+  { "drpe_lsb_encrypt_all", k_drpe_lsb_encrypt, DC, minmax_raw, NULL },
+  { "drpe_lsb_decrypt_all", k_drpe_lsb_decrypt, DC, minmax_raw,
+    k_drpe_lsb_encrypt },
+  { "lsb_encrypt", k_lsb_encrypt, DC, minmax_poweroftwo, NULL },
+  { "lsb_decrypt", k_lsb_decrypt, DC, minmax_poweroftwo, k_lsb_encrypt },
+  { "gibbs_encrypt_block", k_gibbs_encrypt, DC, minmax_bitmask, NULL },
+  { "gibbs_decrypt_block", k_gibbs_decrypt, DC, minmax_bitmask,
+    k_gibbs_encrypt },
+  { "fisheryates_shuffle", k_shuffle, DC, NULL, NULL },
+  { "fisheryates_unshuffle", k_unshuffle, DC, NULL, k_shuffle },
+  { "mosaic_fuzzy_block", k_mosaic_fuzzy, DC, NULL, NULL },
+  { "minmax_from_sample", k_minmax_from_sample, DC, NULL, NULL },
+  { "minmax_poweroftwo", k_minmax_poweroftwo, DC, NULL, NULL },
+  { "minmax_average_plusminus_poweroftwo",
+    k_minmax_average_plusminus_poweroftwo, DC, NULL, NULL },
+  { "minmax_bitmask", k_minmax_bitmask, DC, NULL, NULL },
+  { "minmax_fixedbase_plus_poweroftwo",
+    k_minmax_fixedbase_plus_poweroftwo, DC, NULL, NULL },
+  { "minmax_raw", k_minmax_raw, DC, NULL, NULL },
+  { "random_uints", k_random_uints, DC, NULL, NULL },
+};
+#define NUM_KERNELS ((int) (sizeof kernels / sizeof kernels[0]))
+
+/* The tiles one kernel runs over at one tile length */
+struct tiles {
+  JCOEF data[NUM_TILES][MAX_TILE_LEN];
+  JCOEF vmin[NUM_TILES], vmax[NUM_TILES];
+  unsigned char nonce[NUM_TILES][crypto_stream_NONCEBYTES];
+};
+
+static unsigned char key[crypto_stream_KEYBYTES];
+
+static unsigned int
+rng(unsigned int *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static void
+make_tiles(struct tiles *t, const struct kernel *k, int len)
+{
+  unsigned int state = 2463534242u + len;
+  int i, j;
+
+  for (i = 0; i < NUM_TILES; i++) {
+    JCOEF *tile = t->data[i];
+    if (k->band == DC) {
+      // A level somewhere in [-1024, 1023], drifting from block to block
+      int level = (int) (rng(&state) % 1800) - 900;
+      for (j = 0; j < len; j++) {
+        level += (int) (rng(&state) % 41) - 20;
+        tile[j] = level < -1024 ? -1024 : level > 1023 ? 1023 : level;
+      }
+    } else {
+      // Roughly Laplacian: about two in three are zero
+      for (j = 0; j < len; j++) {
+        unsigned int r = rng(&state);
+        int mag = 0;
+        if (r % 3 == 0)
+          for (mag = 1; mag < 64 && (rng(&state) & 3) == 0; mag *= 2)
+            ;
+        tile[j] = (r & 0x100) ? -mag : mag;
+      }
+    }
+
+    t->vmin[i] = t->vmax[i] = 0;
+    if (k->range != NULL) {
+      JCOEF avg;
+      k->range(tile, len, 0, 10, &t->vmin[i], &t->vmax[i], &avg);
+    }
+    memset(t->nonce[i], 0, crypto_stream_NONCEBYTES);
+    memcpy(t->nonce[i], &i, sizeof i);
+    if (k->prepare != NULL)
+      k->prepare(key, t->nonce[i], tile, len, t->vmin[i], t->vmax[i]);
+  }
+}
+
+/* Seconds per coefficient over one round, with or without the kernel */
+static double
+run_round(const struct tiles *t, kernel_fcn fcn, int len, double seconds)
+{
+  JCOEF work[MAX_TILE_LEN];
+  unsigned char nonce[crypto_stream_NONCEBYTES];
+  double start = figleaf_now(), elapsed;
+  unsigned long long coefs = 0;
+  int i;
+
+  do {
+    for (i = 0; i < NUM_TILES; i++) {
+      memcpy(work, t->data[i], len * sizeof(JCOEF));
+      memcpy(nonce, t->nonce[i], sizeof nonce);
+      if (fcn != NULL)
+        fcn(key, nonce, work, len, t->vmin[i], t->vmax[i]);
+    }
+    coefs += (unsigned long long) NUM_TILES * len;
+    elapsed = figleaf_now() - start;
+  } while (elapsed < seconds);
+
+  return elapsed / coefs;
+}
+
+static double
+best_of(const struct tiles *t, kernel_fcn fcn, int len, double seconds,
+        int rounds)
+{
+  double best = 0;
+  int r;
+
+  for (r = 0; r < rounds; r++) {
+    double time = run_round(t, fcn, len, seconds);
+    if (r == 0 || time < best)
+      best = time;
+  }
+  return best;
+}
+
+static int
+selected(const char *name, int argc, char *argv[])
+{
+  int i;
+
+  if (argc <= 3)
+    return 1;
+  for (i = 3; i < argc; i++)
+    if (!strcmp(argv[i], name))
+      return 1;
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  double seconds = argc > 1 ? atof(argv[1]) : 0.05;
+  int rounds = argc > 2 ? atoi(argv[2]) : 3;
+  struct tiles *t;
+  int n, l, i;
+
+  if (seconds <= 0 || rounds < 1)
+    errx(1, "Usage: %s [seconds] [rounds] [kernel...]", argv[0]);
+  for (i = 3; i < argc; i++) {
+    for (n = 0; n < NUM_KERNELS; n++)
+      if (!strcmp(argv[i], kernels[n].name))
+        break;
+    if (n == NUM_KERNELS)
+      errx(1, "No kernel called %s", argv[i]);
+  }
+  if (sodium_init() == -1)
+    errx(1, "Failed to initialize libsodium");
+  if ((t = (struct tiles *) malloc(sizeof *t)) == NULL)
+    err(1, "Couldn't allocate memory");
+  memset(key, 0x5a, sizeof key);
+
+  // Some kernels print warnings as they go; keep those out of the results
+  FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    err(1, "Couldn't redirect stdout");
+
+  fprintf(out, "%-36s", "ns/coefficient");
+  for (l = 0; l < NUM_TILE_LENS; l++)
+    fprintf(out, " %8d", tile_lens[l]);
+  fprintf(out, "\n");
+
+  for (n = 0; n < NUM_KERNELS; n++) {
+    if (!selected(kernels[n].name, argc, argv))
+      continue;
+    fprintf(out, "%-36s", kernels[n].name);
+    for (l = 0; l < NUM_TILE_LENS; l++) {
+      int len = tile_lens[l];
+      make_tiles(t, &kernels[n], len);
+      double copy = best_of(t, NULL, len, seconds / 4, rounds);
+      double time = best_of(t, kernels[n].fcn, len, seconds, rounds) - copy;
+      fprintf(out, " %8.2f", time > 0 ? time * 1e9 : 0);
+      fflush(out);
+    }
+    fprintf(out, "\n");
+  }
+  free(t);
+  fclose(out);
+  return 0;
+}
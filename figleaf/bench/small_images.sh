@@ -0,0 +1,55 @@
+#!/bin/bash
+#
+# Throughput benchmark for batches of small images
+#
+# Converts the ATT face images from figleaf-torch-nn/sample_data into
+# small JPEGs (roughly profile-picture sized), makes COPIES copies of the
+# set, and times encryption of the whole directory in batch mode.
+#
+# Usage: bench/small_images.sh [path/to/figleaf] [copies] [threads]
+#
+# Run it once against an old build and once against a new one to compare.
+
+FIGLEAF=${1:-./figleaf}
+COPIES=${2:-10}
+THREADS=${3:-1}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+CJPEG=$HERE/../jpeg-6b/cjpeg
+SAMPLES=$HERE/../../figleaf-torch-nn/sample_data/ATT
+
+if [ ! -x "$CJPEG" ]; then
+  echo "Need $CJPEG -- run make first" >&2
+  exit 1
+fi
+
+# Older builds have no -j option
+JOBS_FLAG=
+if [ "$THREADS" -gt 1 ]; then
+  JOBS_FLAG="-j $THREADS"
+fi
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+mkdir -p "$WORKDIR/in" "$WORKDIR/out"
+
+n=0
+for c in $(seq 1 "$COPIES"); do
+  for pgm in "$SAMPLES"/s*/*.pgm; do
+    "$CJPEG" -quality 75 "$pgm" > "$WORKDIR/in/$n.jpg"
+    n=$((n + 1))
+  done
+done
+
+bytes=$(cat "$WORKDIR"/in/*.jpg | wc -c)
+echo "Encrypting $n images ($bytes bytes) with $THREADS thread(s)"
+
+start=$(date +%s.%N)
+"$FIGLEAF" -e -i "$WORKDIR/in" -o "$WORKDIR/out" -p benchmark \
+  -b 16 -m drpe-lsb -a 2 $JOBS_FLAG > /dev/null
+end=$(date +%s.%N)
+
+awk -v n="$n" -v s="$start" -v e="$end" 'BEGIN {
+  t = e - s;
+  printf("%.3f s total, %.1f images/s, %.1f us/image\n", t, n / t, 1e6 * t / n);
+}'
@@ -0,0 +1,338 @@
+/*
+ * Per-stage timing of the bundled libjpeg's pixel pipeline
+ *
+ * Decodes a JPEG to RGB, then encodes the result again, ITERATIONS times
+ * each, and reports how long each stage took: entropy coding, DCT,
+ * up/downsampling and color conversion.  The stages are timed by wrapping
+ * the method pointers libjpeg's modules install, so this needs a baseline
+ * (single-scan) input.  Time that isn't in any of the wrapped stages, such
+ * as moving rows between buffers and the file I/O, shows up as "other".
+ *
+ * Usage: bench/stages input.jpg [iterations] [-nosmooth]
+ *
+ * -nosmooth selects the merged upsampler, which does upsampling and color
+ * conversion in one step, so their times are reported together.  Set
+ * JSIMD_FORCENONE=1 or JSIMD_FORCESSE2=1 in the environment to compare
+ * against the C routines or the SSE2-only build of the SIMD routines.
+ */
+
+#define _POSIX_C_SOURCE 199309L	// for clock_gettime under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <time.h>
+
+#define JPEG_INTERNALS
+#include "jpeglib.h"
+
+enum stage {
+  STAGE_ENTROPY, STAGE_DCT, STAGE_SAMPLE, STAGE_COLOR, STAGE_TOTAL, NUM_STAGES
+};
+
+static const char *stage_names[NUM_STAGES] = {
+  "entropy", "dct", "sampling", "color", "total"
+};
+
+static double stage_time[NUM_STAGES];
+
+// The real methods, called by the timing wrappers below
+static JMETHOD(boolean, real_decode_mcu, (j_decompress_ptr, JBLOCKROW *));
+static JMETHOD(int, real_decompress_data, (j_decompress_ptr, JSAMPIMAGE));
+static JMETHOD(void, real_upsample, (j_decompress_ptr, JSAMPIMAGE,
+                                     JDIMENSION *, JDIMENSION, JSAMPARRAY,
+                                     JDIMENSION *, JDIMENSION));
+static JMETHOD(void, real_color_deconvert, (j_decompress_ptr, JSAMPIMAGE,
+                                            JDIMENSION, JSAMPARRAY, int));
+static JMETHOD(boolean, real_encode_mcu, (j_compress_ptr, JBLOCKROW *));
+static JMETHOD(void, real_forward_DCT, (j_compress_ptr, jpeg_component_info *,
+                                        JSAMPARRAY, JBLOCKROW, JDIMENSION,
+                                        JDIMENSION, JDIMENSION));
+static JMETHOD(void, real_downsample, (j_compress_ptr, JSAMPIMAGE, JDIMENSION,
+                                       JSAMPIMAGE, JDIMENSION));
+static JMETHOD(void, real_color_convert, (j_compress_ptr, JSAMPARRAY,
+                                          JSAMPIMAGE, JDIMENSION, int));
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Decompression wrappers.  decompress_data includes the entropy decoding,
+ * so that is subtracted out afterwards; likewise upsample includes the
+ * color conversion unless the merged upsampler is in use.
+ */
+
+static boolean
+timed_decode_mcu(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  double start = now();
+  boolean ret = real_decode_mcu(cinfo, MCU_data);
+
+  stage_time[STAGE_ENTROPY] += now() - start;
+  return ret;
+}
+
+static int
+timed_decompress_data(j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
+{
+  double start = now();
+  int ret = real_decompress_data(cinfo, output_buf);
+
+  stage_time[STAGE_DCT] += now() - start;
+  return ret;
+}
+
+static void
+timed_upsample(j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+               JDIMENSION *in_row_group_ctr, JDIMENSION in_row_groups_avail,
+               JSAMPARRAY output_buf, JDIMENSION *out_row_ctr,
+               JDIMENSION out_rows_avail)
+{
+  double start = now();
+
+  real_upsample(cinfo, input_buf, in_row_group_ctr, in_row_groups_avail,
+                output_buf, out_row_ctr, out_rows_avail);
+  stage_time[STAGE_SAMPLE] += now() - start;
+}
+
+static void
+timed_color_deconvert(j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+                      JDIMENSION input_row, JSAMPARRAY output_buf,
+                      int num_rows)
+{
+  double start = now();
+
+  real_color_deconvert(cinfo, input_buf, input_row, output_buf, num_rows);
+  stage_time[STAGE_COLOR] += now() - start;
+}
+
+/* Compression wrappers.  None of these nest. */
+
+static boolean
+timed_encode_mcu(j_compress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  double start = now();
+  boolean ret = real_encode_mcu(cinfo, MCU_data);
+
+  stage_time[STAGE_ENTROPY] += now() - start;
+  return ret;
+}
+
+static void
+timed_forward_DCT(j_compress_ptr cinfo, jpeg_component_info *compptr,
+                  JSAMPARRAY sample_data, JBLOCKROW coef_blocks,
+                  JDIMENSION start_row, JDIMENSION start_col,
+                  JDIMENSION num_blocks)
+{
+  double start = now();
+
+  real_forward_DCT(cinfo, compptr, sample_data, coef_blocks, start_row,
+                   start_col, num_blocks);
+  stage_time[STAGE_DCT] += now() - start;
+}
+
+static void
+timed_downsample(j_compress_ptr cinfo, JSAMPIMAGE input_buf,
+                 JDIMENSION in_row_index, JSAMPIMAGE output_buf,
+                 JDIMENSION out_row_group_index)
+{
+  double start = now();
+
+  real_downsample(cinfo, input_buf, in_row_index, output_buf,
+                  out_row_group_index);
+  stage_time[STAGE_SAMPLE] += now() - start;
+}
+
+static void
+timed_color_convert(j_compress_ptr cinfo, JSAMPARRAY input_buf,
+                    JSAMPIMAGE output_buf, JDIMENSION output_row,
+                    int num_rows)
+{
+  double start = now();
+
+  real_color_convert(cinfo, input_buf, output_buf, output_row, num_rows);
+  stage_time[STAGE_COLOR] += now() - start;
+}
+
+static void
+report(const char *what, int iterations, int merged)
+{
+  double other = stage_time[STAGE_TOTAL];
+  int i;
+
+  printf("%s (ms per image):\n", what);
+  for (i = 0; i < NUM_STAGES; i++) {
+    if (i == STAGE_COLOR && merged) {
+      printf("  %-10s (in sampling)\n", stage_names[i]);
+      continue;
+    }
+    printf("  %-10s %8.3f\n", stage_names[i],
+           1e3 * stage_time[i] / iterations);
+    if (i != STAGE_TOTAL)
+      other -= stage_time[i];
+  }
+  printf("  %-10s %8.3f\n", "other", 1e3 * other / iterations);
+}
+
+static JSAMPLE *
+decode(const char *filename, int iterations, int nosmooth,
+       JDIMENSION *width, JDIMENSION *height)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  JSAMPLE *image = NULL;
+  JSAMPROW row;
+  FILE *fp;
+  double start;
+  int i, merged = 0;
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    err(1, "Failed to open [%s]", filename);
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  memset(stage_time, 0, sizeof(stage_time));
+
+  for (i = 0; i < iterations; i++) {
+    rewind(fp);
+    start = now();
+    jpeg_stdio_src(&cinfo, fp);
+    jpeg_read_header(&cinfo, TRUE);
+    if (jpeg_has_multiple_scans(&cinfo))
+      errx(1, "[%s] is progressive; stage timing needs a baseline JPEG",
+           filename);
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.do_fancy_upsampling = !nosmooth;
+    jpeg_start_decompress(&cinfo);
+
+    real_decode_mcu = cinfo.entropy->decode_mcu;
+    cinfo.entropy->decode_mcu = timed_decode_mcu;
+    real_decompress_data = cinfo.coef->decompress_data;
+    cinfo.coef->decompress_data = timed_decompress_data;
+    // With no color quantization, the postprocessing controller hands
+    // rows straight to the upsampler, through a copy of its method pointer
+    real_upsample = cinfo.post->post_process_data;
+    cinfo.post->post_process_data = timed_upsample;
+    // The merged upsampler does the color conversion itself
+    merged = cinfo.cconvert == NULL;
+    if (!merged) {
+      real_color_deconvert = cinfo.cconvert->color_convert;
+      cinfo.cconvert->color_convert = timed_color_deconvert;
+    }
+
+    if (image == NULL) {
+      *width = cinfo.output_width;
+      *height = cinfo.output_height;
+      image = malloc((size_t) *width * *height * 3);
+      if (image == NULL)
+        err(1, "Failed to allocate image buffer");
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+      row = image + (size_t) cinfo.output_scanline * *width * 3;
+      jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    stage_time[STAGE_TOTAL] += now() - start;
+  }
+
+  // decompress_data and upsample include the nested stages
+  stage_time[STAGE_DCT] -= stage_time[STAGE_ENTROPY];
+  stage_time[STAGE_SAMPLE] -= stage_time[STAGE_COLOR];
+  report("Decompression", iterations, merged);
+
+  jpeg_destroy_decompress(&cinfo);
+  fclose(fp);
+  return image;
+}
+
+static void
+encode(JSAMPLE *image, JDIMENSION width, JDIMENSION height, int iterations)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  JSAMPROW row;
+  FILE *fp;
+  double start;
+  int i;
+
+  if ((fp = fopen("/dev/null", "wb")) == NULL)
+    err(1, "Failed to open /dev/null");
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  memset(stage_time, 0, sizeof(stage_time));
+
+  for (i = 0; i < iterations; i++) {
+    start = now();
+    jpeg_stdio_dest(&cinfo, fp);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    real_encode_mcu = cinfo.entropy->encode_mcu;
+    cinfo.entropy->encode_mcu = timed_encode_mcu;
+    real_forward_DCT = cinfo.fdct->forward_DCT;
+    cinfo.fdct->forward_DCT = timed_forward_DCT;
+    real_downsample = cinfo.downsample->downsample;
+    cinfo.downsample->downsample = timed_downsample;
+    real_color_convert = cinfo.cconvert->color_convert;
+    cinfo.cconvert->color_convert = timed_color_convert;
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+      row = image + (size_t) cinfo.next_scanline * width * 3;
+      jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    stage_time[STAGE_TOTAL] += now() - start;
+  }
+
+  report("Compression, quality 90, 2x2 chroma", iterations, 0);
+
+  jpeg_destroy_compress(&cinfo);
+  fclose(fp);
+}
+
+int
+main(int argc, char **argv)
+{
+  JDIMENSION width, height;
+  JSAMPLE *image;
+  int iterations = 20, nosmooth = 0;
+  int i, positional = 0;
+  const char *filename = NULL;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-nosmooth") == 0)
+      nosmooth = 1;
+    else if (positional == 0) {
+      filename = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      iterations = atoi(argv[i]);
+      positional++;
+    }
+  }
+  if (filename == NULL || iterations < 1) {
+    fprintf(stderr, "Usage: %s input.jpg [iterations] [-nosmooth]\n",
+            argv[0]);
+    return 1;
+  }
+
+  image = decode(filename, iterations, nosmooth, &width, &height);
+  printf("\n");
+  encode(image, width, height, iterations);
+
+  free(image);
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * In-memory throughput of encryption, stage by stage
+ *
+ * Generates a photo-sized and a thumbnail-sized JPEG, then runs each
+ * through a worker (decode, crypt, encode; see worker.h) over and over for
+ * about SECONDS seconds, with -b 16 and the default module.  No files are
+ * touched, so this measures figleaf and not the disk.  Prints one line per
+ * measurement:
+ *
+ *   <image>.<stage> <MB/s>
+ *
+ * where MB/s is megabytes of input JPEG per second spent in that stage,
+ * and the stages are decode (header and entropy decoding), crypt (block
+ * preparation, TPE and putting the blocks back), encode, and total.  Each
+ * figure is the best of ROUNDS rounds, which is steadier than the mean on
+ * a busy machine.  bench/check.sh compares these against a baseline.
+ *
+ * Usage: bench/throughput [seconds] [rounds]
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+#include "jpeglib.h"
+#include "figleaf.h"
+#include "tpe.h"
+#include "kdf.h"
+#include "worker.h"
+
+enum { DECODE, CRYPT, ENCODE, TOTAL, NUM_MEASURES };
+
+static const char *measure_names[NUM_MEASURES] = {
+  "decode", "crypt", "encode", "total"
+};
+
+/* A smooth picture with some texture, as a JPEG */
+static void
+make_jpeg(struct figleaf_outbuf *out, int width, int height)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  JSAMPLE *row = (JSAMPLE *) malloc(width * 3);
+  unsigned int seed = 1;
+  int x, c;
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  figleaf_mem_dest(&cinfo, out);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 85, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    int y = cinfo.next_scanline;
+    for (x = 0; x < width; x++) {
+      for (c = 0; c < 3; c++) {
+        seed = seed * 1103515245 + 12345;
+        int v = 128 + (x * (c + 1) - y) % 96 + (int) ((seed >> 16) & 15);
+        row[x * 3 + c] = v < 0 ? 0 : v > 255 ? 255 : v;
+      }
+    }
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  free(row);
+}
+
+/* Seconds spent in each measure over one round of about `seconds` */
+static void
+run_round(struct figleaf_worker *w, struct figleaf_context *ctx,
+          const struct figleaf_outbuf *jpeg, double seconds,
+          double *time, double *bytes)
+{
+  double start = figleaf_now();
+  int i;
+
+  for (i = 0; i < NUM_MEASURES; i++)
+    time[i] = 0;
+  *bytes = 0;
+
+  do {
+    if (figleaf_decode_image(w, jpeg->data, jpeg->size, ctx) != 0 ||
+        figleaf_crypt_image(w, "bench.jpg", "benchmark", ctx) != 0 ||
+        figleaf_encode_image(w) != 0)
+      errx(1, "%s", w->recover.message);
+
+    const double *t = w->stats.time;
+    time[DECODE] += t[FIGLEAF_STAGE_HEADER] + t[FIGLEAF_STAGE_COEF_READ];
+    time[CRYPT] += t[FIGLEAF_STAGE_PREPARE] + t[FIGLEAF_STAGE_KDF] +
+                   t[FIGLEAF_STAGE_TPE] + t[FIGLEAF_STAGE_RETURN];
+    time[ENCODE] += t[FIGLEAF_STAGE_ENCODE];
+    *bytes += jpeg->size;
+  } while (figleaf_now() - start < seconds);
+
+  time[TOTAL] = time[DECODE] + time[CRYPT] + time[ENCODE];
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const struct { const char *name; int width, height; } images[] = {
+    { "photo", 1600, 1200 },
+    { "thumb", 160, 120 },
+  };
+  double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  int rounds = argc > 2 ? atoi(argv[2]) : 3;
+  struct figleaf_context ctx;
+  struct figleaf_worker w;
+  size_t n;
+  int r, i;
+
+  if (seconds <= 0 || rounds < 1)
+    errx(1, "Usage: %s [seconds] [rounds]", argv[0]);
+  if (sodium_init() == -1)
+    errx(1, "Failed to initialize libsodium");
+
+  memset(&ctx, 0, sizeof ctx);
+  ctx.tpe_method_name = "drpe-lsb";
+  ctx.mode = FIGLEAF_MODE_ENCRYPT;
+  ctx.blocksize = 16;
+  ctx.restart_rows = 1;
+  ctx.num_threads = 1;
+  if (tpe_select_module(&ctx) != NULL || kdf_select("hash", &ctx.kdf) != NULL)
+    errx(1, "Couldn't set up the default module");
+
+  // The worker prints as it goes; keep that out of the results
+  FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    err(1, "Couldn't redirect stdout");
+
+  figleaf_worker_init(&w, 1);
+  for (n = 0; n < sizeof images / sizeof images[0]; n++) {
+    struct figleaf_outbuf jpeg;
+    double best[NUM_MEASURES] = { 0 };
+
+    memset(&jpeg, 0, sizeof jpeg);
+    make_jpeg(&jpeg, images[n].width, images[n].height);
+    for (r = 0; r < rounds; r++) {
+      double time[NUM_MEASURES], bytes;
+      run_round(&w, &ctx, &jpeg, seconds, time, &bytes);
+      for (i = 0; i < NUM_MEASURES; i++) {
+        double rate = time[i] > 0 ? bytes / time[i] / 1e6 : 0;
+        if (rate > best[i])
+          best[i] = rate;
+      }
+    }
+    for (i = 0; i < NUM_MEASURES; i++)
+      fprintf(out, "%s.%s %.2f\n", images[n].name, measure_names[i], best[i]);
+    figleaf_outbuf_free(&jpeg);
+  }
+  figleaf_worker_destroy(&w);
+  fclose(out);
+  return 0;
+}
@@ -8,6 +8,7 @@
 #include "util.h"
 #include "bounce.h"
 #include "random.h"
+#include "recover.h"
 
 JCOEF
 bounce(JCOEF plaintext, JCOEF delta, JCOEF vmin, JCOEF vmax)
@@ -78,7 +79,7 @@ bounce_encrypt_block(unsigned char *key, unsigned char *nonce,
 
 
   unsigned short *randomness = random_ushorts(key, nonce, blocklen);
-  JCOEF *keystream = (JCOEF *) malloc(blocklen*sizeof(JCOEF));
+  JCOEF *keystream = (JCOEF *) figleaf_recover_malloc(blocklen*sizeof(JCOEF));
   for(i=0; i<blocklen; i++){
     keystream[i] = randomness[i] % (vmax-vmin+1);
   }
@@ -119,8 +120,8 @@ bounce_encrypt_block(unsigned char *key, unsigned char *nonce,
     block[i] += vmin;
   }
 
-  free(keystream);
-  free(randomness);
+  figleaf_recover_free(keystream);
+  figleaf_recover_free(randomness);
 
   //err(1,"OK done with one bounce block.  Debug me plz.");
 
@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L  // for stat() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <jpeglib.h>
+
+#include "batch.h"
+#include "budget.h"
+
+
+void
+figleaf_budget_init(struct figleaf_budget *b, size_t limit)
+{
+  memset(b, 0, sizeof(struct figleaf_budget));
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->changed, NULL);
+  b->limit = limit;
+
+#ifdef M_MMAP_THRESHOLD
+  // glibc raises its mmap threshold each time a big block is freed, after
+  // which coefficient arrays come out of the per-thread heaps and stay
+  // there when freed.  Pinning it keeps them going back to the system, so
+  // what the process holds tracks what the budget has admitted.
+  mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+#endif
+}
+
+void
+figleaf_budget_destroy(struct figleaf_budget *b)
+{
+  pthread_cond_destroy(&b->changed);
+  pthread_mutex_destroy(&b->lock);
+}
+
+size_t
+figleaf_budget_estimate(j_decompress_ptr cinfo, size_t input_size)
+{
+  size_t blocks = 0;
+  int c;
+
+  for (c = 0; c < cinfo->num_components; c++) {
+    jpeg_component_info *comp = &cinfo->comp_info[c];
+    // libjpeg pads each component's arrays out to whole iMCU rows
+    size_t rows = (comp->height_in_blocks + comp->v_samp_factor - 1)
+                  / comp->v_samp_factor * comp->v_samp_factor;
+    blocks += (size_t) comp->width_in_blocks * rows;
+  }
+  // The output comes out at about the size of the input
+  return 2 * blocks * sizeof(JBLOCK) + 2 * input_size;
+}
+
+void
+figleaf_budget_acquire(struct figleaf_budget *b, size_t bytes)
+{
+  pthread_mutex_lock(&b->lock);
+  unsigned long long ticket = b->next_ticket++;
+  // An image that's over budget by itself only fits when nothing else is
+  // running
+  while (ticket != b->now_serving ||
+         (b->used != 0 && b->used + bytes > b->limit))
+    pthread_cond_wait(&b->changed, &b->lock);
+  b->used += bytes;
+  b->now_serving++;
+  pthread_cond_broadcast(&b->changed);
+  pthread_mutex_unlock(&b->lock);
+}
+
+void
+figleaf_budget_release(struct figleaf_budget *b, size_t bytes)
+{
+  pthread_mutex_lock(&b->lock);
+  b->used -= bytes;
+  pthread_cond_broadcast(&b->changed);
+  pthread_mutex_unlock(&b->lock);
+}
+
+size_t
+figleaf_parse_size(const char *s)
+{
+  char *end;
+  unsigned long long n = strtoull(s, &end, 10);
+  int shift = 0;
+
+  switch (*end) {
+    case 'T': case 't': shift += 10;  // fall through
+    case 'G': case 'g': shift += 10;  // fall through
+    case 'M': case 'm': shift += 10;  // fall through
+    case 'K': case 'k': shift += 10;
+                        end++;
+                        break;
+  }
+  if (end == s || *end != '\0')
+    return 0;
+  return (size_t) n << shift;
+}
+
+
+static long long
+input_size(const char *filename)
+{
+  struct stat st;
+  return stat(filename, &st) == 0 ? (long long) st.st_size : 0;
+}
+
+/* Top the window up from the inner source.  Called with the lock held. */
+static void
+largest_first_fill(struct figleaf_largest_first *lf)
+{
+  while (!lf->inner_done && lf->count < lf->window_size) {
+    struct figleaf_job *job = &lf->window[lf->count];
+    if (!lf->inner->next(lf->inner, job)) {
+      lf->inner_done = 1;
+      break;
+    }
+    lf->sizes[lf->count++] = input_size(job->input_filename);
+  }
+}
+
+static int
+largest_first_next(struct figleaf_jobs *jobs, struct figleaf_job *job)
+{
+  struct figleaf_largest_first *lf = (struct figleaf_largest_first *) jobs;
+  size_t i, biggest = 0;
+
+  pthread_mutex_lock(&lf->lock);
+  largest_first_fill(lf);
+  if (lf->count == 0) {
+    pthread_mutex_unlock(&lf->lock);
+    return 0;
+  }
+  for (i = 1; i < lf->count; i++) {
+    if (lf->sizes[i] > lf->sizes[biggest])
+      biggest = i;
+  }
+  *job = lf->window[biggest];
+  // Fill the hole from the end
+  lf->count--;
+  lf->window[biggest] = lf->window[lf->count];
+  lf->sizes[biggest] = lf->sizes[lf->count];
+  pthread_mutex_unlock(&lf->lock);
+  return 1;
+}
+
+static size_t
+largest_first_prefetch(struct figleaf_jobs *jobs, size_t n)
+{
+  struct figleaf_largest_first *lf = (struct figleaf_largest_first *) jobs;
+
+  lf->inner->prefetch(lf->inner, n > lf->window_size ? n : lf->window_size);
+  pthread_mutex_lock(&lf->lock);
+  largest_first_fill(lf);
+  pthread_mutex_unlock(&lf->lock);
+  return lf->count < n ? lf->count : n;
+}
+
+static void
+largest_first_done(struct figleaf_jobs *jobs, struct figleaf_job *job,
+                   const void *output, size_t output_size)
+{
+  struct figleaf_largest_first *lf = (struct figleaf_largest_first *) jobs;
+
+  lf->inner->done(lf->inner, job, output, output_size);
+}
+
+void
+figleaf_largest_first_init(struct figleaf_largest_first *lf,
+                           struct figleaf_jobs *inner, size_t window_size)
+{
+  memset(lf, 0, sizeof(struct figleaf_largest_first));
+  lf->pub.next = largest_first_next;
+  lf->pub.prefetch = largest_first_prefetch;
+  lf->pub.done = largest_first_done;
+  lf->inner = inner;
+  pthread_mutex_init(&lf->lock, NULL);
+
+  lf->window_size = window_size;
+  lf->window = (struct figleaf_job *)
+    calloc(window_size, sizeof(struct figleaf_job));
+  lf->sizes = (long long *) calloc(window_size, sizeof(long long));
+  if (lf->window == NULL || lf->sizes == NULL)
+    err(1, "Couldn't allocate memory for jobs");
+}
+
+void
+figleaf_largest_first_destroy(struct figleaf_largest_first *lf)
+{
+  // Release anything left in the window the way failed jobs are
+  while (lf->count > 0) {
+    lf->count--;
+    lf->inner->done(lf->inner, &lf->window[lf->count], NULL, 0);
+  }
+  free(lf->window);
+  free(lf->sizes);
+  pthread_mutex_destroy(&lf->lock);
+}
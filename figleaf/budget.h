@@ -0,0 +1,78 @@
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+
+#include "batch.h"
+
+/*
+ * A memory budget shared by the workers (--mem-budget).
+ *
+ * Each image's memory use is estimated from its header, before its
+ * coefficients are read (see figleaf_budget_estimate()), and the worker
+ * waits until that much of the budget is free.  Images are admitted in
+ * the order they ask, so a big one isn't starved by a stream of small
+ * ones.  An image that's bigger than the whole budget on its own waits
+ * until nothing else is running, and nothing else is admitted until it's
+ * done.
+ */
+struct figleaf_budget {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  size_t limit, used;
+  unsigned long long next_ticket, now_serving;
+};
+
+void
+figleaf_budget_init(struct figleaf_budget *b, size_t limit);
+
+void
+figleaf_budget_destroy(struct figleaf_budget *b);
+
+/* Bytes needed to process the image whose header has just been read:
+ * the coefficients (held twice, by libjpeg and by jpeg_prepare_blocks()),
+ * plus the input and output files. */
+size_t
+figleaf_budget_estimate(j_decompress_ptr cinfo, size_t input_size);
+
+void
+figleaf_budget_acquire(struct figleaf_budget *b, size_t bytes);
+
+void
+figleaf_budget_release(struct figleaf_budget *b, size_t bytes);
+
+/* Parse a size like "512M" or "4G" (K, M, G or T; bytes if none).
+ * Returns 0 if it isn't one. */
+size_t
+figleaf_parse_size(const char *s);
+
+
+/*
+ * A job source that hands out the jobs of another one largest first (by
+ * input file size), from a window of the next few.  Scheduling the big
+ * images first keeps one from being left running on its own at the end
+ * of the batch.  The window must be at least as big as the number of
+ * worker threads.  Pass &lf.pub to the batch.
+ */
+struct figleaf_largest_first {
+  struct figleaf_jobs pub;
+  struct figleaf_jobs *inner;
+  pthread_mutex_t lock;
+
+  struct figleaf_job *window;
+  long long *sizes;
+  size_t window_size, count;
+  int inner_done;
+};
+
+void
+figleaf_largest_first_init(struct figleaf_largest_first *lf,
+                           struct figleaf_jobs *inner, size_t window_size);
+
+void
+figleaf_largest_first_destroy(struct figleaf_largest_first *lf);
+
+#endif
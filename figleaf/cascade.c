@@ -11,6 +11,7 @@
 #include "bounce.h"
 #include "cascade.h"
 #include "random.h"
+#include "recover.h"
 
 #define DEBUG_CASCADE 1
 
@@ -92,14 +93,14 @@ cascade_encrypt_block(unsigned char *key, unsigned char *nonce,
   puts("-- END PLAINTEXT BLOCK --");
 
   uint32_t* randomness = random_uints(key, nonce, blocklen);
-  JCOEF *keystream = (JCOEF *) malloc(blocklen*sizeof(JCOEF));
+  JCOEF *keystream = (JCOEF *) figleaf_recover_malloc(blocklen*sizeof(JCOEF));
   for(i=0; i < blocklen; i++)
     keystream[i] = randomness[i] % (vmax-vmin+1);
 
   cascade_encrypt_recurse(keystream, block, blocklen, 0, blocklen-1, subsum, 0, 0, vmax-vmin+1);
 
-  free(keystream);
-  free(randomness);
+  figleaf_recover_free(keystream);
+  figleaf_recover_free(randomness);
 
   puts("-- START CIPHERTEXT BLOCK --");
   print_block(block);
@@ -0,0 +1,354 @@
+/*
+ * figleaf-compare: how close an encrypted image's thumbnail is to the
+ * original's, without decoding either to pixels
+ *
+ * The thumbnail that TPE preserves is the mean brightness of each tile of
+ * blocksize x blocksize pixels.  That's the average of the tile's DC
+ * coefficients, which is all this reads: the coefficient planes are
+ * entropy decoded, but there's no IDCT, upsampling or colour conversion.
+ * Tiles are laid out on each component's own block grid, exactly as
+ * tpe.c lays them out, so with the blocksize the image was encrypted with
+ * each thumbnail pixel is one TPE tile.
+ *
+ * For each component it reports the PSNR and SSIM between the two
+ * thumbnails and the largest difference between a pair of tile means, in
+ * 8-bit sample values.  Given two directories, it compares every JPEG
+ * under the first with the file of the same name under the second and
+ * finishes with a summary over all of them.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for fdopen() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+#include <setjmp.h>
+
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <jpeglib.h>
+
+#include "fileio.h"
+#include "walk.h"
+#include "recover.h"
+
+// SSIM is computed over windows of this many thumbnail pixels a side
+#define SSIM_WINDOW 8
+
+extern char *optarg;
+extern int optind;
+
+/* The tile means of each component of one image */
+struct thumbnail {
+  int num_components;
+  int width[MAX_COMPONENTS], height[MAX_COMPONENTS];
+  double *mean[MAX_COMPONENTS];
+};
+
+/* The comparison of one component */
+struct fidelity {
+  double mse, psnr, ssim, max_error;
+  int num_tiles;
+};
+
+/* Totals for the summary */
+struct corpus {
+  size_t num_images, num_failed;
+  int num_components;
+  double sum_mse[MAX_COMPONENTS], sum_ssim[MAX_COMPONENTS];
+  double max_error[MAX_COMPONENTS];
+  size_t count[MAX_COMPONENTS];
+};
+
+struct reader {
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  struct figleaf_input input;
+  struct figleaf_recover recover;
+  struct thumbnail plain, encrypted;  // Here so a failure can free them
+};
+
+// Results go here; the directory walk's chatter on stdout doesn't
+static FILE *out;
+
+static const char *component_names[] = { "Y", "Cb", "Cr", "K" };
+
+static void
+print_usage(const char *progname)
+{
+  printf("Usage: %s [-b blocksize] plain.jpg encrypted.jpg\n"
+         "       %s [-b blocksize] plain-dir encrypted-dir\n"
+         "  -b: TPE block size in pixels, a multiple of 8 (default 16)\n",
+         progname, progname);
+}
+
+static void
+thumbnail_free(struct thumbnail *t)
+{
+  int c;
+
+  for (c = 0; c < t->num_components; c++)
+    free(t->mean[c]);
+  memset(t, 0, sizeof *t);
+}
+
+/* Read the named JPEG's coefficients and average the DC of each tile of
+ * tile_blocks x tile_blocks blocks, as a sample value */
+static void
+read_thumbnail(struct reader *r, const char *filename, int tile_blocks,
+               struct thumbnail *t)
+{
+  struct jpeg_decompress_struct *cinfo = &r->cinfo;
+  int c, bx, by;
+
+  figleaf_input_open(&r->input, filename);
+  figleaf_mem_src(cinfo, r->input.data, r->input.size);
+  (void) jpeg_read_header(cinfo, TRUE);
+  jvirt_barray_ptr *coeffs = jpeg_read_coefficients(cinfo);
+
+  t->num_components = cinfo->num_components;
+  for (c = 0; c < cinfo->num_components; c++) {
+    jpeg_component_info *comp = &cinfo->comp_info[c];
+    int wib = comp->width_in_blocks, hib = comp->height_in_blocks;
+    int tw = (wib + tile_blocks - 1) / tile_blocks;
+    int th = (hib + tile_blocks - 1) / tile_blocks;
+    int *count = (int *) calloc((size_t) tw * th, sizeof(int));
+    // The DC coefficient is 8 times the block's mean, less 128
+    double scale = comp->quant_table->quantval[0] / 8.0;
+
+    t->width[c] = tw;
+    t->height[c] = th;
+    t->mean[c] = (double *) calloc((size_t) tw * th, sizeof(double));
+    if (t->mean[c] == NULL || count == NULL)
+      figleaf_err("Couldn't allocate memory for the thumbnail");
+
+    for (by = 0; by < hib; by++) {
+      JBLOCKARRAY row = cinfo->mem->access_virt_barray
+        ((j_common_ptr) cinfo, coeffs[c], by, 1, FALSE);
+      double *tile_row = t->mean[c] + (by / tile_blocks) * tw;
+      int *count_row = count + (by / tile_blocks) * tw;
+      for (bx = 0; bx < wib; bx++) {
+        tile_row[bx / tile_blocks] += row[0][bx][0];
+        count_row[bx / tile_blocks]++;
+      }
+    }
+    for (bx = 0; bx < tw * th; bx++)
+      t->mean[c][bx] = t->mean[c][bx] / count[bx] * scale + 128;
+    free(count);
+  }
+
+  (void) jpeg_finish_decompress(cinfo);
+  figleaf_input_close(&r->input);
+}
+
+/* Mean SSIM over every window of a component's thumbnails.  Thumbnails
+ * smaller than the window are taken as one window. */
+static double
+ssim(const double *a, const double *b, int width, int height)
+{
+  const double c1 = (0.01 * 255) * (0.01 * 255);
+  const double c2 = (0.03 * 255) * (0.03 * 255);
+  int ww = width < SSIM_WINDOW ? width : SSIM_WINDOW;
+  int wh = height < SSIM_WINDOW ? height : SSIM_WINDOW;
+  double n = ww * wh, total = 0;
+  int x, y, i, j, windows = 0;
+
+  for (y = 0; y + wh <= height; y++) {
+    for (x = 0; x + ww <= width; x++) {
+      double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+      for (j = y; j < y + wh; j++) {
+        for (i = x; i < x + ww; i++) {
+          double va = a[j * width + i], vb = b[j * width + i];
+          sa += va;
+          sb += vb;
+          saa += va * va;
+          sbb += vb * vb;
+          sab += va * vb;
+        }
+      }
+      double ma = sa / n, mb = sb / n;
+      double var_a = saa / n - ma * ma, var_b = sbb / n - mb * mb;
+      double cov = sab / n - ma * mb;
+      total += (2 * ma * mb + c1) * (2 * cov + c2) /
+               ((ma * ma + mb * mb + c1) * (var_a + var_b + c2));
+      windows++;
+    }
+  }
+  return total / windows;
+}
+
+static void
+compare_component(const struct thumbnail *a, const struct thumbnail *b,
+                  int c, struct fidelity *f)
+{
+  int n = a->width[c] * a->height[c], i;
+  double sum = 0;
+
+  f->max_error = 0;
+  for (i = 0; i < n; i++) {
+    double d = a->mean[c][i] - b->mean[c][i];
+    sum += d * d;
+    if (fabs(d) > f->max_error)
+      f->max_error = fabs(d);
+  }
+  f->num_tiles = n;
+  f->mse = sum / n;
+  f->psnr = f->mse > 0 ? 10 * log10(255.0 * 255.0 / f->mse) : INFINITY;
+  f->ssim = ssim(a->mean[c], b->mean[c], a->width[c], a->height[c]);
+}
+
+static void
+print_fidelity(const char *component, const struct fidelity *f)
+{
+  fprintf(out, "  %s psnr %6.2f ssim %.4f maxerr %6.2f", component, f->psnr,
+         f->ssim, f->max_error);
+}
+
+/* Compare one pair of images and add them to the totals.  Returns -1,
+ * having said why, if either couldn't be read or they don't match up. */
+static int
+compare_files(struct reader *r, const char *plain, const char *encrypted,
+              int tile_blocks, struct corpus *corpus)
+{
+  struct thumbnail *a = &r->plain, *b = &r->encrypted;
+  struct fidelity f;
+  int c;
+
+  if (setjmp(r->recover.env) != 0) {
+    jpeg_abort_decompress(&r->cinfo);
+    figleaf_input_close(&r->input);
+    thumbnail_free(a);
+    thumbnail_free(b);
+    warnx("%s vs %s: %s", plain, encrypted, r->recover.message);
+    corpus->num_failed++;
+    return -1;
+  }
+  figleaf_recover_point = &r->recover;
+
+  read_thumbnail(r, plain, tile_blocks, a);
+  read_thumbnail(r, encrypted, tile_blocks, b);
+  if (a->num_components != b->num_components)
+    figleaf_errx("Has %d components, not %d", b->num_components,
+                 a->num_components);
+  for (c = 0; c < a->num_components; c++)
+    if (a->width[c] != b->width[c] || a->height[c] != b->height[c])
+      figleaf_errx("Component %d is %dx%d tiles, not %dx%d", c,
+                   b->width[c], b->height[c], a->width[c], a->height[c]);
+  figleaf_recover_point = NULL;
+
+  fprintf(out, "%s", plain);
+  for (c = 0; c < a->num_components; c++) {
+    compare_component(a, b, c, &f);
+    print_fidelity(c < 4 ? component_names[c] : "?", &f);
+    corpus->sum_mse[c] += f.mse;
+    corpus->sum_ssim[c] += f.ssim;
+    if (f.max_error > corpus->max_error[c])
+      corpus->max_error[c] = f.max_error;
+    corpus->count[c]++;
+  }
+  fprintf(out, "\n");
+  if (a->num_components > corpus->num_components)
+    corpus->num_components = a->num_components;
+  corpus->num_images++;
+
+  thumbnail_free(a);
+  thumbnail_free(b);
+  return 0;
+}
+
+/* PSNR here is from the mean MSE over the images, so identical pairs
+ * don't make it infinite */
+static void
+print_summary(const struct corpus *corpus)
+{
+  struct fidelity f;
+  int c;
+
+  fprintf(out, "%zu images", corpus->num_images);
+  if (corpus->num_failed > 0)
+    fprintf(out, ", %zu failed", corpus->num_failed);
+  fprintf(out, ":");
+  for (c = 0; c < corpus->num_components; c++) {
+    f.mse = corpus->sum_mse[c] / corpus->count[c];
+    f.psnr = f.mse > 0 ? 10 * log10(255.0 * 255.0 / f.mse) : INFINITY;
+    f.ssim = corpus->sum_ssim[c] / corpus->count[c];
+    f.max_error = corpus->max_error[c];
+    print_fidelity(c < 4 ? component_names[c] : "?", &f);
+  }
+  fprintf(out, "\n");
+}
+
+static int
+isdir(const char *filename)
+{
+  struct stat st;
+  return stat(filename, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct reader r;
+  struct corpus corpus;
+  int blocksize = 16;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:h")) != -1) {
+    switch (opt) {
+    case 'b':
+      blocksize = atoi(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (argc - optind != 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (blocksize < 8 || blocksize % 8 != 0)
+    errx(1, "Block size must be a positive multiple of 8");
+
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    err(1, "Couldn't redirect stdout");
+
+  memset(&r, 0, sizeof r);
+  memset(&corpus, 0, sizeof corpus);
+  r.cinfo.err = jpeg_std_error(&r.jerr);
+  r.jerr.error_exit = figleaf_jpeg_error_exit;
+  jpeg_create_decompress(&r.cinfo);
+
+  if (isdir(argv[optind])) {
+    // The walk mirrors the first tree onto the second, which is just the
+    // pairing wanted here
+    struct figleaf_walk walk;
+    struct figleaf_job job;
+
+    if (!isdir(argv[optind + 1]))
+      errx(1, "%s is a directory but %s isn't", argv[optind],
+           argv[optind + 1]);
+    figleaf_walk_init(&walk, argv[optind], argv[optind + 1]);
+    // Only reading, so don't make directories in the encrypted tree
+    walk.skip_output_dirs = 1;
+    while (walk.pub.next(&walk.pub, &job)) {
+      compare_files(&r, job.input_filename, job.output_filename,
+                    blocksize / 8, &corpus);
+      walk.pub.done(&walk.pub, &job, NULL, 0);
+    }
+    figleaf_walk_destroy(&walk);
+    print_summary(&corpus);
+  } else {
+    compare_files(&r, argv[optind], argv[optind + 1], blocksize / 8,
+                  &corpus);
+  }
+
+  jpeg_destroy_decompress(&r.cinfo);
+  fclose(out);
+  return corpus.num_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L  // for strdup(), strndup() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "dataset.h"
+#include "recover.h"
+
+// Bytes before the first image
+#define HEADER_SIZE (8 + 6 * 4)
+
+static void
+put_u32(FILE *f, uint32_t v)
+{
+  unsigned char b[4] = { v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24 };
+  fwrite(b, 1, sizeof b, f);
+}
+
+/* The name of the directory the named file is in, malloc'd; "" if none */
+static char *
+class_of(const char *name)
+{
+  const char *end = strrchr(name, '/'), *start;
+  char *class;
+
+  if (end == NULL)
+    end = name;
+  for (start = end; start > name && start[-1] != '/'; start--)
+    ;
+  class = strndup(start, end - start);
+  if (class == NULL)
+    err(1, "Couldn't allocate memory for the dataset");
+  return class;
+}
+
+static int
+compare_strings(const void *a, const void *b)
+{
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+void
+figleaf_dataset_open(struct figleaf_dataset *ds, const char *filename)
+{
+  memset(ds, 0, sizeof(struct figleaf_dataset));
+  ds->file = fopen(filename, "wb");
+  if (ds->file == NULL)
+    err(1, "Couldn't open dataset [%s]", filename);
+  ds->filename = strdup(filename);
+  if (ds->filename == NULL)
+    err(1, "Couldn't allocate memory for the dataset");
+  pthread_mutex_init(&ds->lock, NULL);
+
+  // Room for the header, which is filled in at the end
+  static const char zeros[HEADER_SIZE];
+  if (fwrite(zeros, 1, sizeof zeros, ds->file) != sizeof zeros)
+    err(1, "Couldn't write dataset [%s]", filename);
+}
+
+void
+figleaf_dataset_add(struct figleaf_dataset *ds, const char *name,
+                    const unsigned char *pixels,
+                    int channels, int height, int width)
+{
+  size_t size = (size_t) channels * height * width;
+
+  pthread_mutex_lock(&ds->lock);
+  if (ds->count == 0) {
+    ds->channels = channels;
+    ds->height = height;
+    ds->width = width;
+  } else if (channels != ds->channels || height != ds->height ||
+             width != ds->width) {
+    pthread_mutex_unlock(&ds->lock);
+    figleaf_errx("Image is %dx%d with %d channel(s), but the dataset's are "
+                 "%dx%d with %d", width, height, channels,
+                 ds->width, ds->height, ds->channels);
+  }
+
+  if (ds->count == ds->alloc) {
+    ds->alloc = ds->alloc ? 2 * ds->alloc : 1024;
+    ds->names = (char **) realloc(ds->names, ds->alloc * sizeof(char *));
+    if (ds->names == NULL)
+      err(1, "Couldn't allocate memory for the dataset");
+  }
+  ds->names[ds->count] = strdup(name);
+  if (ds->names[ds->count] == NULL)
+    err(1, "Couldn't allocate memory for the dataset");
+  ds->count++;
+
+  if (fwrite(pixels, 1, size, ds->file) != size)
+    err(1, "Couldn't write dataset [%s]", ds->filename);
+  pthread_mutex_unlock(&ds->lock);
+}
+
+void
+figleaf_dataset_close(struct figleaf_dataset *ds)
+{
+  char **classes = NULL, **image_class = NULL;
+  size_t num_classes = 0, i;
+
+  if (ds->count > 0) {
+    classes = (char **) malloc(ds->count * sizeof(char *));
+    image_class = (char **) malloc(ds->count * sizeof(char *));
+    if (classes == NULL || image_class == NULL)
+      err(1, "Couldn't allocate memory for the dataset");
+  }
+  for (i = 0; i < ds->count; i++)
+    classes[i] = image_class[i] = class_of(ds->names[i]);
+
+  // The distinct class names, in order, number the classes
+  if (ds->count > 0) {
+    qsort(classes, ds->count, sizeof(char *), compare_strings);
+    for (i = 0; i < ds->count; i++)
+      if (num_classes == 0 || strcmp(classes[i], classes[num_classes - 1]))
+        classes[num_classes++] = classes[i];
+  }
+
+  for (i = 0; i < ds->count; i++) {
+    char **found = (char **) bsearch(&image_class[i], classes, num_classes,
+                                     sizeof(char *), compare_strings);
+    put_u32(ds->file, found - classes);
+  }
+  for (i = 0; i < num_classes; i++)
+    fwrite(classes[i], 1, strlen(classes[i]) + 1, ds->file);
+  for (i = 0; i < ds->count; i++)
+    fwrite(ds->names[i], 1, strlen(ds->names[i]) + 1, ds->file);
+
+  if (fseek(ds->file, 0, SEEK_SET) != 0)
+    err(1, "Couldn't write dataset [%s]", ds->filename);
+  fwrite(FIGLEAF_DATASET_MAGIC, 1, 8, ds->file);
+  put_u32(ds->file, FIGLEAF_DATASET_VERSION);
+  put_u32(ds->file, ds->count);
+  put_u32(ds->file, ds->channels);
+  put_u32(ds->file, ds->height);
+  put_u32(ds->file, ds->width);
+  put_u32(ds->file, num_classes);
+  if (ferror(ds->file) || fclose(ds->file) != 0)
+    err(1, "Couldn't write dataset [%s]", ds->filename);
+
+  for (i = 0; i < ds->count; i++) {
+    free(image_class[i]);
+    free(ds->names[i]);
+  }
+  free(classes);
+  free(image_class);
+  free(ds->names);
+  free(ds->filename);
+  pthread_mutex_destroy(&ds->lock);
+}
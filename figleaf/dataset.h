@@ -0,0 +1,63 @@
+#ifndef _DATASET_H
+#define _DATASET_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Packed image datasets, for --dataset.
+ *
+ * The adversary in figleaf-torch-nn trains on thousands of small images,
+ * and decoding every one of them with image.load each time it starts
+ * takes minutes.  With --dataset, each output image is also decoded to
+ * pixels as it's finished, and the pixels go into one file that the
+ * loader reads in a handful of bulk reads.  All numbers are little-endian
+ * uint32s:
+ *
+ *   header   "FIGLEAFD", then version (1), count, channels, height,
+ *            width and num_classes
+ *   pixels   count images of channels x height x width bytes, one plane
+ *            per channel (NCHW), in the order they were finished
+ *   labels   count class numbers, from 0
+ *   classes  num_classes NUL-terminated names, sorted; an image's class
+ *            is the name of the directory it's in, as in the AT&T set
+ *   names    count NUL-terminated input names, so the loader can put the
+ *            images in a class in order
+ *
+ * The first image sets the size and number of channels, and any image that
+ * doesn't match fails.  Grayscale images have one channel; everything
+ * else is converted to RGB.  The header is written last, so the dataset
+ * from a run that didn't finish says it has no images.
+ */
+
+#define FIGLEAF_DATASET_MAGIC "FIGLEAFD"
+#define FIGLEAF_DATASET_VERSION 1
+
+struct figleaf_dataset {
+  FILE *file;
+  char *filename;
+  pthread_mutex_t lock;
+
+  int channels, height, width;  // Set by the first image
+
+  char **names;                 // Of the images so far, in file order
+  size_t count, alloc;
+};
+
+void
+figleaf_dataset_open(struct figleaf_dataset *ds, const char *filename);
+
+/* Append an image, height rows of width pixels in channels planes, from
+ * the input with this name.  Fails the image (see recover.h) if it isn't
+ * the same shape as the ones before. */
+void
+figleaf_dataset_add(struct figleaf_dataset *ds, const char *name,
+                    const unsigned char *pixels,
+                    int channels, int height, int width);
+
+/* Write out the labels, class names and header, and close the file */
+void
+figleaf_dataset_close(struct figleaf_dataset *ds);
+
+#endif
@@ -17,6 +17,7 @@
 #include "util.h"
 #include "drpe.h"
 #include "minmax.h"
+#include "recover.h"
 
 #define DRPE_DEBUG 0
 
@@ -123,10 +124,10 @@ drpe_encrypt_decrypt(unsigned char *key, unsigned char *nonce,
 
   // Use the libsodium stream cipher to generate a stream of pseudorandom bytes
   size_t kslen = datalen * sizeof(unsigned short);
-  unsigned short *keystream = (unsigned short *) malloc(kslen);
+  unsigned short *keystream = (unsigned short *) figleaf_recover_malloc(kslen);
   int rc = crypto_stream((unsigned char *)keystream, kslen, nonce, key);
   if (rc != 0)
-    err(1, "Error returned by crypto_stream; rc = %d", rc);
+    figleaf_errx("Error returned by crypto_stream; rc = %d", rc);
 
   unsigned short bitmask = 0;
   int sign_bit_position;
@@ -173,7 +174,7 @@ drpe_encrypt_decrypt(unsigned char *key, unsigned char *nonce,
 done:
   // Overwrite the keystream so it's not just hanging around in memory
   sodium_memzero(keystream, kslen);
-  free(keystream);
+  figleaf_recover_free(keystream);
 }
 
 void
@@ -2,6 +2,7 @@
 #include <sodium.h>
 
 #include <math.h>
+#include <string.h>
 #include <jpeglib.h>
 #include "random.h"
 #include "fisheryates.h"
@@ -9,6 +10,7 @@
 #include "lsb.h"
 #include "drpe.h"
 #include "drpe_lsb.h"
+#include "recover.h"
 
 #define DRPE_LSB_DEBUG 0
 
@@ -28,13 +30,15 @@ drpe_lsb_encrypt_all(unsigned char *key, unsigned char *nonce,
   if (minvalue == 0 && maxvalue == 0) return;
 
   /* Allocate an array which will contain pointers to all pixels in this block */
-  JCOEF **pixel_list = (JCOEF **)calloc(1, datalen * sizeof(JCOEF *));
+  JCOEF **pixel_list =
+    (JCOEF **) figleaf_recover_malloc(datalen * sizeof(JCOEF *));
   ASSERTF(pixel_list != NULL, "Allocation of pixel list failed (%zu bytes)",
           datalen * sizeof(JCOEF *));
+  memset(pixel_list, 0, datalen * sizeof(JCOEF *));
 
   /* Use the libsodium stream cipher to generate a stream of pseudorandom bytes */
   size_t kslen = datalen * sizeof(unsigned short);
-  unsigned short *keystream = (unsigned short *) malloc(kslen);
+  unsigned short *keystream = (unsigned short *) figleaf_recover_malloc(kslen);
   int rc = crypto_stream((unsigned char *)keystream, kslen, nonce, key);
   ASSERTF(rc == 0, "crypto_stream failed! rc=%d", rc);
 
@@ -131,7 +135,7 @@ drpe_lsb_encrypt_all(unsigned char *key, unsigned char *nonce,
       pixel_list[j] = tmp;
     }
 
-    free(randomness);
+    figleaf_recover_free(randomness);
   }
 
   /* Prioritize changing higher significance bits first */
@@ -195,8 +199,8 @@ fixup_done:
 
   // Overwrite the keystream so it's not just hanging around in memory
   sodium_memzero(keystream, kslen);
-  free(keystream);
-  free(pixel_list);
+  figleaf_recover_free(keystream);
+  figleaf_recover_free(pixel_list);
 }
 
 void
@@ -210,7 +214,7 @@ drpe_lsb_decrypt_all(unsigned char *key, unsigned char *nonce,
 
   /* Use the libsodium stream cipher to generate a stream of pseudorandom bytes */
   size_t kslen = datalen * sizeof(unsigned short);
-  unsigned short *keystream = (unsigned short *) malloc(kslen);
+  unsigned short *keystream = (unsigned short *) figleaf_recover_malloc(kslen);
   int rc = crypto_stream((unsigned char *)keystream, kslen, nonce, key);
   ASSERTF(rc == 0, "crypto_stream failed! rc=%d", rc);
 
@@ -244,6 +248,6 @@ drpe_lsb_decrypt_all(unsigned char *key, unsigned char *nonce,
 
   // Overwrite the keystream so it's not just hanging around in memory
   sodium_memzero(keystream, kslen);
-  free(keystream);
+  figleaf_recover_free(keystream);
 }
 
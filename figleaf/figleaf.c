@@ -9,7 +9,6 @@
 #include <getopt.h>
 #include <libgen.h>  // for basename()
 #include <sys/stat.h>
-#include <glob.h>
 
 #include <jpeglib.h>
 #include <jutil.h>
@@ -29,6 +28,23 @@
 #include "gibbs.h"
 #include "mosaic.h"
 #include "kdf.h"
+#include "fileio.h"
+#include "worker.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "walk.h"
+#include "manifest.h"
+#include "tar.h"
+#include "stats.h"
+#include "sizes.h"
+#include "recover.h"
+#include "budget.h"
+#include "sweep.h"
+#include "dataset.h"
+#include "roi.h"
+
+// Jobs looked at to find the largest, per thread, with --mem-budget
+#define LARGEST_FIRST_WINDOW_PER_THREAD 4
 
 extern char *optarg;
 extern int optind, opterr, optopt;
@@ -37,10 +53,6 @@ extern int optind, opterr, optopt;
 EXTERN(boolean) read_quant_tables JPP((j_compress_ptr cinfo, char *filename,
                                        int scale_factor, boolean force_baseline));
 
-int
-figleaf_process_image(char *input_filename, char *output_filename,
-                      char *passphrase, struct figleaf_context *ctx);
-
 int isdir(const char *filename)
 {
   struct stat st;
@@ -61,8 +73,13 @@ path_join(char *path, char *filename)
 
 void print_usage(char *progname)
 {
-  printf("Usage: %s <-e|-d> -i input_path -o output_path -p passphrase [-b blocksize] [-m module] [-a arg] [-s]\n\n",
-         progname);
+  printf("Usage: %s <-e|-d> -i input_path -o output_path -p passphrase [-b blocksize] [-m module] [-a arg] [-s] [-j threads] [-P] [-r rows] [-q tables] [-k kdf]\n"
+         "       %s <-e|-d> --manifest file [--journal file] [--check-hash] -p passphrase [options]\n"
+         "       %s <-e|-d> --tar -i archive -o archive -p passphrase [options]\n"
+         "       %s <-e|-d> --sweep -i input_path -o output_template -p passphrase [-m modules] [-b blocksizes] [-a args] [options]\n"
+         "       %s --calibrate-kdf ms [-k kdf]\n"
+         "       %s --merge-stats output report...\n\n",
+         progname, progname, progname, progname, progname, progname);
   printf("  -e: Mode = encrypt\n"
          "  -d: Mode = decrypt\n"
          "  -i: Path to input file\n"
@@ -72,7 +89,81 @@ void print_usage(char *progname)
          "  -m: Module (or method) to use for encryption/decryption\n"
          "  -a: Integer (int) argument to be passed to the encryption/decryption function\n"
          "  -s: If specified, input file name will be hashed and used to salt the password\n"
-         "      This means that decryption will fail if the filename is changed\n");
+         "      This means that decryption will fail if the filename is changed\n"
+         "  -j: Number of worker threads to use.  Between images, the workers keep\n"
+         "      up to 64MB of codec buffers for reuse, split between them\n"
+         "  -P: Pipeline a directory of files through separate read, encrypt/decrypt\n"
+         "      and write threads, instead of one thread per file\n"
+         "  -r: Restart interval for the output, in MCU rows (default 1, 0 = none)\n"
+         "  -q: Requantize to the tables in this file (cjpeg -qtables format) before encrypting\n"
+         "  --manifest: Process the jobs listed in this file, one per line, as tab-separated\n"
+         "      input, output, [salt, [module, [blocksize, [arg]]]] fields; an empty field\n"
+         "      takes the setting from the command line, and a salt of \"-\" means none\n"
+         "  --journal: Record finished jobs in this file (default: the manifest's name\n"
+         "      plus \".journal\"), and skip jobs whose outputs are already up to date\n"
+         "      The journal doesn't record the passphrase; start a new one to change it\n"
+         "  --check-hash: Check that outputs are up to date by their contents rather\n"
+         "      than their size and mtime\n"
+         "  --tar: Input and output are tar archives (\"-\" for stdin/stdout); JPEG\n"
+         "      members are processed in memory and everything else copied through\n"
+         "  --stats: Write per-stage timings and work counts to this file as JSON,\n"
+         "      one line per image and a line of totals for the run\n"
+         "  --size-report: Count the coded bits of each image before and after, by\n"
+         "      component, zigzag band and tile, and write them to this file as JSON,\n"
+         "      with a line of totals giving the size expansion for the module and -a\n"
+         "  --master-key: Stretch the passphrase once per run with the KDF (see -k), and\n"
+         "      derive each file's key from that with a fast keyed hash of its salt (-s)\n"
+         "      The argument is a file holding the corpus's random salt for the KDF,\n"
+         "      which encrypting creates if it doesn't exist; keep it with the files,\n"
+         "      which must be decrypted with --master-key and the same salt file\n"
+         "  -k: Key derivation function, as name[:opslimit[:memlimit in MiB]]; one of\n"
+         "      hash (the default), hkdf, scrypt or argon2id, the last two with costs\n"
+         "      (default: libsodium's INTERACTIVE limits; argon2id:3:256 with --master-key)\n"
+         "  --calibrate-kdf: Time the KDF given with -k (default argon2id) on this host,\n"
+         "      print the opslimit that takes about this many milliseconds, and exit\n"
+         "  --mem-budget: Only work on as many images at once as fit in this much memory\n"
+         "      (eg 2G), judging each from its header, and start on the largest first;\n"
+         "      an image too big for the budget on its own is processed by itself\n"
+         "  --shard: As i/n, process only the i'th (from 0) of n disjoint slices of the\n"
+         "      input directory, picked by a hash of each file's relative path, and write\n"
+         "      the --stats report (default: figleaf-shard-i-of-n.stats in the output\n"
+         "      directory) for the slice\n"
+         "  --dataset: Also decode each output to pixels and pack them into this file,\n"
+         "      labelled by the directory each input is in, for figleaf-torch-nn to load\n"
+         "      (see dataset.h); with --sweep, a template like the output path\n"
+         "  --sweep: Encrypt each input under every combination of the comma-separated\n"
+         "      lists given to -m, -b and -a, decoding it only once; the output path is\n"
+         "      a template in which %%m, %%b and %%a stand for the module, blocksize and\n"
+         "      argument, and directories in it are created as needed\n"
+         "  --roi: Only encrypt the tiles that overlap these rectangles, given in pixels\n"
+         "      as x,y,w,h or WxH+X+Y, separated by semicolons; the output records them,\n"
+         "      and decryption reads them from there (see roi.h)\n"
+         "  --roi-file: Read --roi's rectangles from this file, one per line\n"
+         "  --crop: When decrypting, only decrypt the tiles that overlap this viewport,\n"
+         "      given as WxH+X+Y in pixels, and crop the output to it; the top left\n"
+         "      corner moves up and left to the nearest MCU, as with jpegtran -crop\n"
+         "  --merge-stats: Combine the reports of the shards of a run into this file\n");
+}
+
+/* Run the jobs in a batch, largest first if there's a memory budget */
+static void
+run_jobs(struct figleaf_jobs *jobs, char *passphrase,
+         struct figleaf_context *ctx)
+{
+  struct figleaf_largest_first lf;
+  int num_threads = ctx->num_threads > 1 ? ctx->num_threads : 1;
+
+  if (ctx->mem_budget != NULL) {
+    figleaf_largest_first_init(&lf, jobs,
+                               LARGEST_FIRST_WINDOW_PER_THREAD * num_threads);
+    jobs = &lf.pub;
+  }
+  if (ctx->pipeline)
+    figleaf_run_pipeline(jobs, passphrase, ctx);
+  else
+    figleaf_run_batch(jobs, passphrase, ctx);
+  if (ctx->mem_budget != NULL)
+    figleaf_largest_first_destroy(&lf);
 }
 
 int main(int argc, char *argv[])
@@ -81,18 +172,66 @@ int main(int argc, char *argv[])
   char *output_path = NULL;
   char *passphrase = NULL;
   char *quant_matrix_filename = NULL;
+  char *manifest_filename = NULL;
+  char *journal_filename = NULL;
+  int check_hash = 0;
+  int tar = 0;
+  char *stats_filename = NULL;
+  char *size_filename = NULL;
+  char *dataset_filename = NULL;
+  char *master_salt_filename = NULL;   // With --master-key
+  double calibrate_ms = 0;
+  size_t mem_budget = 0;
+  unsigned shard_index = 0, shard_count = 0;
+  char *merge_stats_filename = NULL;
+  int sweep_mode = 0;
+  // -m, -b and -a as given, for --sweep to split into lists
+  char *module_list = NULL, *blocksize_list = NULL, *arg_list = NULL;
+  struct figleaf_roi roi;
+  const char *roi_error = NULL;
+  struct figleaf_roi crop;
 
   int rc = 0;
 
-  char *optstring = "edsi:o:b:p:m:a:q:";
+  char *optstring = "edsPi:o:b:p:m:a:q:j:r:k:";
+  // Long options get codes past the end of the single-character ones
+  enum { OPT_MANIFEST = 256, OPT_JOURNAL, OPT_CHECK_HASH, OPT_TAR, OPT_STATS, OPT_MASTER_KEY,
+         OPT_CALIBRATE_KDF, OPT_MEM_BUDGET, OPT_SHARD, OPT_MERGE_STATS,
+         OPT_SIZE_REPORT, OPT_SWEEP, OPT_DATASET, OPT_ROI, OPT_ROI_FILE,
+         OPT_CROP };
+  static const struct option longopts[] = {
+    { "manifest",   required_argument, NULL, OPT_MANIFEST },
+    { "journal",    required_argument, NULL, OPT_JOURNAL },
+    { "check-hash", no_argument,       NULL, OPT_CHECK_HASH },
+    { "tar",        no_argument,       NULL, OPT_TAR },
+    { "stats",      required_argument, NULL, OPT_STATS },
+    { "master-key", required_argument, NULL, OPT_MASTER_KEY },
+    { "calibrate-kdf", required_argument, NULL, OPT_CALIBRATE_KDF },
+    { "mem-budget", required_argument, NULL, OPT_MEM_BUDGET },
+    { "shard",      required_argument, NULL, OPT_SHARD },
+    { "merge-stats", required_argument, NULL, OPT_MERGE_STATS },
+    { "size-report", required_argument, NULL, OPT_SIZE_REPORT },
+    { "sweep",      no_argument,       NULL, OPT_SWEEP },
+    { "dataset",    required_argument, NULL, OPT_DATASET },
+    { "roi",        required_argument, NULL, OPT_ROI },
+    { "roi-file",   required_argument, NULL, OPT_ROI_FILE },
+    { "crop",       required_argument, NULL, OPT_CROP },
+    { NULL, 0, NULL, 0 }
+  };
 
   //printf("FigLeaf image encryptor/decryptor starting up...\n");
 
+  // Before there are any threads to create files (see fileio.h)
+  figleaf_save_umask();
+
   // Configure our context structure that keeps all our configuration state
   struct figleaf_context *ctx = (struct figleaf_context *) calloc(1, sizeof(struct figleaf_context));
+  ctx->restart_rows = 1;
+  figleaf_roi_init(&roi);
+  figleaf_roi_init(&crop);
 
   //printf("Parsing command-line arguments\n");
-  while ((rc = getopt(argc, argv, optstring)) != -1) {
+  while ((rc = getopt_long(argc, argv, optstring, longopts, NULL)) != -1) {
     /*
     printf("\trc = %c\n", rc);
     printf("\toptind = %d\n", optind);
@@ -119,12 +258,15 @@ int main(int argc, char *argv[])
                 break;
       case 'b': // Blocksize
                 ctx->blocksize = atoi(optarg);
+                blocksize_list = optarg;
                 break;
       case 'm': // Encryption Module -- Which TPE construction do we want to use?
                 ctx->tpe_method_name = optarg;
+                module_list = optarg;
                 break;
       case 'a': // Optional argument to the encryption module
                 ctx->fcn_user_arg = atoi(optarg);
+                arg_list = optarg;
                 break;
       case 'i': // Input source
                 input_path = optarg;
@@ -138,359 +280,386 @@ int main(int argc, char *argv[])
       case 'q': // Quantization matrix
                 quant_matrix_filename = optarg;
                 break;
+      case 'j': // Number of worker threads
+                ctx->num_threads = atoi(optarg);
+                break;
+      case 'P': // Pipelined batch mode
+                ctx->pipeline = 1;
+                break;
+      case 'r': // Restart interval in MCU rows
+                ctx->restart_rows = atoi(optarg);
+                break;
+      case OPT_MANIFEST: // List of jobs
+                manifest_filename = optarg;
+                break;
+      case OPT_JOURNAL: // Record of finished jobs
+                journal_filename = optarg;
+                break;
+      case OPT_CHECK_HASH: // Compare outputs by contents
+                check_hash = 1;
+                break;
+      case OPT_TAR: // Archive in, archive out
+                tar = 1;
+                break;
+      case OPT_STATS: // Timings and counts as JSON
+                stats_filename = optarg;
+                break;
+      case OPT_SIZE_REPORT: // Where the bytes go, as JSON
+                size_filename = optarg;
+                break;
+      case OPT_DATASET: // Outputs' pixels, packed for training on
+                dataset_filename = optarg;
+                break;
+      case OPT_ROI: // Rectangles to encrypt
+                if (roi_error == NULL)
+                  roi_error = figleaf_roi_parse(&roi, optarg, strlen(optarg));
+                ctx->roi = &roi;
+                break;
+      case OPT_ROI_FILE: // Rectangles to encrypt, from a sidecar file
+                if (roi_error == NULL)
+                  roi_error = figleaf_roi_read_file(&roi, optarg);
+                ctx->roi = &roi;
+                break;
+      case OPT_CROP: // Viewport to decrypt
+                crop.num_rects = 0;
+                {
+                  const char *crop_error = figleaf_roi_parse_crop(&crop, optarg);
+                  if (crop_error != NULL)
+                    errx(1, "%s", crop_error);
+                }
+                ctx->crop = &crop;
+                break;
+      case OPT_SWEEP: // Every combination of the -m, -b and -a lists
+                sweep_mode = 1;
+                break;
+      case OPT_MASTER_KEY: // Stretch the passphrase once per run
+                master_salt_filename = optarg;
+                break;
+      case 'k': // Key derivation function
+                ctx->kdf_name = optarg;
+                break;
+      case OPT_CALIBRATE_KDF: // Pick KDF costs for this host
+                calibrate_ms = atof(optarg);
+                if (calibrate_ms <= 0)
+                  errx(1, "KDF calibration target must be a positive number of ms");
+                break;
+      case OPT_MEM_BUDGET: // Limit on memory for images in flight
+                mem_budget = figleaf_parse_size(optarg);
+                if (mem_budget == 0)
+                  errx(1, "Memory budget must be a size like 512M or 4G");
+                break;
+      case OPT_SHARD: // Which slice of the input directory to process
+                {
+                  char extra;
+                  if (sscanf(optarg, "%u/%u%c", &shard_index, &shard_count,
+                             &extra) != 2 ||
+                      shard_count == 0 || shard_index >= shard_count)
+                    errx(1, "Shard must be i/n with 0 <= i < n");
+                }
+                break;
+      case OPT_MERGE_STATS: // Combine shard reports; the rest are inputs
+                merge_stats_filename = optarg;
+                break;
     }
   }
 
+  if (calibrate_ms > 0) {
+    if (sodium_init() == -1)
+      err(1, "Failed to initialize libsodium");
+    kdf_calibrate(ctx->kdf_name ? ctx->kdf_name : "argon2id", calibrate_ms);
+    free(ctx);
+    return 0;
+  }
+
+  if (merge_stats_filename != NULL) {
+    if (optind >= argc)
+      errx(1, "No reports to merge");
+    figleaf_stats_merge(merge_stats_filename, argv + optind, argc - optind);
+    free(ctx);
+    return 0;
+  }
+
   if (ctx->mode <= 0) {
     print_usage(argv[0]);
     err(1, "Must specify either encryption or decryption");
   }
-  if (input_path == NULL) {
+  // A manifest names the files itself, and may give each its own blocksize
+  if (input_path == NULL && manifest_filename == NULL) {
     print_usage(argv[0]);
     err(1, "No input path");
   }
-  if (output_path == NULL) {
+  if (output_path == NULL && manifest_filename == NULL) {
     print_usage(argv[0]);
     err(1, "No output path");
   }
+  if (roi_error != NULL)
+    errx(1, "%s", roi_error);
+  if (ctx->roi != NULL) {
+    // Make sure they'll fit in the marker now, rather than fail every image
+    JOCTET marker[FIGLEAF_ROI_MAX];
+    if (figleaf_roi_format(ctx->roi, marker, sizeof marker) == 0)
+      errx(1, "Too many regions to record in the output");
+  }
+  if (ctx->crop != NULL) {
+    if (ctx->mode != FIGLEAF_MODE_DECRYPT)
+      errx(1, "--crop only applies when decrypting");
+    if (sweep_mode || size_filename != NULL)
+      errx(1, "--crop doesn't work with --sweep or --size-report");
+  }
+  if (shard_count > 0 &&
+      (manifest_filename != NULL || tar || !isdir(input_path)))
+    errx(1, "--shard only applies to an input directory");
   if (ctx->tpe_method_name == NULL) {
     ctx->tpe_method_name = "drpe-lsb";
   }
-  if (ctx->blocksize <= 0 || ctx->blocksize % 8) {
+  struct figleaf_sweep sweep;
+  if (sweep_mode) {
+    if (manifest_filename != NULL || tar || ctx->pipeline)
+      errx(1, "--sweep doesn't work with --manifest, --tar or -P");
+    if (size_filename != NULL)
+      errx(1, "--size-report measures one setting, so doesn't work with --sweep");
+    if (shard_count > 0 && stats_filename == NULL)
+      errx(1, "--shard with --sweep needs --stats, as the output path is a template");
+    const char *sweep_error = figleaf_sweep_init(&sweep, module_list,
+                                                 blocksize_list, arg_list);
+    if (sweep_error == NULL)
+      sweep_error = figleaf_sweep_check_template(&sweep, output_path);
+    if (sweep_error == NULL && dataset_filename != NULL)
+      sweep_error = figleaf_sweep_check_template(&sweep, dataset_filename);
+    if (sweep_error != NULL)
+      errx(1, "%s", sweep_error);
+    sweep.output_template = output_path;
+    // Check every module now, rather than failing every image on it
+    size_t i;
+    for (i = 0; i < sweep.num_configs; i++) {
+      struct figleaf_context config = *ctx;
+      const char *module_error = figleaf_sweep_apply(&sweep, i, &config);
+      if (module_error != NULL)
+        errx(1, "%s", module_error);
+    }
+    // The rest of the checks go by the first combination
+    (void) figleaf_sweep_apply(&sweep, 0, ctx);
+    ctx->sweep = &sweep;
+  }
+  if (manifest_filename != NULL && ctx->blocksize == 0) {
+    // Checked for each job instead
+  } else if (ctx->blocksize <= 0 || ctx->blocksize % 8) {
     err(1, "Blocksize must be a multiple of eight");
   }
   if (passphrase == NULL) {
     print_usage(argv[0]);
     err(1, "No passphrase");
   }
-#if 0
-  // FIXME - Having some trouble linking the read_quant_tables() from libjpeg
-  // Is it included in the libjpeg.a that we're building???
   if (quant_matrix_filename != NULL) {
+    // read_quant_tables() lives in rdswitch.c, which libjpeg.a doesn't
+    // include; the Makefile links it in from jpeg-6b alongside the library.
     struct jpeg_compress_struct tmp_cinfo;
+    struct jpeg_error_mgr tmp_jerr;
+    tmp_cinfo.err = jpeg_std_error(&tmp_jerr);
     jpeg_create_compress(&tmp_cinfo);
-    int scalefactor = 1;
+    int scalefactor = 100;  // percent, ie use the tables as given
     if (!read_quant_tables(&tmp_cinfo, quant_matrix_filename,
-                           scalefactor, 0))
-      err(1, "Couldn't read quantization tables");
+                           scalefactor, TRUE))
+      errx(1, "Couldn't read quantization tables");
+    // As with cjpeg, table 0 is for luminance and table 1 (if given) for
+    // chrominance.  Both chroma components share the one copy.
+    JQUANT_TBL *luma = tmp_cinfo.quant_tbl_ptrs[0];
+    JQUANT_TBL *chroma = tmp_cinfo.quant_tbl_ptrs[1];
+    if (luma == NULL)
+      errx(1, "No quantization tables in [%s]", quant_matrix_filename);
+    if (chroma == NULL)
+      chroma = luma;
+    ctx->quant_tables[0] = (JQUANT_TBL *) malloc(sizeof(JQUANT_TBL));
+    memcpy(ctx->quant_tables[0], luma, sizeof(JQUANT_TBL));
+    ctx->quant_tables[1] = (JQUANT_TBL *) malloc(sizeof(JQUANT_TBL));
+    memcpy(ctx->quant_tables[1], chroma, sizeof(JQUANT_TBL));
     int c = 0;
-    for (c = 0; c < MAX_COMPS_IN_SCAN; c++) {
-      JQUANT_TBL *table = tmp_cinfo.quant_tbl_ptrs[c];
-      if (table != NULL) {
-        ctx->quant_tables[c] = (JQUANT_TBL *) malloc(sizeof(JQUANT_TBL));
-        memcpy(ctx->quant_tables[c], table, sizeof(JQUANT_TBL));
-      }
-    }
+    for (c = 2; c < MAX_COMPS_IN_SCAN; c++)
+      ctx->quant_tables[c] = ctx->quant_tables[1];
     jpeg_destroy_compress(&tmp_cinfo);
+    if (ctx->mode != FIGLEAF_MODE_ENCRYPT)
+      warnx("Ignoring -q: requantization only applies when encrypting");
   }
-#endif
 
   if (ctx->tpe_method_name == NULL) {
     err(1, "No encryption/decryption module specified");
   }
   // Set up crypto function pointers
-  // Are we encrypting or decrypting?
-  if (ctx->mode == FIGLEAF_MODE_ENCRYPT) {
-    //ctx->DC_crypto_fcn = cascade_encrypt_block;
-    //ctx->DC_crypto_fcn = bounce_encrypt_block;
-    if (!strcmp(ctx->tpe_method_name, "lsb")) {
-      ctx->DC_crypto_fcn = lsb_encrypt_dc;
-      ctx->AC_crypto_fcn = lsb_encrypt_ac;
-      ctx->DC_minmax_fcn = minmax_poweroftwo;
-      ctx->AC_minmax_fcn = minmax_poweroftwo;
-    } else if (!strcmp(ctx->tpe_method_name, "noop")) {
-      ctx->DC_crypto_fcn = noop_encrypt_block;
-      ctx->AC_crypto_fcn = noop_encrypt_block;
-      ctx->DC_minmax_fcn = NULL;
-      ctx->AC_minmax_fcn = NULL;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe")) {
-      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe-nz")) {
-      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb")) {
-      ctx->DC_crypto_fcn = drpe_lsb_encrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb-nz")) {
-      ctx->DC_crypto_fcn = drpe_lsb_encrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "mosaic")) {
-      ctx->DC_crypto_fcn = mosaic_fuzzy_block;
-      ctx->AC_crypto_fcn = mosaic_zero_block;
-      //ctx->AC_crypto_fcn = fpe_encrypt_all;
-      ctx->DC_minmax_fcn = NULL;
-      ctx->AC_minmax_fcn = NULL;
-    } else if (!strcmp(ctx->tpe_method_name, "shuffle")) {
-      ctx->DC_crypto_fcn = shuffle_encrypt_block;
-      ctx->AC_crypto_fcn = fpe_encrypt_nonzero;
-      //ctx->AC_crypto_fcn = fpe_encrypt_all;
-      ctx->DC_minmax_fcn = NULL;
-      ctx->AC_minmax_fcn = NULL;
-    } else if (!strcmp(ctx->tpe_method_name, "gibbs")) {
-      ctx->DC_crypto_fcn = gibbs_encrypt_block;
-      ctx->AC_crypto_fcn = fpe_encrypt_nonzero;
-      //ctx->AC_crypto_fcn = fpe_encrypt_all;
-      ctx->DC_minmax_fcn = minmax_bitmask;
-      ctx->AC_minmax_fcn = minmax_poweroftwo;
-    } else {
-      err(1, "Invalid TPE module name, or no encryption module specified");
-    }
-    // One more sanity check:
-    // If we're working on 8x8 blocks, we should really
-    // just leave the DC coefficients alone.
-    if (ctx->blocksize == 8) {
-      ctx->DC_crypto_fcn = noop_encrypt_block;
-      ctx->DC_minmax_fcn = NULL;
-      // FIXME - What should we do about the AC's?
-      // Here's one idea: preseve the first 1 bit,
-      // and encrypt all lower bits.  So it leaks
-      // a bit more, but it's always repeatable.
-    }
-  } else if (ctx->mode == FIGLEAF_MODE_DECRYPT) {
-    //ctx->DC_crypto_fcn = cascade_decrypt_block;
-    //ctx->DC_crypto_fcn = bounce_decrypt_block;
-    if (!strcmp(ctx->tpe_method_name, "lsb")) {
-      ctx->DC_crypto_fcn = lsb_decrypt_dc;
-      ctx->AC_crypto_fcn = lsb_decrypt_ac;
-      ctx->DC_minmax_fcn = minmax_poweroftwo;
-      ctx->AC_minmax_fcn = minmax_poweroftwo;
-    } else if (!strcmp(ctx->tpe_method_name, "noop")) {
-      ctx->DC_crypto_fcn = noop_decrypt_block;
-      ctx->AC_crypto_fcn = noop_decrypt_block;
-      ctx->DC_minmax_fcn = NULL;
-      ctx->AC_minmax_fcn = NULL;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe")) {
-      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe-nz")) {
-      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb")) {
-      ctx->DC_crypto_fcn = drpe_lsb_decrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb-nz")) {
-      ctx->DC_crypto_fcn = drpe_lsb_decrypt_all;
-      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
-      ctx->DC_minmax_fcn = minmax_raw;
-      ctx->AC_minmax_fcn = minmax_raw;
-    } else if (!strcmp(ctx->tpe_method_name, "mosaic")) {
-      err(1, "Can't decrypt mosaiced images");
-    } else if (!strcmp(ctx->tpe_method_name, "shuffle")) {
-      ctx->DC_crypto_fcn = shuffle_decrypt_block;
-      ctx->AC_crypto_fcn = fpe_decrypt_nonzero;
-      //ctx->AC_crypto_fcn = fpe_decrypt_all;
-      ctx->DC_minmax_fcn = NULL;
-      ctx->AC_minmax_fcn = NULL;
-    } else if (!strcmp(ctx->tpe_method_name, "gibbs")) {
-      ctx->DC_crypto_fcn = gibbs_decrypt_block;
-      ctx->AC_crypto_fcn = fpe_decrypt_nonzero;
-      //ctx->AC_crypto_fcn = fpe_decrypt_all;
-      ctx->DC_minmax_fcn = minmax_bitmask;
-      ctx->AC_minmax_fcn = minmax_poweroftwo;
-    } else {
-      err(1, "Invalid TPE module name, or no decryption module specified");
-    }
-    // One more sanity check:
-    // If we're working on 8x8 blocks, we should really
-    // just leave the DC coefficients alone.
-    if (ctx->blocksize == 8) {
-      ctx->DC_crypto_fcn = noop_decrypt_block;
-      ctx->DC_minmax_fcn = NULL;
-      // FIXME - What should we do about the AC's?
-      // Here's one idea: preseve the first 1 bit,
-      // and encrypt all lower bits.  So it leaks
-      // a bit more, but it's always repeatable.
-    }
-  } else {
-    errx(1, "Invalid mode -- Mode must be either ENCRYPT (-e) or DECRYPT (-d)");
+  const char *module_error = tpe_select_module(ctx);
+  if (module_error != NULL)
+    errx(1, "%s", module_error);
+
+  // Set up the key derivation function.  A master key is only derived
+  // once, so it defaults to something much more expensive.
+  const char *kdf_spec = ctx->kdf_name;
+  if (kdf_spec == NULL)
+    kdf_spec = master_salt_filename != NULL ? "argon2id:3:256" : "hash";
+  const char *kdf_error = kdf_select(kdf_spec, &ctx->kdf);
+  if (kdf_error != NULL)
+    errx(1, "%s", kdf_error);
+
+  //puts("Initializing libsodium");
+  if (sodium_init() == -1)
+    err(1, "Failed to initialize libsodium");
+
+  unsigned char master_key[crypto_generichash_KEYBYTES];
+  unsigned char master_salt[KDF_MASTER_SALT_BYTES];
+  if (master_salt_filename != NULL) {
+    kdf_master_salt(master_salt, master_salt_filename,
+                    ctx->mode == FIGLEAF_MODE_ENCRYPT);
+    puts("Deriving master key");
+    kdf_master_key(master_key, sizeof master_key,
+                   (unsigned char *) passphrase, strlen(passphrase),
+                   master_salt, sizeof master_salt, ctx->kdf);
+    ctx->master_key = master_key;
+    ctx->master_salt = master_salt;
+  }
+
+  struct figleaf_failures failures;
+  figleaf_failures_init(&failures);
+  ctx->failures = &failures;
+
+  struct figleaf_budget budget;
+  if (mem_budget != 0) {
+    figleaf_budget_init(&budget, mem_budget);
+    ctx->mem_budget = &budget;
+  }
+
+  // Every shard leaves a report behind, for --merge-stats to put together
+  char *default_stats = NULL;
+  if (shard_count > 0 && stats_filename == NULL) {
+    char name[64];
+    snprintf(name, sizeof name, "figleaf-shard-%u-of-%u.stats",
+             shard_index, shard_count);
+    default_stats = path_join(output_path, name);
+    stats_filename = default_stats;
   }
 
-  // Set up the key derivation function
-  // TODO: Make this configurable as a command-line option
-  ctx->kdf = kdf_hash;
+  struct figleaf_stats_log stats_log;
+  if (stats_filename != NULL) {
+    figleaf_stats_log_open(&stats_log, stats_filename);
+    stats_log.shard_index = shard_index;
+    stats_log.shard_count = shard_count;
+    ctx->stats_log = &stats_log;
+  }
 
+  struct figleaf_sizes_log size_log;
+  if (size_filename != NULL) {
+    figleaf_sizes_log_open(&size_log, size_filename, ctx->tpe_method_name,
+                           ctx->fcn_user_arg, ctx->blocksize);
+    ctx->size_log = &size_log;
+  }
 
-  if (isdir(input_path)) {
+  // With a sweep, the dataset's name is a template like the output path's
+  size_t num_datasets = 0, i;
+  if (dataset_filename != NULL) {
+    num_datasets = ctx->sweep != NULL ? ctx->sweep->num_configs : 1;
+    ctx->dataset = (struct figleaf_dataset *)
+                   calloc(num_datasets, sizeof(struct figleaf_dataset));
+    if (ctx->dataset == NULL)
+      err(1, "Couldn't allocate memory for datasets");
+    for (i = 0; i < num_datasets; i++) {
+      char name[FILENAME_MAX];
+      if (ctx->sweep != NULL) {
+        struct figleaf_context config = *ctx;
+        (void) figleaf_sweep_apply(ctx->sweep, i, &config);
+        figleaf_sweep_output(&config, dataset_filename, "", name, sizeof name);
+      } else {
+        snprintf(name, sizeof name, "%s", dataset_filename);
+      }
+      figleaf_dataset_open(&ctx->dataset[i], name);
+    }
+  }
+
+
+  if (manifest_filename != NULL) {
+    char *default_journal = NULL;
+    if (journal_filename == NULL) {
+      default_journal = (char *) malloc(strlen(manifest_filename) + sizeof ".journal");
+      if (default_journal == NULL)
+        err(1, "Couldn't allocate memory");
+      strcpy(default_journal, manifest_filename);
+      strcat(default_journal, ".journal");
+      journal_filename = default_journal;
+    }
+    struct figleaf_manifest manifest;
+    figleaf_manifest_init(&manifest, manifest_filename, journal_filename,
+                          check_hash, ctx);
+    run_jobs(&manifest.pub, passphrase, ctx);
+    figleaf_manifest_destroy(&manifest);
+    free(default_journal);
+  } else if (tar) {
+    figleaf_run_tar(input_path, output_path, passphrase, ctx);
+  } else if (isdir(input_path)) {
     printf("Input path [%s] is a directory\n", input_path);
-    if (!isdir(output_path)) {
+    // A sweep's output path is a template, made into directories as needed
+    if (ctx->sweep == NULL && !isdir(output_path)) {
       err(1, "Input path is a directory, but output path is not");
     }
-    glob_t globber;
-    char *pattern = path_join(input_path, "*.jpg");
-    int glob_flags = GLOB_NOSORT | GLOB_TILDE;
-    rc = glob(pattern, glob_flags, NULL, &globber);
-    if (rc == 0) { // Success!
-      // Now we go through, find all the matching filenames,
-      // derive the corresponding output filenames, and
-      // encrypt/decrypt all the input files
-      size_t i = 0;
-      for (i = 0; i < globber.gl_pathc; i++) {
-        char *input_filename = globber.gl_pathv[i];
-        printf("Found input file [%s]\n", input_filename);
-        char *input_basename = basename(input_filename);
-        char *output_filename = path_join(output_path, input_basename);
-        printf("\tOutput file will be [%s]\n", output_filename);
-        // Now process input_filename into output_filename
-        figleaf_process_image(input_filename, output_filename,
-                              passphrase, ctx);
-        free(output_filename);
-      }
-    } else if (rc == GLOB_NOSPACE) {
-      err(1, "Ran out of memory while matching filenames");
-    } else if (rc == GLOB_ABORTED) {
-      err(1, "Read error while matching filenames");
-    } else if (rc == GLOB_NOMATCH) {
-      err(1, "No matching input files");
-    } else {
-      err(1, "Unknown error while matching input filenames");
-    }
-    globfree(&globber);
-    free(pattern);
+    // Walk the input tree, handing each file to the workers as soon as
+    // it's found
+    struct figleaf_walk walk;
+    figleaf_walk_init(&walk, input_path, output_path);
+    walk.skip_output_dirs = (ctx->sweep != NULL);
+    if (shard_count > 0)
+      figleaf_walk_set_shard(&walk, shard_index, shard_count);
+    run_jobs(&walk.pub, passphrase, ctx);
+    if (walk.num_found + walk.num_other_shards == 0)
+      errx(1, "No matching input files");
+    if (walk.num_found == 0)
+      printf("No input files in shard %u of %u\n", shard_index, shard_count);
+    figleaf_walk_destroy(&walk);
   } else {
     char *input_filename = input_path;
     char *output_filename = NULL;
     printf("Input path [%s] is NOT a directory\n", input_path);
-    if (isdir(output_path)) {
+    if (ctx->sweep == NULL && isdir(output_path)) {
       char *input_basename = basename(input_filename);
-      char *output_filename = path_join(output_path, input_basename);
+      output_filename = path_join(output_path, input_basename);
       printf("\tOutput file will be [%s]\n", output_filename);
     } else {
       output_filename = output_path;
       printf("\tUsing specified output file [%s]\n", output_filename);
     }
     // Process input_filename into output_filename
-    figleaf_process_image(input_filename, output_filename,
-                          passphrase, ctx);
+    struct figleaf_worker worker;
+    figleaf_worker_init(&worker, ctx->num_threads);
+    int failed;
+    if (ctx->sweep != NULL)
+      failed = figleaf_sweep_image(&worker, input_filename, output_filename,
+                                   passphrase, ctx->sweep, ctx);
+    else
+      failed = figleaf_process_image(&worker, input_filename, output_filename,
+                                     passphrase, ctx) ||
+               figleaf_export_image(&worker, ctx->dataset, input_filename);
+    if (failed)
+      errx(1, "%s", worker.recover.message);
+    figleaf_stats_log_file(ctx->stats_log, input_filename, &worker.stats);
+    figleaf_sizes_log_file(ctx->size_log, input_filename, &worker.sizes,
+                           worker.stats.bytes_in, worker.stats.bytes_out);
+    figleaf_worker_destroy(&worker);
   }
 
+  if (ctx->stats_log != NULL)
+    figleaf_stats_log_close(ctx->stats_log, &failures);
+  if (ctx->size_log != NULL)
+    figleaf_sizes_log_close(ctx->size_log);
+  for (i = 0; i < num_datasets; i++)
+    figleaf_dataset_close(&ctx->dataset[i]);
+  free(ctx->dataset);
+  free(default_stats);
+  if (ctx->sweep != NULL)
+    figleaf_sweep_destroy(ctx->sweep);
+  figleaf_roi_destroy(&roi);
+  figleaf_roi_destroy(&crop);
+  // Everything else got done, but the run as a whole didn't succeed
+  figleaf_failures_report(&failures);
+  int status = (failures.count > 0) ? 1 : 0;
+  figleaf_failures_destroy(&failures);
+  if (ctx->mem_budget != NULL)
+    figleaf_budget_destroy(ctx->mem_budget);
+  sodium_memzero(master_key, sizeof master_key);
   free(ctx);
-  return 0;
-}
-
-
-
-
-int
-figleaf_process_image(char *input_filename, char *output_filename,
-                      char *passphrase, struct figleaf_context *ctx)
-{
-  FILE *infile = NULL;
-  FILE *outfile = NULL;
-
-  struct jpeg_decompress_struct jpegdec;
-  struct jpeg_compress_struct jpegenc;
-  struct jpeg_error_mgr jerr_dec, jerr_enc;
-  struct jeasy *je = NULL;
-
-  //printf("Opening file [%s] for reading\n", input_filename);
-  infile = fopen(input_filename, "rb");
-  if (infile == NULL) {
-    err(1, "Couldn't open file [%s] for reading", input_filename);
-  }
-
-  //printf("Opening file [%s] for writing\n", output_filename);
-  outfile = fopen(output_filename, "wb");
-  if (outfile == NULL) {
-    err(1, "Couldn't open file [%s] for writing", output_filename);
-  }
-
-  //puts("Creating JPEG decompression object");
-  jpegdec.err = jpeg_std_error(&jerr_dec);
-  jpeg_create_decompress(&jpegdec);
-  //puts("Setting JPEG input to be our input file");
-  jpeg_stdio_src(&jpegdec, infile);
-
-  //puts("Creating JPEG compression object");
-  jpegenc.err = jpeg_std_error(&jerr_enc);
-  jpeg_create_compress(&jpegenc);
-  //puts("Setting JPEG output to be our output file");
-  jpeg_stdio_dest(&jpegenc, outfile);
-
-  //puts("Reading JPEG header");
-  (void) jpeg_read_header(&jpegdec, TRUE);
-
-  // Copy all the JPEG params from the decoder struct into the encoder struct
-  //puts("Copying JPEG parameters");
-  jpeg_copy_critical_parameters(&jpegdec, &jpegenc);
-
-  // Use Provos's easy interface to get at the DCT block data
-  //puts("Creating JPEG Easy struct");
-  je = jpeg_prepare_blocks(&jpegdec);
-
-  // And for a sanity check, let's have a look at one of the blocks
-  //puts("Here's block (0,0)");
-  //print_block(je->blocks[0][0]);
-
-  //puts("Initializing libsodium");
-  if (sodium_init() == -1)
-    err(1, "Failed to initialize libsodium");
-
-  if (passphrase == NULL) {
-    errx(1, "Empty passphrase");
-  }
-
-  unsigned char key[crypto_stream_KEYBYTES];
-  char *key_salt = NULL;
-  int salt_length = 0;
-  if (ctx->salt_source != NULL && !strcmp(ctx->salt_source, "filename")) {
-    key_salt = basename(input_filename);
-    salt_length = strlen(key_salt);
-  }
-
-  if (ctx->kdf(key, sizeof key,
-               (unsigned char *)passphrase, strlen(passphrase),
-               (unsigned char *)key_salt, salt_length)
-      != 0)
-    err(1, "Key derivation failed");
-
-#if 0
-  char buf[65];
-  sodium_bin2hex(buf, sizeof buf, key, sizeof key);
-  printf("Derived key is [%s]\n", buf);
-#endif
-
-  // Now run whichever operation we've decided to do
-  puts("Running crypto functions on the input image");
-  tpe_process_image(key, je, ctx);
-
-  // Copy DCT coefficients into the output image (that is, the JPEG compression object)
-  //puts("Writing JPEG blocks back into JEasy");
-  jpeg_return_blocks(je, &jpegdec);
-  //puts("Freeing JEasy structure");
-  jpeg_free_blocks(je);
-
-  // Copy the actual DCT coefficients from the decoder to the encoder
-  //puts("Copying DCT coefficients");
-  jvirt_barray_ptr *coeffs = jpeg_read_coefficients(&jpegdec);
-  jpeg_write_coefficients(&jpegenc, coeffs);
-
-  // Save the output image, de-allocate compression data, close the output file
-  //puts("Finishing JPEG compression with entropy coding");
-  jpeg_finish_compress(&jpegenc);
-  jpeg_destroy_compress(&jpegenc);
-  fclose(outfile);
-  // De-allocate decompression data, close the input file
-  (void) jpeg_finish_decompress(&jpegdec);
-  jpeg_destroy_decompress(&jpegdec);
-  fclose(infile);
-
-  //printf("Done writing output file [%s]\n", output_filename);
-  return 0;
+  return status;
 }
 
-
@@ -7,6 +7,14 @@
 //#include "tpe.h"
 //#include "kdf.h"
 
+struct figleaf_stats_log;
+struct figleaf_sizes_log;
+struct figleaf_failures;
+struct figleaf_budget;
+struct figleaf_sweep;
+struct figleaf_dataset;
+struct figleaf_roi;
+
 typedef int (*key_derivation_fcn)(unsigned char *, int, unsigned char *, int, unsigned char *, int);
 
 typedef void (*minmax_fcn)(JCOEF*, int, int, int, JCOEF*, JCOEF*, JCOEF*);
@@ -21,12 +29,21 @@ struct figleaf_context {
   int blocksize;         // Dimensions of a thumbnail block
 
   /* Do we have a unique salt for each file? */
-  /* And if so, where do we get it from? */
+  /* And if so, where do we get it from?     */
+  /* "filename" for the input's basename,    */
+  /* otherwise the salt itself               */
   char *salt_source;
 
   /* Key Derivation Function */
   /* eg PBKDF2, scrypt, ...  */
   key_derivation_fcn kdf;
+  char *kdf_name;        // As given to -k, or NULL for the default
+
+  /* If not NULL, the passphrase stretched once for the whole run;  */
+  /* each file's key is then a keyed hash of its salt (see kdf.h)   */
+  /* instead of running the KDF again                               */
+  unsigned char *master_key;
+  unsigned char *master_salt;   // What it was derived with (see kdf.h)
 
   /* Functions for handling DC coefficients */
   minmax_fcn       DC_minmax_fcn;  // Minmax function
@@ -43,6 +60,48 @@ struct figleaf_context {
   /* Optional argument for TPE functions */
   int fcn_user_arg;
 
+  /* How many worker threads to use (across files in batch mode, */
+  /* and across restart intervals within each file)              */
+  int num_threads;
+
+  /* Nonzero to pipeline batches through separate read, crypt and */
+  /* write threads (see pipeline.h)                               */
+  int pipeline;
+
+  /* Restart interval for the output, in MCU rows (0 for none) */
+  int restart_rows;
+
+  /* Where to write per-image timings and counts, or NULL */
+  /* (see stats.h)                                        */
+  struct figleaf_stats_log *stats_log;
+
+  /* Where to write where each image's bytes go, or NULL */
+  /* (see sizes.h)                                      */
+  struct figleaf_sizes_log *size_log;
+
+  /* Where to record the files that fail (see recover.h), or NULL */
+  struct figleaf_failures *failures;
+
+  /* Memory budget the workers share (see budget.h), or NULL */
+  struct figleaf_budget *mem_budget;
+
+  /* Settings to encrypt each image under, with the output path as a */
+  /* template for the filenames (see sweep.h), or NULL               */
+  struct figleaf_sweep *sweep;
+
+  /* Where to put the outputs' pixels (see dataset.h), or NULL; with a */
+  /* sweep, one for each of its combinations                           */
+  struct figleaf_dataset *dataset;
+
+  /* Only the tiles that overlap these rectangles are encrypted or */
+  /* decrypted (see roi.h); NULL for the whole image               */
+  struct figleaf_roi *roi;
+
+  /* When decrypting, only the tiles that overlap this one rectangle   */
+  /* are decrypted, and the output is cropped to it (see roi.h); NULL */
+  /* for the whole image                                               */
+  struct figleaf_roi *crop;
+
 };
 
 #endif
@@ -0,0 +1,350 @@
+#define _POSIX_C_SOURCE 200809L  // for mkstemp(), fchmod() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+#include "fileio.h"
+#include "recover.h"
+
+// Starting size of an output buffer; it doubles whenever it fills up
+#define OUTBUF_INITIAL_SIZE 65536
+
+
+void
+figleaf_input_open(struct figleaf_input *in, const char *filename)
+{
+  struct stat st;
+  int fd;
+
+  memset(in, 0, sizeof(struct figleaf_input));
+
+  // Failing to read the file only fails this image (see recover.h), so
+  // don't leave anything open behind us
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    figleaf_err("Couldn't open file [%s] for reading", filename);
+  if (fstat(fd, &st) != 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    figleaf_err("Couldn't stat file [%s]", filename);
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      // libjpeg reads the file front to back exactly once
+      posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+      in->data = map;
+      in->size = st.st_size;
+      in->mapped = 1;
+      close(fd);
+      return;
+    }
+  }
+
+  // Not mappable, so fall back to reading it all into memory
+  size_t alloc = 0;
+  JOCTET *data = NULL;
+  for (;;) {
+    if (in->size == alloc) {
+      alloc = alloc ? alloc * 2 : OUTBUF_INITIAL_SIZE;
+      JOCTET *grown = realloc(data, alloc);
+      if (grown == NULL) {
+        close(fd);
+        free(data);
+        errno = ENOMEM;
+        figleaf_err("Couldn't allocate memory for [%s]", filename);
+      }
+      data = grown;
+    }
+    ssize_t n = read(fd, data + in->size, alloc - in->size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      int saved_errno = errno;
+      close(fd);
+      free(data);
+      errno = saved_errno;
+      figleaf_err("Couldn't read file [%s]", filename);
+    }
+    if (n == 0)
+      break;
+    in->size += n;
+  }
+  close(fd);
+  in->data = data;
+}
+
+void
+figleaf_input_close(struct figleaf_input *in)
+{
+  if (in->mapped)
+    munmap((void *) in->data, in->size);
+  else
+    free((void *) in->data);
+  memset(in, 0, sizeof(struct figleaf_input));
+}
+
+
+/*
+ * Source manager: the whole file is already in the buffer, so there is
+ * never anything more to fill it with.  Running off the end is handled
+ * the same way as jdatasrc.c does it, by warning and inserting a fake EOI.
+ */
+
+static void
+mem_init_source(j_decompress_ptr cinfo)
+{
+}
+
+static boolean
+mem_fill_input_buffer(j_decompress_ptr cinfo)
+{
+  static const JOCTET fake_eoi[2] = { 0xFF, JPEG_EOI };
+
+  WARNMS(cinfo, JWRN_JPEG_EOF);
+  cinfo->src->next_input_byte = fake_eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+static void
+mem_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+  struct jpeg_source_mgr *src = cinfo->src;
+
+  if (num_bytes <= 0)
+    return;
+  if ((size_t) num_bytes > src->bytes_in_buffer) {
+    (void) mem_fill_input_buffer(cinfo);
+  } else {
+    src->next_input_byte += num_bytes;
+    src->bytes_in_buffer -= num_bytes;
+  }
+}
+
+static void
+mem_term_source(j_decompress_ptr cinfo)
+{
+}
+
+void
+figleaf_mem_src(j_decompress_ptr cinfo, const JOCTET *data, size_t size)
+{
+  struct jpeg_source_mgr *src;
+
+  // Like jpeg_stdio_src(), the manager is allocated once per object
+  if (cinfo->src == NULL) {
+    cinfo->src = (struct jpeg_source_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+                                  sizeof(struct jpeg_source_mgr));
+  }
+
+  src = cinfo->src;
+  src->init_source = mem_init_source;
+  src->fill_input_buffer = mem_fill_input_buffer;
+  src->skip_input_data = mem_skip_input_data;
+  src->resync_to_restart = jpeg_resync_to_restart;
+  src->term_source = mem_term_source;
+  src->next_input_byte = data;
+  src->bytes_in_buffer = size;
+}
+
+
+/* Destination manager writing into a growable figleaf_outbuf */
+
+struct mem_destination_mgr {
+  struct jpeg_destination_mgr pub;
+  struct figleaf_outbuf *buf;
+};
+
+static void
+mem_init_destination(j_compress_ptr cinfo)
+{
+  struct mem_destination_mgr *dest = (struct mem_destination_mgr *) cinfo->dest;
+  struct figleaf_outbuf *buf = dest->buf;
+
+  if (buf->alloc == 0) {
+    buf->data = malloc(OUTBUF_INITIAL_SIZE);
+    if (buf->data == NULL)
+      ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    buf->alloc = OUTBUF_INITIAL_SIZE;
+  }
+  buf->size = 0;
+
+  dest->pub.next_output_byte = buf->data;
+  dest->pub.free_in_buffer = buf->alloc;
+}
+
+static boolean
+mem_empty_output_buffer(j_compress_ptr cinfo)
+{
+  struct mem_destination_mgr *dest = (struct mem_destination_mgr *) cinfo->dest;
+  struct figleaf_outbuf *buf = dest->buf;
+  size_t used = buf->alloc;
+  JOCTET *data = realloc(buf->data, buf->alloc * 2);
+
+  if (data == NULL)
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 11);
+  buf->data = data;
+  buf->alloc *= 2;
+
+  dest->pub.next_output_byte = buf->data + used;
+  dest->pub.free_in_buffer = buf->alloc - used;
+  return TRUE;
+}
+
+static void
+mem_term_destination(j_compress_ptr cinfo)
+{
+  struct mem_destination_mgr *dest = (struct mem_destination_mgr *) cinfo->dest;
+
+  dest->buf->size = dest->buf->alloc - dest->pub.free_in_buffer;
+}
+
+void
+figleaf_mem_dest(j_compress_ptr cinfo, struct figleaf_outbuf *buf)
+{
+  struct mem_destination_mgr *dest;
+
+  if (cinfo->dest == NULL) {
+    cinfo->dest = (struct jpeg_destination_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+                                  sizeof(struct mem_destination_mgr));
+  }
+
+  dest = (struct mem_destination_mgr *) cinfo->dest;
+  dest->pub.init_destination = mem_init_destination;
+  dest->pub.empty_output_buffer = mem_empty_output_buffer;
+  dest->pub.term_destination = mem_term_destination;
+  dest->buf = buf;
+}
+
+void
+figleaf_outbuf_free(struct figleaf_outbuf *buf)
+{
+  free(buf->data);
+  memset(buf, 0, sizeof(struct figleaf_outbuf));
+}
+
+
+// mkstemp() creates files 0600; give the output the usual 0666 & ~umask
+static mode_t saved_umask;
+
+void
+figleaf_save_umask(void)
+{
+  saved_umask = umask(0);
+  umask(saved_umask);
+}
+
+mode_t
+figleaf_output_mode(void)
+{
+  return 0666 & ~saved_umask;
+}
+
+/* Write all of data to fd; returns 0, or -1 with errno set */
+static int
+write_all(int fd, const char *p, size_t size)
+{
+  // Normally this is one write(); loop in case it comes up short
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+/* Write straight through to a path that isn't a regular file: a symlink,
+ * a FIFO or a device, which renaming over would replace */
+static void
+write_through(const char *filename, const void *data, size_t size)
+{
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  if (fd < 0)
+    figleaf_err("Couldn't open file [%s] for writing", filename);
+  if (write_all(fd, data, size) != 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    figleaf_err("Couldn't write file [%s]", filename);
+  }
+  if (close(fd) != 0)
+    figleaf_err("Couldn't write file [%s]", filename);
+}
+
+void
+figleaf_write_file(const char *filename, const void *data, size_t size)
+{
+  struct stat st;
+  size_t len = strlen(filename);
+  char *tmpname;
+  int fd;
+
+  if (lstat(filename, &st) == 0 && !S_ISREG(st.st_mode)) {
+    write_through(filename, data, size);
+    return;
+  }
+
+  tmpname = malloc(len + sizeof ".XXXXXX");
+  if (tmpname == NULL)
+    figleaf_err("Couldn't allocate memory for [%s]", filename);
+  memcpy(tmpname, filename, len);
+  memcpy(tmpname + len, ".XXXXXX", sizeof ".XXXXXX");
+
+  fd = mkstemp(tmpname);
+  if (fd < 0) {
+    int saved_errno = errno;
+    free(tmpname);
+    errno = saved_errno;
+    figleaf_err("Couldn't open file [%s] for writing", filename);
+  }
+  if (fchmod(fd, figleaf_output_mode()) != 0)
+    goto fail;
+
+  if (write_all(fd, data, size) != 0)
+    goto fail;
+
+  // Network filesystems may only report write errors at close
+  if (close(fd) != 0) {
+    fd = -1;
+    goto fail;
+  }
+  if (rename(tmpname, filename) != 0) {
+    fd = -1;
+    goto fail;
+  }
+
+  free(tmpname);
+  return;
+
+fail:
+  {
+    int saved_errno = errno;
+    if (fd >= 0)
+      close(fd);
+    unlink(tmpname);
+    free(tmpname);
+    errno = saved_errno;
+    figleaf_err("Couldn't write file [%s]", filename);
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef _FILEIO_H
+#define _FILEIO_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <jpeglib.h>
+
+/*
+ * Whole-file I/O for the per-image path.
+ *
+ * The input file is memory-mapped and libjpeg reads straight out of the
+ * mapping.  The output is encoded into a memory buffer that grows as
+ * needed and is kept by the worker between images; once the image is
+ * complete it is written out with a single write() to a temporary file
+ * in the same directory, which is then renamed over the real name.  A
+ * failure part way through never leaves a truncated output file behind.
+ */
+
+struct figleaf_input {
+  const JOCTET *data;
+  size_t size;
+  int mapped;       // Nonzero if data is an mmap; otherwise it was malloc'd
+};
+
+struct figleaf_outbuf {
+  JOCTET *data;
+  size_t size;      // Bytes written so far
+  size_t alloc;     // Bytes allocated
+};
+
+/* Map the whole of the named file.  Files that can't be mapped (pipes,
+ * empty files) are read into memory instead.  Fails the image on error
+ * (see recover.h).
+ */
+void
+figleaf_input_open(struct figleaf_input *in, const char *filename);
+
+void
+figleaf_input_close(struct figleaf_input *in);
+
+/* Point the decoder at an in-memory JPEG file.  The data must stay
+ * valid until the decoder is finished with it.
+ */
+void
+figleaf_mem_src(j_decompress_ptr cinfo, const JOCTET *data, size_t size);
+
+/* Encode into buf, starting from the beginning of it.  buf->data is
+ * realloc'd as needed and is freed by figleaf_outbuf_free().
+ */
+void
+figleaf_mem_dest(j_compress_ptr cinfo, struct figleaf_outbuf *buf);
+
+void
+figleaf_outbuf_free(struct figleaf_outbuf *buf);
+
+/* Replace the named file with the given contents: write them to a
+ * temporary file next to it and rename that into place.  Fails the image
+ * on error (see recover.h), after removing the temporary file.  A path
+ * that exists but isn't a regular file -- a symlink, a FIFO, or a device
+ * like /dev/stdout -- is written through instead, so it stays what it is.
+ */
+void
+figleaf_write_file(const char *filename, const void *data, size_t size);
+
+/* Read the umask, which new output files are given the usual permissions
+ * with.  Reading it means setting it for a moment, and anything another
+ * thread created meanwhile would come out world-writable, so main() calls
+ * this once before starting any.
+ */
+void
+figleaf_save_umask(void);
+
+/* 0666 less the umask read by figleaf_save_umask() */
+mode_t
+figleaf_output_mode(void);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <jpeglib.h>
 #include <random.h>
+#include "recover.h"
 
 
 void fisheryates_shuffle(unsigned char *key, unsigned char *nonce,
@@ -21,7 +22,7 @@ void fisheryates_shuffle(unsigned char *key, unsigned char *nonce,
     data[j] = tmp;
   }
 
-  free(randomness);
+  figleaf_recover_free(randomness);
 }
 
 void fisheryates_unshuffle(unsigned char *key, unsigned char *nonce,
@@ -30,7 +31,8 @@ void fisheryates_unshuffle(unsigned char *key, unsigned char *nonce,
   int i;
   int r = 0;
   unsigned int *randomness = random_uints(key, nonce, datalen);
-  unsigned int *j = (unsigned int *) malloc(datalen * sizeof(unsigned int));
+  unsigned int *j =
+    (unsigned int *) figleaf_recover_malloc(datalen * sizeof(unsigned int));
 
 
   for(i=datalen-1; i > 0; i--)
@@ -42,8 +44,8 @@ void fisheryates_unshuffle(unsigned char *key, unsigned char *nonce,
     data[i] = data[j[i]];
     data[j[i]] = tmp;
   }
-  free(j);
-  free(randomness);
+  figleaf_recover_free(j);
+  figleaf_recover_free(randomness);
 }
 
 
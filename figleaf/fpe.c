@@ -4,6 +4,7 @@
 
 #include <jpeglib.h>
 #include "fpe.h"
+#include "recover.h"
 
 #define DEBUG_FPE 0
 
@@ -22,14 +23,14 @@ fpe_encrypt(unsigned char *key, unsigned char *nonce,
 {
   // Use the libsodium stream cipher to generate a stream of pseudorandom bytes
   size_t kslen = datalen * sizeof(unsigned short);
-  unsigned short *keystream = (unsigned short *) malloc(kslen);
+  unsigned short *keystream = (unsigned short *) figleaf_recover_malloc(kslen);
   int rc = crypto_stream((unsigned char *)keystream, kslen, nonce, key);
   if (rc != 0)
-    err(1, "Error returned by crypto_stream; rc = %d", rc);
+    figleaf_errx("Error returned by crypto_stream; rc = %d", rc);
 
   int range = maxvalue-minvalue+1;
   if(range <= 0)
-    err(1, "FPE Encrypt: Range is empty!\t(%d,%d)", minvalue, maxvalue);
+    figleaf_errx("FPE Encrypt: Range is empty!\t(%d,%d)", minvalue, maxvalue);
 
   int i=0;
 
@@ -68,7 +69,7 @@ fpe_encrypt(unsigned char *key, unsigned char *nonce,
 
   // Overwrite the keystream so it's not just hanging around in memory
   sodium_memzero(keystream, kslen);
-  free(keystream);
+  figleaf_recover_free(keystream);
 #if DEBUG_FPE
   printf("Ciphertext:\n");
   for(i=0; i < datalen; i++)
@@ -102,17 +103,17 @@ fpe_decrypt(unsigned char *key, unsigned char *nonce,
 {
   // Use the libsodium stream cipher to generate a stream of pseudorandom bytes
   size_t kslen = datalen * sizeof(short);
-  unsigned short *keystream = (unsigned short *) malloc(kslen);
+  unsigned short *keystream = (unsigned short *) figleaf_recover_malloc(kslen);
   if(keystream == NULL)
-    err(1, "Couldn't allocate space for encryption key stream");
+    figleaf_err("Couldn't allocate space for encryption key stream");
 
   int rc = crypto_stream((unsigned char *)keystream, kslen, nonce, key);
   if (rc != 0)
-    err(1, "Error returned by crypto_stream; rc = %d", rc);
+    figleaf_errx("Error returned by crypto_stream; rc = %d", rc);
 
   int range = maxvalue-minvalue+1;
   if(range <= 0)
-    err(1, "FPE Decrypt: Range is empty!");
+    figleaf_errx("FPE Decrypt: Range is empty!");
   if(range == 1) {
     int i = 0;
     for(i=0; i < datalen; i++)
@@ -149,7 +150,7 @@ done:
   // Overwrite the keystream so it's not just hanging around in memory
   sodium_memzero(keystream, kslen);
   // And return it to the OS
-  free(keystream);
+  figleaf_recover_free(keystream);
 #if DEBUG_FPE
   printf("Plaintext:\n");
   for(i=0; i < datalen; i++)
@@ -9,6 +9,7 @@
 #include "gibbs.h"
 #include "random.h"
 #include "fisheryates.h"
+#include "recover.h"
 
 int gibbs_num_rounds = 5;
 
@@ -66,7 +67,7 @@ void gibbs_sample(unsigned char *key, unsigned char *nonce,
       y = budget;
     }
     else if(yrange <= 0) {
-      errx(1,"Gibbs sampling range is empty");
+      figleaf_errx("Gibbs sampling range is empty");
     }
     else if(yrange == 1) {
       y = ymin;
@@ -89,7 +90,7 @@ void gibbs_sample(unsigned char *key, unsigned char *nonce,
     budget -= y;
     subtotal += y;
   }
-  free(randomness);
+  figleaf_recover_free(randomness);
 }
 
 
@@ -180,7 +181,7 @@ void gibbs_reverse_sample(unsigned char *key, unsigned char *nonce,
       y = budget;
     }
     else if(yrange <= 0) {
-      errx(1,"Gibbs sampling range is empty");
+      figleaf_errx("Gibbs sampling range is empty");
     }
     else if(yrange == 1) {
       y = ymin;
@@ -204,7 +205,7 @@ void gibbs_reverse_sample(unsigned char *key, unsigned char *nonce,
     subtotal += y;
   }
   x[xlen-1] = sum - subtotal;
-  free(randomness);
+  figleaf_recover_free(randomness);
 }
 
 
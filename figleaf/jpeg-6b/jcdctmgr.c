@@ -15,6 +15,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
 
 
 /* Private subobject for this module */
@@ -81,8 +82,12 @@ start_pass_fdctmgr (j_compress_ptr cinfo)
 				      DCTSIZE2 * SIZEOF(DCTELEM));
       }
       dtbl = fdct->divisors[qtblno];
+      /* An application that quantizes to tables of its own can have the
+       * coefficients as they come out of the FDCT, still scaled up by 8.
+       */
       for (i = 0; i < DCTSIZE2; i++) {
-	dtbl[i] = ((DCTELEM) qtbl->quantval[i]) << 3;
+	dtbl[i] = cinfo->fdct_unquantized ? 1 :
+		  ((DCTELEM) qtbl->quantval[i]) << 3;
       }
       break;
 #endif
@@ -353,11 +358,17 @@ jinit_forward_dct (j_compress_ptr cinfo)
   cinfo->fdct = (struct jpeg_forward_dct *) fdct;
   fdct->pub.start_pass = start_pass_fdctmgr;
 
+  if (cinfo->fdct_unquantized && cinfo->dct_method != JDCT_ISLOW)
+    ERREXIT(cinfo, JERR_NOT_COMPILED);
+
   switch (cinfo->dct_method) {
 #ifdef DCT_ISLOW_SUPPORTED
   case JDCT_ISLOW:
     fdct->pub.forward_DCT = forward_DCT;
-    fdct->do_dct = jpeg_fdct_islow;
+    if (jsimd_can_fdct_islow())
+      fdct->do_dct = jsimd_fdct_islow;
+    else
+      fdct->do_dct = jpeg_fdct_islow;
     break;
 #endif
 #ifdef DCT_IFAST_SUPPORTED
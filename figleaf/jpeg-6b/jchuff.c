@@ -18,6 +18,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jchuff.h"		/* Declarations shared with jcphuff.c */
+#include "jmemsys.h"		/* segment buffers come from jpeg_get_large */
 
 
 /* Expanded entropy encoder object for Huffman encoding.
@@ -82,13 +83,30 @@ typedef struct {
   size_t free_in_buffer;	/* # of byte spaces remaining in buffer */
   savable_state cur;		/* Current bit buffer & DC state */
   j_compress_ptr cinfo;		/* dump_buffer needs access to this */
+  jpeg_c_segment * seg;		/* segment being coded, or NULL */
 } working_state;
 
+/* Coding errors are normally fatal.  When coding a restart segment we may
+ * be running on a helper thread, though, and must not call the error
+ * handler; we just record the error and let the caller report it.
+ */
+#define CODING_ERREXIT(state,code)  \
+	{ if ((state)->seg != NULL) {  \
+	    (state)->seg->error_code = (code);  \
+	    return FALSE;  \
+	  }  \
+	  ERREXIT((state)->cinfo, code); }
+
 
 /* Forward declarations */
 METHODDEF(boolean) encode_mcu_huff JPP((j_compress_ptr cinfo,
 					JBLOCKROW *MCU_data));
 METHODDEF(void) finish_pass_huff JPP((j_compress_ptr cinfo));
+METHODDEF(boolean) encode_segment_mcu_huff JPP((j_compress_ptr cinfo,
+						jpeg_c_segment * seg,
+						JBLOCKROW *MCU_data));
+METHODDEF(boolean) finish_segment_huff JPP((j_compress_ptr cinfo,
+					    jpeg_c_segment * seg));
 #ifdef ENTROPY_OPT_SUPPORTED
 METHODDEF(boolean) encode_mcu_gather JPP((j_compress_ptr cinfo,
 					  JBLOCKROW *MCU_data));
@@ -113,12 +131,16 @@ start_pass_huff (j_compress_ptr cinfo, boolean gather_statistics)
 #ifdef ENTROPY_OPT_SUPPORTED
     entropy->pub.encode_mcu = encode_mcu_gather;
     entropy->pub.finish_pass = finish_pass_gather;
+    entropy->pub.encode_segment_mcu = NULL;
+    entropy->pub.finish_segment = NULL;
 #else
     ERREXIT(cinfo, JERR_NOT_COMPILED);
 #endif
   } else {
     entropy->pub.encode_mcu = encode_mcu_huff;
     entropy->pub.finish_pass = finish_pass_huff;
+    entropy->pub.encode_segment_mcu = encode_segment_mcu_huff;
+    entropy->pub.finish_segment = finish_segment_huff;
   }
 
   for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
@@ -266,6 +288,36 @@ jpeg_make_c_derived_tbl (j_compress_ptr cinfo, boolean isDC, int tblno,
 
 /* Outputting bytes to the file */
 
+LOCAL(boolean)
+grow_segment_buffer (working_state * state)
+/* Enlarge a segment's private output buffer; return FALSE if out of memory */
+{
+  jpeg_c_segment * seg = state->seg;
+  size_t used = seg->buffer_size - state->free_in_buffer;
+  size_t new_size = seg->buffer_size * 2;
+  JOCTET * new_buffer;
+
+  if (new_size < 4096)
+    new_size = 4096;
+  new_buffer = (JOCTET *)
+    jpeg_get_large((j_common_ptr) state->cinfo, new_size * SIZEOF(JOCTET));
+  if (new_buffer == NULL) {
+    seg->error_code = JERR_OUT_OF_MEMORY;
+    return FALSE;
+  }
+  if (seg->buffer != NULL) {
+    MEMCOPY(new_buffer, seg->buffer, used * SIZEOF(JOCTET));
+    jpeg_free_large((j_common_ptr) state->cinfo, (void FAR *) seg->buffer,
+		    seg->buffer_size * SIZEOF(JOCTET));
+  }
+  seg->buffer = new_buffer;
+  seg->buffer_size = new_size;
+  state->next_output_byte = new_buffer + used;
+  state->free_in_buffer = new_size - used;
+  return TRUE;
+}
+
+
 /* Emit a byte, taking 'action' if must suspend. */
 #define emit_byte(state,val,action)  \
 	{ *(state)->next_output_byte++ = (JOCTET) (val);  \
@@ -280,6 +332,9 @@ dump_buffer (working_state * state)
 {
   struct jpeg_destination_mgr * dest = state->cinfo->dest;
 
+  if (state->seg != NULL)
+    return grow_segment_buffer(state);
+
   if (! (*dest->empty_output_buffer) (state->cinfo))
     return FALSE;
   /* After a successful buffer dump, must reset buffer pointers */
@@ -308,7 +363,7 @@ emit_bits (working_state * state, unsigned int code, int size)
 
   /* if size is 0, caller used an invalid Huffman table entry */
   if (size == 0)
-    ERREXIT(state->cinfo, JERR_HUFF_MISSING_CODE);
+    CODING_ERREXIT(state, JERR_HUFF_MISSING_CODE);
 
   put_buffer &= (((INT32) 1)<<size) - 1; /* mask off any extra bits in code */
   
@@ -378,7 +433,7 @@ encode_one_block (working_state * state, JCOEFPTR block, int last_dc_val,
    * Since we're encoding a difference, the range limit is twice as much.
    */
   if (nbits > MAX_COEF_BITS+1)
-    ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
+    CODING_ERREXIT(state, JERR_BAD_DCT_COEF);
   
   /* Emit the Huffman-coded symbol for the number of bits */
   if (! emit_bits(state, dctbl->ehufco[nbits], dctbl->ehufsi[nbits]))
@@ -418,7 +473,7 @@ encode_one_block (working_state * state, JCOEFPTR block, int last_dc_val,
 	nbits++;
       /* Check for out-of-range coefficient values */
       if (nbits > MAX_COEF_BITS)
-	ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
+	CODING_ERREXIT(state, JERR_BAD_DCT_COEF);
       
       /* Emit Huffman symbol for run length / number of bits */
       i = (r << 4) + nbits;
@@ -485,6 +540,7 @@ encode_mcu_huff (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   state.free_in_buffer = cinfo->dest->free_in_buffer;
   ASSIGN_STATE(state.cur, entropy->saved);
   state.cinfo = cinfo;
+  state.seg = NULL;
 
   /* Emit restart marker if needed */
   if (cinfo->restart_interval) {
@@ -525,6 +581,91 @@ encode_mcu_huff (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
 }
 
 
+/*
+ * Encode one MCU of a restart segment into the segment's private buffer.
+ * The caller zeroes the segment before its first MCU.  No restart markers
+ * are emitted here; the caller puts them between the finished segments.
+ */
+
+METHODDEF(boolean)
+encode_segment_mcu_huff (j_compress_ptr cinfo, jpeg_c_segment * seg,
+			 JBLOCKROW *MCU_data)
+{
+  huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
+  working_state state;
+  int blkn, ci;
+  jpeg_component_info * compptr;
+
+  /* Load up working state */
+  state.next_output_byte = seg->buffer + seg->bytes_used;
+  state.free_in_buffer = seg->buffer_size - seg->bytes_used;
+  state.cur.put_buffer = seg->put_buffer;
+  state.cur.put_bits = seg->put_bits;
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++)
+    state.cur.last_dc_val[ci] = seg->last_dc_val[ci];
+  state.cinfo = cinfo;
+  state.seg = seg;
+
+  /* emit_byte assumes there is room for at least one byte */
+  if (state.free_in_buffer == 0)
+    if (! grow_segment_buffer(&state))
+      return FALSE;
+
+  /* Encode the MCU data blocks */
+  for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+    ci = cinfo->MCU_membership[blkn];
+    compptr = cinfo->cur_comp_info[ci];
+    if (! encode_one_block(&state,
+			   MCU_data[blkn][0], state.cur.last_dc_val[ci],
+			   entropy->dc_derived_tbls[compptr->dc_tbl_no],
+			   entropy->ac_derived_tbls[compptr->ac_tbl_no]))
+      return FALSE;
+    /* Update last_dc_val */
+    state.cur.last_dc_val[ci] = MCU_data[blkn][0][0];
+  }
+
+  /* Completed MCU, so update segment state */
+  seg->bytes_used = seg->buffer_size - state.free_in_buffer;
+  seg->put_buffer = state.cur.put_buffer;
+  seg->put_bits = state.cur.put_bits;
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++)
+    seg->last_dc_val[ci] = state.cur.last_dc_val[ci];
+
+  return TRUE;
+}
+
+
+/*
+ * Pad out the last byte of a restart segment, as emit_restart would.
+ */
+
+METHODDEF(boolean)
+finish_segment_huff (j_compress_ptr cinfo, jpeg_c_segment * seg)
+{
+  working_state state;
+
+  /* Load up working state ... flush_bits needs it */
+  state.next_output_byte = seg->buffer + seg->bytes_used;
+  state.free_in_buffer = seg->buffer_size - seg->bytes_used;
+  state.cur.put_buffer = seg->put_buffer;
+  state.cur.put_bits = seg->put_bits;
+  state.cinfo = cinfo;
+  state.seg = seg;
+
+  if (state.free_in_buffer == 0)
+    if (! grow_segment_buffer(&state))
+      return FALSE;
+
+  if (! flush_bits(&state))
+    return FALSE;
+
+  seg->bytes_used = seg->buffer_size - state.free_in_buffer;
+  seg->put_buffer = 0;
+  seg->put_bits = 0;
+  return TRUE;
+}
+
+
 /*
  * Finish up at the end of a Huffman-compressed scan.
  */
@@ -540,6 +681,7 @@ finish_pass_huff (j_compress_ptr cinfo)
   state.free_in_buffer = cinfo->dest->free_in_buffer;
   ASSIGN_STATE(state.cur, entropy->saved);
   state.cinfo = cinfo;
+  state.seg = NULL;
 
   /* Flush out the last data */
   if (! flush_bits(&state))
@@ -821,6 +821,9 @@ jinit_phuff_encoder (j_compress_ptr cinfo)
 				SIZEOF(phuff_entropy_encoder));
   cinfo->entropy = (struct jpeg_entropy_encoder *) entropy;
   entropy->pub.start_pass = start_pass_phuff;
+  /* Progressive scans can't be coded a restart segment at a time */
+  entropy->pub.encode_segment_mcu = NULL;
+  entropy->pub.finish_segment = NULL;
 
   /* Mark tables unallocated */
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
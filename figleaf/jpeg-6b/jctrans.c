@@ -13,6 +13,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jmemsys.h"		/* segment buffers come from jpeg_get_large */
 
 
 /* Forward declarations */
@@ -218,11 +219,23 @@ typedef struct {
 
   /* Workspace for constructing dummy blocks at right/bottom edges. */
   JBLOCKROW dummy_buffer[C_MAX_BLOCKS_IN_MCU];
+
+  boolean scan_done;		/* TRUE if the scan was coded all at once */
 } my_coef_controller;
 
 typedef my_coef_controller * my_coef_ptr;
 
 
+/* Shared state for coding the restart segments of a scan concurrently. */
+
+typedef struct {
+  j_compress_ptr cinfo;
+  JBLOCKARRAY buffer[MAX_COMPS_IN_SCAN]; /* all block rows of each component */
+  JDIMENSION total_MCUs;	/* # of MCUs in the scan */
+  jpeg_c_segment * segments;	/* one per restart interval */
+} segment_job;
+
+
 LOCAL(void)
 start_iMCU_row (j_compress_ptr cinfo)
 /* Reset within-iMCU-row counters for a new row */
@@ -260,10 +273,204 @@ start_pass_coef (j_compress_ptr cinfo, J_BUF_MODE pass_mode)
     ERREXIT(cinfo, JERR_BAD_BUFFER_MODE);
 
   coef->iMCU_row_num = 0;
+  coef->scan_done = FALSE;
   start_iMCU_row(cinfo);
 }
 
 
+/*
+ * Code one restart segment of the scan.  This runs on a task thread,
+ * so it must not touch any state except its own segment.
+ */
+
+METHODDEF(void)
+encode_segment_task (void * task_arg, int task_num)
+{
+  segment_job * job = (segment_job *) task_arg;
+  j_compress_ptr cinfo = job->cinfo;
+  jpeg_c_segment * seg = job->segments + task_num;
+  JDIMENSION MCU_num, MCU_row_num, MCU_col_num, block_row, end_MCU;
+  int blkn, ci, xindex, yindex;
+  JDIMENSION start_col;
+  JBLOCK dummy_blocks[C_MAX_BLOCKS_IN_MCU];
+  JBLOCKROW MCU_buffer[C_MAX_BLOCKS_IN_MCU];
+  JBLOCKROW buffer_ptr;
+  jpeg_component_info *compptr;
+
+  /* Dummy blocks need zeroed AC entries, as in transencode_coef_controller */
+  MEMZERO(dummy_blocks, SIZEOF(dummy_blocks));
+
+  MCU_num = (JDIMENSION) task_num * cinfo->restart_interval;
+  end_MCU = MCU_num + cinfo->restart_interval;
+  if (end_MCU > job->total_MCUs)
+    end_MCU = job->total_MCUs;
+
+  for (; MCU_num < end_MCU; MCU_num++) {
+    MCU_row_num = MCU_num / cinfo->MCUs_per_row;
+    MCU_col_num = MCU_num % cinfo->MCUs_per_row;
+    /* Construct list of pointers to DCT blocks belonging to this MCU,
+     * exactly as compress_output does.
+     */
+    blkn = 0;
+    for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+      compptr = cinfo->cur_comp_info[ci];
+      start_col = MCU_col_num * compptr->MCU_width;
+      for (yindex = 0; yindex < compptr->MCU_height; yindex++) {
+	block_row = MCU_row_num * compptr->MCU_height + yindex;
+	xindex = 0;
+	if (block_row < compptr->height_in_blocks) {
+	  buffer_ptr = job->buffer[ci][block_row] + start_col;
+	  for (; xindex < compptr->MCU_width &&
+		 start_col + xindex < compptr->width_in_blocks; xindex++)
+	    MCU_buffer[blkn++] = buffer_ptr++;
+	}
+	for (; xindex < compptr->MCU_width; xindex++) {
+	  MCU_buffer[blkn] = dummy_blocks + blkn;
+	  MCU_buffer[blkn][0][0] = MCU_buffer[blkn-1][0][0];
+	  blkn++;
+	}
+      }
+    }
+    if (! (*cinfo->entropy->encode_segment_mcu) (cinfo, seg, MCU_buffer))
+      return;
+  }
+  (void) (*cinfo->entropy->finish_segment) (cinfo, seg);
+}
+
+
+/*
+ * Release the private buffers of a set of coded segments.
+ */
+
+LOCAL(void)
+free_segments (j_compress_ptr cinfo, jpeg_c_segment * segments,
+	       int num_segments)
+{
+  int k;
+
+  for (k = 0; k < num_segments; k++) {
+    if (segments[k].buffer != NULL)
+      jpeg_free_large((j_common_ptr) cinfo, (void FAR *) segments[k].buffer,
+		      segments[k].buffer_size * SIZEOF(JOCTET));
+    segments[k].buffer = NULL;
+  }
+}
+
+
+/*
+ * Copy coded data to the destination, emptying its buffer as needed.
+ */
+
+LOCAL(void)
+emit_coded_data (j_compress_ptr cinfo, const JOCTET * data, size_t length)
+{
+  struct jpeg_destination_mgr * dest = cinfo->dest;
+  size_t count;
+
+  while (length > 0) {
+    count = MIN(length, dest->free_in_buffer);
+    MEMCOPY(dest->next_output_byte, data, count * SIZEOF(JOCTET));
+    dest->next_output_byte += count;
+    dest->free_in_buffer -= count;
+    data += count;
+    length -= count;
+    if (dest->free_in_buffer == 0)
+      if (! (*dest->empty_output_buffer) (cinfo))
+	ERREXIT(cinfo, JERR_CANT_SUSPEND);
+  }
+}
+
+
+/*
+ * Code the whole scan at once, handing each restart interval to the
+ * application's task executor and then writing the coded segments out in
+ * order with RSTn markers between them.  The result is byte-for-byte what
+ * compress_output would produce.  Returns FALSE if the coefficient arrays
+ * aren't entirely in memory, in which case the caller must code serially.
+ */
+
+LOCAL(boolean)
+compress_segments (j_compress_ptr cinfo)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  segment_job job;
+  JBLOCKARRAY buffer;
+  JDIMENSION iMCU_row;
+  JOCTET * coded;
+  size_t coded_size, pos;
+  int ci, k, num_segments, error_code;
+  jpeg_component_info *compptr;
+
+  /* The tasks need every block row of every component in the scan.
+   * Rather than copy them, we rely on the virtual arrays being fully
+   * memory-resident, in which case accessing any strip just hands back
+   * the array's own row pointers offset to that strip.
+   */
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+    compptr = cinfo->cur_comp_info[ci];
+    job.buffer[ci] = (*cinfo->mem->access_virt_barray)
+      ((j_common_ptr) cinfo, coef->whole_image[compptr->component_index],
+       (JDIMENSION) 0, (JDIMENSION) compptr->v_samp_factor, FALSE);
+    for (iMCU_row = 1; iMCU_row < cinfo->total_iMCU_rows; iMCU_row++) {
+      buffer = (*cinfo->mem->access_virt_barray)
+	((j_common_ptr) cinfo, coef->whole_image[compptr->component_index],
+	 iMCU_row * compptr->v_samp_factor,
+	 (JDIMENSION) compptr->v_samp_factor, FALSE);
+      if (buffer != job.buffer[ci] + iMCU_row * compptr->v_samp_factor)
+	return FALSE;
+    }
+  }
+
+  job.cinfo = cinfo;
+  job.total_MCUs = cinfo->MCUs_per_row * cinfo->MCU_rows_in_scan;
+  num_segments = (int) ((job.total_MCUs + cinfo->restart_interval - 1) /
+			cinfo->restart_interval);
+  job.segments = (jpeg_c_segment *)
+    (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				num_segments * SIZEOF(jpeg_c_segment));
+  MEMZERO(job.segments, num_segments * SIZEOF(jpeg_c_segment));
+
+  (*cinfo->parallel->run_tasks) ((j_common_ptr) cinfo, num_segments,
+				 encode_segment_task, (void *) &job);
+
+  /* Check for coding errors, freeing the segment buffers before we bail */
+  error_code = 0;
+  for (k = 0; k < num_segments; k++) {
+    if (job.segments[k].error_code != 0 && error_code == 0)
+      error_code = job.segments[k].error_code;
+  }
+  if (error_code != 0) {
+    free_segments(cinfo, job.segments, num_segments);
+    ERREXIT(cinfo, error_code);
+  }
+
+  /* Gather the segments into pool storage with restart markers in between,
+   * so that nothing is left to leak if the destination manager errors out.
+   */
+  coded_size = 0;
+  for (k = 0; k < num_segments; k++)
+    coded_size += job.segments[k].bytes_used + 2;
+  coded = (JOCTET *)
+    (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				coded_size * SIZEOF(JOCTET));
+  pos = 0;
+  for (k = 0; k < num_segments; k++) {
+    if (k > 0) {
+      coded[pos++] = 0xFF;
+      coded[pos++] = (JOCTET) (JPEG_RST0 + ((k - 1) & 7));
+    }
+    MEMCOPY(coded + pos, job.segments[k].buffer,
+	    job.segments[k].bytes_used * SIZEOF(JOCTET));
+    pos += job.segments[k].bytes_used;
+  }
+  free_segments(cinfo, job.segments, num_segments);
+
+  emit_coded_data(cinfo, coded, pos);
+
+  return TRUE;
+}
+
+
 /*
  * Process some data.
  * We process the equivalent of one fully interleaved MCU row ("iMCU" row)
@@ -288,6 +495,22 @@ compress_output (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
   JBLOCKROW buffer_ptr;
   jpeg_component_info *compptr;
 
+  /* If the application gave us a task executor and the scan has restart
+   * markers, we can code the restart segments concurrently.  That handles
+   * the whole scan on the first call; the remaining calls have no work.
+   */
+  if (coef->scan_done)
+    return TRUE;
+  if (cinfo->parallel != NULL && cinfo->restart_interval != 0 &&
+      cinfo->entropy->encode_segment_mcu != NULL &&
+      coef->iMCU_row_num == 0 && coef->mcu_ctr == 0 &&
+      coef->MCU_vert_offset == 0) {
+    if (compress_segments(cinfo)) {
+      coef->scan_done = TRUE;
+      return TRUE;
+    }
+  }
+
   /* Align the virtual buffers for the components used in this scan. */
   for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
     compptr = cinfo->cur_comp_info[ci];
@@ -251,6 +251,17 @@ consume_data (j_decompress_ptr cinfo)
   JBLOCKROW buffer_ptr;
   jpeg_component_info *compptr;
 
+  /* At the start of a scan, give the entropy decoder a chance to decode
+   * all of it at once (it can, given a task executor and restart markers).
+   */
+  if (cinfo->input_iMCU_row == 0 && coef->MCU_vert_offset == 0 &&
+      coef->MCU_ctr == 0 && cinfo->entropy->decode_scan != NULL &&
+      (*cinfo->entropy->decode_scan) (cinfo, coef->whole_image)) {
+    cinfo->input_iMCU_row = cinfo->total_iMCU_rows;
+    (*cinfo->inputctl->finish_input_pass) (cinfo);
+    return JPEG_SCAN_COMPLETED;
+  }
+
   /* Align the virtual buffers for the components used in this scan. */
   for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
     compptr = cinfo->cur_comp_info[ci];
@@ -298,17 +298,26 @@ jpeg_fill_bit_buffer (bitread_working_state * state,
   register const JOCTET * next_input_byte = state->next_input_byte;
   register size_t bytes_in_buffer = state->bytes_in_buffer;
   j_decompress_ptr cinfo = state->cinfo;
+  d_segment * seg = state->seg;
+  /* A segment's unread_marker stands in for the real one */
+  int * unread_marker = (seg != NULL) ? &seg->unread_marker
+				      : &cinfo->unread_marker;
 
   /* Attempt to load at least MIN_GET_BITS bits into get_buffer. */
   /* (It is assumed that no request will be for more than that many bits.) */
   /* We fail to do so only if we hit a marker or are forced to suspend. */
 
-  if (cinfo->unread_marker == 0) {	/* cannot advance past a marker */
+  if (*unread_marker == 0) {	/* cannot advance past a marker */
     while (bits_left < MIN_GET_BITS) {
       register int c;
 
       /* Attempt to read a byte */
       if (bytes_in_buffer == 0) {
+	if (seg != NULL) {
+	  /* The end of a segment's data is where its RSTn marker was */
+	  seg->unread_marker = JPEG_RST0;
+	  goto no_more_bytes;
+	}
 	if (! (*cinfo->src->fill_input_buffer) (cinfo))
 	  return FALSE;
 	next_input_byte = cinfo->src->next_input_byte;
@@ -326,6 +335,10 @@ jpeg_fill_bit_buffer (bitread_working_state * state,
 	 */
 	do {
 	  if (bytes_in_buffer == 0) {
+	    if (seg != NULL) {
+	      seg->unread_marker = JPEG_RST0;
+	      goto no_more_bytes;
+	    }
 	    if (! (*cinfo->src->fill_input_buffer) (cinfo))
 	      return FALSE;
 	    next_input_byte = cinfo->src->next_input_byte;
@@ -347,7 +360,7 @@ jpeg_fill_bit_buffer (bitread_working_state * state,
 	   * current MCU, because we will read no more bytes from the data
 	   * source.  So it is OK to update permanent state right away.
 	   */
-	  cinfo->unread_marker = c;
+	  *unread_marker = c;
 	  /* See if we need to insert some fake zero bits. */
 	  goto no_more_bytes;
 	}
@@ -369,7 +382,9 @@ jpeg_fill_bit_buffer (bitread_working_state * state,
        * We use a nonvolatile flag to ensure that only one warning message
        * appears per data segment.
        */
-      if (! cinfo->entropy->insufficient_data) {
+      if (seg != NULL) {
+	seg->insufficient_data = TRUE;	/* caller will warn */
+      } else if (! cinfo->entropy->insufficient_data) {
 	WARNMS(cinfo, JWRN_HIT_MARKER);
 	cinfo->entropy->insufficient_data = TRUE;
       }
@@ -425,7 +440,10 @@ jpeg_huff_decode (bitread_working_state * state,
   /* With garbage input we may reach the sentinel value l = 17. */
 
   if (l > 16) {
-    WARNMS(state->cinfo, JWRN_HUFF_BAD_CODE);
+    if (state->seg != NULL)
+      state->seg->bad_code = TRUE;	/* caller will warn */
+    else
+      WARNMS(state->cinfo, JWRN_HUFF_BAD_CODE);
     return 0;			/* fake a zero as the safest result */
   }
 
@@ -498,6 +516,105 @@ process_restart (j_decompress_ptr cinfo)
 }
 
 
+/*
+ * Decode one MCU's worth of Huffman-compressed coefficients, using and
+ * updating the given bitread and DC-prediction state.
+ * Returns FALSE if data source requested suspension.
+ */
+
+LOCAL(boolean)
+decode_mcu_blocks (j_decompress_ptr cinfo, bitread_working_state * br,
+		   savable_state * state, JBLOCKROW *MCU_data)
+{
+  huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
+  register bit_buf_type get_buffer = br->get_buffer;
+  register int bits_left = br->bits_left;
+  int blkn;
+
+  /* Outer loop handles each block in the MCU */
+
+  for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+    JBLOCKROW block = MCU_data[blkn];
+    d_derived_tbl * dctbl = entropy->dc_cur_tbls[blkn];
+    d_derived_tbl * actbl = entropy->ac_cur_tbls[blkn];
+    register int s, k, r;
+
+    /* Decode a single block's worth of coefficients */
+
+    /* Section F.2.2.1: decode the DC coefficient difference */
+    HUFF_DECODE(s, (*br), dctbl, return FALSE, label1);
+    if (s) {
+      CHECK_BIT_BUFFER((*br), s, return FALSE);
+      r = GET_BITS(s);
+      s = HUFF_EXTEND(r, s);
+    }
+
+    if (entropy->dc_needed[blkn]) {
+      /* Convert DC difference to actual value, update last_dc_val */
+      int ci = cinfo->MCU_membership[blkn];
+      s += state->last_dc_val[ci];
+      state->last_dc_val[ci] = s;
+      /* Output the DC coefficient (assumes jpeg_natural_order[0] = 0) */
+      (*block)[0] = (JCOEF) s;
+    }
+
+    if (entropy->ac_needed[blkn]) {
+
+      /* Section F.2.2.2: decode the AC coefficients */
+      /* Since zeroes are skipped, output area must be cleared beforehand */
+      for (k = 1; k < DCTSIZE2; k++) {
+	HUFF_DECODE(s, (*br), actbl, return FALSE, label2);
+
+	r = s >> 4;
+	s &= 15;
+
+	if (s) {
+	  k += r;
+	  CHECK_BIT_BUFFER((*br), s, return FALSE);
+	  r = GET_BITS(s);
+	  s = HUFF_EXTEND(r, s);
+	  /* Output coefficient in natural (dezigzagged) order.
+	   * Note: the extra entries in jpeg_natural_order[] will save us
+	   * if k >= DCTSIZE2, which could happen if the data is corrupted.
+	   */
+	  (*block)[jpeg_natural_order[k]] = (JCOEF) s;
+	} else {
+	  if (r != 15)
+	    break;
+	  k += 15;
+	}
+      }
+
+    } else {
+
+      /* Section F.2.2.2: decode the AC coefficients */
+      /* In this path we just discard the values */
+      for (k = 1; k < DCTSIZE2; k++) {
+	HUFF_DECODE(s, (*br), actbl, return FALSE, label3);
+
+	r = s >> 4;
+	s &= 15;
+
+	if (s) {
+	  k += r;
+	  CHECK_BIT_BUFFER((*br), s, return FALSE);
+	  DROP_BITS(s);
+	} else {
+	  if (r != 15)
+	    break;
+	  k += 15;
+	}
+      }
+
+    }
+  }
+
+  br->get_buffer = get_buffer;
+  br->bits_left = bits_left;
+  return TRUE;
+}
+
+
 /*
  * Decode and return one MCU's worth of Huffman-compressed coefficients.
  * The coefficients are reordered from zigzag order into natural array order,
@@ -517,8 +634,7 @@ METHODDEF(boolean)
 decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 {
   huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
-  int blkn;
-  BITREAD_STATE_VARS;
+  bitread_working_state br_state;
   savable_state state;
 
   /* Process restart marker if needed; may have to suspend */
@@ -534,95 +650,293 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   if (! entropy->pub.insufficient_data) {
 
     /* Load up working state */
-    BITREAD_LOAD_STATE(cinfo,entropy->bitstate);
+    br_state.cinfo = cinfo;
+    br_state.seg = NULL;
+    br_state.next_input_byte = cinfo->src->next_input_byte;
+    br_state.bytes_in_buffer = cinfo->src->bytes_in_buffer;
+    br_state.get_buffer = entropy->bitstate.get_buffer;
+    br_state.bits_left = entropy->bitstate.bits_left;
     ASSIGN_STATE(state, entropy->saved);
 
-    /* Outer loop handles each block in the MCU */
+    if (! decode_mcu_blocks(cinfo, &br_state, &state, MCU_data))
+      return FALSE;
 
-    for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
-      JBLOCKROW block = MCU_data[blkn];
-      d_derived_tbl * dctbl = entropy->dc_cur_tbls[blkn];
-      d_derived_tbl * actbl = entropy->ac_cur_tbls[blkn];
-      register int s, k, r;
+    /* Completed MCU, so update state */
+    cinfo->src->next_input_byte = br_state.next_input_byte;
+    cinfo->src->bytes_in_buffer = br_state.bytes_in_buffer;
+    entropy->bitstate.get_buffer = br_state.get_buffer;
+    entropy->bitstate.bits_left = br_state.bits_left;
+    ASSIGN_STATE(entropy->saved, state);
+  }
 
-      /* Decode a single block's worth of coefficients */
+  /* Account for restart interval (no-op if not using restarts) */
+  entropy->restarts_to_go--;
 
-      /* Section F.2.2.1: decode the DC coefficient difference */
-      HUFF_DECODE(s, br_state, dctbl, return FALSE, label1);
-      if (s) {
-	CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	r = GET_BITS(s);
-	s = HUFF_EXTEND(r, s);
-      }
+  return TRUE;
+}
 
-      if (entropy->dc_needed[blkn]) {
-	/* Convert DC difference to actual value, update last_dc_val */
-	int ci = cinfo->MCU_membership[blkn];
-	s += state.last_dc_val[ci];
-	state.last_dc_val[ci] = s;
-	/* Output the DC coefficient (assumes jpeg_natural_order[0] = 0) */
-	(*block)[0] = (JCOEF) s;
-      }
 
-      if (entropy->ac_needed[blkn]) {
-
-	/* Section F.2.2.2: decode the AC coefficients */
-	/* Since zeroes are skipped, output area must be cleared beforehand */
-	for (k = 1; k < DCTSIZE2; k++) {
-	  HUFF_DECODE(s, br_state, actbl, return FALSE, label2);
-      
-	  r = s >> 4;
-	  s &= 15;
-      
-	  if (s) {
-	    k += r;
-	    CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	    r = GET_BITS(s);
-	    s = HUFF_EXTEND(r, s);
-	    /* Output coefficient in natural (dezigzagged) order.
-	     * Note: the extra entries in jpeg_natural_order[] will save us
-	     * if k >= DCTSIZE2, which could happen if the data is corrupted.
-	     */
-	    (*block)[jpeg_natural_order[k]] = (JCOEF) s;
-	  } else {
-	    if (r != 15)
-	      break;
-	    k += 15;
-	  }
-	}
+/*
+ * Decoding a whole scan at once, split at its restart markers.
+ *
+ * When the application supplies a task executor, the coefficient controller
+ * offers us each scan before decoding it MCU by MCU.  We read the rest of the
+ * scan into memory, find the restart markers, and decode the segments
+ * between them concurrently.  Each segment starts with empty bit buffer and
+ * zero DC predictions, so the result is exactly what decode_mcu would give.
+ * If the markers aren't all present and in sequence, the data is corrupt;
+ * then we run the in-memory copy through decode_mcu instead, so that the
+ * usual resynchronization logic deals with it.
+ */
 
-      } else {
-
-	/* Section F.2.2.2: decode the AC coefficients */
-	/* In this path we just discard the values */
-	for (k = 1; k < DCTSIZE2; k++) {
-	  HUFF_DECODE(s, br_state, actbl, return FALSE, label3);
-      
-	  r = s >> 4;
-	  s &= 15;
-      
-	  if (s) {
-	    k += r;
-	    CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	    DROP_BITS(s);
-	  } else {
-	    if (r != 15)
-	      break;
-	    k += 15;
-	  }
-	}
+typedef struct {
+  j_decompress_ptr cinfo;
+  JBLOCKARRAY buffer[MAX_COMPS_IN_SCAN]; /* all block rows of each component */
+  JDIMENSION total_MCUs;	/* # of MCUs in the scan */
+  d_segment * segments;		/* one per restart interval */
+} segment_job;
 
-      }
+
+/* Build the list of pointers to DCT blocks belonging to an MCU,
+ * the same way jdcoefct.c's consume_data does.
+ */
+
+LOCAL(void)
+locate_mcu_blocks (segment_job * job, JDIMENSION MCU_num, JBLOCKROW *MCU_data)
+{
+  j_decompress_ptr cinfo = job->cinfo;
+  JDIMENSION MCU_row_num = MCU_num / cinfo->MCUs_per_row;
+  JDIMENSION start_col;
+  int blkn, ci, xindex, yindex;
+  JBLOCKROW buffer_ptr;
+  jpeg_component_info *compptr;
+
+  blkn = 0;
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+    compptr = cinfo->cur_comp_info[ci];
+    start_col = (MCU_num % cinfo->MCUs_per_row) * compptr->MCU_width;
+    for (yindex = 0; yindex < compptr->MCU_height; yindex++) {
+      buffer_ptr = job->buffer[ci][MCU_row_num * compptr->MCU_height + yindex]
+	+ start_col;
+      for (xindex = 0; xindex < compptr->MCU_width; xindex++)
+	MCU_data[blkn++] = buffer_ptr++;
     }
+  }
+}
 
-    /* Completed MCU, so update state */
-    BITREAD_SAVE_STATE(cinfo,entropy->bitstate);
-    ASSIGN_STATE(entropy->saved, state);
+
+/* Decode one restart segment.  This runs on a task thread. */
+
+METHODDEF(void)
+decode_segment_task (void * task_arg, int task_num)
+{
+  segment_job * job = (segment_job *) task_arg;
+  j_decompress_ptr cinfo = job->cinfo;
+  d_segment * seg = job->segments + task_num;
+  JDIMENSION MCU_num, end_MCU;
+  JBLOCKROW MCU_data[D_MAX_BLOCKS_IN_MCU];
+  bitread_working_state br_state;
+  savable_state state;
+  int ci;
+
+  br_state.cinfo = cinfo;
+  br_state.seg = seg;
+  br_state.next_input_byte = seg->data;
+  br_state.bytes_in_buffer = seg->length;
+  br_state.get_buffer = 0;
+  br_state.bits_left = 0;
+  for (ci = 0; ci < MAX_COMPS_IN_SCAN; ci++)
+    state.last_dc_val[ci] = 0;
+
+  MCU_num = (JDIMENSION) task_num * cinfo->restart_interval;
+  end_MCU = MCU_num + cinfo->restart_interval;
+  if (end_MCU > job->total_MCUs)
+    end_MCU = job->total_MCUs;
+
+  /* As in decode_mcu, once the data runs out the rest stays zero */
+  for (; MCU_num < end_MCU && ! seg->insufficient_data; MCU_num++) {
+    locate_mcu_blocks(job, MCU_num, MCU_data);
+    (void) decode_mcu_blocks(cinfo, &br_state, &state, MCU_data);
   }
+}
+
+
+/* Split the entropy-coded data of a scan at its restart markers.
+ * Returns FALSE unless there are exactly the expected number of markers,
+ * numbered in sequence.
+ */
+
+LOCAL(boolean)
+split_segments (j_decompress_ptr cinfo, const JOCTET * data, size_t length,
+		d_segment * segments, int num_segments)
+{
+  size_t pos, start, marker;
+  int k, c;
+
+  k = 0;
+  start = 0;
+  pos = 0;
+  while (pos < length) {
+    if (GETJOCTET(data[pos]) != 0xFF) {
+      pos++;
+      continue;
+    }
+    /* Skip any fill bytes; FF/00 is just stuffing for an FF data byte */
+    marker = pos;
+    do {
+      pos++;
+    } while (pos < length && GETJOCTET(data[pos]) == 0xFF);
+    if (pos >= length)
+      break;
+    c = GETJOCTET(data[pos++]);
+    if (c == 0)
+      continue;
+    if (k + 1 >= num_segments || c != JPEG_RST0 + (k & 7))
+      return FALSE;
+    segments[k].data = data + start;
+    segments[k].length = marker - start;
+    k++;
+    start = pos;
+  }
+  if (k + 1 != num_segments)
+    return FALSE;
+  segments[k].data = data + start;
+  segments[k].length = length - start;
+  return TRUE;
+}
 
-  /* Account for restart interval (no-op if not using restarts) */
-  entropy->restarts_to_go--;
 
+METHODDEF(boolean)
+decode_scan (j_decompress_ptr cinfo, jvirt_barray_ptr * coef_arrays)
+{
+  huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
+  struct jpeg_source_mgr * src = cinfo->src;
+  segment_job job;
+  JBLOCKARRAY buffer;
+  JDIMENSION iMCU_row, MCU_num;
+  JBLOCKROW MCU_data[D_MAX_BLOCKS_IN_MCU];
+  JOCTET * data, * new_data;
+  size_t data_size, data_alloc, count, end_of_data;
+  const JOCTET * saved_next_input_byte;
+  size_t saved_bytes_in_buffer;
+  boolean in_marker;
+  int ci, k, c, num_segments, end_marker;
+  jpeg_component_info *compptr;
+
+  if (cinfo->parallel == NULL || cinfo->restart_interval == 0 ||
+      cinfo->unread_marker != 0 || entropy->bitstate.bits_left != 0)
+    return FALSE;
+
+  /* The tasks need every block row of every component in the scan.
+   * As in jctrans.c, we use the arrays' own row pointers, which works
+   * only if the arrays are entirely in memory.  Accessing each strip
+   * here also takes care of pre-zeroing the whole array.
+   */
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+    compptr = cinfo->cur_comp_info[ci];
+    job.buffer[ci] = (*cinfo->mem->access_virt_barray)
+      ((j_common_ptr) cinfo, coef_arrays[compptr->component_index],
+       (JDIMENSION) 0, (JDIMENSION) compptr->v_samp_factor, TRUE);
+    for (iMCU_row = 1; iMCU_row < cinfo->total_iMCU_rows; iMCU_row++) {
+      buffer = (*cinfo->mem->access_virt_barray)
+	((j_common_ptr) cinfo, coef_arrays[compptr->component_index],
+	 iMCU_row * compptr->v_samp_factor,
+	 (JDIMENSION) compptr->v_samp_factor, TRUE);
+      if (buffer != job.buffer[ci] + iMCU_row * compptr->v_samp_factor)
+	return FALSE;
+    }
+  }
+
+  /* Read the rest of the scan, up to and including the code byte of the
+   * marker that ends it.  We can't back up in the data source afterwards,
+   * so a suspending source can't be used with a task executor.
+   */
+  data = NULL;
+  data_size = data_alloc = 0;
+  end_of_data = 0;
+  end_marker = 0;
+  in_marker = FALSE;
+  while (end_marker == 0) {
+    if (src->bytes_in_buffer == 0)
+      if (! (*src->fill_input_buffer) (cinfo))
+	ERREXIT(cinfo, JERR_CANT_SUSPEND);
+    for (count = 0; count < src->bytes_in_buffer; count++) {
+      c = GETJOCTET(src->next_input_byte[count]);
+      if (in_marker) {
+	if (c == 0xFF)
+	  continue;		/* fill byte */
+	in_marker = FALSE;
+	if (c == 0 || (c >= JPEG_RST0 && c <= JPEG_RST0 + 7))
+	  continue;		/* stuffed zero or restart marker */
+	end_marker = c;
+	count++;
+	break;
+      } else if (c == 0xFF) {
+	in_marker = TRUE;
+	end_of_data = data_size + count;
+      }
+    }
+    if (data_size + count > data_alloc) {
+      data_alloc = MAX(data_alloc * 2, data_size + count);
+      data_alloc = MAX(data_alloc, 65536);
+      new_data = (JOCTET *)
+	(*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				    data_alloc * SIZEOF(JOCTET));
+      if (data_size > 0)
+	MEMCOPY(new_data, data, data_size * SIZEOF(JOCTET));
+      data = new_data;
+    }
+    MEMCOPY(data + data_size, src->next_input_byte, count * SIZEOF(JOCTET));
+    data_size += count;
+    src->next_input_byte += count;
+    src->bytes_in_buffer -= count;
+  }
+
+  job.cinfo = cinfo;
+  job.total_MCUs = cinfo->MCUs_per_row * cinfo->MCU_rows_in_scan;
+  num_segments = (int) ((job.total_MCUs + cinfo->restart_interval - 1) /
+			cinfo->restart_interval);
+  job.segments = (d_segment *)
+    (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				num_segments * SIZEOF(d_segment));
+  MEMZERO(job.segments, num_segments * SIZEOF(d_segment));
+
+  if (split_segments(cinfo, data, end_of_data, job.segments, num_segments)) {
+    (*cinfo->parallel->run_tasks) ((j_common_ptr) cinfo, num_segments,
+				   decode_segment_task, (void *) &job);
+    /* Report any trouble the segments ran into, once per scan */
+    for (k = 0; k < num_segments; k++) {
+      if (job.segments[k].insufficient_data) {
+	WARNMS(cinfo, JWRN_HIT_MARKER);
+	break;
+      }
+    }
+    for (k = 0; k < num_segments; k++) {
+      if (job.segments[k].bad_code) {
+	WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
+	break;
+      }
+    }
+  } else {
+    /* Decode our copy of the scan the ordinary way.  It ends with the
+     * terminating marker, so the bit reader will never need to refill.
+     */
+    saved_next_input_byte = src->next_input_byte;
+    saved_bytes_in_buffer = src->bytes_in_buffer;
+    src->next_input_byte = data;
+    src->bytes_in_buffer = data_size;
+    for (MCU_num = 0; MCU_num < job.total_MCUs; MCU_num++) {
+      locate_mcu_blocks(&job, MCU_num, MCU_data);
+      if (! (*entropy->pub.decode_mcu) (cinfo, MCU_data))
+	ERREXIT(cinfo, JERR_CANT_SUSPEND);
+    }
+    src->next_input_byte = saved_next_input_byte;
+    src->bytes_in_buffer = saved_bytes_in_buffer;
+  }
+
+  /* We've consumed the marker that ends the scan; leave it for jdmarker.c */
+  cinfo->unread_marker = end_marker;
+  entropy->bitstate.bits_left = 0;
   return TRUE;
 }
 
@@ -643,6 +957,7 @@ jinit_huff_decoder (j_decompress_ptr cinfo)
   cinfo->entropy = (struct jpeg_entropy_decoder *) entropy;
   entropy->pub.start_pass = start_pass_huff_decoder;
   entropy->pub.decode_mcu = decode_mcu;
+  entropy->pub.decode_scan = decode_scan;
 
   /* Mark tables unallocated */
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
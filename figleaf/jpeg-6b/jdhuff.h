@@ -84,6 +84,14 @@ typedef struct {		/* Bitreading state saved across MCUs */
   int bits_left;		/* # of unused bits in it */
 } bitread_perm_state;
 
+typedef struct {		/* Restart segment being decoded from memory */
+  const JOCTET * data;		/* entropy-coded data, not including RSTn */
+  size_t length;		/* # of bytes of data */
+  int unread_marker;		/* nonzero once we've run off the end */
+  boolean insufficient_data;	/* TRUE if the data ran out early */
+  boolean bad_code;		/* TRUE if we saw an invalid Huffman code */
+} d_segment;
+
 typedef struct {		/* Bitreading working state within an MCU */
   /* Current data source location */
   /* We need a copy, rather than munging the original, in case of suspension */
@@ -96,6 +104,11 @@ typedef struct {		/* Bitreading working state within an MCU */
   int bits_left;		/* # of unused bits in it */
   /* Pointer needed by jpeg_fill_bit_buffer. */
   j_decompress_ptr cinfo;	/* back link to decompress master record */
+  /* When decoding a restart segment on a task thread, all reads come from
+   * the segment's data, and anything that would otherwise be reported to
+   * cinfo is noted in the segment instead.  NULL for normal decoding.
+   */
+  d_segment * seg;
 } bitread_working_state;
 
 /* Macros to declare and load/save bitread local variables. */
@@ -106,6 +119,7 @@ typedef struct {		/* Bitreading working state within an MCU */
 
 #define BITREAD_LOAD_STATE(cinfop,permstate)  \
 	br_state.cinfo = cinfop; \
+	br_state.seg = NULL; \
 	br_state.next_input_byte = cinfop->src->next_input_byte; \
 	br_state.bytes_in_buffer = cinfop->src->bytes_in_buffer; \
 	get_buffer = permstate.get_buffer; \
@@ -74,6 +74,25 @@ extern char * getenv JPP((const char * name));
 #endif
 
 
+/*
+ * When the IMAGE pool is released (by jpeg_abort, jpeg_finish_compress or
+ * jpeg_finish_decompress), its large pools are not handed back to the system
+ * but kept on a spare list, up to max_spare_space bytes (MAX_SPARE_SPACE
+ * unless the application changes it).  The next image processed with the
+ * same JPEG object then takes its coefficient and sample buffers from the
+ * spare list instead of from jpeg_get_large().  This makes a difference for
+ * applications that run many small images through one persistent JPEG
+ * object, where the per-image malloc/free traffic is a noticeable fraction
+ * of the total work.  The spare list is released by jpeg_destroy, or
+ * earlier by jpeg_release_spare.  Set max_spare_space (or define
+ * MAX_SPARE_SPACE) to 0 to get the old behavior.
+ */
+
+#ifndef MAX_SPARE_SPACE		/* so can override from jconfig.h */
+#define MAX_SPARE_SPACE  64000000L
+#endif
+
+
 /*
  * We allocate objects from "pools", where each pool is gotten with a single
  * request to jpeg_get_small() or jpeg_get_large().  There is no per-object
@@ -128,6 +147,10 @@ typedef struct {
   jvirt_sarray_ptr virt_sarray_list;
   jvirt_barray_ptr virt_barray_list;
 
+  /* Large pools released from the IMAGE pool, kept for reuse */
+  large_pool_ptr spare_large_list;
+  long spare_space;		/* total size of the spare pools */
+
   /* This counts total space obtained from jpeg_get_small/large */
   long total_space_allocated;
 
@@ -338,6 +361,39 @@ alloc_small (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
  * deliberately bunch rows together to ensure a large request size.
  */
 
+LOCAL(large_pool_ptr)
+take_spare_large (my_mem_ptr mem, size_t sizeofobject)
+/* Unlink and return the best-fitting spare large pool, or NULL if none fits */
+{
+  large_pool_ptr hdr_ptr, prev_hdr_ptr;
+  large_pool_ptr best_ptr = NULL, best_prev_ptr = NULL;
+  size_t space, best_space = 0;
+
+  prev_hdr_ptr = NULL;
+  for (hdr_ptr = mem->spare_large_list; hdr_ptr != NULL;
+       hdr_ptr = hdr_ptr->hdr.next) {
+    space = hdr_ptr->hdr.bytes_used + hdr_ptr->hdr.bytes_left;
+    if (space >= sizeofobject && (best_ptr == NULL || space < best_space)) {
+      best_ptr = hdr_ptr;
+      best_prev_ptr = prev_hdr_ptr;
+      best_space = space;
+      if (space == sizeofobject)
+	break;			/* can't do better than an exact fit */
+    }
+    prev_hdr_ptr = hdr_ptr;
+  }
+
+  if (best_ptr != NULL) {
+    if (best_prev_ptr == NULL)
+      mem->spare_large_list = best_ptr->hdr.next;
+    else
+      best_prev_ptr->hdr.next = best_ptr->hdr.next;
+    mem->spare_space -= best_space + SIZEOF(large_pool_hdr);
+  }
+  return best_ptr;
+}
+
+
 METHODDEF(void FAR *)
 alloc_large (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
 /* Allocate a "large" object */
@@ -359,11 +415,20 @@ alloc_large (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
   if (pool_id < 0 || pool_id >= JPOOL_NUMPOOLS)
     ERREXIT1(cinfo, JERR_BAD_POOL_ID, pool_id);	/* safety check */
 
-  hdr_ptr = (large_pool_ptr) jpeg_get_large(cinfo, sizeofobject +
-					    SIZEOF(large_pool_hdr));
-  if (hdr_ptr == NULL)
-    out_of_memory(cinfo, 4);	/* jpeg_get_large failed */
-  mem->total_space_allocated += sizeofobject + SIZEOF(large_pool_hdr);
+  /* Reuse the smallest spare pool that is big enough, if there is one */
+  hdr_ptr = take_spare_large(mem, sizeofobject);
+
+  if (hdr_ptr == NULL) {
+    hdr_ptr = (large_pool_ptr) jpeg_get_large(cinfo, sizeofobject +
+					      SIZEOF(large_pool_hdr));
+    if (hdr_ptr == NULL)
+      out_of_memory(cinfo, 4);	/* jpeg_get_large failed */
+    mem->total_space_allocated += sizeofobject + SIZEOF(large_pool_hdr);
+    hdr_ptr->hdr.bytes_left = 0;
+  } else {
+    /* A spare pool may be bigger than we need; keep its true size */
+    hdr_ptr->hdr.bytes_left += hdr_ptr->hdr.bytes_used - sizeofobject;
+  }
 
   /* Success, initialize the new pool header and add to list */
   hdr_ptr->hdr.next = mem->large_list[pool_id];
@@ -371,7 +436,6 @@ alloc_large (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
    * even though they are not needed for allocation.
    */
   hdr_ptr->hdr.bytes_used = sizeofobject;
-  hdr_ptr->hdr.bytes_left = 0;
   mem->large_list[pool_id] = hdr_ptr;
 
   return (void FAR *) (hdr_ptr + 1); /* point to first data byte in pool */
@@ -972,8 +1036,16 @@ free_pool (j_common_ptr cinfo, int pool_id)
     space_freed = lhdr_ptr->hdr.bytes_used +
 		  lhdr_ptr->hdr.bytes_left +
 		  SIZEOF(large_pool_hdr);
-    jpeg_free_large(cinfo, (void FAR *) lhdr_ptr, space_freed);
-    mem->total_space_allocated -= space_freed;
+    if (pool_id == JPOOL_IMAGE &&
+	mem->spare_space + (long) space_freed <= mem->pub.max_spare_space) {
+      /* Keep it around for the next image */
+      lhdr_ptr->hdr.next = mem->spare_large_list;
+      mem->spare_large_list = lhdr_ptr;
+      mem->spare_space += (long) space_freed;
+    } else {
+      jpeg_free_large(cinfo, (void FAR *) lhdr_ptr, space_freed);
+      mem->total_space_allocated -= space_freed;
+    }
     lhdr_ptr = next_lhdr_ptr;
   }
 
@@ -993,6 +1065,46 @@ free_pool (j_common_ptr cinfo, int pool_id)
 }
 
 
+/*
+ * Release the spare large pools back to the system.
+ */
+
+LOCAL(void)
+free_spare_large (j_common_ptr cinfo)
+{
+  my_mem_ptr mem = (my_mem_ptr) cinfo->mem;
+  large_pool_ptr lhdr_ptr;
+  size_t space_freed;
+
+  lhdr_ptr = mem->spare_large_list;
+  mem->spare_large_list = NULL;
+
+  while (lhdr_ptr != NULL) {
+    large_pool_ptr next_lhdr_ptr = lhdr_ptr->hdr.next;
+    space_freed = lhdr_ptr->hdr.bytes_used +
+		  lhdr_ptr->hdr.bytes_left +
+		  SIZEOF(large_pool_hdr);
+    jpeg_free_large(cinfo, (void FAR *) lhdr_ptr, space_freed);
+    mem->total_space_allocated -= space_freed;
+    lhdr_ptr = next_lhdr_ptr;
+  }
+  mem->spare_space = 0;
+}
+
+
+/*
+ * Application-callable release of the spare large pools, for callers that
+ * keep a JPEG object around but want its memory back between images.
+ */
+
+GLOBAL(void)
+jpeg_release_spare (j_common_ptr cinfo)
+{
+  if (cinfo->mem != NULL)
+    free_spare_large(cinfo);
+}
+
+
 /*
  * Close up shop entirely.
  * Note that this cannot be called unless cinfo->mem is non-NULL.
@@ -1011,6 +1123,9 @@ self_destruct (j_common_ptr cinfo)
     free_pool(cinfo, pool);
   }
 
+  /* Release the spare large pools kept by free_pool */
+  free_spare_large(cinfo);
+
   /* Release the memory manager control block too. */
   jpeg_free_small(cinfo, (void *) cinfo->mem, SIZEOF(my_memory_mgr));
   cinfo->mem = NULL;		/* ensures I will be called only once */
@@ -1078,6 +1193,7 @@ jinit_memory_mgr (j_common_ptr cinfo)
 
   /* Make MAX_ALLOC_CHUNK accessible to other modules */
   mem->pub.max_alloc_chunk = MAX_ALLOC_CHUNK;
+  mem->pub.max_spare_space = MAX_SPARE_SPACE;
 
   /* Initialize working state */
   mem->pub.max_memory_to_use = max_to_use;
@@ -1088,6 +1204,8 @@ jinit_memory_mgr (j_common_ptr cinfo)
   }
   mem->virt_sarray_list = NULL;
   mem->virt_barray_list = NULL;
+  mem->spare_large_list = NULL;
+  mem->spare_space = 0;
 
   mem->total_space_allocated = SIZEOF(my_memory_mgr);
 
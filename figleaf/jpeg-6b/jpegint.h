@@ -109,11 +109,35 @@ struct jpeg_forward_dct {
 			      JDIMENSION num_blocks));
 };
 
+/* Restart segment being entropy-coded into a private buffer.
+ * The transcoder uses these to code the restart intervals of a scan
+ * concurrently (see jpeg_parallel_mgr); the segments are then written
+ * out in order with RSTn markers between them.
+ */
+typedef struct {
+  JOCTET * buffer;		/* coded data, from jpeg_get_large (or NULL) */
+  size_t bytes_used;		/* # of bytes of coded data in buffer */
+  size_t buffer_size;		/* allocated size of buffer */
+  INT32 put_buffer;		/* current bit-accumulation buffer */
+  int put_bits;			/* # of bits now in it */
+  int last_dc_val[MAX_COMPS_IN_SCAN]; /* last DC coef for each component */
+  int error_code;		/* JERR_xxx code if coding failed, else 0 */
+} jpeg_c_segment;
+
 /* Entropy encoding */
 struct jpeg_entropy_encoder {
   JMETHOD(void, start_pass, (j_compress_ptr cinfo, boolean gather_statistics));
   JMETHOD(boolean, encode_mcu, (j_compress_ptr cinfo, JBLOCKROW *MCU_data));
   JMETHOD(void, finish_pass, (j_compress_ptr cinfo));
+  /* Restart segment coding; NULL if the current pass can't do it.
+   * These may be called concurrently for different segments, and report
+   * failure through seg->error_code rather than the error handler.
+   */
+  JMETHOD(boolean, encode_segment_mcu, (j_compress_ptr cinfo,
+					jpeg_c_segment * seg,
+					JBLOCKROW *MCU_data));
+  JMETHOD(boolean, finish_segment, (j_compress_ptr cinfo,
+				    jpeg_c_segment * seg));
 };
 
 /* Marker writing */
@@ -210,6 +234,12 @@ struct jpeg_entropy_decoder {
   JMETHOD(void, start_pass, (j_decompress_ptr cinfo));
   JMETHOD(boolean, decode_mcu, (j_decompress_ptr cinfo,
 				JBLOCKROW *MCU_data));
+  /* Decode a whole scan into the coefficient arrays at once, if possible
+   * (NULL if never possible).  Returns FALSE, having consumed nothing, if
+   * the caller must fall back to MCU-at-a-time decoding.
+   */
+  JMETHOD(boolean, decode_scan, (j_decompress_ptr cinfo,
+				 jvirt_barray_ptr * coef_arrays));
 
   /* This is here to share code between baseline and progressive decoders; */
   /* other modules probably should not use it */
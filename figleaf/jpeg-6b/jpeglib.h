@@ -242,6 +242,7 @@ typedef enum {
   struct jpeg_error_mgr * err;	/* Error handler module */\
   struct jpeg_memory_mgr * mem;	/* Memory manager module */\
   struct jpeg_progress_mgr * progress; /* Progress monitor, or NULL if none */\
+  struct jpeg_parallel_mgr * parallel; /* Task executor, or NULL if none */\
   void * client_data;		/* Available for use by application */\
   boolean is_decompressor;	/* So common code can tell which is which */\
   int global_state		/* For checking call sequence validity */
@@ -323,6 +324,8 @@ struct jpeg_compress_struct {
   boolean CCIR601_sampling;	/* TRUE=first samples are cosited */
   int smoothing_factor;		/* 1..100, or 0 for no input smoothing */
   J_DCT_METHOD dct_method;	/* DCT algorithm selector */
+  boolean fdct_unquantized;	/* TRUE=store FDCT outputs (x8) unquantized */
+				/* (JDCT_ISLOW only; not for entropy coding) */
 
   /* The restart interval can be specified in absolute MCUs by setting
    * restart_interval, or in MCU rows by setting restart_in_rows
@@ -708,6 +711,27 @@ struct jpeg_progress_mgr {
 };
 
 
+/* Parallel task executor object.
+ * If the application supplies one, the entropy coders split scans that
+ * have a restart interval into their restart segments and hand the
+ * segments to run_tasks, which must call task(task_arg, i) once for each
+ * i in 0..num_tasks-1 (in any order, on any threads) and return only when
+ * all of them have finished.  The tasks never call back into the error
+ * handler or memory manager, so they are safe to run concurrently.
+ * The decompressor reads a whole scan ahead to find its restart markers,
+ * so it can't use an executor together with a suspending data source.
+ */
+
+typedef JMETHOD(void, jpeg_task_ptr, (void * task_arg, int task_num));
+
+struct jpeg_parallel_mgr {
+  JMETHOD(void, run_tasks, (j_common_ptr cinfo, int num_tasks,
+			    jpeg_task_ptr task, void * task_arg));
+
+  int max_threads;		/* number of tasks that can run at once */
+};
+
+
 /* Data destination object for compression */
 
 struct jpeg_destination_mgr {
@@ -800,6 +824,12 @@ struct jpeg_memory_mgr {
 
   /* Maximum allocation request accepted by alloc_large. */
   long max_alloc_chunk;
+
+  /* Limit on the large pools kept for reuse after an image is finished
+   * (see jmemmgr.c).  May be changed by outer application after creating
+   * the JPEG object; 0 frees them all as before.
+   */
+  long max_spare_space;
 };
 
 
@@ -876,6 +906,7 @@ typedef JMETHOD(boolean, jpeg_marker_parser_method, (j_decompress_ptr cinfo));
 #define jpeg_abort_decompress	jAbrtDecompress
 #define jpeg_abort		jAbort
 #define jpeg_destroy		jDestroy
+#define jpeg_release_spare	jRelSpare
 #define jpeg_resync_to_restart	jResyncRestart
 #endif /* NEED_SHORT_EXTERNAL_NAMES */
 
@@ -1033,6 +1064,9 @@ EXTERN(void) jpeg_abort_decompress JPP((j_decompress_ptr cinfo));
 EXTERN(void) jpeg_abort JPP((j_common_ptr cinfo));
 EXTERN(void) jpeg_destroy JPP((j_common_ptr cinfo));
 
+/* Hand the large pools kept for reuse between images back to the system */
+EXTERN(void) jpeg_release_spare JPP((j_common_ptr cinfo));
+
 /* Default restart-marker-resync procedure for use by data source modules */
 EXTERN(boolean) jpeg_resync_to_restart JPP((j_decompress_ptr cinfo,
 					    int desired));
@@ -134,6 +134,7 @@ parse_switches (j_compress_ptr cinfo, int argc, char **argv,
   transformoption.transform = JXFORM_NONE;
   transformoption.trim = FALSE;
   transformoption.force_grayscale = FALSE;
+  transformoption.crop = FALSE;
   cinfo->err->trace_level = 0;
 
   /* Scan command line options, adjust parameters */
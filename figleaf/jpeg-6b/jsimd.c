@@ -0,0 +1,1747 @@
+/*
+ * jsimd.c
+ *
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains SSE2 and AVX2 versions of the slow-but-accurate
+ * integer forward DCT (jfdctint.c) and inverse DCTs (jidctint.c and the
+ * reduced-size 4x4 and 2x2 routines in jidctred.c), SSE2 versions of the
+ * color conversion and 2:1 resampling loops (jccolor.c, jcsample.c,
+ * jdcolor.c, jdsample.c and jdmerge.c), and the logic that decides at run
+ * time which of them, if any, this machine can use.  All of them produce
+ * exactly the same output as the C routines they replace.
+ *
+ * The SIMD DCTs are exact transcriptions of the C routines: every
+ * intermediate is kept in a 32-bit lane and goes through the same multiplies,
+ * adds and descaling shifts, so the output is bit-for-bit identical.  (Since
+ * integer addition is associative, the only freedom we take is in the order
+ * sums are formed.)  The C routines' shortcuts for all-zero AC terms give the
+ * same results as the full calculation, so they are simply left out.
+ *
+ * That holds only while the 32-bit intermediates don't overflow.  (The C code
+ * works in INT32, which is wider than 32 bits on most 64-bit systems.)  The
+ * forward DCT's inputs are level-shifted samples and are always small enough,
+ * but an IDCT is handed whatever was in the file, so the IDCTs check that the
+ * dequantized coefficients are within DEQUANT_LIMIT and pass any block that
+ * isn't to the C routine.
+ *
+ * The IDCTs assume the standard sample_range_limit table set up by jdmaster.c,
+ * whose effect on a descaled output x is to take the low 10 bits of x as a
+ * signed value, add CENTERJSAMPLE and clamp to 0..MAXJSAMPLE.  We do that
+ * arithmetically instead of with table lookups.
+ *
+ * SSE2 has no 32-bit multiply that keeps the low half, so the SSE2 routines
+ * spend much of their time emulating one.  That still beats the C code for
+ * the full-size DCTs, but not for the reduced-size IDCTs, whose C versions
+ * are cheap to begin with; so those are done only with AVX2.
+ *
+ * The SIMD code is compiled only by GCC-compatible compilers on x86; each
+ * routine carries a target attribute, so no special compiler switches are
+ * needed.  On other systems every jsimd_can_xxx() routine returns 0.
+ * Setting the environment variable JSIMD_FORCENONE disables all the SIMD
+ * routines, and JSIMD_FORCESSE2 disables the AVX2 ones, which is handy for
+ * comparing them against each other and against the C code.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#ifndef NO_GETENV
+#ifndef HAVE_STDLIB_H		/* <stdlib.h> should declare getenv() */
+extern char * getenv JPP((const char * name));
+#endif
+#endif
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    BITS_IN_JSAMPLE == 8 && DCTSIZE == 8
+#define JSIMD_X86
+#endif
+
+
+#ifdef JSIMD_X86
+
+#include <immintrin.h>
+
+#define SSE2_TARGET  __attribute__((target("sse2")))
+#define AVX2_TARGET  __attribute__((target("avx2")))
+/* gcc won't inline the larger per-16-pixel helpers on its own */
+#define ALWAYS_INLINE  static inline __attribute__((always_inline))
+
+/* Bits in simd_support */
+#define JSIMD_SSE2  0x01
+#define JSIMD_AVX2  0x02
+
+/* -1 until init_simd() has run.  Two threads racing through init_simd()
+ * will both store the same answer, so no locking is needed.
+ */
+static int simd_support = -1;
+
+
+LOCAL(void)
+init_simd (void)
+{
+  int support = 0;
+#ifndef NO_GETENV
+  char * env;
+#endif
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    support |= JSIMD_SSE2;
+  /* __builtin_cpu_supports also checks that the OS saves the YMM state */
+  if (__builtin_cpu_supports("avx2"))
+    support |= JSIMD_AVX2;
+
+#ifndef NO_GETENV
+  if ((env = getenv("JSIMD_FORCESSE2")) != NULL && env[0] == '1')
+    support &= JSIMD_SSE2;
+  if ((env = getenv("JSIMD_FORCENONE")) != NULL && env[0] == '1')
+    support = 0;
+#endif
+
+  simd_support = support;
+}
+
+
+/* The DCT routines require the same data layout as the C code with its
+ * default configuration.  These checks fold down to a constant.
+ */
+
+#define DCT_TYPES_OK  (SIZEOF(DCTELEM) == 4 && SIZEOF(ISLOW_MULT_TYPE) == 4 && \
+		       SIZEOF(JCOEF) == 2 && SIZEOF(JSAMPLE) == 1)
+
+
+/* Scaling and constants are the same as in jidctint.c, jfdctint.c and
+ * jidctred.c.
+ */
+
+#define CONST_BITS  13
+#define PASS1_BITS  2
+
+#define FIX_0_211164243  ((INT32)  1730)	/* FIX(0.211164243) */
+#define FIX_0_298631336  ((INT32)  2446)	/* FIX(0.298631336) */
+#define FIX_0_390180644  ((INT32)  3196)	/* FIX(0.390180644) */
+#define FIX_0_509795579  ((INT32)  4176)	/* FIX(0.509795579) */
+#define FIX_0_541196100  ((INT32)  4433)	/* FIX(0.541196100) */
+#define FIX_0_601344887  ((INT32)  4926)	/* FIX(0.601344887) */
+#define FIX_0_720959822  ((INT32)  5906)	/* FIX(0.720959822) */
+#define FIX_0_765366865  ((INT32)  6270)	/* FIX(0.765366865) */
+#define FIX_0_850430095  ((INT32)  6967)	/* FIX(0.850430095) */
+#define FIX_0_899976223  ((INT32)  7373)	/* FIX(0.899976223) */
+#define FIX_1_061594337  ((INT32)  8697)	/* FIX(1.061594337) */
+#define FIX_1_175875602  ((INT32)  9633)	/* FIX(1.175875602) */
+#define FIX_1_272758580  ((INT32)  10426)	/* FIX(1.272758580) */
+#define FIX_1_451774981  ((INT32)  11893)	/* FIX(1.451774981) */
+#define FIX_1_501321110  ((INT32)  12299)	/* FIX(1.501321110) */
+#define FIX_1_847759065  ((INT32)  15137)	/* FIX(1.847759065) */
+#define FIX_1_961570560  ((INT32)  16069)	/* FIX(1.961570560) */
+#define FIX_2_053119869  ((INT32)  16819)	/* FIX(2.053119869) */
+#define FIX_2_172734803  ((INT32)  17799)	/* FIX(2.172734803) */
+#define FIX_2_562915447  ((INT32)  20995)	/* FIX(2.562915447) */
+#define FIX_3_072711026  ((INT32)  25172)	/* FIX(3.072711026) */
+#define FIX_3_624509785  ((INT32)  29692)	/* FIX(3.624509785) */
+
+/* Largest dequantized coefficient magnitude the SIMD IDCTs accept.  The
+ * sum of the absolute values of the multipliers feeding any intermediate
+ * result of jpeg_idct_islow is less than 1830000 (and is smaller still for
+ * the reduced-size IDCTs), so with inputs up to this limit nothing exceeds
+ * 31 bits.  Coefficients from any image coded with 8-bit quantization tables
+ * are within 1024 + 255/2 of zero, so only damaged or unusual files are
+ * affected.
+ */
+#define DEQUANT_LIMIT  1152
+
+/* RANGE_MASK keeps 10 bits of the descaled output; shifting left and then
+ * arithmetically right by this much sign-extends those 10 bits.
+ */
+#define RANGE_SHIFT  22
+
+
+/*
+ * One-dimensional kernels, written in terms of the vector operations
+ * V_ADD, V_SUB, V_MUL (by a vector of constants), V_SHL, V_DESCALE and
+ * V_CONST, which are defined below for each instruction set in turn.
+ * They follow the C code statement for statement.
+ */
+
+/* 8-point inverse DCT, as in either pass of jpeg_idct_islow */
+
+#define IDCT_ISLOW_1D(i0,i1,i2,i3,i4,i5,i6,i7, o0,o1,o2,o3,o4,o5,o6,o7, n) \
+  { \
+    z1 = V_MUL(V_ADD(i2, i6), V_CONST(FIX_0_541196100)); \
+    tmp2 = V_ADD(z1, V_MUL(i6, V_CONST(- FIX_1_847759065))); \
+    tmp3 = V_ADD(z1, V_MUL(i2, V_CONST(FIX_0_765366865))); \
+    tmp0 = V_SHL(V_ADD(i0, i4), CONST_BITS); \
+    tmp1 = V_SHL(V_SUB(i0, i4), CONST_BITS); \
+    tmp10 = V_ADD(tmp0, tmp3); \
+    tmp13 = V_SUB(tmp0, tmp3); \
+    tmp11 = V_ADD(tmp1, tmp2); \
+    tmp12 = V_SUB(tmp1, tmp2); \
+    z1 = V_ADD(i7, i1); \
+    z2 = V_ADD(i5, i3); \
+    z3 = V_ADD(i7, i3); \
+    z4 = V_ADD(i5, i1); \
+    z5 = V_MUL(V_ADD(z3, z4), V_CONST(FIX_1_175875602)); \
+    tmp0 = V_MUL(i7, V_CONST(FIX_0_298631336)); \
+    tmp1 = V_MUL(i5, V_CONST(FIX_2_053119869)); \
+    tmp2 = V_MUL(i3, V_CONST(FIX_3_072711026)); \
+    tmp3 = V_MUL(i1, V_CONST(FIX_1_501321110)); \
+    z1 = V_MUL(z1, V_CONST(- FIX_0_899976223)); \
+    z2 = V_MUL(z2, V_CONST(- FIX_2_562915447)); \
+    z3 = V_ADD(V_MUL(z3, V_CONST(- FIX_1_961570560)), z5); \
+    z4 = V_ADD(V_MUL(z4, V_CONST(- FIX_0_390180644)), z5); \
+    tmp0 = V_ADD(tmp0, V_ADD(z1, z3)); \
+    tmp1 = V_ADD(tmp1, V_ADD(z2, z4)); \
+    tmp2 = V_ADD(tmp2, V_ADD(z2, z3)); \
+    tmp3 = V_ADD(tmp3, V_ADD(z1, z4)); \
+    o0 = V_DESCALE(V_ADD(tmp10, tmp3), n); \
+    o7 = V_DESCALE(V_SUB(tmp10, tmp3), n); \
+    o1 = V_DESCALE(V_ADD(tmp11, tmp2), n); \
+    o6 = V_DESCALE(V_SUB(tmp11, tmp2), n); \
+    o2 = V_DESCALE(V_ADD(tmp12, tmp1), n); \
+    o5 = V_DESCALE(V_SUB(tmp12, tmp1), n); \
+    o3 = V_DESCALE(V_ADD(tmp13, tmp0), n); \
+    o4 = V_DESCALE(V_SUB(tmp13, tmp0), n); \
+  }
+
+/* 8-point forward DCT, as in either pass of jpeg_fdct_islow.
+ * DCOUT is applied to outputs 0 and 4, which need no multiplies.
+ */
+
+#define FDCT_ISLOW_1D(i0,i1,i2,i3,i4,i5,i6,i7, o0,o1,o2,o3,o4,o5,o6,o7, \
+		      DCOUT, n) \
+  { \
+    tmp0 = V_ADD(i0, i7); \
+    tmp7 = V_SUB(i0, i7); \
+    tmp1 = V_ADD(i1, i6); \
+    tmp6 = V_SUB(i1, i6); \
+    tmp2 = V_ADD(i2, i5); \
+    tmp5 = V_SUB(i2, i5); \
+    tmp3 = V_ADD(i3, i4); \
+    tmp4 = V_SUB(i3, i4); \
+    tmp10 = V_ADD(tmp0, tmp3); \
+    tmp13 = V_SUB(tmp0, tmp3); \
+    tmp11 = V_ADD(tmp1, tmp2); \
+    tmp12 = V_SUB(tmp1, tmp2); \
+    o0 = DCOUT(V_ADD(tmp10, tmp11)); \
+    o4 = DCOUT(V_SUB(tmp10, tmp11)); \
+    z1 = V_MUL(V_ADD(tmp12, tmp13), V_CONST(FIX_0_541196100)); \
+    o2 = V_DESCALE(V_ADD(z1, V_MUL(tmp13, V_CONST(FIX_0_765366865))), n); \
+    o6 = V_DESCALE(V_ADD(z1, V_MUL(tmp12, V_CONST(- FIX_1_847759065))), n); \
+    z1 = V_ADD(tmp4, tmp7); \
+    z2 = V_ADD(tmp5, tmp6); \
+    z3 = V_ADD(tmp4, tmp6); \
+    z4 = V_ADD(tmp5, tmp7); \
+    z5 = V_MUL(V_ADD(z3, z4), V_CONST(FIX_1_175875602)); \
+    tmp4 = V_MUL(tmp4, V_CONST(FIX_0_298631336)); \
+    tmp5 = V_MUL(tmp5, V_CONST(FIX_2_053119869)); \
+    tmp6 = V_MUL(tmp6, V_CONST(FIX_3_072711026)); \
+    tmp7 = V_MUL(tmp7, V_CONST(FIX_1_501321110)); \
+    z1 = V_MUL(z1, V_CONST(- FIX_0_899976223)); \
+    z2 = V_MUL(z2, V_CONST(- FIX_2_562915447)); \
+    z3 = V_ADD(V_MUL(z3, V_CONST(- FIX_1_961570560)), z5); \
+    z4 = V_ADD(V_MUL(z4, V_CONST(- FIX_0_390180644)), z5); \
+    o7 = V_DESCALE(V_ADD(tmp4, V_ADD(z1, z3)), n); \
+    o5 = V_DESCALE(V_ADD(tmp5, V_ADD(z2, z4)), n); \
+    o3 = V_DESCALE(V_ADD(tmp6, V_ADD(z2, z3)), n); \
+    o1 = V_DESCALE(V_ADD(tmp7, V_ADD(z1, z4)), n); \
+  }
+
+/* 4-point inverse DCT from 8 inputs, as in either pass of jpeg_idct_4x4.
+ * Input 4 is not used.
+ */
+
+#define IDCT_4x4_1D(i0,i1,i2,i3,i5,i6,i7, o0,o1,o2,o3, n) \
+  { \
+    tmp0 = V_SHL(i0, CONST_BITS+1); \
+    tmp2 = V_ADD(V_MUL(i2, V_CONST(FIX_1_847759065)), \
+		 V_MUL(i6, V_CONST(- FIX_0_765366865))); \
+    tmp10 = V_ADD(tmp0, tmp2); \
+    tmp12 = V_SUB(tmp0, tmp2); \
+    tmp0 = V_ADD(V_ADD(V_MUL(i7, V_CONST(- FIX_0_211164243)), \
+		       V_MUL(i5, V_CONST(FIX_1_451774981))), \
+		 V_ADD(V_MUL(i3, V_CONST(- FIX_2_172734803)), \
+		       V_MUL(i1, V_CONST(FIX_1_061594337)))); \
+    tmp2 = V_ADD(V_ADD(V_MUL(i7, V_CONST(- FIX_0_509795579)), \
+		       V_MUL(i5, V_CONST(- FIX_0_601344887))), \
+		 V_ADD(V_MUL(i3, V_CONST(FIX_0_899976223)), \
+		       V_MUL(i1, V_CONST(FIX_2_562915447)))); \
+    o0 = V_DESCALE(V_ADD(tmp10, tmp2), n); \
+    o3 = V_DESCALE(V_SUB(tmp10, tmp2), n); \
+    o1 = V_DESCALE(V_ADD(tmp12, tmp0), n); \
+    o2 = V_DESCALE(V_SUB(tmp12, tmp0), n); \
+  }
+
+
+/*
+ * SSE2 versions.  Each vector holds four 32-bit lanes, so an 8-wide row
+ * or column is handled in two halves.
+ */
+
+#define V_ADD(a,b)	_mm_add_epi32(a, b)
+#define V_SUB(a,b)	_mm_sub_epi32(a, b)
+#define V_MUL(a,b)	mul32_sse2(a, b)
+#define V_SHL(a,n)	_mm_slli_epi32(a, n)
+#define V_DESCALE(a,n)	_mm_srai_epi32(_mm_add_epi32(a, \
+				_mm_set1_epi32(ONE << ((n)-1))), n)
+#define V_CONST(c)	_mm_set1_epi32(c)
+#define V_PASS1OUT(a)	_mm_slli_epi32(a, PASS1_BITS)
+#define V_PASS2OUT(a)	V_DESCALE(a, PASS1_BITS)
+
+/* Low 32 bits of the lane-wise product.  SSE2 has no pmulld, but the low
+ * half of an unsigned 32x32 product is the same as that of a signed one.
+ */
+
+SSE2_TARGET static inline __m128i
+mul32_sse2 (__m128i a, __m128i b)
+{
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+			    _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+#define TRANSPOSE_4x4_SSE2(r0,r1,r2,r3) \
+  { __m128i t0 = _mm_unpacklo_epi32(r0, r1); \
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3); \
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1); \
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3); \
+    r0 = _mm_unpacklo_epi64(t0, t1); \
+    r1 = _mm_unpackhi_epi64(t0, t1); \
+    r2 = _mm_unpacklo_epi64(t2, t3); \
+    r3 = _mm_unpackhi_epi64(t2, t3); }
+
+/* Descaled IDCT output to sample values, as range_limit[x & RANGE_MASK] */
+
+#define RANGE_LIMIT_SSE2(a) \
+  _mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(a, RANGE_SHIFT), RANGE_SHIFT), \
+		_mm_set1_epi32(CENTERJSAMPLE))
+
+/* Load four coefficients, sign-extended to 32 bits, and dequantize them */
+
+SSE2_TARGET static inline __m128i
+dequant4_sse2 (JCOEFPTR inptr, ISLOW_MULT_TYPE * quantptr)
+{
+  __m128i coef = _mm_loadl_epi64((const __m128i *) inptr);
+
+  coef = _mm_srai_epi32(_mm_unpacklo_epi16(coef, coef), 16);
+  return mul32_sse2(coef, _mm_loadu_si128((const __m128i *) quantptr));
+}
+
+
+/* Dequantize rows of coefficients, for columns 4h..4h+3.  rows lists the
+ * input rows that are needed, terminated by -1.  Returns FALSE if any of
+ * the results is beyond DEQUANT_LIMIT.
+ */
+
+SSE2_TARGET static inline boolean
+dequant_sse2 (JCOEFPTR coef_block, ISLOW_MULT_TYPE * quantptr,
+	      __m128i in[2][DCTSIZE], const int * rows)
+{
+  __m128i limit = _mm_set1_epi32(DEQUANT_LIMIT);
+  __m128i neg_limit = _mm_set1_epi32(- DEQUANT_LIMIT);
+  __m128i bad = _mm_setzero_si128();
+  __m128i v;
+  int h, i;
+
+  for (; *rows >= 0; rows++) {
+    i = *rows;
+    for (h = 0; h < 2; h++) {
+      v = dequant4_sse2(coef_block + DCTSIZE*i + 4*h,
+			quantptr + DCTSIZE*i + 4*h);
+      bad = _mm_or_si128(bad, _mm_or_si128(_mm_cmpgt_epi32(v, limit),
+					   _mm_cmplt_epi32(v, neg_limit)));
+      in[h][i] = v;
+    }
+  }
+  return _mm_movemask_epi8(bad) == 0;
+}
+
+static const int all_rows[] = { 0, 1, 2, 3, 4, 5, 6, 7, -1 };
+static const int rows_4x4[] = { 0, 1, 2, 3, 5, 6, 7, -1 };
+static const int rows_2x2[] = { 0, 1, 3, 5, 7, -1 };
+
+
+/* Store four samples, saturated to 0..MAXJSAMPLE */
+
+SSE2_TARGET static inline void
+store4_sse2 (JSAMPROW outptr, __m128i a)
+{
+  int v;
+
+  a = _mm_packs_epi32(a, a);
+  a = _mm_packus_epi16(a, a);
+  v = _mm_cvtsi128_si32(a);
+  MEMCOPY(outptr, &v, 4);
+}
+
+
+SSE2_TARGET LOCAL(void)
+idct_islow_sse2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		 JCOEFPTR coef_block,
+		 JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+  __m128i z1, z2, z3, z4, z5;
+  __m128i dq[2][8], in[8], ws[2][8], out[8];
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  JSAMPROW outptr;
+  int h, g, i;
+
+  if (! dequant_sse2(coef_block, quantptr, dq, all_rows)) {
+    jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: process columns from input, four at a time. */
+
+  for (h = 0; h < 2; h++) {
+    IDCT_ISLOW_1D(dq[h][0], dq[h][1], dq[h][2], dq[h][3],
+		  dq[h][4], dq[h][5], dq[h][6], dq[h][7],
+		  ws[h][0], ws[h][1], ws[h][2], ws[h][3],
+		  ws[h][4], ws[h][5], ws[h][6], ws[h][7],
+		  CONST_BITS-PASS1_BITS);
+  }
+
+  /* Pass 2: process rows from work array, four at a time. */
+
+  for (g = 0; g < 2; g++) {
+    for (i = 0; i < 4; i++) {
+      in[i] = ws[0][4*g + i];
+      in[4+i] = ws[1][4*g + i];
+    }
+    TRANSPOSE_4x4_SSE2(in[0], in[1], in[2], in[3]);
+    TRANSPOSE_4x4_SSE2(in[4], in[5], in[6], in[7]);
+    IDCT_ISLOW_1D(in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7],
+		  out[0], out[1], out[2], out[3],
+		  out[4], out[5], out[6], out[7],
+		  CONST_BITS+PASS1_BITS+3);
+    for (i = 0; i < DCTSIZE; i++)
+      out[i] = RANGE_LIMIT_SSE2(out[i]);
+    TRANSPOSE_4x4_SSE2(out[0], out[1], out[2], out[3]);
+    TRANSPOSE_4x4_SSE2(out[4], out[5], out[6], out[7]);
+    for (i = 0; i < 4; i++) {
+      outptr = output_buf[4*g + i] + output_col;
+      tmp0 = _mm_packs_epi32(out[i], out[4+i]);
+      _mm_storel_epi64((__m128i *) outptr, _mm_packus_epi16(tmp0, tmp0));
+    }
+  }
+}
+
+
+SSE2_TARGET LOCAL(void)
+fdct_islow_sse2 (DCTELEM * data)
+{
+  __m128i tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+  __m128i tmp10, tmp11, tmp12, tmp13;
+  __m128i z1, z2, z3, z4, z5;
+  __m128i in[8], ws[2][8], out[8];
+  int h, g, i;
+
+  /* Pass 1: process rows, four at a time. */
+
+  for (g = 0; g < 2; g++) {
+    for (i = 0; i < 4; i++) {
+      in[i] = _mm_loadu_si128((const __m128i *) (data + DCTSIZE*(4*g + i)));
+      in[4+i] = _mm_loadu_si128((const __m128i *)
+				(data + DCTSIZE*(4*g + i) + 4));
+    }
+    TRANSPOSE_4x4_SSE2(in[0], in[1], in[2], in[3]);
+    TRANSPOSE_4x4_SSE2(in[4], in[5], in[6], in[7]);
+    FDCT_ISLOW_1D(in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7],
+		  out[0], out[1], out[2], out[3],
+		  out[4], out[5], out[6], out[7],
+		  V_PASS1OUT, CONST_BITS-PASS1_BITS);
+    /* Back to rows: ws[h][r] is columns 4h..4h+3 of row r */
+    TRANSPOSE_4x4_SSE2(out[0], out[1], out[2], out[3]);
+    TRANSPOSE_4x4_SSE2(out[4], out[5], out[6], out[7]);
+    for (i = 0; i < 4; i++) {
+      ws[0][4*g + i] = out[i];
+      ws[1][4*g + i] = out[4+i];
+    }
+  }
+
+  /* Pass 2: process columns, four at a time. */
+
+  for (h = 0; h < 2; h++) {
+    FDCT_ISLOW_1D(ws[h][0], ws[h][1], ws[h][2], ws[h][3],
+		  ws[h][4], ws[h][5], ws[h][6], ws[h][7],
+		  out[0], out[1], out[2], out[3],
+		  out[4], out[5], out[6], out[7],
+		  V_PASS2OUT, CONST_BITS+PASS1_BITS);
+    for (i = 0; i < DCTSIZE; i++)
+      _mm_storeu_si128((__m128i *) (data + DCTSIZE*i + 4*h), out[i]);
+  }
+}
+
+
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_SHL
+#undef V_DESCALE
+#undef V_CONST
+#undef V_PASS1OUT
+#undef V_PASS2OUT
+
+
+/*
+ * AVX2 versions.  Each vector holds a whole 8-wide row or column, and
+ * there is a proper 32-bit multiply.
+ */
+
+#define V_ADD(a,b)	_mm256_add_epi32(a, b)
+#define V_SUB(a,b)	_mm256_sub_epi32(a, b)
+#define V_MUL(a,b)	_mm256_mullo_epi32(a, b)
+#define V_SHL(a,n)	_mm256_slli_epi32(a, n)
+#define V_DESCALE(a,n)	_mm256_srai_epi32(_mm256_add_epi32(a, \
+				_mm256_set1_epi32(ONE << ((n)-1))), n)
+#define V_CONST(c)	_mm256_set1_epi32(c)
+#define V_PASS1OUT(a)	_mm256_slli_epi32(a, PASS1_BITS)
+#define V_PASS2OUT(a)	V_DESCALE(a, PASS1_BITS)
+
+AVX2_TARGET static inline void
+transpose_8x8_avx2 (__m256i * r)
+{
+  __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+  __m256i u0, u1, u2, u3, u4, u5, u6, u7;
+
+  t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+  t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+  t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+  t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+  t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+  t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+  t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+  t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+  u0 = _mm256_unpacklo_epi64(t0, t2);
+  u1 = _mm256_unpackhi_epi64(t0, t2);
+  u2 = _mm256_unpacklo_epi64(t1, t3);
+  u3 = _mm256_unpackhi_epi64(t1, t3);
+  u4 = _mm256_unpacklo_epi64(t4, t6);
+  u5 = _mm256_unpackhi_epi64(t4, t6);
+  u6 = _mm256_unpacklo_epi64(t5, t7);
+  u7 = _mm256_unpackhi_epi64(t5, t7);
+
+  r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+
+/* Dequantize the listed rows of coefficients, as dequant_sse2 does. */
+
+AVX2_TARGET static inline boolean
+dequant_avx2 (JCOEFPTR coef_block, ISLOW_MULT_TYPE * quantptr,
+	      __m256i in[DCTSIZE], const int * rows)
+{
+  __m256i limit = _mm256_set1_epi32(DEQUANT_LIMIT);
+  __m256i neg_limit = _mm256_set1_epi32(- DEQUANT_LIMIT);
+  __m256i bad = _mm256_setzero_si256();
+  int i;
+
+  for (; *rows >= 0; rows++) {
+    i = *rows;
+    in[i] = _mm256_mullo_epi32(
+	_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)
+					      (coef_block + DCTSIZE*i))),
+	_mm256_loadu_si256((const __m256i *) (quantptr + DCTSIZE*i)));
+    bad = _mm256_or_si256(bad, _mm256_or_si256(
+	_mm256_cmpgt_epi32(in[i], limit), _mm256_cmpgt_epi32(neg_limit, in[i])));
+  }
+  return _mm256_testz_si256(bad, bad);
+}
+
+/* Sum the two 128-bit halves of a vector */
+
+#define HALF_SUM_AVX2(a) \
+  _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1))
+
+
+AVX2_TARGET LOCAL(void)
+idct_islow_avx2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		 JCOEFPTR coef_block,
+		 JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m256i tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+  __m256i z1, z2, z3, z4, z5;
+  __m256i in[8], ws[8];
+  __m128i row;
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  int i;
+
+  if (! dequant_avx2(coef_block, quantptr, in, all_rows)) {
+    jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: process all 8 columns from input at once. */
+
+  IDCT_ISLOW_1D(in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7],
+		ws[0], ws[1], ws[2], ws[3], ws[4], ws[5], ws[6], ws[7],
+		CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process all 8 rows from work array at once. */
+
+  transpose_8x8_avx2(ws);
+  IDCT_ISLOW_1D(ws[0], ws[1], ws[2], ws[3], ws[4], ws[5], ws[6], ws[7],
+		in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7],
+		CONST_BITS+PASS1_BITS+3);
+  for (i = 0; i < DCTSIZE; i++)
+    in[i] = _mm256_add_epi32(_mm256_srai_epi32(_mm256_slli_epi32(in[i],
+								 RANGE_SHIFT),
+					       RANGE_SHIFT),
+			     _mm256_set1_epi32(CENTERJSAMPLE));
+  transpose_8x8_avx2(in);
+  for (i = 0; i < DCTSIZE; i++) {
+    row = _mm_packs_epi32(_mm256_castsi256_si128(in[i]),
+			  _mm256_extracti128_si256(in[i], 1));
+    _mm_storel_epi64((__m128i *) (output_buf[i] + output_col),
+		     _mm_packus_epi16(row, row));
+  }
+}
+
+
+AVX2_TARGET LOCAL(void)
+fdct_islow_avx2 (DCTELEM * data)
+{
+  __m256i tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+  __m256i tmp10, tmp11, tmp12, tmp13;
+  __m256i z1, z2, z3, z4, z5;
+  __m256i in[8], ws[8];
+  int i;
+
+  /* Pass 1: process all 8 rows at once. */
+
+  for (i = 0; i < DCTSIZE; i++)
+    in[i] = _mm256_loadu_si256((const __m256i *) (data + DCTSIZE*i));
+  transpose_8x8_avx2(in);
+  FDCT_ISLOW_1D(in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7],
+		ws[0], ws[1], ws[2], ws[3], ws[4], ws[5], ws[6], ws[7],
+		V_PASS1OUT, CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process all 8 columns at once. */
+
+  transpose_8x8_avx2(ws);
+  FDCT_ISLOW_1D(ws[0], ws[1], ws[2], ws[3], ws[4], ws[5], ws[6], ws[7],
+		in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7],
+		V_PASS2OUT, CONST_BITS+PASS1_BITS);
+  for (i = 0; i < DCTSIZE; i++)
+    _mm256_storeu_si256((__m256i *) (data + DCTSIZE*i), in[i]);
+}
+
+
+AVX2_TARGET LOCAL(void)
+idct_4x4_avx2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	       JCOEFPTR coef_block,
+	       JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m256i tmp0, tmp2, tmp10, tmp12;
+  __m256i in[8], ws[4], t0, t1, t2, t3, c0, c1, c2, c3;
+  __m128i even, even2, odd0, odd2, out[4];
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  int i;
+
+  if (! dequant_avx2(coef_block, quantptr, in, rows_4x4)) {
+    jpeg_idct_4x4(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: process all 8 columns from input at once. */
+
+  IDCT_4x4_1D(in[0], in[1], in[2], in[3], in[5], in[6], in[7],
+	      ws[0], ws[1], ws[2], ws[3],
+	      CONST_BITS-PASS1_BITS+1);
+
+  /* Pass 2: process the 4 rows from the work array at once.  After the
+   * in-lane transpose, the low half of ck holds term k of rows 0..3 and
+   * the high half holds term k+4, so each product is formed for a pair of
+   * terms and then the halves are summed.
+   */
+
+  t0 = _mm256_unpacklo_epi32(ws[0], ws[1]);
+  t1 = _mm256_unpackhi_epi32(ws[0], ws[1]);
+  t2 = _mm256_unpacklo_epi32(ws[2], ws[3]);
+  t3 = _mm256_unpackhi_epi32(ws[2], ws[3]);
+  c0 = _mm256_unpacklo_epi64(t0, t2);
+  c1 = _mm256_unpackhi_epi64(t0, t2);
+  c2 = _mm256_unpacklo_epi64(t1, t3);
+  c3 = _mm256_unpackhi_epi64(t1, t3);
+
+  even = _mm_slli_epi32(_mm256_castsi256_si128(c0), CONST_BITS+1);
+  tmp2 = V_MUL(c2, _mm256_setr_epi32(FIX_1_847759065, FIX_1_847759065,
+				     FIX_1_847759065, FIX_1_847759065,
+				     - FIX_0_765366865, - FIX_0_765366865,
+				     - FIX_0_765366865, - FIX_0_765366865));
+  odd0 = HALF_SUM_AVX2(V_ADD(
+      V_MUL(c3, _mm256_setr_epi32(- FIX_2_172734803, - FIX_2_172734803,
+				  - FIX_2_172734803, - FIX_2_172734803,
+				  - FIX_0_211164243, - FIX_0_211164243,
+				  - FIX_0_211164243, - FIX_0_211164243)),
+      V_MUL(c1, _mm256_setr_epi32(FIX_1_061594337, FIX_1_061594337,
+				  FIX_1_061594337, FIX_1_061594337,
+				  FIX_1_451774981, FIX_1_451774981,
+				  FIX_1_451774981, FIX_1_451774981))));
+  odd2 = HALF_SUM_AVX2(V_ADD(
+      V_MUL(c3, _mm256_setr_epi32(FIX_0_899976223, FIX_0_899976223,
+				  FIX_0_899976223, FIX_0_899976223,
+				  - FIX_0_509795579, - FIX_0_509795579,
+				  - FIX_0_509795579, - FIX_0_509795579)),
+      V_MUL(c1, _mm256_setr_epi32(FIX_2_562915447, FIX_2_562915447,
+				  FIX_2_562915447, FIX_2_562915447,
+				  - FIX_0_601344887, - FIX_0_601344887,
+				  - FIX_0_601344887, - FIX_0_601344887))));
+  even2 = HALF_SUM_AVX2(tmp2);
+
+  out[0] = _mm_add_epi32(_mm_add_epi32(even, even2), odd2);
+  out[3] = _mm_sub_epi32(_mm_add_epi32(even, even2), odd2);
+  out[1] = _mm_add_epi32(_mm_sub_epi32(even, even2), odd0);
+  out[2] = _mm_sub_epi32(_mm_sub_epi32(even, even2), odd0);
+  for (i = 0; i < 4; i++) {
+    out[i] = _mm_srai_epi32(_mm_add_epi32(out[i],
+	_mm_set1_epi32(ONE << (CONST_BITS+PASS1_BITS+3))),
+	CONST_BITS+PASS1_BITS+3+1);
+    out[i] = RANGE_LIMIT_SSE2(out[i]);
+  }
+  TRANSPOSE_4x4_SSE2(out[0], out[1], out[2], out[3]);
+  for (i = 0; i < 4; i++)
+    store4_sse2(output_buf[i] + output_col, out[i]);
+}
+
+
+AVX2_TARGET LOCAL(void)
+idct_2x2_avx2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	       JCOEFPTR coef_block,
+	       JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m256i tmp0, tmp10, in[8], ws0, ws1, c0, c1, c3;
+  __m128i even, odd, out0, out1;
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  int v;
+
+  if (! dequant_avx2(coef_block, quantptr, in, rows_2x2)) {
+    jpeg_idct_2x2(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: process all 8 columns from input at once. */
+
+  tmp10 = V_SHL(in[0], CONST_BITS+2);
+  tmp0 = V_ADD(V_ADD(V_MUL(in[7], V_CONST(- FIX_0_720959822)),
+		     V_MUL(in[5], V_CONST(FIX_0_850430095))),
+	       V_ADD(V_MUL(in[3], V_CONST(- FIX_1_272758580)),
+		     V_MUL(in[1], V_CONST(FIX_3_624509785))));
+  ws0 = V_DESCALE(V_ADD(tmp10, tmp0), CONST_BITS-PASS1_BITS+2);
+  ws1 = V_DESCALE(V_SUB(tmp10, tmp0), CONST_BITS-PASS1_BITS+2);
+
+  /* Pass 2: process both rows at once, pairing terms as idct_4x4_avx2
+   * does.  Lanes 0 and 1 of each half belong to rows 0 and 1.
+   */
+
+  c0 = _mm256_unpacklo_epi32(ws0, ws1);	/* terms 0,1 | 4,5 */
+  c3 = _mm256_unpackhi_epi32(ws0, ws1);	/* terms 2,3 | 6,7 */
+  c1 = _mm256_unpackhi_epi64(c0, c0);	/* terms 1 | 5 */
+  c3 = _mm256_unpackhi_epi64(c3, c3);	/* terms 3 | 7 */
+  even = _mm_slli_epi32(_mm256_castsi256_si128(c0), CONST_BITS+2);
+  odd = HALF_SUM_AVX2(V_ADD(
+      V_MUL(c1, _mm256_setr_epi32(FIX_3_624509785, FIX_3_624509785,
+				  FIX_3_624509785, FIX_3_624509785,
+				  FIX_0_850430095, FIX_0_850430095,
+				  FIX_0_850430095, FIX_0_850430095)),
+      V_MUL(c3, _mm256_setr_epi32(- FIX_1_272758580, - FIX_1_272758580,
+				  - FIX_1_272758580, - FIX_1_272758580,
+				  - FIX_0_720959822, - FIX_0_720959822,
+				  - FIX_0_720959822, - FIX_0_720959822))));
+  out0 = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(even, odd),
+	_mm_set1_epi32(ONE << (CONST_BITS+PASS1_BITS+3+1))),
+	CONST_BITS+PASS1_BITS+3+2);
+  out1 = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(even, odd),
+	_mm_set1_epi32(ONE << (CONST_BITS+PASS1_BITS+3+1))),
+	CONST_BITS+PASS1_BITS+3+2);
+  out0 = RANGE_LIMIT_SSE2(out0);
+  out1 = RANGE_LIMIT_SSE2(out1);
+
+  /* Lanes 0,1 of out0 are column 0 of rows 0,1; likewise out1 column 1 */
+  out0 = _mm_unpacklo_epi32(out0, out1);
+  out0 = _mm_packs_epi32(out0, out0);
+  out0 = _mm_packus_epi16(out0, out0);
+  v = _mm_cvtsi128_si32(out0);
+  output_buf[0][output_col] = (JSAMPLE) (v & 0xFF);
+  output_buf[0][output_col+1] = (JSAMPLE) ((v >> 8) & 0xFF);
+  output_buf[1][output_col] = (JSAMPLE) ((v >> 16) & 0xFF);
+  output_buf[1][output_col+1] = (JSAMPLE) ((v >> 24) & 0xFF);
+}
+
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_SHL
+#undef V_DESCALE
+#undef V_CONST
+#undef V_PASS1OUT
+#undef V_PASS2OUT
+
+
+/*
+ * Color conversion and resampling.  These work on sixteen 8-bit samples at
+ * a time, widened to 16-bit lanes for the arithmetic.  Only SSE2 versions
+ * are provided: the routines are mostly loads, stores and shuffles, and
+ * AVX2's split 128-bit lanes would make the RGB (de)interleaving awkward.
+ *
+ * The RGB<->YCbCr equations use the same scaled-integer constants as
+ * jccolor.c and jdcolor.c.  Those don't all fit in 16 bits, so where one
+ * doesn't we multiply by (constant - 65536) with pmaddwd and add the
+ * input back in at the appropriate scale; integer identities keep that
+ * exact.  The rounding constants ride along as a second pmaddwd term.
+ */
+
+/* The color routines require this RGB pixel layout (see jmorecfg.h). */
+
+#define RGB_LAYOUT_OK  (RGB_RED == 0 && RGB_GREEN == 1 && RGB_BLUE == 2 && \
+			RGB_PIXELSIZE == 3 && SIZEOF(JSAMPLE) == 1)
+
+#define SCALEBITS	16	/* as in jccolor.c and jdcolor.c */
+#define CBCR_OFFSET	((INT32) CENTERJSAMPLE << SCALEBITS)
+#define ONE_HALF	((INT32) 1 << (SCALEBITS-1))
+#define CFIX(x)		((INT32) ((x) * (1L<<SCALEBITS) + 0.5))
+
+/* A pmaddwd operand holding a in the low and b in the high 16 bits of
+ * each 32-bit lane.
+ */
+
+#define PAIR_SSE2(a,b) \
+  _mm_set1_epi32((int) (((unsigned int) (b) << 16) | \
+			((unsigned int) (a) & 0xFFFF)))
+
+/* Byte masks for each 64-bit half */
+
+#define MASK64_SSE2(m)	_mm_set1_epi64x((long long) (m))
+
+
+/* Expand four packed RGB pixels in the low 12 bytes of v to one pixel per
+ * 32-bit lane, with the fourth byte of each lane set to fill.
+ */
+
+SSE2_TARGET ALWAYS_INLINE __m128i
+expand_rgb_sse2 (__m128i v, int fill)
+{
+  __m128i t;
+
+  /* Pixels 0-1 to bytes 0-5, pixels 2-3 to bytes 8-13 */
+  t = _mm_or_si128(_mm_and_si128(v, _mm_setr_epi32(-1, 0xFFFF, 0, 0)),
+		   _mm_slli_si128(_mm_and_si128(v, _mm_setr_epi32(0,
+			0xFFFF0000, -1, 0)), 2));
+  /* Then the second pixel of each pair up by a byte */
+  t = _mm_or_si128(_mm_and_si128(t, MASK64_SSE2(0xFFFFFF)),
+		   _mm_slli_epi64(_mm_and_si128(t, MASK64_SSE2(0xFFFFFF000000LL)),
+				  8));
+  return _mm_or_si128(t, _mm_set1_epi32(fill << 24));
+}
+
+/* The inverse: pack four pixels, one per 32-bit lane, into the low 12
+ * bytes of the result, with zeroes above.
+ */
+
+SSE2_TARGET ALWAYS_INLINE __m128i
+pack_rgb_sse2 (__m128i p)
+{
+  __m128i t;
+
+  t = _mm_or_si128(_mm_and_si128(p, MASK64_SSE2(0xFFFFFF)),
+		   _mm_srli_epi64(_mm_and_si128(p,
+			MASK64_SSE2(0xFFFFFF00000000LL)), 8));
+  return _mm_or_si128(_mm_and_si128(t, _mm_setr_epi32(-1, 0xFFFF, 0, 0)),
+		      _mm_srli_si128(_mm_and_si128(t, _mm_setr_epi32(0, 0,
+			-1, 0xFFFF)), 2));
+}
+
+
+/* Convert 16 pixels of Y, Cb, Cr to packed RGB, as ycc_rgb_convert does.
+ * If dup is TRUE, only 8 Cb and Cr samples are read and each is used for
+ * two pixels, as in the merged upsamplers.
+ */
+
+SSE2_TARGET ALWAYS_INLINE void
+ycc_rgb_16_sse2 (const JSAMPLE * inptr0, const JSAMPLE * inptr1,
+		 const JSAMPLE * inptr2, JSAMPLE * outptr, boolean dup)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i two = _mm_set1_epi16(2);
+  __m128i y, cb, cr, yw, cbw, crw, r[2], g[2], b[2], t0, t1;
+  __m128i rgb_lo, rgb_hi, bz_lo, bz_hi, p0, p1, p2, p3;
+  int h;
+
+  y = _mm_loadu_si128((const __m128i *) inptr0);
+  if (dup) {
+    cb = _mm_loadl_epi64((const __m128i *) inptr1);
+    cr = _mm_loadl_epi64((const __m128i *) inptr2);
+    cb = _mm_unpacklo_epi8(cb, cb);
+    cr = _mm_unpacklo_epi8(cr, cr);
+  } else {
+    cb = _mm_loadu_si128((const __m128i *) inptr1);
+    cr = _mm_loadu_si128((const __m128i *) inptr2);
+  }
+
+  for (h = 0; h < 2; h++) {
+    if (h == 0) {
+      yw = _mm_unpacklo_epi8(y, zero);
+      cbw = _mm_unpacklo_epi8(cb, zero);
+      crw = _mm_unpacklo_epi8(cr, zero);
+    } else {
+      yw = _mm_unpackhi_epi8(y, zero);
+      cbw = _mm_unpackhi_epi8(cb, zero);
+      crw = _mm_unpackhi_epi8(cr, zero);
+    }
+    cbw = _mm_sub_epi16(cbw, _mm_set1_epi16(CENTERJSAMPLE));
+    crw = _mm_sub_epi16(crw, _mm_set1_epi16(CENTERJSAMPLE));
+
+    /* R = y + ((FIX(1.40200) * cr + ONE_HALF) >> 16) */
+    t0 = _mm_madd_epi16(_mm_unpacklo_epi16(crw, two),
+			PAIR_SSE2(CFIX(1.40200) - 65536, ONE_HALF/2));
+    t1 = _mm_madd_epi16(_mm_unpackhi_epi16(crw, two),
+			PAIR_SSE2(CFIX(1.40200) - 65536, ONE_HALF/2));
+    t0 = _mm_packs_epi32(_mm_srai_epi32(t0, SCALEBITS),
+			 _mm_srai_epi32(t1, SCALEBITS));
+    r[h] = _mm_add_epi16(_mm_add_epi16(yw, crw), t0);
+
+    /* B = y + ((FIX(1.77200) * cb + ONE_HALF) >> 16) */
+    t0 = _mm_madd_epi16(_mm_unpacklo_epi16(cbw, two),
+			PAIR_SSE2(CFIX(1.77200) - 131072, ONE_HALF/2));
+    t1 = _mm_madd_epi16(_mm_unpackhi_epi16(cbw, two),
+			PAIR_SSE2(CFIX(1.77200) - 131072, ONE_HALF/2));
+    t0 = _mm_packs_epi32(_mm_srai_epi32(t0, SCALEBITS),
+			 _mm_srai_epi32(t1, SCALEBITS));
+    b[h] = _mm_add_epi16(_mm_add_epi16(yw, _mm_slli_epi16(cbw, 1)), t0);
+
+    /* G = y + ((- FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF) >> 16) */
+    t0 = _mm_madd_epi16(_mm_unpacklo_epi16(cbw, crw),
+			PAIR_SSE2(- CFIX(0.34414), 65536 - CFIX(0.71414)));
+    t1 = _mm_madd_epi16(_mm_unpackhi_epi16(cbw, crw),
+			PAIR_SSE2(- CFIX(0.34414), 65536 - CFIX(0.71414)));
+    t0 = _mm_add_epi32(t0, _mm_set1_epi32(ONE_HALF));
+    t1 = _mm_add_epi32(t1, _mm_set1_epi32(ONE_HALF));
+    t0 = _mm_packs_epi32(_mm_srai_epi32(t0, SCALEBITS),
+			 _mm_srai_epi32(t1, SCALEBITS));
+    g[h] = _mm_add_epi16(_mm_sub_epi16(yw, crw), t0);
+  }
+
+  /* Saturating to 0..MAXJSAMPLE is what range_limit does here */
+  r[0] = _mm_packus_epi16(r[0], r[1]);
+  g[0] = _mm_packus_epi16(g[0], g[1]);
+  b[0] = _mm_packus_epi16(b[0], b[1]);
+
+  rgb_lo = _mm_unpacklo_epi8(r[0], g[0]);
+  rgb_hi = _mm_unpackhi_epi8(r[0], g[0]);
+  bz_lo = _mm_unpacklo_epi8(b[0], zero);
+  bz_hi = _mm_unpackhi_epi8(b[0], zero);
+  p0 = pack_rgb_sse2(_mm_unpacklo_epi16(rgb_lo, bz_lo));
+  p1 = pack_rgb_sse2(_mm_unpackhi_epi16(rgb_lo, bz_lo));
+  p2 = pack_rgb_sse2(_mm_unpacklo_epi16(rgb_hi, bz_hi));
+  p3 = pack_rgb_sse2(_mm_unpackhi_epi16(rgb_hi, bz_hi));
+  _mm_storeu_si128((__m128i *) outptr,
+		   _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+  _mm_storeu_si128((__m128i *) (outptr + 16),
+		   _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+  _mm_storeu_si128((__m128i *) (outptr + 32),
+		   _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+}
+
+
+/* Convert one row of num_cols pixels.  The last partial group of 16 goes
+ * through scratch buffers, so we never touch memory beyond either row.
+ */
+
+SSE2_TARGET LOCAL(void)
+ycc_rgb_row_sse2 (const JSAMPLE * inptr0, const JSAMPLE * inptr1,
+		  const JSAMPLE * inptr2, JSAMPLE * outptr,
+		  JDIMENSION num_cols, boolean dup)
+{
+  JSAMPLE y[16], cb[16], cr[16], rgb[16*3];
+  JDIMENSION col, cstep = dup ? 8 : 16;
+  int n;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    ycc_rgb_16_sse2(inptr0, inptr1, inptr2, outptr, dup);
+    inptr0 += 16;
+    inptr1 += cstep;
+    inptr2 += cstep;
+    outptr += 16 * RGB_PIXELSIZE;
+  }
+  if (col < num_cols) {
+    n = (int) (num_cols - col);
+    MEMZERO(y, SIZEOF(y));
+    MEMZERO(cb, SIZEOF(cb));
+    MEMZERO(cr, SIZEOF(cr));
+    MEMCOPY(y, inptr0, n * SIZEOF(JSAMPLE));
+    MEMCOPY(cb, inptr1, (dup ? (n + 1) / 2 : n) * SIZEOF(JSAMPLE));
+    MEMCOPY(cr, inptr2, (dup ? (n + 1) / 2 : n) * SIZEOF(JSAMPLE));
+    ycc_rgb_16_sse2(y, cb, cr, rgb, dup);
+    MEMCOPY(outptr, rgb, n * RGB_PIXELSIZE * SIZEOF(JSAMPLE));
+  }
+}
+
+
+/* Convert 16 packed RGB pixels to Y, Cb, Cr, as rgb_ycc_convert does. */
+
+SSE2_TARGET ALWAYS_INLINE void
+rgb_ycc_16_sse2 (const JSAMPLE * inptr, JSAMPLE * outptr0,
+		 JSAMPLE * outptr1, JSAMPLE * outptr2)
+{
+  __m128i mask = _mm_set1_epi32(0x00FF00FF);
+  __m128i p, rb, g2, y[4], cb[4], cr[4];
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    /* Pixels 4k..4k+3; the last group is loaded from 4 bytes further back
+     * so as not to read past the 48 bytes of input.
+     */
+    if (k < 3)
+      p = _mm_loadu_si128((const __m128i *) (inptr + 12*k));
+    else
+      p = _mm_srli_si128(_mm_loadu_si128((const __m128i *) (inptr + 32)), 4);
+    p = expand_rgb_sse2(p, 2);
+    rb = _mm_and_si128(p, mask);			/* R, B */
+    g2 = _mm_and_si128(_mm_srli_epi32(p, 8), mask);	/* G, 2 */
+
+    /* Y = (FIX(0.29900)*R + FIX(0.58700)*G + FIX(0.11400)*B + ONE_HALF)
+     *     >> 16
+     */
+    y[k] = _mm_add_epi32(
+	_mm_add_epi32(_mm_madd_epi16(rb, PAIR_SSE2(CFIX(0.29900),
+						   CFIX(0.11400))),
+		      _mm_madd_epi16(g2, PAIR_SSE2(CFIX(0.58700) - 65536,
+						   ONE_HALF/2))),
+	_mm_slli_epi32(g2, 16));
+    y[k] = _mm_srli_epi32(y[k], SCALEBITS);
+
+    /* Cb = (- FIX(0.16874)*R - FIX(0.33126)*G + FIX(0.5)*B
+     *       + CBCR_OFFSET + ONE_HALF-1) >> 16
+     * Half of the FIX(0.5)*B term comes from pmaddwd and half from a shift.
+     */
+    cb[k] = _mm_add_epi32(
+	_mm_add_epi32(_mm_madd_epi16(rb, PAIR_SSE2(- CFIX(0.16874),
+						   CFIX(0.50000) / 2)),
+		      _mm_madd_epi16(g2, PAIR_SSE2(- CFIX(0.33126), 0))),
+	_mm_add_epi32(_mm_slli_epi32(_mm_srli_epi32(rb, 16), 14),
+		      _mm_set1_epi32(CBCR_OFFSET + ONE_HALF-1)));
+    cb[k] = _mm_srli_epi32(cb[k], SCALEBITS);
+
+    /* Cr = (FIX(0.5)*R - FIX(0.41869)*G - FIX(0.08131)*B
+     *       + CBCR_OFFSET + ONE_HALF-1) >> 16
+     */
+    cr[k] = _mm_add_epi32(
+	_mm_add_epi32(_mm_madd_epi16(rb, PAIR_SSE2(CFIX(0.50000) / 2,
+						   - CFIX(0.08131))),
+		      _mm_madd_epi16(g2, PAIR_SSE2(- CFIX(0.41869), 0))),
+	_mm_add_epi32(_mm_slli_epi32(_mm_and_si128(rb,
+						   _mm_set1_epi32(0xFF)), 14),
+		      _mm_set1_epi32(CBCR_OFFSET + ONE_HALF-1)));
+    cr[k] = _mm_srli_epi32(cr[k], SCALEBITS);
+  }
+
+  _mm_storeu_si128((__m128i *) outptr0,
+		   _mm_packus_epi16(_mm_packs_epi32(y[0], y[1]),
+				    _mm_packs_epi32(y[2], y[3])));
+  _mm_storeu_si128((__m128i *) outptr1,
+		   _mm_packus_epi16(_mm_packs_epi32(cb[0], cb[1]),
+				    _mm_packs_epi32(cb[2], cb[3])));
+  _mm_storeu_si128((__m128i *) outptr2,
+		   _mm_packus_epi16(_mm_packs_epi32(cr[0], cr[1]),
+				    _mm_packs_epi32(cr[2], cr[3])));
+}
+
+
+/* Fancy upsampling of 16 input samples to 32 outputs.  prev, cur and next
+ * hold the input samples at offsets -1, 0 and +1.  The results are the
+ * 3/4, 1/4 weighted sums formed by h2v1_fancy_upsample.
+ */
+
+SSE2_TARGET ALWAYS_INLINE void
+h2v1_fancy_16_sse2 (__m128i prev, __m128i cur, __m128i next,
+		    JSAMPLE * outptr)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i c3, even, odd;
+  int h;
+
+  for (h = 0; h < 2; h++) {
+    if (h == 0) {
+      c3 = _mm_unpacklo_epi8(cur, zero);
+      even = _mm_unpacklo_epi8(prev, zero);
+      odd = _mm_unpacklo_epi8(next, zero);
+    } else {
+      c3 = _mm_unpackhi_epi8(cur, zero);
+      even = _mm_unpackhi_epi8(prev, zero);
+      odd = _mm_unpackhi_epi8(next, zero);
+    }
+    c3 = _mm_add_epi16(c3, _mm_add_epi16(c3, c3));
+    even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(c3, even),
+					_mm_set1_epi16(1)), 2);
+    odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(c3, odd),
+				       _mm_set1_epi16(2)), 2);
+    _mm_storeu_si128((__m128i *) (outptr + 16*h),
+		     _mm_or_si128(even, _mm_slli_epi16(odd, 8)));
+  }
+}
+
+/* Likewise for h2v2_fancy_upsample, given the two input rows */
+
+SSE2_TARGET ALWAYS_INLINE void
+h2v2_fancy_16_sse2 (__m128i prev0, __m128i cur0, __m128i next0,
+		    __m128i prev1, __m128i cur1, __m128i next1,
+		    JSAMPLE * outptr)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i three = _mm_set1_epi16(3);
+  __m128i c3, p, n, even, odd;
+  int h;
+
+  for (h = 0; h < 2; h++) {
+    /* Column sums 3 * nearer row + further row */
+    if (h == 0) {
+      c3 = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(cur0, zero), three),
+			 _mm_unpacklo_epi8(cur1, zero));
+      p = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(prev0, zero), three),
+			_mm_unpacklo_epi8(prev1, zero));
+      n = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(next0, zero), three),
+			_mm_unpacklo_epi8(next1, zero));
+    } else {
+      c3 = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(cur0, zero), three),
+			 _mm_unpackhi_epi8(cur1, zero));
+      p = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(prev0, zero), three),
+			_mm_unpackhi_epi8(prev1, zero));
+      n = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(next0, zero), three),
+			_mm_unpackhi_epi8(next1, zero));
+    }
+    c3 = _mm_mullo_epi16(c3, three);
+    even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(c3, p),
+					_mm_set1_epi16(8)), 4);
+    odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(c3, n),
+				       _mm_set1_epi16(7)), 4);
+    _mm_storeu_si128((__m128i *) (outptr + 16*h),
+		     _mm_or_si128(even, _mm_slli_epi16(odd, 8)));
+  }
+}
+
+
+/* Fetch the input samples at offsets -1, 0 and +1 from inptr[col] for a
+ * fancy upsampler, for a row of num_cols samples.  The first and last
+ * samples stand in for their missing neighbors, which is what the C code's
+ * special cases for the first and last columns amount to.  The final
+ * partial group comes from a scratch buffer, which must have room for 18
+ * samples.
+ */
+
+SSE2_TARGET ALWAYS_INLINE void
+fancy_load_sse2 (const JSAMPLE * inptr, JDIMENSION col, JDIMENSION num_cols,
+		 JSAMPLE * scratch, __m128i * prev, __m128i * cur,
+		 __m128i * next)
+{
+  int n, i;
+
+  if (col + 16 < num_cols) {
+    *cur = _mm_loadu_si128((const __m128i *) (inptr + col));
+    *next = _mm_loadu_si128((const __m128i *) (inptr + col + 1));
+    if (col > 0)
+      *prev = _mm_loadu_si128((const __m128i *) (inptr + col - 1));
+    else
+      *prev = _mm_or_si128(_mm_slli_si128(*cur, 1),
+			   _mm_and_si128(*cur, _mm_cvtsi32_si128(0xFF)));
+  } else {
+    n = (int) (num_cols - col);
+    scratch[0] = col > 0 ? inptr[col - 1] : inptr[0];
+    MEMCOPY(scratch + 1, inptr + col, n * SIZEOF(JSAMPLE));
+    for (i = n + 1; i < 18; i++)
+      scratch[i] = inptr[num_cols - 1];
+    *prev = _mm_loadu_si128((const __m128i *) scratch);
+    *cur = _mm_loadu_si128((const __m128i *) (scratch + 1));
+    *next = _mm_loadu_si128((const __m128i *) (scratch + 2));
+  }
+}
+
+
+/* The outputs for inputs col..col+15 go straight to the output row, except
+ * for a partial group at the end of the row, which goes through out[].
+ */
+
+#define FANCY_DEST(outptr, col, num_cols, out) \
+  ((col) + 16 <= (num_cols) ? (outptr) + 2 * (col) : (out))
+
+#define FANCY_FINISH(outptr, col, num_cols, out) \
+  { if ((col) + 16 > (num_cols)) \
+      MEMCOPY((outptr) + 2 * (col), out, \
+	      2 * ((num_cols) - (col)) * SIZEOF(JSAMPLE)); }
+
+
+/* 2:1 horizontal and 2:1 vertical downsampling of 16 outputs, as in
+ * h2v1_downsample and h2v2_downsample.  inptr1 is NULL for h2v1.
+ */
+
+SSE2_TARGET ALWAYS_INLINE __m128i
+downsample_8_sse2 (const JSAMPLE * inptr0, const JSAMPLE * inptr1)
+{
+  __m128i mask = _mm_set1_epi16(0xFF);
+  __m128i v, sum;
+
+  v = _mm_loadu_si128((const __m128i *) inptr0);
+  sum = _mm_add_epi16(_mm_and_si128(v, mask), _mm_srli_epi16(v, 8));
+  if (inptr1 == NULL)
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi32(0x10000)), 1);
+  v = _mm_loadu_si128((const __m128i *) inptr1);
+  sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(v, mask),
+					 _mm_srli_epi16(v, 8)));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi32(0x20001)), 2);
+}
+
+
+SSE2_TARGET LOCAL(void)
+ycc_rgb_convert_sse2 (j_decompress_ptr cinfo,
+		      JSAMPIMAGE input_buf, JDIMENSION input_row,
+		      JSAMPARRAY output_buf, int num_rows)
+{
+  while (--num_rows >= 0) {
+    ycc_rgb_row_sse2(input_buf[0][input_row], input_buf[1][input_row],
+		     input_buf[2][input_row], *output_buf++,
+		     cinfo->output_width, FALSE);
+    input_row++;
+  }
+}
+
+
+SSE2_TARGET LOCAL(void)
+rgb_ycc_convert_sse2 (j_compress_ptr cinfo,
+		      JSAMPARRAY input_buf, JSAMPIMAGE output_buf,
+		      JDIMENSION output_row, int num_rows)
+{
+  JSAMPLE rgb[16*3], y[16], cb[16], cr[16];
+  JSAMPROW inptr, outptr0, outptr1, outptr2;
+  JDIMENSION col, num_cols = cinfo->image_width;
+  int n;
+
+  while (--num_rows >= 0) {
+    inptr = *input_buf++;
+    outptr0 = output_buf[0][output_row];
+    outptr1 = output_buf[1][output_row];
+    outptr2 = output_buf[2][output_row];
+    output_row++;
+    for (col = 0; col + 16 <= num_cols; col += 16)
+      rgb_ycc_16_sse2(inptr + col * RGB_PIXELSIZE,
+		      outptr0 + col, outptr1 + col, outptr2 + col);
+    if (col < num_cols) {
+      n = (int) (num_cols - col);
+      MEMZERO(rgb, SIZEOF(rgb));
+      MEMCOPY(rgb, inptr + col * RGB_PIXELSIZE,
+	      n * RGB_PIXELSIZE * SIZEOF(JSAMPLE));
+      rgb_ycc_16_sse2(rgb, y, cb, cr);
+      MEMCOPY(outptr0 + col, y, n * SIZEOF(JSAMPLE));
+      MEMCOPY(outptr1 + col, cb, n * SIZEOF(JSAMPLE));
+      MEMCOPY(outptr2 + col, cr, n * SIZEOF(JSAMPLE));
+    }
+  }
+}
+
+
+SSE2_TARGET LOCAL(void)
+h2v1_fancy_upsample_sse2 (j_decompress_ptr cinfo,
+			  jpeg_component_info * compptr,
+			  JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  JSAMPARRAY output_data = *output_data_ptr;
+  JDIMENSION col, num_cols = compptr->downsampled_width;
+  JSAMPLE scratch[18], out[32];
+  __m128i prev, cur, next;
+  int inrow;
+
+  for (inrow = 0; inrow < cinfo->max_v_samp_factor; inrow++) {
+    for (col = 0; col < num_cols; col += 16) {
+      fancy_load_sse2(input_data[inrow], col, num_cols, scratch,
+		      &prev, &cur, &next);
+      h2v1_fancy_16_sse2(prev, cur, next,
+			 FANCY_DEST(output_data[inrow], col, num_cols, out));
+      FANCY_FINISH(output_data[inrow], col, num_cols, out);
+    }
+  }
+}
+
+
+SSE2_TARGET LOCAL(void)
+h2v2_fancy_upsample_sse2 (j_decompress_ptr cinfo,
+			  jpeg_component_info * compptr,
+			  JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  JSAMPARRAY output_data = *output_data_ptr;
+  JSAMPROW inptr0, inptr1, outptr;
+  JDIMENSION col, num_cols = compptr->downsampled_width;
+  JSAMPLE scratch0[18], scratch1[18], out[32];
+  __m128i prev0, cur0, next0, prev1, cur1, next1;
+  int inrow, outrow, v;
+
+  inrow = outrow = 0;
+  while (outrow < cinfo->max_v_samp_factor) {
+    for (v = 0; v < 2; v++) {
+      /* inptr0 points to nearest input row, inptr1 points to next nearest */
+      inptr0 = input_data[inrow];
+      inptr1 = input_data[v == 0 ? inrow-1 : inrow+1];
+      outptr = output_data[outrow++];
+      for (col = 0; col < num_cols; col += 16) {
+	fancy_load_sse2(inptr0, col, num_cols, scratch0,
+			&prev0, &cur0, &next0);
+	fancy_load_sse2(inptr1, col, num_cols, scratch1,
+			&prev1, &cur1, &next1);
+	h2v2_fancy_16_sse2(prev0, cur0, next0, prev1, cur1, next1,
+			   FANCY_DEST(outptr, col, num_cols, out));
+	FANCY_FINISH(outptr, col, num_cols, out);
+      }
+    }
+    inrow++;
+  }
+}
+
+
+SSE2_TARGET LOCAL(void)
+h2v1_merged_upsample_sse2 (j_decompress_ptr cinfo,
+			   JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			   JSAMPARRAY output_buf)
+{
+  ycc_rgb_row_sse2(input_buf[0][in_row_group_ctr],
+		   input_buf[1][in_row_group_ctr],
+		   input_buf[2][in_row_group_ctr],
+		   output_buf[0], cinfo->output_width, TRUE);
+}
+
+
+SSE2_TARGET LOCAL(void)
+h2v2_merged_upsample_sse2 (j_decompress_ptr cinfo,
+			   JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			   JSAMPARRAY output_buf)
+{
+  ycc_rgb_row_sse2(input_buf[0][in_row_group_ctr*2],
+		   input_buf[1][in_row_group_ctr],
+		   input_buf[2][in_row_group_ctr],
+		   output_buf[0], cinfo->output_width, TRUE);
+  ycc_rgb_row_sse2(input_buf[0][in_row_group_ctr*2 + 1],
+		   input_buf[1][in_row_group_ctr],
+		   input_buf[2][in_row_group_ctr],
+		   output_buf[1], cinfo->output_width, TRUE);
+}
+
+
+/* Replicate the rightmost column of the input out to output_cols, exactly
+ * as jcsample.c does before downsampling.
+ */
+
+LOCAL(void)
+expand_right_edge (JSAMPARRAY image_data, int num_rows,
+		   JDIMENSION input_cols, JDIMENSION output_cols)
+{
+  register JSAMPROW ptr;
+  register JSAMPLE pixval;
+  register int count;
+  int row;
+  int numcols = (int) (output_cols - input_cols);
+
+  if (numcols > 0) {
+    for (row = 0; row < num_rows; row++) {
+      ptr = image_data[row] + input_cols;
+      pixval = ptr[-1];
+      for (count = numcols; count > 0; count--)
+	*ptr++ = pixval;
+    }
+  }
+}
+
+
+SSE2_TARGET LOCAL(void)
+h2v1_downsample_sse2 (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		      JSAMPARRAY input_data, JSAMPARRAY output_data)
+{
+  JDIMENSION outcol, output_cols = compptr->width_in_blocks * DCTSIZE;
+  JSAMPROW inptr, outptr;
+  int outrow;
+
+  expand_right_edge(input_data, cinfo->max_v_samp_factor,
+		    cinfo->image_width, output_cols * 2);
+
+  /* output_cols is a multiple of 8, so there is no ragged end */
+  for (outrow = 0; outrow < compptr->v_samp_factor; outrow++) {
+    outptr = output_data[outrow];
+    inptr = input_data[outrow];
+    for (outcol = 0; outcol + 16 <= output_cols; outcol += 16)
+      _mm_storeu_si128((__m128i *) (outptr + outcol),
+		       _mm_packus_epi16(
+			   downsample_8_sse2(inptr + 2*outcol, NULL),
+			   downsample_8_sse2(inptr + 2*outcol + 16, NULL)));
+    if (outcol < output_cols) {
+      _mm_storel_epi64((__m128i *) (outptr + outcol),
+		       _mm_packus_epi16(
+			   downsample_8_sse2(inptr + 2*outcol, NULL),
+			   _mm_setzero_si128()));
+    }
+  }
+}
+
+
+SSE2_TARGET LOCAL(void)
+h2v2_downsample_sse2 (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		      JSAMPARRAY input_data, JSAMPARRAY output_data)
+{
+  JDIMENSION outcol, output_cols = compptr->width_in_blocks * DCTSIZE;
+  JSAMPROW inptr0, inptr1, outptr;
+  int outrow;
+
+  expand_right_edge(input_data, cinfo->max_v_samp_factor,
+		    cinfo->image_width, output_cols * 2);
+
+  for (outrow = 0; outrow < compptr->v_samp_factor; outrow++) {
+    outptr = output_data[outrow];
+    inptr0 = input_data[2*outrow];
+    inptr1 = input_data[2*outrow + 1];
+    for (outcol = 0; outcol + 16 <= output_cols; outcol += 16)
+      _mm_storeu_si128((__m128i *) (outptr + outcol),
+		       _mm_packus_epi16(
+			   downsample_8_sse2(inptr0 + 2*outcol,
+					     inptr1 + 2*outcol),
+			   downsample_8_sse2(inptr0 + 2*outcol + 16,
+					     inptr1 + 2*outcol + 16)));
+    if (outcol < output_cols) {
+      _mm_storel_epi64((__m128i *) (outptr + outcol),
+		       _mm_packus_epi16(
+			   downsample_8_sse2(inptr0 + 2*outcol,
+					     inptr1 + 2*outcol),
+			   _mm_setzero_si128()));
+    }
+  }
+}
+
+
+/*
+ * Public entry points.
+ */
+
+GLOBAL(int)
+jsimd_can_fdct_islow (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return DCT_TYPES_OK && (simd_support & JSIMD_SSE2);
+}
+
+GLOBAL(int)
+jsimd_can_idct_islow (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return DCT_TYPES_OK && (simd_support & JSIMD_SSE2);
+}
+
+GLOBAL(int)
+jsimd_can_idct_4x4 (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return DCT_TYPES_OK && (simd_support & JSIMD_AVX2);
+}
+
+GLOBAL(int)
+jsimd_can_idct_2x2 (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return DCT_TYPES_OK && (simd_support & JSIMD_AVX2);
+}
+
+
+GLOBAL(void)
+jsimd_fdct_islow (DCTELEM * data)
+{
+  if (simd_support & JSIMD_AVX2)
+    fdct_islow_avx2(data);
+  else
+    fdct_islow_sse2(data);
+}
+
+GLOBAL(void)
+jsimd_idct_islow (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		  JCOEFPTR coef_block,
+		  JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  if (simd_support & JSIMD_AVX2)
+    idct_islow_avx2(cinfo, compptr, coef_block, output_buf, output_col);
+  else
+    idct_islow_sse2(cinfo, compptr, coef_block, output_buf, output_col);
+}
+
+GLOBAL(void)
+jsimd_idct_4x4 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		JCOEFPTR coef_block,
+		JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  idct_4x4_avx2(cinfo, compptr, coef_block, output_buf, output_col);
+}
+
+GLOBAL(void)
+jsimd_idct_2x2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		JCOEFPTR coef_block,
+		JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  idct_2x2_avx2(cinfo, compptr, coef_block, output_buf, output_col);
+}
+
+
+GLOBAL(int)
+jsimd_can_ycc_rgb (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return RGB_LAYOUT_OK && (simd_support & JSIMD_SSE2);
+}
+
+GLOBAL(int)
+jsimd_can_rgb_ycc (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return RGB_LAYOUT_OK && (simd_support & JSIMD_SSE2);
+}
+
+GLOBAL(int)
+jsimd_can_fancy_upsample (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return SIZEOF(JSAMPLE) == 1 && (simd_support & JSIMD_SSE2);
+}
+
+GLOBAL(int)
+jsimd_can_merged_upsample (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return RGB_LAYOUT_OK && (simd_support & JSIMD_SSE2);
+}
+
+GLOBAL(int)
+jsimd_can_downsample (void)
+{
+  if (simd_support < 0)
+    init_simd();
+  return SIZEOF(JSAMPLE) == 1 && (simd_support & JSIMD_SSE2);
+}
+
+
+GLOBAL(void)
+jsimd_ycc_rgb_convert (j_decompress_ptr cinfo,
+		       JSAMPIMAGE input_buf, JDIMENSION input_row,
+		       JSAMPARRAY output_buf, int num_rows)
+{
+  ycc_rgb_convert_sse2(cinfo, input_buf, input_row, output_buf, num_rows);
+}
+
+GLOBAL(void)
+jsimd_rgb_ycc_convert (j_compress_ptr cinfo,
+		       JSAMPARRAY input_buf, JSAMPIMAGE output_buf,
+		       JDIMENSION output_row, int num_rows)
+{
+  rgb_ycc_convert_sse2(cinfo, input_buf, output_buf, output_row, num_rows);
+}
+
+GLOBAL(void)
+jsimd_h2v1_fancy_upsample (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr,
+			   JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  h2v1_fancy_upsample_sse2(cinfo, compptr, input_data, output_data_ptr);
+}
+
+GLOBAL(void)
+jsimd_h2v2_fancy_upsample (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr,
+			   JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  h2v2_fancy_upsample_sse2(cinfo, compptr, input_data, output_data_ptr);
+}
+
+GLOBAL(void)
+jsimd_h2v1_merged_upsample (j_decompress_ptr cinfo,
+			    JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			    JSAMPARRAY output_buf)
+{
+  h2v1_merged_upsample_sse2(cinfo, input_buf, in_row_group_ctr, output_buf);
+}
+
+GLOBAL(void)
+jsimd_h2v2_merged_upsample (j_decompress_ptr cinfo,
+			    JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			    JSAMPARRAY output_buf)
+{
+  h2v2_merged_upsample_sse2(cinfo, input_buf, in_row_group_ctr, output_buf);
+}
+
+GLOBAL(void)
+jsimd_h2v1_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		       JSAMPARRAY input_data, JSAMPARRAY output_data)
+{
+  h2v1_downsample_sse2(cinfo, compptr, input_data, output_data);
+}
+
+GLOBAL(void)
+jsimd_h2v2_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		       JSAMPARRAY input_data, JSAMPARRAY output_data)
+{
+  h2v2_downsample_sse2(cinfo, compptr, input_data, output_data);
+}
+
+
+#else /* ! JSIMD_X86 */
+
+/*
+ * No SIMD support on this system.  The callers never get as far as
+ * calling the jsimd_xxx() routines, but they must still link.
+ */
+
+GLOBAL(int)
+jsimd_can_fdct_islow (void)
+{
+  return 0;
+}
+
+GLOBAL(int)
+jsimd_can_idct_islow (void)
+{
+  return 0;
+}
+
+GLOBAL(int)
+jsimd_can_idct_4x4 (void)
+{
+  return 0;
+}
+
+GLOBAL(int)
+jsimd_can_idct_2x2 (void)
+{
+  return 0;
+}
+
+GLOBAL(void)
+jsimd_fdct_islow (DCTELEM * data)
+{
+}
+
+GLOBAL(void)
+jsimd_idct_islow (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		  JCOEFPTR coef_block,
+		  JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+}
+
+GLOBAL(void)
+jsimd_idct_4x4 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		JCOEFPTR coef_block,
+		JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+}
+
+GLOBAL(void)
+jsimd_idct_2x2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		JCOEFPTR coef_block,
+		JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+}
+
+GLOBAL(int)
+jsimd_can_ycc_rgb (void)
+{
+  return 0;
+}
+
+GLOBAL(int)
+jsimd_can_rgb_ycc (void)
+{
+  return 0;
+}
+
+GLOBAL(int)
+jsimd_can_fancy_upsample (void)
+{
+  return 0;
+}
+
+GLOBAL(int)
+jsimd_can_merged_upsample (void)
+{
+  return 0;
+}
+
+GLOBAL(int)
+jsimd_can_downsample (void)
+{
+  return 0;
+}
+
+GLOBAL(void)
+jsimd_ycc_rgb_convert (j_decompress_ptr cinfo,
+		       JSAMPIMAGE input_buf, JDIMENSION input_row,
+		       JSAMPARRAY output_buf, int num_rows)
+{
+}
+
+GLOBAL(void)
+jsimd_rgb_ycc_convert (j_compress_ptr cinfo,
+		       JSAMPARRAY input_buf, JSAMPIMAGE output_buf,
+		       JDIMENSION output_row, int num_rows)
+{
+}
+
+GLOBAL(void)
+jsimd_h2v1_fancy_upsample (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr,
+			   JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+}
+
+GLOBAL(void)
+jsimd_h2v2_fancy_upsample (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr,
+			   JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+}
+
+GLOBAL(void)
+jsimd_h2v1_merged_upsample (j_decompress_ptr cinfo,
+			    JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			    JSAMPARRAY output_buf)
+{
+}
+
+GLOBAL(void)
+jsimd_h2v2_merged_upsample (j_decompress_ptr cinfo,
+			    JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			    JSAMPARRAY output_buf)
+{
+}
+
+GLOBAL(void)
+jsimd_h2v1_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		       JSAMPARRAY input_data, JSAMPARRAY output_data)
+{
+}
+
+GLOBAL(void)
+jsimd_h2v2_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		       JSAMPARRAY input_data, JSAMPARRAY output_data)
+{
+}
+
+#endif /* JSIMD_X86 */
@@ -0,0 +1,101 @@
+/*
+ * jsimd.h
+ *
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This include file contains declarations for the SIMD (SSE2/AVX2) versions
+ * of some of the library's inner loops: the DCTs, color conversion and
+ * 2:1 up/downsampling.  Each jsimd_can_xxx() routine says
+ * whether the matching jsimd_xxx() routine may be used on this machine;
+ * the caller should fall back on the portable C routine if it returns 0.
+ * The SIMD routines produce exactly the same output as the C routines
+ * they replace.
+ */
+
+
+/* Short forms of external names for systems with brain-damaged linkers. */
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jsimd_can_fdct_islow	jSCFislow
+#define jsimd_can_idct_islow	jSCIislow
+#define jsimd_can_idct_4x4	jSCI4x4
+#define jsimd_can_idct_2x2	jSCI2x2
+#define jsimd_fdct_islow	jSFDislow
+#define jsimd_idct_islow	jSRDislow
+#define jsimd_idct_4x4		jSRD4x4
+#define jsimd_idct_2x2		jSRD2x2
+#define jsimd_can_ycc_rgb	jSCyccrgb
+#define jsimd_can_rgb_ycc	jSCrgbycc
+#define jsimd_can_fancy_upsample	jSCfancyup
+#define jsimd_can_merged_upsample	jSCmergedup
+#define jsimd_can_downsample	jSCdownsamp
+#define jsimd_ycc_rgb_convert	jSyccrgb
+#define jsimd_rgb_ycc_convert	jSrgbycc
+#define jsimd_h2v1_fancy_upsample	jSh2v1fancy
+#define jsimd_h2v2_fancy_upsample	jSh2v2fancy
+#define jsimd_h2v1_merged_upsample	jSh2v1merged
+#define jsimd_h2v2_merged_upsample	jSh2v2merged
+#define jsimd_h2v1_downsample	jSh2v1down
+#define jsimd_h2v2_downsample	jSh2v2down
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+
+/* DCT routines.  These are declared only if jdct.h has been included
+ * first, since the color and sampling modules can't include it (its FIX()
+ * macro collides with theirs).
+ */
+
+#ifdef IDCT_range_limit
+
+EXTERN(int) jsimd_can_fdct_islow JPP((void));
+EXTERN(int) jsimd_can_idct_islow JPP((void));
+EXTERN(int) jsimd_can_idct_4x4 JPP((void));
+EXTERN(int) jsimd_can_idct_2x2 JPP((void));
+
+EXTERN(void) jsimd_fdct_islow JPP((DCTELEM * data));
+
+EXTERN(void) jsimd_idct_islow
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(void) jsimd_idct_4x4
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(void) jsimd_idct_2x2
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+
+#endif /* IDCT_range_limit */
+
+
+/* Color conversion and resampling routines */
+
+EXTERN(int) jsimd_can_ycc_rgb JPP((void));
+EXTERN(int) jsimd_can_rgb_ycc JPP((void));
+EXTERN(int) jsimd_can_fancy_upsample JPP((void));
+EXTERN(int) jsimd_can_merged_upsample JPP((void));
+EXTERN(int) jsimd_can_downsample JPP((void));
+
+EXTERN(void) jsimd_ycc_rgb_convert
+    JPP((j_decompress_ptr cinfo, JSAMPIMAGE input_buf, JDIMENSION input_row,
+	 JSAMPARRAY output_buf, int num_rows));
+EXTERN(void) jsimd_rgb_ycc_convert
+    JPP((j_compress_ptr cinfo, JSAMPARRAY input_buf, JSAMPIMAGE output_buf,
+	 JDIMENSION output_row, int num_rows));
+EXTERN(void) jsimd_h2v1_fancy_upsample
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr));
+EXTERN(void) jsimd_h2v2_fancy_upsample
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr));
+EXTERN(void) jsimd_h2v1_merged_upsample
+    JPP((j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+	 JDIMENSION in_row_group_ctr, JSAMPARRAY output_buf));
+EXTERN(void) jsimd_h2v2_merged_upsample
+    JPP((j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+	 JDIMENSION in_row_group_ctr, JSAMPARRAY output_buf));
+EXTERN(void) jsimd_h2v1_downsample
+    JPP((j_compress_ptr cinfo, jpeg_component_info * compptr,
+	 JSAMPARRAY input_data, JSAMPARRAY output_data));
+EXTERN(void) jsimd_h2v2_downsample
+    JPP((j_compress_ptr cinfo, jpeg_component_info * compptr,
+	 JSAMPARRAY input_data, JSAMPARRAY output_data));
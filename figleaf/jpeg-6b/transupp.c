@@ -62,6 +62,45 @@
  */
 
 
+LOCAL(void)
+do_crop (j_decompress_ptr srcinfo, j_compress_ptr dstinfo,
+	 JDIMENSION x_crop_offset, JDIMENSION y_crop_offset,
+	 jvirt_barray_ptr *src_coef_arrays,
+	 jvirt_barray_ptr *dst_coef_arrays)
+/* Crop.  This is only used without another transform. */
+{
+  JDIMENSION dst_blk_y, x_crop_blocks, y_crop_blocks;
+  int ci, offset_y;
+  JBLOCKARRAY src_buffer, dst_buffer;
+  jpeg_component_info *compptr;
+
+  /* We simply have to copy the right blocks from the source to the
+   * destination, starting at the crop's top left corner; the compressor
+   * makes up the dummy blocks past the edges of the cropped image.
+   */
+  for (ci = 0; ci < dstinfo->num_components; ci++) {
+    compptr = dstinfo->comp_info + ci;
+    x_crop_blocks = x_crop_offset * compptr->h_samp_factor;
+    y_crop_blocks = y_crop_offset * compptr->v_samp_factor;
+    for (dst_blk_y = 0; dst_blk_y < compptr->height_in_blocks;
+	 dst_blk_y += compptr->v_samp_factor) {
+      dst_buffer = (*srcinfo->mem->access_virt_barray)
+	((j_common_ptr) srcinfo, dst_coef_arrays[ci], dst_blk_y,
+	 (JDIMENSION) compptr->v_samp_factor, TRUE);
+      src_buffer = (*srcinfo->mem->access_virt_barray)
+	((j_common_ptr) srcinfo, src_coef_arrays[ci],
+	 dst_blk_y + y_crop_blocks,
+	 (JDIMENSION) compptr->v_samp_factor, FALSE);
+      for (offset_y = 0; offset_y < compptr->v_samp_factor; offset_y++) {
+	jcopy_block_row(src_buffer[offset_y] + x_crop_blocks,
+			dst_buffer[offset_y],
+			compptr->width_in_blocks);
+      }
+    }
+  }
+}
+
+
 LOCAL(void)
 do_flip_h (j_decompress_ptr srcinfo, j_compress_ptr dstinfo,
 	   jvirt_barray_ptr *src_coef_arrays)
@@ -571,6 +610,7 @@ jtransform_request_workspace (j_decompress_ptr srcinfo,
   jvirt_barray_ptr *coef_arrays = NULL;
   jpeg_component_info *compptr;
   int ci;
+  JDIMENSION iMCU_width, iMCU_height;
 
   if (info->force_grayscale &&
       srcinfo->jpeg_color_space == JCS_YCbCr &&
@@ -582,6 +622,58 @@ jtransform_request_workspace (j_decompress_ptr srcinfo,
     info->num_components = srcinfo->num_components;
   }
 
+  if (info->crop) {
+    /* Cropping is only done on its own, and the rectangle has to have
+     * some of the image in it.
+     */
+    if (info->transform != JXFORM_NONE ||
+	info->crop_width == 0 || info->crop_height == 0 ||
+	info->crop_xoffset >= srcinfo->image_width ||
+	info->crop_yoffset >= srcinfo->image_height)
+      ERREXIT(srcinfo, JERR_BAD_CROP_SPEC);
+    /* Move the top left corner to an iMCU boundary, and clip the right
+     * and bottom edges to the image.
+     */
+    iMCU_width = (JDIMENSION) (srcinfo->max_h_samp_factor * DCTSIZE);
+    iMCU_height = (JDIMENSION) (srcinfo->max_v_samp_factor * DCTSIZE);
+    info->x_crop_offset = info->crop_xoffset / iMCU_width;
+    info->y_crop_offset = info->crop_yoffset / iMCU_height;
+    if (info->crop_width > srcinfo->image_width - info->crop_xoffset)
+      info->output_width = srcinfo->image_width;
+    else
+      info->output_width = info->crop_xoffset + info->crop_width;
+    if (info->crop_height > srcinfo->image_height - info->crop_yoffset)
+      info->output_height = srcinfo->image_height;
+    else
+      info->output_height = info->crop_yoffset + info->crop_height;
+    info->output_width -= info->x_crop_offset * iMCU_width;
+    info->output_height -= info->y_crop_offset * iMCU_height;
+    /* Need workspace arrays having the cropped dimensions, padded out to
+     * the next iMCU boundary like the others below.
+     */
+    coef_arrays = (jvirt_barray_ptr *)
+      (*srcinfo->mem->alloc_small) ((j_common_ptr) srcinfo, JPOOL_IMAGE,
+	SIZEOF(jvirt_barray_ptr) * info->num_components);
+    for (ci = 0; ci < info->num_components; ci++) {
+      compptr = srcinfo->comp_info + ci;
+      coef_arrays[ci] = (*srcinfo->mem->request_virt_barray)
+	((j_common_ptr) srcinfo, JPOOL_IMAGE, FALSE,
+	 (JDIMENSION) jround_up((long) jdiv_round_up
+				((long) info->output_width *
+				 (long) compptr->h_samp_factor,
+				 (long) iMCU_width),
+				(long) compptr->h_samp_factor),
+	 (JDIMENSION) jround_up((long) jdiv_round_up
+				((long) info->output_height *
+				 (long) compptr->v_samp_factor,
+				 (long) iMCU_height),
+				(long) compptr->v_samp_factor),
+	 (JDIMENSION) compptr->v_samp_factor);
+    }
+    info->workspace_coef_arrays = coef_arrays;
+    return;
+  }
+
   switch (info->transform) {
   case JXFORM_NONE:
   case JXFORM_FLIP_H:
@@ -760,7 +852,10 @@ jtransform_adjust_parameters (j_decompress_ptr srcinfo,
   /* Correct the destination's image dimensions etc if necessary */
   switch (info->transform) {
   case JXFORM_NONE:
-    /* Nothing to do */
+    if (info->crop) {
+      dstinfo->image_width = info->output_width;
+      dstinfo->image_height = info->output_height;
+    }
     break;
   case JXFORM_FLIP_H:
     if (info->trim)
@@ -825,6 +920,9 @@ jtransform_execute_transformation (j_decompress_ptr srcinfo,
 
   switch (info->transform) {
   case JXFORM_NONE:
+    if (info->crop)
+      do_crop(srcinfo, dstinfo, info->x_crop_offset, info->y_crop_offset,
+	      src_coef_arrays, dst_coef_arrays);
     break;
   case JXFORM_FLIP_H:
     do_flip_h(srcinfo, dstinfo, src_coef_arrays);
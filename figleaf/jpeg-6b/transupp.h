@@ -81,6 +81,13 @@ typedef enum {
  * thing as the rotate/flip transformations, but it's convenient to handle it
  * as part of this package, mainly because the transformation routines have to
  * be aware of the option to know how many components to work on.
+ *
+ * Cropping, too, is done here, though only without another transform.  The
+ * crop rectangle is given in pixels; since whole iMCUs have to be kept, its
+ * top left corner is moved up and left to the nearest iMCU boundary, and
+ * the output is that much bigger.  Its right and bottom edges are clipped
+ * to the image.  The output's dimensions and the offset of its top left
+ * corner in iMCUs are left in the info struct by jtransform_request_workspace.
  */
 
 typedef struct {
@@ -88,6 +95,17 @@ typedef struct {
   JXFORM_CODE transform;	/* image transform operator */
   boolean trim;			/* if TRUE, trim partial MCUs as needed */
   boolean force_grayscale;	/* if TRUE, convert color image to grayscale */
+  boolean crop;			/* if TRUE, crop to the rectangle below */
+  JDIMENSION crop_width;	/* crop rectangle, in pixels */
+  JDIMENSION crop_height;
+  JDIMENSION crop_xoffset;
+  JDIMENSION crop_yoffset;
+
+  /* Results of cropping: set by jtransform_request_workspace */
+  JDIMENSION output_width;	/* cropped image dimensions, in pixels */
+  JDIMENSION output_height;
+  JDIMENSION x_crop_offset;	/* top left corner of the crop, in iMCUs */
+  JDIMENSION y_crop_offset;
 
   /* Internal workspace: caller should not touch these */
   int num_components;		/* # of components in workspace */
@@ -45,6 +45,7 @@
 
 #include <jpeglib.h>
 #include <jutil.h>
+#include "recover.h"
 
 /* Prints a single block */
 
@@ -128,16 +129,22 @@ jpeg_prepare_blocks(struct jpeg_decompress_struct *jsrc)
 {
 	jvirt_barray_ptr *dctcoeff = jpeg_read_coefficients(jsrc);
 	struct jeasy *je;
+	short *slab;
 	int i, j;
 
+	/* struct jeasy only has room for MAX_COMPS_IN_SCAN components */
+	if (jsrc->num_components > MAX_COMPS_IN_SCAN)
+		figleaf_errx("Image has %d components, more than %d",
+		    jsrc->num_components, MAX_COMPS_IN_SCAN);
+
 	if ((je = malloc(sizeof(struct jeasy))) == NULL)
-		err(1, "malloc");
+		figleaf_err("malloc");
 
 	memset(je, 0, sizeof(struct jeasy));
 	je->jinfo = jsrc;
 	je->blocks = malloc(jsrc->num_components * sizeof(short **));
 	if (je->blocks == NULL)
-		err(1, "malloc");
+		figleaf_err("malloc");
 
 	je->comp = jsrc->num_components;
 	/* Read first ten rows of first component */
@@ -152,27 +159,24 @@ jpeg_prepare_blocks(struct jpeg_decompress_struct *jsrc)
 
 		je->blocks[i] = malloc(wib * hib * sizeof(short *));
 		if (je->blocks[i] == NULL)
-			err(1, "malloc");
+			figleaf_err("malloc");
 
-		for (j = 0; j < wib * hib; j++) {
-			je->blocks[i][j] = malloc(DCTSIZE2 * sizeof(short));
-			if (je->blocks[i][j] == NULL)
-				err(1, "malloc");
-		}
+		/* All blocks of a component live in one allocation */
+		slab = malloc((size_t)wib * hib * DCTSIZE2 * sizeof(short));
+		if (slab == NULL)
+			figleaf_err("malloc");
 
-		for (j = 0; j < hib; j++) {
-			JBLOCKROW row;
-			int k, l;
+		for (j = 0; j < wib * hib; j++)
+			je->blocks[i][j] = slab + (size_t)j * DCTSIZE2;
 
-			rows = jsrc->mem->access_virt_barray((j_common_ptr)&jsrc, dctcoeff[i], j, 1, 1);
+		for (j = 0; j < hib; j++) {
+			rows = jsrc->mem->access_virt_barray((j_common_ptr)jsrc, dctcoeff[i], j, 1, 1);
 			if (rows == NULL)
-				errx(1, "Access failed");
+				figleaf_errx("Access failed");
 
-			row = rows[0];
-
-			for (k = 0; k < wib; k++)
-				for (l = 0; l < DCTSIZE2; l++)
-					je->blocks[i][j * wib + k][l] = row[k][l];
+			/* A row of JBLOCKs is contiguous, and so is the slab */
+			memcpy(je->blocks[i][j * wib], rows[0],
+			    wib * sizeof(JBLOCK));
 		}
 	}
 	return (je);
@@ -192,18 +196,12 @@ jpeg_return_blocks(struct jeasy *je, struct jpeg_decompress_struct *jsrc)
 		int hib = jsrc->comp_info[i].height_in_blocks;
 
 		for (j = 0; j < hib; j++) {
-			JBLOCKROW row;
-			int k, l;
-
-			rows = jsrc->mem->access_virt_barray((j_common_ptr)&jsrc, dctcoeff[i], j, 1, 1);
+			rows = jsrc->mem->access_virt_barray((j_common_ptr)jsrc, dctcoeff[i], j, 1, 1);
 			if (rows == NULL)
-				errx(1, "Access failed");
+				figleaf_errx("Access failed");
 
-			row = rows[0];
-
-			for (k = 0; k < wib; k++)
-				for (l = 0; l < DCTSIZE2; l++)
-					row[k][l] = blocks[i][j * wib + k][l];
+			memcpy(rows[0], blocks[i][j * wib],
+			    wib * sizeof(JBLOCK));
 		}
 	}
 
@@ -212,26 +210,60 @@ jpeg_return_blocks(struct jeasy *je, struct jpeg_decompress_struct *jsrc)
 void
 jpeg_free_blocks(struct jeasy *je)
 {
-	int i, j;
+	int i;
 	short ***blocks = je->blocks;
 
 	/* Read first ten rows of first component */
 	for (i = 0; i < je->comp; i++) {
-		int wib = je->width[i];
-		int hib = je->height[i];
-
-		for (j = 0; j < hib; j++) {
-			int k;
-
-			for (k = 0; k < wib; k++)
-				free (blocks[i][j * wib + k]);
-		}
+		/* The first block points at the start of the slab */
+		free(blocks[i][0]);
 		free(blocks[i]);
 	}
 	free(blocks);
 	free(je);
 }
 
+/* Allocate a copy of the blocks, to work on while keeping the original */
+struct jeasy *
+jpeg_clone_blocks(struct jeasy *src)
+{
+	struct jeasy *je;
+	short *slab;
+	int i, j;
+
+	if ((je = malloc(sizeof(struct jeasy))) == NULL)
+		figleaf_err("malloc");
+
+	memcpy(je, src, sizeof(struct jeasy));
+	je->blocks = malloc(src->comp * sizeof(short **));
+	if (je->blocks == NULL)
+		figleaf_err("malloc");
+
+	for (i = 0; i < src->comp; i++) {
+		int nblocks = src->width[i] * src->height[i];
+
+		je->blocks[i] = malloc(nblocks * sizeof(short *));
+		slab = malloc((size_t)nblocks * DCTSIZE2 * sizeof(short));
+		if (je->blocks[i] == NULL || slab == NULL)
+			figleaf_err("malloc");
+		for (j = 0; j < nblocks; j++)
+			je->blocks[i][j] = slab + (size_t)j * DCTSIZE2;
+	}
+	jpeg_copy_blocks(je, src);
+	return (je);
+}
+
+/* Copy the coefficients of src over those of dst, a clone of it */
+void
+jpeg_copy_blocks(struct jeasy *dst, struct jeasy *src)
+{
+	int i;
+
+	for (i = 0; i < src->comp; i++)
+		memcpy(dst->blocks[i][0], src->blocks[i][0],
+		    (size_t)src->width[i] * src->height[i] * DCTSIZE2 * sizeof(short));
+}
+
 int
 diff_horizontal(short *left, short *right)
 {
@@ -44,6 +44,8 @@ int count_all(short *);
 struct jeasy *jpeg_prepare_blocks(struct jpeg_decompress_struct *);
 void jpeg_return_blocks(struct jeasy *, struct jpeg_decompress_struct *);
 void jpeg_free_blocks(struct jeasy *);
+struct jeasy *jpeg_clone_blocks(struct jeasy *);
+void jpeg_copy_blocks(struct jeasy *, struct jeasy *);
 
 void statistic(struct jeasy *);
 
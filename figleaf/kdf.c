@@ -1,9 +1,21 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <err.h>
 #include <sodium.h>
 
 #include "util.h"
+#include "figleaf.h"
+#include "stats.h"
 #include "kdf.h"
+#include "recover.h"
+
+// Cost settings for scrypt and Argon2id, from -k; 0 for the defaults.
+// They're set once, before any keys are derived.
+static unsigned long long kdf_opslimit = 0;
+static size_t kdf_memlimit = 0;
 
 int
 kdf_scrypt(unsigned char *key, int key_len,
@@ -11,8 +23,10 @@ kdf_scrypt(unsigned char *key, int key_len,
            unsigned char *salt, int salt_len)
 {
   // Yuck this code looks horrible and unreadable, but woo it's using scrypt underneath
-  size_t opslimit = crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_INTERACTIVE;
-  size_t memlimit = crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE;
+  unsigned long long opslimit = kdf_opslimit
+    ? kdf_opslimit : crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_INTERACTIVE;
+  size_t memlimit = kdf_memlimit
+    ? kdf_memlimit : crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE;
 
 #if 0
   /* Old libsodium-1.0.5 on CentOS 7 doesn't seem to have these... */
@@ -37,12 +51,36 @@ kdf_scrypt(unsigned char *key, int key_len,
       (key, key_len, (char *)passphrase, passphrase_len, salt_hash,
        opslimit, memlimit) != 0) {
       /* out of memory */
-      errx(1,"Key derivation failed; Probably ran out of memory");
+      figleaf_errx("Key derivation failed; Probably ran out of memory");
   }
 
   return 0;
 }
 
+int
+kdf_argon2id(unsigned char *key, int key_len,
+             unsigned char *passphrase, int passphrase_len,
+             unsigned char *salt, int salt_len)
+{
+  unsigned long long opslimit = kdf_opslimit
+    ? kdf_opslimit : crypto_pwhash_OPSLIMIT_INTERACTIVE;
+  size_t memlimit = kdf_memlimit
+    ? kdf_memlimit : crypto_pwhash_MEMLIMIT_INTERACTIVE;
+
+  // As with scrypt, hash whatever we were given down to a salt
+  unsigned char salt_hash[crypto_pwhash_SALTBYTES] = {0};
+  if(salt != NULL)
+    crypto_generichash(salt_hash, sizeof salt_hash,
+                       salt, salt_len, NULL, 0);
+
+  if (crypto_pwhash(key, key_len, (char *)passphrase, passphrase_len,
+                    salt_hash, opslimit, memlimit,
+                    crypto_pwhash_ALG_ARGON2ID13) != 0)
+    figleaf_errx("Key derivation failed; Probably ran out of memory");
+
+  return 0;
+}
+
 int
 kdf_hash(unsigned char *key, int key_len,
          unsigned char *passphrase, int passphrase_len,
@@ -64,8 +102,6 @@ kdf_hash(unsigned char *key, int key_len,
   return 0;
 }
 
-//#define USE_HKDF 1
-#ifdef USE_HKDF
 int
 kdf_hkdf(unsigned char *key, int key_len,
          unsigned char *passphrase, int passphrase_len,
@@ -79,34 +115,245 @@ kdf_hkdf(unsigned char *key, int key_len,
   // encrypt lots of images, but we don't really care
   // about protection against a real adversary.
 
+  static const unsigned char info[] = "figleaf";
   unsigned char prk[crypto_auth_hmacsha256_BYTES];
-  unsigned char salt_hash[crypto_auth_hmacsha256_BYTES];
+  unsigned char t[crypto_auth_hmacsha256_BYTES];
+  crypto_auth_hmacsha256_state state;
+  int i;
 
-  // Hash the salt to get a key for the first HMAC
-  crypto_hash_sha256(salt_hash, salt, salt_len);
+  if (key_len > 255 * crypto_auth_hmacsha256_BYTES)
+    figleaf_errx("Requested key length is too long");
 
-  // Extract -- Use the (hashed) salt as the HMAC key
+  // Extract -- Use the salt as the HMAC key
   // to derive our pseudorandom key from the passphrase.
-  crypto_auth_hmacsha256(prk, passphrase, passphrase_len, salt_hash);
-
-  // Expand -- Use the pseudorandom key to generate
-  // the required amout of key material.
-  int num_blocks = key_len / crypto_auth_hmacsha256_BYTES + 1;
-  unsigned char *okm = (unsigned char *) calloc(num_blocks, crypto_auth_hmacsha256_BYTES);
-
-  unsigned char *t = NULL;
-  unsigned char *t_prev = NULL;
-  for(i=1; i <= num_blocks; i++) {
-    /* FIXME
-    crypto_auth_hmacsha256(...
-    */
+  crypto_auth_hmacsha256_init(&state, salt, salt_len);
+  crypto_auth_hmacsha256_update(&state, passphrase, passphrase_len);
+  crypto_auth_hmacsha256_final(&state, prk);
+
+  // Expand -- T(i) = HMAC(PRK, T(i-1) | info | i), and the key is
+  // T(1) | T(2) | ... cut off at key_len
+  for (i = 1; key_len > 0; i++) {
+    unsigned char counter = i;
+    crypto_auth_hmacsha256_init(&state, prk, sizeof prk);
+    if (i > 1)
+      crypto_auth_hmacsha256_update(&state, t, sizeof t);
+    crypto_auth_hmacsha256_update(&state, info, sizeof info - 1);
+    crypto_auth_hmacsha256_update(&state, &counter, 1);
+    crypto_auth_hmacsha256_final(&state, t);
+
+    int num_bytes = min(key_len, crypto_auth_hmacsha256_BYTES);
+    memcpy(key, t, num_bytes);
+    key += num_bytes;
+    key_len -= num_bytes;
   }
 
-  memcpy(key, okm, key_len);
-  free(okm);
+  sodium_memzero(prk, sizeof prk);
+  sodium_memzero(t, sizeof t);
   return 0;
 }
-#endif
+
+int
+kdf_master_key(unsigned char *master_key, int key_len,
+               unsigned char *passphrase, int passphrase_len,
+               const unsigned char *salt, int salt_len,
+               key_derivation_fcn kdf)
+{
+  // The master key is only derived once per run, so we can afford to
+  // make it properly expensive.  The files are told apart by the
+  // subkeys; the salt tells corpora apart, so that guesses at the
+  // passphrase can't be worked out ahead of time or shared between them.
+  return kdf(master_key, key_len, passphrase, passphrase_len,
+             (unsigned char *) salt, salt_len);
+}
+
+/* Read a salt in hex from filename; returns 0 if there's no such file */
+static int
+read_master_salt(unsigned char *salt, const char *filename)
+{
+  char hex[2 * KDF_MASTER_SALT_BYTES + 2];
+  size_t len;
+  FILE *f = fopen(filename, "r");
+
+  if (f == NULL) {
+    if (errno == ENOENT)
+      return 0;
+    err(1, "Couldn't open master key salt [%s]", filename);
+  }
+  if (fgets(hex, sizeof hex, f) == NULL)
+    hex[0] = '\0';
+  fclose(f);
+  len = strcspn(hex, "\n");
+  if (len != 2 * KDF_MASTER_SALT_BYTES ||
+      sodium_hex2bin(salt, KDF_MASTER_SALT_BYTES, hex, len,
+                     NULL, NULL, NULL) != 0)
+    errx(1, "Master key salt [%s] must be %d hex digits", filename,
+         2 * KDF_MASTER_SALT_BYTES);
+  return 1;
+}
+
+void
+kdf_master_salt(unsigned char *salt, const char *filename, int create)
+{
+  char hex[2 * KDF_MASTER_SALT_BYTES + 1];
+  FILE *f;
+
+  if (read_master_salt(salt, filename))
+    return;
+  if (!create)
+    errx(1, "No master key salt [%s]; decrypting needs the one the files "
+         "were encrypted with", filename);
+
+  randombytes_buf(salt, KDF_MASTER_SALT_BYTES);
+  sodium_bin2hex(hex, sizeof hex, salt, KDF_MASTER_SALT_BYTES);
+  // "x" so that if another run made it first, we use that one
+  f = fopen(filename, "wx");
+  if (f == NULL) {
+    if (errno == EEXIST && read_master_salt(salt, filename))
+      return;
+    err(1, "Couldn't create master key salt [%s]", filename);
+  }
+  fprintf(f, "%s\n", hex);
+  if (fclose(f) != 0)
+    err(1, "Couldn't write master key salt [%s]", filename);
+  printf("Wrote a new master key salt to [%s]\n", filename);
+}
+
+int
+kdf_subkey(unsigned char *key, int key_len,
+           const unsigned char *master_key, int master_key_len,
+           unsigned char *salt, int salt_len)
+{
+  // A keyed BLAKE2b of the salt: as good as a PRF keyed with the master
+  // key, and about as fast as hashing the filename
+  if (crypto_generichash(key, key_len, salt, salt_len,
+                         master_key, master_key_len) != 0)
+    return -1;
+  return 0;
+}
+
+
+static const struct {
+  const char *name;
+  key_derivation_fcn fcn;
+  int tunable;          // Takes the opslimit and memlimit
+} kdf_table[] = {
+  { "hash",     kdf_hash,     0 },
+  { "hkdf",     kdf_hkdf,     0 },
+  { "scrypt",   kdf_scrypt,   1 },
+  { "argon2id", kdf_argon2id, 1 },
+  { NULL, NULL, 0 }
+};
+
+const char *
+kdf_select(const char *spec, key_derivation_fcn *kdf)
+{
+  size_t name_len = strcspn(spec, ":");
+  int k;
+
+  for (k = 0; kdf_table[k].name != NULL; k++) {
+    if (strlen(kdf_table[k].name) == name_len &&
+        !strncmp(kdf_table[k].name, spec, name_len))
+      break;
+  }
+  if (kdf_table[k].name == NULL)
+    return "Invalid KDF name; use hash, hkdf, scrypt or argon2id";
+  *kdf = kdf_table[k].fcn;
+
+  kdf_opslimit = 0;
+  kdf_memlimit = 0;
+  if (spec[name_len] == '\0')
+    return NULL;
+  if (!kdf_table[k].tunable)
+    return "Only scrypt and argon2id take cost settings";
+
+  char *end;
+  kdf_opslimit = strtoull(spec + name_len + 1, &end, 10);
+  if (*end == ':') {
+    // 0 would quietly mean the default, and too much would wrap around
+    unsigned long long mib = strtoull(end + 1, &end, 10);
+    if (mib == 0 || mib > SIZE_MAX >> 20)
+      return "KDF memlimit must be at least 1 MiB and fit in a size_t";
+    kdf_memlimit = (size_t) mib << 20;
+  }
+  if (*end != '\0' || kdf_opslimit == 0)
+    return "KDF cost must be given as opslimit[:memlimit in MiB]";
+  return NULL;
+}
+
+/* Milliseconds for one derivation, taking the best of a couple of runs
+ * to keep other work on the host from skewing it */
+static double
+kdf_time(key_derivation_fcn kdf)
+{
+  unsigned char key[32];
+  unsigned char passphrase[] = "calibration";
+  unsigned char salt[] = "calibration";
+  double best = 0;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    double start = figleaf_now();
+    kdf(key, sizeof key, passphrase, sizeof passphrase - 1,
+        salt, sizeof salt - 1);
+    double ms = (figleaf_now() - start) * 1000.0;
+    if (i == 0 || ms < best)
+      best = ms;
+  }
+  printf("  opslimit %llu, memlimit %zu MiB: %.1f ms\n",
+         kdf_opslimit, kdf_memlimit >> 20, best);
+  return best;
+}
+
+void
+kdf_calibrate(const char *spec, double target_ms)
+{
+  key_derivation_fcn kdf;
+  const char *error = kdf_select(spec, &kdf);
+  size_t name_len = strcspn(spec, ":");
+
+  if (error != NULL)
+    errx(1, "%s", error);
+  if (kdf != kdf_scrypt && kdf != kdf_argon2id)
+    errx(1, "Only scrypt and argon2id can be calibrated");
+
+  // Keep the memory cost as given (or the default), and find the largest
+  // time cost that stays within the target.  Neither KDF's running time
+  // is smooth in the opslimit (scrypt's goes up in steps), so bracket it
+  // by doubling and then bisect, rather than extrapolating.
+  unsigned long long lo = (kdf == kdf_scrypt)
+    ? crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_MIN : 1;
+  unsigned long long hi;
+  if (kdf_memlimit == 0)
+    kdf_memlimit = (kdf == kdf_scrypt)
+      ? crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE
+      : crypto_pwhash_MEMLIMIT_INTERACTIVE;
+
+  printf("Calibrating %.*s for %.0f ms per derivation\n",
+         (int) name_len, spec, target_ms);
+  kdf_opslimit = lo;
+  if (kdf_time(kdf) > target_ms) {
+    warnx("Even the lowest opslimit is over the target; lower the memlimit");
+    hi = lo;
+  } else {
+    for (;;) {
+      kdf_opslimit = lo * 2;
+      if (kdf_time(kdf) > target_ms)
+        break;
+      lo = kdf_opslimit;
+    }
+    hi = kdf_opslimit;
+    // Stop at a step of 1, or 1/32nd for scrypt's big opslimits
+    while (hi - lo > 1 && hi - lo > lo / 32) {
+      kdf_opslimit = lo + (hi - lo) / 2;
+      if (kdf_time(kdf) > target_ms)
+        hi = kdf_opslimit;
+      else
+        lo = kdf_opslimit;
+    }
+  }
+
+  printf("-k %.*s:%llu:%zu\n", (int) name_len, spec, lo, kdf_memlimit >> 20);
+}
 
 int
 kdf_allzero(unsigned char *key, int keylen,
@@ -1,6 +1,8 @@
 #ifndef KDF_H
 #define KDF_H
 
+#include "figleaf.h"
+
 int
 kdf_scrypt(unsigned char *key, int keylen,
            unsigned char *passphrase, int passphraselen,
@@ -11,6 +13,59 @@ kdf_hash(unsigned char *key, int key_len,
          unsigned char *passphrase, int passphrase_len,
          unsigned char *salt, int salt_len);
 
+int
+kdf_argon2id(unsigned char *key, int key_len,
+             unsigned char *passphrase, int passphrase_len,
+             unsigned char *salt, int salt_len);
+
+int
+kdf_hkdf(unsigned char *key, int key_len,
+         unsigned char *passphrase, int passphrase_len,
+         unsigned char *salt, int salt_len);
+
+/* Stretch the passphrase into a master key once per run, with the given
+ * KDF and the corpus's salt (see kdf_master_salt()), then derive each
+ * file's key from the master key and the file's salt with kdf_subkey(),
+ * which is cheap.  master_key must be crypto_generichash_KEYBYTES long.
+ */
+int
+kdf_master_key(unsigned char *master_key, int key_len,
+               unsigned char *passphrase, int passphrase_len,
+               const unsigned char *salt, int salt_len,
+               key_derivation_fcn kdf);
+
+#define KDF_MASTER_SALT_BYTES 16
+
+/* Read the master key's salt from filename, where it's kept in hex.  So
+ * that the same passphrase gives a different master key for every corpus,
+ * encrypting (with create set) makes the file with a new random salt if
+ * it doesn't exist yet; decrypting needs the one the corpus was encrypted
+ * with.  Exits on error.
+ */
+void
+kdf_master_salt(unsigned char *salt, const char *filename, int create);
+
+int
+kdf_subkey(unsigned char *key, int key_len,
+           const unsigned char *master_key, int master_key_len,
+           unsigned char *salt, int salt_len);
+
+/* Look up the KDF named by spec, which is name[:opslimit[:memlimit]],
+ * with the memlimit in MiB.  hash and hkdf are fast and take no costs;
+ * scrypt and argon2id default to libsodium's INTERACTIVE limits.  The
+ * costs apply to every derivation from then on.  Returns NULL on
+ * success, or a message saying what's wrong.
+ */
+const char *
+kdf_select(const char *spec, key_derivation_fcn *kdf);
+
+/* Time the scrypt or argon2id KDF named by spec on this host, and print
+ * the -k setting whose opslimit comes closest to target_ms per
+ * derivation, at the spec's memlimit (or the default one).
+ */
+void
+kdf_calibrate(const char *spec, double target_ms);
+
 int
 kdf_allzero(unsigned char *key, int keylen,
             unsigned char *passphrase, int passphraselen,
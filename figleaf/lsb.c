@@ -2,11 +2,13 @@
 #include <sodium.h>
 
 #include <math.h>
+#include <string.h>
 #include "jpeglib.h"
 #include "random.h"
 #include "fisheryates.h"
 #include "lsb.h"
 #include "util.h"
+#include "recover.h"
 
 
 /**
@@ -44,12 +46,14 @@ lsb_encrypt(unsigned char *key, unsigned char *nonce,
           "Range must be > 0 and a power of two!\t(%d,%d)", minvalue, maxvalue);
 
   /* Allocate an array which will contain pointers to all pixels in this block */
-  JCOEF **pixel_list = (JCOEF **)calloc(1, datalen * sizeof(JCOEF *));
+  JCOEF **pixel_list =
+    (JCOEF **) figleaf_recover_malloc(datalen * sizeof(JCOEF *));
   ASSERTF(pixel_list != NULL, "Allocation of pixel list failed %d", range);
+  memset(pixel_list, 0, datalen * sizeof(JCOEF *));
 
   /* Use the libsodium stream cipher to generate a stream of pseudorandom bytes */
   size_t kslen = datalen * sizeof(unsigned short);
-  unsigned short *keystream = (unsigned short *) malloc(kslen);
+  unsigned short *keystream = (unsigned short *) figleaf_recover_malloc(kslen);
   int rc = crypto_stream((unsigned char *)keystream, kslen, nonce, key);
   ASSERTF(rc == 0, "crypto_stream failed! rc=%d", rc);
 
@@ -147,7 +151,7 @@ lsb_encrypt(unsigned char *key, unsigned char *nonce,
       pixel_list[j] = tmp;
     }
 
-    free(randomness);
+    figleaf_recover_free(randomness);
   }
 
   /* Prioritize changing higher significance bits first */
@@ -186,8 +190,8 @@ lsb_encrypt(unsigned char *key, unsigned char *nonce,
 
   // Overwrite the keystream so it's not just hanging around in memory
   sodium_memzero(keystream, kslen);
-  free(keystream);
-  free(pixel_list);
+  figleaf_recover_free(keystream);
+  figleaf_recover_free(pixel_list);
 }
 
 void
@@ -232,7 +236,7 @@ lsb_decrypt(unsigned char *key, unsigned char *nonce,
 
   /* Use the libsodium stream cipher to generate a stream of pseudorandom bytes */
   size_t kslen = datalen * sizeof(unsigned short);
-  unsigned short *keystream = (unsigned short *) malloc(kslen);
+  unsigned short *keystream = (unsigned short *) figleaf_recover_malloc(kslen);
   int rc = crypto_stream((unsigned char *)keystream, kslen, nonce, key);
   ASSERTF(rc == 0, "crypto_stream failed! rc=%d", rc);
 
@@ -278,7 +282,7 @@ lsb_decrypt(unsigned char *key, unsigned char *nonce,
 
   // Overwrite the keystream so it's not just hanging around in memory
   sodium_memzero(keystream, kslen);
-  free(keystream);
+  figleaf_recover_free(keystream);
 }
 
 
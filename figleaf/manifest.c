@@ -0,0 +1,524 @@
+#define _POSIX_C_SOURCE 200809L  // for getline(), strdup() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <sodium.h>
+
+#include "figleaf.h"
+#include "batch.h"
+#include "tpe.h"
+#include "fileio.h"
+#include "manifest.h"
+#include "roi.h"
+#include "kdf.h"
+
+// Length of the hashes identifying a job's settings and its output
+#define JOB_HASH_BYTES 16
+
+struct journal_entry {
+  char *output_filename;
+  unsigned char key[JOB_HASH_BYTES];     // Hash of the input and settings
+  unsigned char hash[JOB_HASH_BYTES];    // Hash of the output's contents
+  long long size;
+  long long mtime_sec, mtime_nsec;
+};
+
+/* The settings for one job, which job->ctx points at */
+struct manifest_job {
+  struct figleaf_context ctx;           // Must be first
+  unsigned char key[JOB_HASH_BYTES];
+  char *salt;
+  char *module;
+};
+
+
+/* Journal lookup, by output filename */
+
+static size_t
+hash_string(const char *s)
+{
+  size_t h = 14695981039346656037ULL;  // FNV-1a
+  while (*s)
+    h = (h ^ (unsigned char) *s++) * 1099511628211ULL;
+  return h;
+}
+
+static struct journal_entry **
+journal_slot(struct figleaf_manifest *m, const char *output_filename)
+{
+  size_t i = hash_string(output_filename) & (m->table_size - 1);
+
+  while (m->table[i] != NULL &&
+         strcmp(m->table[i]->output_filename, output_filename))
+    i = (i + 1) & (m->table_size - 1);
+  return &m->table[i];
+}
+
+static void
+journal_insert(struct figleaf_manifest *m, struct journal_entry *e)
+{
+  struct journal_entry **slot;
+  size_t i;
+
+  if (2 * (m->table_count + 1) > m->table_size) {
+    struct journal_entry **old = m->table;
+    size_t old_size = m->table_size;
+    m->table_size = old_size ? old_size * 2 : 1024;
+    m->table = (struct journal_entry **)
+      calloc(m->table_size, sizeof(struct journal_entry *));
+    if (m->table == NULL)
+      err(1, "Couldn't allocate memory for journal");
+    for (i = 0; i < old_size; i++)
+      if (old[i] != NULL)
+        *journal_slot(m, old[i]->output_filename) = old[i];
+    free(old);
+  }
+
+  // Later lines in the journal supersede earlier ones
+  slot = journal_slot(m, e->output_filename);
+  if (*slot != NULL) {
+    free((*slot)->output_filename);
+    free(*slot);
+  } else {
+    m->table_count++;
+  }
+  *slot = e;
+}
+
+static int
+parse_hex(unsigned char *out, size_t len, const char *hex)
+{
+  size_t bin_len;
+  return strlen(hex) == 2 * len &&
+         sodium_hex2bin(out, len, hex, 2 * len, NULL, &bin_len, NULL) == 0 &&
+         bin_len == len;
+}
+
+/* Journal lines are
+ *   key  output-hash  size  mtime-sec  mtime-nsec  output-filename
+ * separated by tabs.  A line cut short by the run being killed is ignored.
+ */
+static void
+journal_load(struct figleaf_manifest *m, const char *journal_filename)
+{
+  FILE *f = fopen(journal_filename, "r");
+  char *line = NULL;
+  size_t line_alloc = 0;
+  ssize_t len;
+
+  if (f == NULL) {
+    if (errno == ENOENT)
+      return;
+    err(1, "Couldn't open journal [%s]", journal_filename);
+  }
+
+  while ((len = getline(&line, &line_alloc, f)) > 0) {
+    if (line[len - 1] != '\n')
+      break;
+    line[len - 1] = '\0';
+
+    char *field[6];
+    char *p = line;
+    int n;
+    for (n = 0; n < 5 && p != NULL; n++) {
+      field[n] = p;
+      p = strchr(p, '\t');
+      if (p != NULL)
+        *p++ = '\0';
+    }
+    if (n < 5 || p == NULL || *p == '\0')
+      continue;
+    field[5] = p;
+
+    struct journal_entry *e = (struct journal_entry *)
+      calloc(1, sizeof(struct journal_entry));
+    if (e == NULL)
+      err(1, "Couldn't allocate memory for journal");
+    if (!parse_hex(e->key, sizeof e->key, field[0]) ||
+        !parse_hex(e->hash, sizeof e->hash, field[1])) {
+      free(e);
+      continue;
+    }
+    e->size = atoll(field[2]);
+    e->mtime_sec = atoll(field[3]);
+    e->mtime_nsec = atoll(field[4]);
+    e->output_filename = strdup(field[5]);
+    if (e->output_filename == NULL)
+      err(1, "Couldn't allocate memory for journal");
+    journal_insert(m, e);
+  }
+
+  free(line);
+  fclose(f);
+}
+
+
+static void
+hash_file(unsigned char *hash, const char *filename)
+{
+  struct figleaf_input in;
+
+  figleaf_input_open(&in, filename);
+  crypto_generichash(hash, JOB_HASH_BYTES, in.data, in.size, NULL, 0);
+  figleaf_input_close(&in);
+}
+
+/* Add the rectangles to the key as the marker records them, after a tag
+ * that keeps different kinds of rectangle apart */
+static void
+hash_roi(crypto_generichash_state *state, const char *tag,
+         const struct figleaf_roi *roi)
+{
+  JOCTET buf[FIGLEAF_ROI_MAX];
+  size_t len = figleaf_roi_format(roi, buf, sizeof buf);
+
+  crypto_generichash_update(state, (const unsigned char *) tag,
+                            strlen(tag) + 1);
+  crypto_generichash_update(state, buf, len);
+}
+
+/* Hash everything that goes into the output: the input file as it is now,
+ * and the settings.
+ */
+static void
+job_key(unsigned char *key, struct figleaf_context *ctx,
+        const char *input_filename, const struct stat *st)
+{
+  crypto_generichash_state state;
+  long long fields[7];
+  int c;
+
+  fields[0] = ctx->mode;
+  fields[1] = ctx->blocksize;
+  fields[2] = ctx->fcn_user_arg;
+  fields[3] = ctx->restart_rows;
+  fields[4] = st->st_size;
+  fields[5] = st->st_mtim.tv_sec;
+  fields[6] = st->st_mtim.tv_nsec;
+
+  crypto_generichash_init(&state, NULL, 0, JOB_HASH_BYTES);
+  crypto_generichash_update(&state, (unsigned char *) fields, sizeof fields);
+  // Strings go in with their terminating NULs, so they can't run together
+  crypto_generichash_update(&state, (unsigned char *) ctx->tpe_method_name,
+                            strlen(ctx->tpe_method_name) + 1);
+  if (ctx->salt_source != NULL)
+    crypto_generichash_update(&state, (unsigned char *) ctx->salt_source,
+                              strlen(ctx->salt_source) + 1);
+  else
+    crypto_generichash_update(&state, (unsigned char *) "", 1);
+  crypto_generichash_update(&state, (unsigned char *) input_filename,
+                            strlen(input_filename) + 1);
+  // Keys from a master key differ from the per-file KDF's, and from
+  // those of a master key with another salt
+  if (ctx->master_key != NULL) {
+    crypto_generichash_update(&state, (unsigned char *) "master", 7);
+    crypto_generichash_update(&state, ctx->master_salt, KDF_MASTER_SALT_BYTES);
+  }
+  if (ctx->kdf_name != NULL)
+    crypto_generichash_update(&state, (unsigned char *) ctx->kdf_name,
+                              strlen(ctx->kdf_name) + 1);
+  if (ctx->mode == FIGLEAF_MODE_ENCRYPT) {
+    for (c = 0; c < MAX_COMPS_IN_SCAN && ctx->quant_tables[c] != NULL; c++)
+      crypto_generichash_update(&state,
+                                (unsigned char *) ctx->quant_tables[c]->quantval,
+                                sizeof ctx->quant_tables[c]->quantval);
+  }
+  // Regions change which tiles are encrypted, and go in the marker
+  if (ctx->roi != NULL)
+    hash_roi(&state, "roi", ctx->roi);
+  // A crop decrypts only part of the image, and keeps only that
+  if (ctx->crop != NULL)
+    hash_roi(&state, "crop", ctx->crop);
+  crypto_generichash_final(&state, key, JOB_HASH_BYTES);
+}
+
+static int
+up_to_date(struct figleaf_manifest *m, const char *output_filename,
+           const unsigned char *key)
+{
+  struct journal_entry *e;
+  struct stat st;
+
+  if (m->table_size == 0)
+    return 0;
+  e = *journal_slot(m, output_filename);
+  if (e == NULL || memcmp(e->key, key, JOB_HASH_BYTES))
+    return 0;
+  if (stat(output_filename, &st) != 0 || st.st_size != e->size)
+    return 0;
+
+  if (m->check_hash) {
+    unsigned char hash[JOB_HASH_BYTES];
+    hash_file(hash, output_filename);
+    return !memcmp(hash, e->hash, JOB_HASH_BYTES);
+  }
+  return st.st_mtim.tv_sec == e->mtime_sec &&
+         st.st_mtim.tv_nsec == e->mtime_nsec;
+}
+
+/* Create the directory the file goes in, and any above it */
+static void
+make_parent_dirs(const char *filename)
+{
+  char *path = strdup(filename);
+  char *p;
+
+  if (path == NULL)
+    err(1, "Couldn't allocate memory for path");
+  for (p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    if (mkdir(path, 0777) != 0 && errno != EEXIST)
+      err(1, "Couldn't create output directory [%s]", path);
+    *p = '/';
+  }
+  free(path);
+}
+
+static void
+manifest_job_free(struct figleaf_job *job)
+{
+  struct manifest_job *mj = (struct manifest_job *) job->ctx;
+
+  free(mj->salt);
+  free(mj->module);
+  free(mj);
+  free(job->input_filename);
+  free(job->output_filename);
+}
+
+/* Split a manifest line into the job, with its settings */
+static void
+manifest_parse(struct figleaf_manifest *m, char *line,
+               struct figleaf_job *job, struct manifest_job *mj)
+{
+  char *field[6] = { NULL };
+  char *p = line;
+  int n;
+
+  for (n = 0; n < 6 && p != NULL; n++) {
+    field[n] = p;
+    p = strchr(p, '\t');
+    if (p != NULL)
+      *p++ = '\0';
+  }
+  if (p != NULL || field[1] == NULL || !*field[0] || !*field[1])
+    errx(1, "%s:%d: expected 2 to 6 tab-separated fields",
+         m->filename, m->line);
+
+  mj->ctx = *m->defaults;
+  if (field[2] != NULL && *field[2]) {
+    if (strcmp(field[2], "-")) {
+      mj->salt = strdup(field[2]);
+      if (mj->salt == NULL)
+        err(1, "Couldn't allocate memory for job");
+    }
+    mj->ctx.salt_source = mj->salt;
+  }
+  if (field[3] != NULL && *field[3] && strcmp(field[3], "-")) {
+    mj->module = strdup(field[3]);
+    if (mj->module == NULL)
+      err(1, "Couldn't allocate memory for job");
+    mj->ctx.tpe_method_name = mj->module;
+  }
+  if (field[4] != NULL && *field[4] && strcmp(field[4], "-"))
+    mj->ctx.blocksize = atoi(field[4]);
+  if (field[5] != NULL && *field[5] && strcmp(field[5], "-"))
+    mj->ctx.fcn_user_arg = atoi(field[5]);
+
+  if (mj->ctx.blocksize <= 0 || mj->ctx.blocksize % 8)
+    errx(1, "%s:%d: blocksize must be a multiple of eight",
+         m->filename, m->line);
+  const char *module_error = tpe_select_module(&mj->ctx);
+  if (module_error != NULL)
+    errx(1, "%s:%d: %s", m->filename, m->line, module_error);
+
+  job->input_filename = strdup(field[0]);
+  job->output_filename = strdup(field[1]);
+  if (job->input_filename == NULL || job->output_filename == NULL)
+    err(1, "Couldn't allocate memory for job");
+  job->ctx = &mj->ctx;
+}
+
+static int
+manifest_next_locked(struct figleaf_manifest *m, struct figleaf_job *job)
+{
+  char *line = NULL;
+  size_t line_alloc = 0;
+  ssize_t len;
+  int found = 0;
+
+  while (!found && (len = getline(&line, &line_alloc, m->file)) > 0) {
+    m->line++;
+    if (line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (len == 0 || line[0] == '#')
+      continue;
+
+    struct manifest_job *mj = (struct manifest_job *)
+      calloc(1, sizeof(struct manifest_job));
+    if (mj == NULL)
+      err(1, "Couldn't allocate memory for job");
+    manifest_parse(m, line, job, mj);
+
+    struct stat st;
+    if (stat(job->input_filename, &st) != 0) {
+      warn("%s:%d: skipping [%s]", m->filename, m->line, job->input_filename);
+      manifest_job_free(job);
+      continue;
+    }
+    job_key(mj->key, &mj->ctx, job->input_filename, &st);
+
+    if (up_to_date(m, job->output_filename, mj->key)) {
+      printf("Skipping [%s]: up to date\n", job->output_filename);
+      m->num_skipped++;
+      manifest_job_free(job);
+      continue;
+    }
+
+    make_parent_dirs(job->output_filename);
+    printf("Found input file [%s]\n", job->input_filename);
+    printf("\tOutput file will be [%s]\n", job->output_filename);
+    found = 1;
+  }
+
+  if (!found && ferror(m->file))
+    err(1, "Couldn't read manifest [%s]", m->filename);
+  free(line);
+  return found;
+}
+
+static int
+manifest_next(struct figleaf_jobs *jobs, struct figleaf_job *job)
+{
+  struct figleaf_manifest *m = (struct figleaf_manifest *) jobs;
+  int found = 1;
+
+  pthread_mutex_lock(&m->lock);
+  if (m->ahead_start < m->ahead_count)
+    *job = m->ahead[m->ahead_start++];
+  else
+    found = manifest_next_locked(m, job);
+  pthread_mutex_unlock(&m->lock);
+  return found;
+}
+
+static size_t
+manifest_prefetch(struct figleaf_jobs *jobs, size_t n)
+{
+  struct figleaf_manifest *m = (struct figleaf_manifest *) jobs;
+
+  m->ahead = (struct figleaf_job *) calloc(n, sizeof(struct figleaf_job));
+  if (m->ahead == NULL)
+    err(1, "Couldn't allocate memory for jobs");
+  while (m->ahead_count < n &&
+         manifest_next_locked(m, &m->ahead[m->ahead_count]))
+    m->ahead_count++;
+  return m->ahead_count;
+}
+
+/* Record the finished job in the journal, unless it failed */
+static void
+manifest_done(struct figleaf_jobs *jobs, struct figleaf_job *job,
+              const void *output, size_t output_size)
+{
+  struct figleaf_manifest *m = (struct figleaf_manifest *) jobs;
+  struct manifest_job *mj = (struct manifest_job *) job->ctx;
+  unsigned char hash[JOB_HASH_BYTES];
+  char key_hex[2 * JOB_HASH_BYTES + 1], hash_hex[2 * JOB_HASH_BYTES + 1];
+  struct stat st;
+
+  // A failed job isn't journalled, so the next run tries it again
+  if (output == NULL) {
+    manifest_job_free(job);
+    return;
+  }
+
+  crypto_generichash(hash, sizeof hash, output, output_size, NULL, 0);
+  if (stat(job->output_filename, &st) != 0)
+    err(1, "Couldn't stat output file [%s]", job->output_filename);
+
+  sodium_bin2hex(key_hex, sizeof key_hex, mj->key, sizeof mj->key);
+  sodium_bin2hex(hash_hex, sizeof hash_hex, hash, sizeof hash);
+  int len = snprintf(NULL, 0, "%s\t%s\t%lld\t%lld\t%lld\t%s\n",
+                     key_hex, hash_hex, (long long) st.st_size,
+                     (long long) st.st_mtim.tv_sec,
+                     (long long) st.st_mtim.tv_nsec, job->output_filename);
+  char *entry = malloc(len + 1);
+  if (entry == NULL)
+    err(1, "Couldn't allocate memory for journal");
+  snprintf(entry, len + 1, "%s\t%s\t%lld\t%lld\t%lld\t%s\n",
+           key_hex, hash_hex, (long long) st.st_size,
+           (long long) st.st_mtim.tv_sec,
+           (long long) st.st_mtim.tv_nsec, job->output_filename);
+
+  // One write() per entry on an O_APPEND file, so entries from different
+  // threads can't interleave
+  if (write(m->journal_fd, entry, len) != len)
+    err(1, "Couldn't write to journal");
+  free(entry);
+
+  pthread_mutex_lock(&m->lock);
+  m->num_done++;
+  pthread_mutex_unlock(&m->lock);
+
+  manifest_job_free(job);
+}
+
+
+void
+figleaf_manifest_init(struct figleaf_manifest *m, const char *filename,
+                      const char *journal_filename, int check_hash,
+                      struct figleaf_context *defaults)
+{
+  memset(m, 0, sizeof(struct figleaf_manifest));
+  m->pub.next = manifest_next;
+  m->pub.prefetch = manifest_prefetch;
+  m->pub.done = manifest_done;
+  pthread_mutex_init(&m->lock, NULL);
+
+  m->filename = filename;
+  m->defaults = defaults;
+  m->check_hash = check_hash;
+
+  m->file = fopen(filename, "r");
+  if (m->file == NULL)
+    err(1, "Couldn't open manifest [%s]", filename);
+
+  journal_load(m, journal_filename);
+  m->journal_fd = open(journal_filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (m->journal_fd < 0)
+    err(1, "Couldn't open journal [%s]", journal_filename);
+}
+
+void
+figleaf_manifest_destroy(struct figleaf_manifest *m)
+{
+  size_t i;
+
+  printf("%zu files processed, %zu already up to date\n",
+         m->num_done, m->num_skipped);
+
+  while (m->ahead_start < m->ahead_count)
+    manifest_job_free(&m->ahead[m->ahead_start++]);
+  for (i = 0; i < m->table_size; i++) {
+    if (m->table[i] != NULL) {
+      free(m->table[i]->output_filename);
+      free(m->table[i]);
+    }
+  }
+  free(m->table);
+  free(m->ahead);
+  if (close(m->journal_fd) != 0)
+    err(1, "Couldn't write to journal");
+  fclose(m->file);
+  pthread_mutex_destroy(&m->lock);
+}
@@ -0,0 +1,70 @@
+#ifndef _MANIFEST_H
+#define _MANIFEST_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "figleaf.h"
+#include "batch.h"
+
+/*
+ * Jobs listed in a manifest file, with a journal of the ones finished.
+ *
+ * Each line of the manifest is one job, as tab-separated fields:
+ *
+ *   input  output  [salt  [module  [blocksize  [arg]]]]
+ *
+ * A missing or empty field takes the setting from the command line.  A
+ * salt of "filename" salts with the input's basename (like -s), "-"
+ * means no salt, and anything else is the salt itself.  Blank lines and
+ * lines starting with '#' are skipped.  Output directories are created
+ * as needed.
+ *
+ * When a job's output has been written, a line recording it is appended
+ * to the journal.  A job is skipped if the journal says its output was
+ * made from the same input (path, size and mtime) with the same settings,
+ * and the output is still as it was then: the same size and mtime, or
+ * with check_hash, the same contents.  So a run that's killed picks up
+ * where it left off, and rerunning over a growing corpus only does the
+ * new files.  The passphrase isn't recorded; start a new journal when
+ * changing it.
+ *
+ * The manifest is read as the jobs are handed out; only the journal is
+ * held in memory.  It's a job source (see batch.h); pass &manifest.pub
+ * to the batch.
+ */
+
+struct journal_entry;
+
+struct figleaf_manifest {
+  struct figleaf_jobs pub;
+  pthread_mutex_t lock;
+
+  FILE *file;
+  const char *filename;
+  int line;                     // Line number of the last line read
+
+  struct figleaf_context *defaults;
+  int check_hash;
+
+  int journal_fd;
+  struct journal_entry **table; // Hash table of journal entries by output
+  size_t table_size, table_count;
+
+  // Jobs read ahead by prefetch, handed out first
+  struct figleaf_job *ahead;
+  size_t ahead_start, ahead_count;
+
+  size_t num_skipped, num_done;
+};
+
+void
+figleaf_manifest_init(struct figleaf_manifest *m, const char *filename,
+                      const char *journal_filename, int check_hash,
+                      struct figleaf_context *defaults);
+
+void
+figleaf_manifest_destroy(struct figleaf_manifest *m);
+
+#endif
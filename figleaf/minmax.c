@@ -48,6 +48,30 @@ minmax_set_debug(int dbg)
   minmax_debug = dbg;
 }
 
+// Coefficients this thread has clamped, for the stats (see stats.h)
+static __thread unsigned long long minmax_clamped = 0;
+
+unsigned long long
+minmax_clamp_count(void)
+{
+  return minmax_clamped;
+}
+
+static void
+minmax_clamp(JCOEF *array, int array_len, int tmp_min, int tmp_max)
+{
+  for (int i = 0; i < array_len; i++) {
+    if (array[i] > tmp_max) {
+      array[i] = tmp_max;
+      minmax_clamped++;
+    }
+    if (array[i] < tmp_min) {
+      array[i] = tmp_min;
+      minmax_clamped++;
+    }
+  }
+}
+
 #define MINMAX_DEBUG(fmt, ...)                               \
   do {                                                       \
     if (minmax_debug)                                        \
@@ -155,12 +179,7 @@ minmax_poweroftwo(JCOEF *array, int array_len,
     MINMAX_DEBUG("  observed_max = %d but returning array_max = %d\n", observed_max, tmp_max);
     MINMAX_DEBUG("  observed_min = %d but returning array_min = %d\n", observed_min, tmp_min);
 
-    for (int i = 0; i < array_len; i++) {
-      if (array[i] > tmp_max)
-        array[i] = tmp_max;
-      if (array[i] < tmp_min)
-        array[i] = tmp_min;
-    }
+    minmax_clamp(array, array_len, tmp_min, tmp_max);
   }
 
   *array_min = tmp_min;
@@ -213,12 +232,7 @@ minmax_average_plusminus_poweroftwo(JCOEF *array, int array_len,
     MINMAX_DEBUG("  observed_max = %d but returning array_max = %d\n", observed_max, tmp_max);
     MINMAX_DEBUG("  observed_min = %d but returning array_min = %d\n", observed_min, tmp_min);
 
-    for (int i = 0; i < array_len; i++) {
-      if (array[i] > tmp_max)
-        array[i] = tmp_max;
-      if (array[i] < tmp_min)
-        array[i] = tmp_min;
-    }
+    minmax_clamp(array, array_len, tmp_min, tmp_max);
   }
 
   *array_min = tmp_min;
@@ -302,12 +316,7 @@ minmax_bitmask(JCOEF *array, int array_len,
     MINMAX_DEBUG("  observed_max = %d but returning array_max = %d\n", observed_max, tmp_max);
     MINMAX_DEBUG("  observed_min = %d but returning array_min = %d\n", observed_min, tmp_min);
 
-    for (int i = 0; i < array_len; i++) {
-      if (array[i] > tmp_max)
-        array[i] = tmp_max;
-      if (array[i] < tmp_min)
-        array[i] = tmp_min;
-    }
+    minmax_clamp(array, array_len, tmp_min, tmp_max);
   }
 
   *array_min = tmp_min;
@@ -411,12 +420,7 @@ minmax_fixedbase_plus_poweroftwo(JCOEF *array, int array_len,
     MINMAX_DEBUG("  observed_max = %d but returning array_max = %d\n", observed_max, tmp_max);
     MINMAX_DEBUG("  observed_min = %d but returning array_min = %d\n", observed_min, tmp_min);
 
-    for (int i = 0; i < array_len; i++) {
-      if (array[i] > tmp_max)
-        array[i] = tmp_max;
-      if (array[i] < tmp_min)
-        array[i] = tmp_min;
-    }
+    minmax_clamp(array, array_len, tmp_min, tmp_max);
   }
 
   *array_min = tmp_min;
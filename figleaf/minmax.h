@@ -6,6 +6,11 @@
 void
 minmax_set_debug(int dbg);
 
+/* How many coefficients the minmax functions have clamped to fit the
+ * ranges they return, on this thread, so far */
+unsigned long long
+minmax_clamp_count(void);
+
 void
 minmax_from_sample(JCOEF *array, int arraylen,
                    int min_param, int max_param,
@@ -0,0 +1,294 @@
+/*
+ * figleaf-mkjpeg: encode a PPM/PGM image at several JPEG qualities at once
+ *
+ * The evaluation datasets take every raw image at a handful of qualities.
+ * Encoding it from scratch for each one repeats the colour conversion,
+ * downsampling and forward DCT, which come out the same every time; only
+ * the quantization differs.  So this runs the jpeg-6b compressor over the
+ * image once, with the FDCT's quantizer turned off (fdct_unquantized in
+ * jpeglib.h) and the entropy coder replaced by one that keeps the blocks.
+ * Then for each quality it divides them by that quality's tables, rounding
+ * the way jcdctmgr.c does, and entropy codes them through
+ * jpeg_write_coefficients().  The files are the same as cjpeg -quality
+ * writes, byte for byte.
+ *
+ * In the output name, %q stands for the quality.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include <unistd.h>
+#include <getopt.h>
+
+#include <cdjpeg.h>  // for jinit_read_ppm()
+#include <jpegint.h>  // for struct jpeg_entropy_encoder
+
+#include "fileio.h"
+#include "recover.h"
+
+#define MAX_QUALITIES 16
+
+extern char *optarg;
+extern int optind;
+
+// rdppm.c's error messages, as cjpeg.c sets them up
+#define JMESSAGE(code,string) string ,
+static const char * const cdjpeg_message_table[] = {
+#include "cderror.h"
+  NULL
+};
+
+/* An entropy coder that just keeps the blocks it's given, one array per
+ * component laid out like the component's block grid */
+struct capture {
+  struct jpeg_entropy_encoder pub;
+  JBLOCK *blocks[MAX_COMPONENTS];
+  JDIMENSION width[MAX_COMPONENTS], height[MAX_COMPONENTS];
+  JDIMENSION mcu_col, mcu_row;
+};
+
+static void
+print_usage(const char *progname)
+{
+  printf("Usage: %s [-q qualities] input.ppm output_template\n"
+         "  -q: Comma-separated JPEG qualities, 1 to 100 (default 75)\n"
+         "  %%q in the output name is replaced with the quality\n",
+         progname);
+}
+
+METHODDEF(void)
+capture_start_pass(j_compress_ptr cinfo, boolean gather_statistics)
+{
+}
+
+METHODDEF(void)
+capture_finish_pass(j_compress_ptr cinfo)
+{
+}
+
+/* Copy the MCU's blocks into place.  Dummy blocks past the edges, which
+ * jpeg_write_coefficients() makes up again, are dropped. */
+METHODDEF(boolean)
+capture_mcu(j_compress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  struct capture *cap = (struct capture *) cinfo->entropy;
+  int blkn = 0, ci, x, y;
+
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+    jpeg_component_info *compptr = cinfo->cur_comp_info[ci];
+    int c = compptr->component_index;
+
+    for (y = 0; y < compptr->MCU_height; y++) {
+      for (x = 0; x < compptr->MCU_width; x++, blkn++) {
+        JDIMENSION bx = cap->mcu_col * compptr->MCU_width + x;
+        JDIMENSION by = cap->mcu_row * compptr->MCU_height + y;
+        if (bx < cap->width[c] && by < cap->height[c])
+          memcpy(cap->blocks[c][by * cap->width[c] + bx], MCU_data[blkn][0],
+                 sizeof(JBLOCK));
+      }
+    }
+  }
+  if (++cap->mcu_col == cinfo->MCUs_per_row) {
+    cap->mcu_col = 0;
+    cap->mcu_row++;
+  }
+  return TRUE;
+}
+
+/* Run the image through colour conversion, downsampling and the FDCT,
+ * leaving the unquantized blocks in cap and the geometry in cinfo */
+static void
+transform_image(j_compress_ptr cinfo, const char *filename,
+                struct capture *cap)
+{
+  struct figleaf_outbuf markers;
+  cjpeg_source_ptr src;
+  int c;
+
+  cinfo->in_color_space = JCS_RGB;  // For now; the file says
+  jpeg_set_defaults(cinfo);
+  src = jinit_read_ppm(cinfo);
+  if ((src->input_file = fopen(filename, "rb")) == NULL)
+    err(1, "Couldn't open [%s]", filename);
+  (*src->start_input)(cinfo, src);
+  jpeg_default_colorspace(cinfo);
+  cinfo->dct_method = JDCT_ISLOW;
+  cinfo->fdct_unquantized = TRUE;
+
+  // The headers written on the way in aren't wanted
+  memset(&markers, 0, sizeof markers);
+  figleaf_mem_dest(cinfo, &markers);
+  jpeg_start_compress(cinfo, TRUE);
+
+  memset(cap, 0, sizeof(struct capture));
+  cap->pub.start_pass = capture_start_pass;
+  cap->pub.encode_mcu = capture_mcu;
+  cap->pub.finish_pass = capture_finish_pass;
+  for (c = 0; c < cinfo->num_components; c++) {
+    cap->width[c] = cinfo->comp_info[c].width_in_blocks;
+    cap->height[c] = cinfo->comp_info[c].height_in_blocks;
+    cap->blocks[c] = (JBLOCK *) malloc((size_t) cap->width[c] *
+                                       cap->height[c] * sizeof(JBLOCK));
+    if (cap->blocks[c] == NULL)
+      err(1, "Couldn't allocate memory for coefficients");
+  }
+  cinfo->entropy = &cap->pub;
+
+  while (cinfo->next_scanline < cinfo->image_height) {
+    JDIMENSION rows = (*src->get_pixel_rows)(cinfo, src);
+    (void) jpeg_write_scanlines(cinfo, src->buffer, rows);
+  }
+  (*src->finish_input)(cinfo, src);
+  fclose(src->input_file);
+  // Nothing was entropy coded, so there's no file to finish
+  jpeg_abort_compress(cinfo);
+  figleaf_outbuf_free(&markers);
+}
+
+/* Quantize the blocks in cap with the tables for quality and entropy
+ * code them into out, with the same settings cjpeg -quality would use */
+static void
+encode_quality(j_compress_ptr enc, j_compress_ptr geometry,
+               const struct capture *cap, int quality,
+               struct figleaf_outbuf *out)
+{
+  jvirt_barray_ptr arrays[MAX_COMPONENTS];
+  JDIMENSION bx, by;
+  int c, k;
+
+  enc->image_width = geometry->image_width;
+  enc->image_height = geometry->image_height;
+  enc->input_components = geometry->input_components;
+  enc->in_color_space = geometry->in_color_space;
+  jpeg_set_defaults(enc);
+  jpeg_set_quality(enc, quality, FALSE);
+
+  for (c = 0; c < geometry->num_components; c++) {
+    jpeg_component_info *compptr = &geometry->comp_info[c];
+    arrays[c] = (*enc->mem->request_virt_barray)
+      ((j_common_ptr) enc, JPOOL_IMAGE, TRUE,
+       (JDIMENSION) jround_up((long) cap->width[c], compptr->h_samp_factor),
+       (JDIMENSION) jround_up((long) cap->height[c], compptr->v_samp_factor),
+       compptr->v_samp_factor);
+  }
+  (*enc->mem->realize_virt_arrays)((j_common_ptr) enc);
+
+  for (c = 0; c < geometry->num_components; c++) {
+    const UINT16 *quantval =
+      enc->quant_tbl_ptrs[enc->comp_info[c].quant_tbl_no]->quantval;
+    int divisors[DCTSIZE2];
+    for (k = 0; k < DCTSIZE2; k++)
+      divisors[k] = quantval[k] << 3;
+    for (by = 0; by < cap->height[c]; by++) {
+      JBLOCKARRAY row = (*enc->mem->access_virt_barray)
+        ((j_common_ptr) enc, arrays[c], by, 1, TRUE);
+      for (bx = 0; bx < cap->width[c]; bx++) {
+        const JCOEF *in = cap->blocks[c][by * cap->width[c] + bx];
+        JCOEF *block = row[0][bx];
+        for (k = 0; k < DCTSIZE2; k++) {
+          // As forward_DCT() in jcdctmgr.c, which scales the divisor by 8;
+          // most coefficients round to zero, so check for that first
+          int v = in[k] < 0 ? -in[k] : in[k];
+          v += divisors[k] >> 1;
+          v = v < divisors[k] ? 0 : v / divisors[k];
+          block[k] = (JCOEF) (in[k] < 0 ? -v : v);
+        }
+      }
+    }
+  }
+
+  figleaf_mem_dest(enc, out);
+  jpeg_write_coefficients(enc, arrays);
+  jpeg_finish_compress(enc);
+}
+
+/* The output name for quality, with %q replaced */
+static void
+output_name(const char *template, int quality, char *name, size_t size)
+{
+  size_t len = 0;
+  const char *p;
+
+  for (p = template; *p; p++) {
+    char str[16] = { *p, '\0' };
+    if (*p == '%' && p[1] == 'q') {
+      snprintf(str, sizeof str, "%d", quality);
+      p++;
+    } else if (*p == '%' && p[1] == '%') {
+      p++;
+    }
+    size_t n = strlen(str);
+    if (len + n >= size)
+      errx(1, "Output name made from [%s] is too long", template);
+    memcpy(name + len, str, n);
+    len += n;
+  }
+  name[len] = '\0';
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct jpeg_compress_struct cinfo, enc;
+  struct jpeg_error_mgr jerr, jerr_enc;
+  struct figleaf_outbuf out;
+  struct capture cap;
+  int qualities[MAX_QUALITIES] = { 75 };
+  int num_qualities = 1, opt, i, c;
+
+  while ((opt = getopt(argc, argv, "q:h")) != -1) {
+    switch (opt) {
+    case 'q':
+      {
+        char *list = optarg, *end;
+        for (num_qualities = 0; *list; list = end + (*end == ',')) {
+          long q = strtol(list, &end, 10);
+          if (end == list || (*end != ',' && *end != '\0') || q < 1 || q > 100)
+            errx(1, "Qualities must be a comma-separated list of 1 to 100");
+          if (num_qualities == MAX_QUALITIES)
+            errx(1, "At most %d qualities at once", MAX_QUALITIES);
+          qualities[num_qualities++] = (int) q;
+        }
+      }
+      break;
+    default:
+      print_usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (argc - optind != 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (num_qualities > 1 && strstr(argv[optind + 1], "%q") == NULL)
+    errx(1, "With more than one quality, the output name needs a %%q");
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jerr.addon_message_table = cdjpeg_message_table;
+  jerr.first_addon_message = JMSG_FIRSTADDONCODE;
+  jerr.last_addon_message = JMSG_LASTADDONCODE;
+  jpeg_create_compress(&cinfo);
+  enc.err = jpeg_std_error(&jerr_enc);
+  jpeg_create_compress(&enc);
+
+  transform_image(&cinfo, argv[optind], &cap);
+
+  figleaf_save_umask();
+  memset(&out, 0, sizeof out);
+  for (i = 0; i < num_qualities; i++) {
+    char name[FILENAME_MAX];
+    encode_quality(&enc, &cinfo, &cap, qualities[i], &out);
+    output_name(argv[optind + 1], qualities[i], name, sizeof name);
+    figleaf_write_file(name, out.data, out.size);
+  }
+
+  for (c = 0; c < cinfo.num_components; c++)
+    free(cap.blocks[c]);
+  figleaf_outbuf_free(&out);
+  jpeg_destroy_compress(&enc);
+  jpeg_destroy_compress(&cinfo);
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+
+#include "parallel.h"
+#include "recover.h"
+
+struct task_state {
+  jpeg_task_ptr task;
+  void *task_arg;
+  int num_tasks;
+  int next_task;          // Index of the next task nobody has claimed yet
+  int failed;             // A task has failed, with this message
+  char message[FIGLEAF_ERROR_LENGTH];
+  pthread_mutex_t lock;   // Protects next_task and the failure
+};
+
+static void *
+task_thread_main(void *arg)
+{
+  struct task_state *state = (struct task_state *) arg;
+  struct figleaf_recover recover;
+  struct figleaf_recover *saved_point = figleaf_recover_point;
+
+  memset(&recover, 0, sizeof(struct figleaf_recover));
+
+  // A failing task can't longjmp out of another thread, or out from under
+  // the threads still working, so it stops the rest of the tasks from
+  // being started, and run_tasks() passes the error on once they're done
+  if (setjmp(recover.env) != 0) {
+    pthread_mutex_lock(&state->lock);
+    if (!state->failed) {
+      state->failed = 1;
+      memcpy(state->message, recover.message, sizeof state->message);
+    }
+    state->next_task = state->num_tasks;
+    pthread_mutex_unlock(&state->lock);
+    figleaf_recover_release(&recover);
+    figleaf_recover_point = saved_point;
+    return NULL;
+  }
+  figleaf_recover_point = &recover;
+
+  for (;;) {
+    pthread_mutex_lock(&state->lock);
+    int i = state->next_task++;
+    pthread_mutex_unlock(&state->lock);
+
+    if (i >= state->num_tasks)
+      break;
+
+    state->task(state->task_arg, i);
+  }
+
+  figleaf_recover_release(&recover);
+  figleaf_recover_point = saved_point;
+  return NULL;
+}
+
+static void
+run_tasks(j_common_ptr cinfo, int num_tasks,
+          jpeg_task_ptr task, void *task_arg)
+{
+  struct figleaf_parallel *p = (struct figleaf_parallel *) cinfo->parallel;
+  struct task_state state;
+  int num_threads = p->pub.max_threads;
+
+  if (num_threads > num_tasks)
+    num_threads = num_tasks;
+
+  state.task = task;
+  state.task_arg = task_arg;
+  state.num_tasks = num_tasks;
+  state.next_task = 0;
+  state.failed = 0;
+  pthread_mutex_init(&state.lock, NULL);
+
+  if (num_threads <= 1) {
+    task_thread_main(&state);
+  } else {
+    // This thread makes up the last of the num_threads
+    pthread_t *threads = (pthread_t *) calloc(num_threads - 1, sizeof(pthread_t));
+    if (threads == NULL)
+      err(1, "Couldn't allocate task threads");
+
+    int t = 0;
+    for (t = 0; t < num_threads - 1; t++) {
+      int rc = pthread_create(&threads[t], NULL, task_thread_main, &state);
+      if (rc != 0)
+        errx(1, "Couldn't start task thread %d; rc = %d", t, rc);
+    }
+    task_thread_main(&state);
+    for (t = 0; t < num_threads - 1; t++)
+      pthread_join(threads[t], NULL);
+
+    free(threads);
+  }
+
+  pthread_mutex_destroy(&state.lock);
+  if (state.failed)
+    figleaf_errx("%s", state.message);
+}
+
+void
+figleaf_parallel_init(struct figleaf_parallel *p, int num_threads)
+{
+  p->pub.run_tasks = run_tasks;
+  p->pub.max_threads = (num_threads < 1) ? 1 : num_threads;
+}
@@ -0,0 +1,22 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stdio.h>
+#include <jpeglib.h>
+
+/*
+ * A jpeg_parallel_mgr that runs libjpeg's tasks on pthreads.
+ *
+ * Hooking one of these into a codec object lets the entropy coder work on
+ * the restart segments of a scan concurrently.  Threads are started for
+ * each batch of tasks and joined before run_tasks returns; the calling
+ * thread works through tasks alongside them.
+ */
+struct figleaf_parallel {
+  struct jpeg_parallel_mgr pub;
+};
+
+void
+figleaf_parallel_init(struct figleaf_parallel *p, int num_threads);
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "figleaf.h"
+#include "worker.h"
+#include "batch.h"
+#include "queue.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "sizes.h"
+#include "recover.h"
+
+// Images that can be in flight beyond one per thread, so the readers
+// can get ahead of the crypt stage
+#define PIPELINE_EXTRA_SLOTS 2
+
+/* One image in flight, with the codec objects it's being processed in */
+struct pipeline_slot {
+  struct figleaf_worker worker;
+  struct figleaf_job job;
+};
+
+struct pipeline_state {
+  struct figleaf_jobs *jobs;
+
+  char *passphrase;
+  struct figleaf_context *ctx;
+
+  // Slots flow free -> to_crypt -> to_write -> free.  A NULL on to_crypt
+  // or to_write tells one thread of that stage that there's nothing more.
+  struct figleaf_queue free_slots;
+  struct figleaf_queue to_crypt;
+  struct figleaf_queue to_write;
+
+  int num_readers, num_crypters, num_writers;
+  int readers_left;       // Threads still running in each of the first
+  int crypters_left;      // two stages; the last one out signals the next
+};
+
+// The settings for the slot's job
+#define JOB_CTX(state, slot) \
+  ((slot)->job.ctx != NULL ? (slot)->job.ctx : (state)->ctx)
+
+/* Record that the slot's job failed, and put the slot back on the free
+ * list without going through the rest of the stages */
+static void
+pipeline_fail(struct pipeline_state *state, struct pipeline_slot *slot)
+{
+  figleaf_failures_add(state->ctx->failures, slot->job.input_filename,
+                       slot->worker.recover.message);
+  state->jobs->done(state->jobs, &slot->job, NULL, 0);
+  figleaf_queue_push(&state->free_slots, slot);
+}
+
+static void *
+pipeline_reader_main(void *arg)
+{
+  struct pipeline_state *state = (struct pipeline_state *) arg;
+  int i;
+
+  for (;;) {
+    struct pipeline_slot *slot = figleaf_queue_pop(&state->free_slots);
+    if (!state->jobs->next(state->jobs, &slot->job)) {
+      figleaf_queue_push(&state->free_slots, slot);
+      break;
+    }
+    if (figleaf_read_image(&slot->worker, slot->job.input_filename,
+                           JOB_CTX(state, slot)) != 0) {
+      pipeline_fail(state, slot);
+      continue;
+    }
+    figleaf_queue_push(&state->to_crypt, slot);
+  }
+
+  if (__atomic_sub_fetch(&state->readers_left, 1, __ATOMIC_ACQ_REL) == 0) {
+    for (i = 0; i < state->num_crypters; i++)
+      figleaf_queue_push(&state->to_crypt, NULL);
+  }
+  return NULL;
+}
+
+static void *
+pipeline_crypt_main(void *arg)
+{
+  struct pipeline_state *state = (struct pipeline_state *) arg;
+  struct pipeline_slot *slot;
+  int i;
+
+  while ((slot = figleaf_queue_pop(&state->to_crypt)) != NULL) {
+    if (figleaf_crypt_image(&slot->worker, slot->job.input_filename,
+                            state->passphrase, JOB_CTX(state, slot)) != 0) {
+      pipeline_fail(state, slot);
+      continue;
+    }
+    figleaf_queue_push(&state->to_write, slot);
+  }
+
+  if (__atomic_sub_fetch(&state->crypters_left, 1, __ATOMIC_ACQ_REL) == 0) {
+    for (i = 0; i < state->num_writers; i++)
+      figleaf_queue_push(&state->to_write, NULL);
+  }
+  return NULL;
+}
+
+static void *
+pipeline_writer_main(void *arg)
+{
+  struct pipeline_state *state = (struct pipeline_state *) arg;
+  struct pipeline_slot *slot;
+
+  while ((slot = figleaf_queue_pop(&state->to_write)) != NULL) {
+    if (figleaf_write_image(&slot->worker, slot->job.output_filename) != 0 ||
+        figleaf_export_image(&slot->worker, state->ctx->dataset,
+                             slot->job.input_filename) != 0) {
+      pipeline_fail(state, slot);
+      continue;
+    }
+    figleaf_stats_log_file(state->ctx->stats_log, slot->job.input_filename,
+                           &slot->worker.stats);
+    figleaf_sizes_log_file(state->ctx->size_log, slot->job.input_filename,
+                           &slot->worker.sizes, slot->worker.stats.bytes_in,
+                           slot->worker.stats.bytes_out);
+    state->jobs->done(state->jobs, &slot->job, slot->worker.outbuf.data,
+                      slot->worker.outbuf.size);
+    figleaf_queue_push(&state->free_slots, slot);
+  }
+  return NULL;
+}
+
+void
+figleaf_run_pipeline(struct figleaf_jobs *jobs,
+                     char *passphrase, struct figleaf_context *ctx)
+{
+  struct pipeline_state state;
+  int num_threads = ctx->num_threads;
+  int num_slots;
+  int t;
+
+  // A third of the threads each to reading and writing, the rest to the
+  // crypt stage
+  state.num_readers = num_threads / 3;
+  if (state.num_readers < 1)
+    state.num_readers = 1;
+  state.num_writers = state.num_readers;
+  state.num_crypters = num_threads - state.num_readers - state.num_writers;
+  if (state.num_crypters < 1)
+    state.num_crypters = 1;
+  num_threads = state.num_readers + state.num_crypters + state.num_writers;
+  num_slots = num_threads + PIPELINE_EXTRA_SLOTS;
+
+  if (jobs->prefetch(jobs, 1) == 0)
+    return;
+
+  state.jobs = jobs;
+  state.passphrase = passphrase;
+  state.ctx = ctx;
+  state.readers_left = state.num_readers;
+  state.crypters_left = state.num_crypters;
+
+  figleaf_queue_init(&state.free_slots, num_slots);
+  figleaf_queue_init(&state.to_crypt, num_slots + state.num_crypters);
+  figleaf_queue_init(&state.to_write, num_slots + state.num_writers);
+
+  struct pipeline_slot *slots = (struct pipeline_slot *)
+    calloc(num_slots, sizeof(struct pipeline_slot));
+  pthread_t *threads = (pthread_t *) calloc(num_threads, sizeof(pthread_t));
+  if (slots == NULL || threads == NULL)
+    err(1, "Couldn't allocate pipeline");
+
+  // Each stage is single-threaded per image, so the codec objects don't
+  // get a task executor of their own
+  for (t = 0; t < num_slots; t++) {
+    figleaf_worker_init(&slots[t].worker, 1);
+    figleaf_worker_share_spare(&slots[t].worker, num_slots);
+    figleaf_queue_push(&state.free_slots, &slots[t]);
+  }
+
+  for (t = 0; t < num_threads; t++) {
+    void *(*thread_main)(void *);
+    if (t < state.num_readers)
+      thread_main = pipeline_reader_main;
+    else if (t < state.num_readers + state.num_crypters)
+      thread_main = pipeline_crypt_main;
+    else
+      thread_main = pipeline_writer_main;
+    int rc = pthread_create(&threads[t], NULL, thread_main, &state);
+    if (rc != 0)
+      errx(1, "Couldn't start pipeline thread %d; rc = %d", t, rc);
+  }
+  for (t = 0; t < num_threads; t++)
+    pthread_join(threads[t], NULL);
+
+  for (t = 0; t < num_slots; t++)
+    figleaf_worker_destroy(&slots[t].worker);
+  free(slots);
+  free(threads);
+  figleaf_queue_destroy(&state.to_write);
+  figleaf_queue_destroy(&state.to_crypt);
+  figleaf_queue_destroy(&state.free_slots);
+}
@@ -0,0 +1,30 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stddef.h>
+
+#include "figleaf.h"
+#include "batch.h"
+
+/*
+ * Process every job from the source as a three-stage pipeline, instead
+ * of one thread taking each file from start to finish (see batch.h):
+ *
+ *   reader threads  map each input file and entropy-decode it
+ *   crypt threads   derive the key and run the TPE construction
+ *   writer threads  entropy-encode and write out the result
+ *
+ * While one file is being written, the next is being encrypted and the
+ * ones after that are being read, so the time spent waiting on storage
+ * overlaps with the computation.  Images move between the stages through
+ * bounded lock-free queues, and a fixed pool of codec objects keeps the
+ * readers from running too far ahead.
+ *
+ * ctx->num_threads threads are shared out among the stages, at least one
+ * each.
+ */
+void
+figleaf_run_pipeline(struct figleaf_jobs *jobs,
+                     char *passphrase, struct figleaf_context *ctx);
+
+#endif
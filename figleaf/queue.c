@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 200809L  // for sem_t under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include "queue.h"
+
+
+void
+figleaf_queue_init(struct figleaf_queue *q, size_t capacity)
+{
+  size_t size = 2;
+  size_t i;
+
+  while (size < capacity)
+    size *= 2;
+
+  q->cells = (struct figleaf_queue_cell *)
+    calloc(size, sizeof(struct figleaf_queue_cell));
+  if (q->cells == NULL)
+    err(1, "Couldn't allocate queue");
+  for (i = 0; i < size; i++)
+    q->cells[i].seq = i;
+  q->mask = size - 1;
+  q->head = 0;
+  q->tail = 0;
+  if (sem_init(&q->items, 0, 0) != 0)
+    err(1, "Couldn't create queue semaphore");
+}
+
+void
+figleaf_queue_destroy(struct figleaf_queue *q)
+{
+  sem_destroy(&q->items);
+  free(q->cells);
+}
+
+/*
+ * A cell whose seq equals the position being pushed is free; after the
+ * push its seq is position + 1, which is what the popper for that
+ * position waits for.  Popping sets it to position + size, ready for the
+ * next lap around the ring.
+ */
+
+void
+figleaf_queue_push(struct figleaf_queue *q, void *item)
+{
+  struct figleaf_queue_cell *cell;
+  size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+  for (;;) {
+    cell = &q->cells[pos & q->mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    ptrdiff_t diff = (ptrdiff_t) (seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      errx(1, "Queue overflow");
+    } else {
+      pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->item = item;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  sem_post(&q->items);
+}
+
+void *
+figleaf_queue_pop(struct figleaf_queue *q)
+{
+  struct figleaf_queue_cell *cell;
+  size_t pos;
+
+  while (sem_wait(&q->items) != 0) {
+    if (errno != EINTR)
+      err(1, "Couldn't wait on queue");
+  }
+
+  pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &q->cells[pos & q->mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    ptrdiff_t diff = (ptrdiff_t) (seq - (pos + 1));
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      // The semaphore says there's an item, but the push that claimed
+      // this cell hasn't filled it in yet; it will in a moment
+      sched_yield();
+      pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    } else {
+      pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  void *item = cell->item;
+  __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+  return item;
+}
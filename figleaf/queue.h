@@ -0,0 +1,46 @@
+#ifndef _QUEUE_H
+#define _QUEUE_H
+
+#include <stddef.h>
+#include <semaphore.h>
+
+/*
+ * A bounded multi-producer, multi-consumer queue of pointers.
+ *
+ * Pushing and popping are lock-free (a ring of sequence-numbered cells,
+ * after Dmitry Vyukov's bounded MPMC queue).  A semaphore counts the
+ * items in the queue so that an idle consumer sleeps in figleaf_queue_pop()
+ * instead of spinning.
+ *
+ * Pushing onto a full queue is a fatal error, so size the queue for the
+ * most items that can ever be in it at once.
+ */
+
+struct figleaf_queue_cell {
+  size_t seq;
+  void *item;
+};
+
+struct figleaf_queue {
+  struct figleaf_queue_cell *cells;
+  size_t mask;              // Number of cells, minus one
+  size_t head;              // Next cell to pop from
+  size_t tail;              // Next cell to push into
+  sem_t items;              // Number of items ready to pop
+};
+
+/* Room for at least capacity items */
+void
+figleaf_queue_init(struct figleaf_queue *q, size_t capacity);
+
+void
+figleaf_queue_destroy(struct figleaf_queue *q);
+
+void
+figleaf_queue_push(struct figleaf_queue *q, void *item);
+
+/* Waits until there's an item to pop */
+void *
+figleaf_queue_pop(struct figleaf_queue *q);
+
+#endif
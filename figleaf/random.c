@@ -3,15 +3,16 @@
 #include <sodium.h>
 
 #include "random.h"
+#include "recover.h"
 
 uint32_t*
 random_uints(unsigned char *key, unsigned char *nonce, int len)
 {
   size_t randomlen = len * sizeof(uint32_t);
-  uint32_t *random_numbers = (uint32_t *) malloc(randomlen);
+  uint32_t *random_numbers = (uint32_t *) figleaf_recover_malloc(randomlen);
   int rc = crypto_stream((unsigned char *)random_numbers, randomlen, nonce, key);
   if (rc != 0)
-    err(1, "Error returned by crypto_stream; rc = %d", rc);
+    figleaf_errx("Error returned by crypto_stream; rc = %d", rc);
   return random_numbers;
 }
 
@@ -19,10 +20,10 @@ uint16_t*
 random_ushorts(unsigned char *key, unsigned char *nonce, int len)
 {
   size_t randomlen = len * sizeof(uint16_t);
-  uint16_t *random_numbers = (uint16_t *) malloc(randomlen);
+  uint16_t *random_numbers = (uint16_t *) figleaf_recover_malloc(randomlen);
   int rc = crypto_stream((unsigned char *)random_numbers, randomlen, nonce, key);
   if (rc != 0)
-    err(1, "Error returned by crypto_stream; rc = %d", rc);
+    figleaf_errx("Error returned by crypto_stream; rc = %d", rc);
   return random_numbers;
 
 }
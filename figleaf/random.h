@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+/* len pseudorandom numbers from the stream cipher, which the caller frees
+ * with figleaf_recover_free() (see recover.h) */
 uint32_t* random_uints(unsigned char *key, unsigned char *nonce, int len);
 
 uint16_t* random_ushorts(unsigned char *key, unsigned char *nonce, int len);
@@ -0,0 +1,179 @@
+#define _POSIX_C_SOURCE 200809L  // for strdup() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <err.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+
+#include "recover.h"
+
+__thread struct figleaf_recover *figleaf_recover_point = NULL;
+
+static void __attribute__((noreturn))
+recover_or_exit(const char *message)
+{
+  struct figleaf_recover *r = figleaf_recover_point;
+
+  if (r == NULL)
+    errx(1, "%s", message);
+  // Whoever catches it sets up the next recovery point
+  figleaf_recover_point = NULL;
+  snprintf(r->message, sizeof r->message, "%s", message);
+  longjmp(r->env, 1);
+}
+
+void
+figleaf_err(const char *fmt, ...)
+{
+  char message[FIGLEAF_ERROR_LENGTH];
+  int saved_errno = errno;
+  va_list ap;
+
+  va_start(ap, fmt);
+  int len = vsnprintf(message, sizeof message, fmt, ap);
+  va_end(ap);
+  if (len >= 0 && (size_t) len < sizeof message)
+    snprintf(message + len, sizeof message - len, ": %s",
+             strerror(saved_errno));
+  recover_or_exit(message);
+}
+
+void
+figleaf_errx(const char *fmt, ...)
+{
+  char message[FIGLEAF_ERROR_LENGTH];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(message, sizeof message, fmt, ap);
+  va_end(ap);
+  recover_or_exit(message);
+}
+
+void *
+figleaf_recover_malloc(size_t size)
+{
+  struct figleaf_recover *r = figleaf_recover_point;
+  void *ptr = malloc(size);
+
+  if (ptr == NULL && size != 0)
+    figleaf_err("Couldn't allocate %zu bytes", size);
+  if (r == NULL)
+    return ptr;
+  if (r->num_owned == r->owned_alloc) {
+    size_t alloc = r->owned_alloc ? r->owned_alloc * 2 : 16;
+    void **owned = (void **) realloc(r->owned, alloc * sizeof(void *));
+    if (owned == NULL) {
+      free(ptr);
+      figleaf_err("Couldn't allocate memory for scratch list");
+    }
+    r->owned = owned;
+    r->owned_alloc = alloc;
+  }
+  r->owned[r->num_owned++] = ptr;
+  return ptr;
+}
+
+void
+figleaf_recover_free(void *ptr)
+{
+  struct figleaf_recover *r = figleaf_recover_point;
+  size_t i;
+
+  // Buffers are mostly freed in the reverse order they were allocated in,
+  // so look from the end
+  if (r != NULL && ptr != NULL) {
+    for (i = r->num_owned; i > 0; i--) {
+      if (r->owned[i - 1] == ptr) {
+        r->owned[i - 1] = r->owned[--r->num_owned];
+        break;
+      }
+    }
+  }
+  free(ptr);
+}
+
+void
+figleaf_recover_release(struct figleaf_recover *r)
+{
+  size_t i;
+
+  for (i = 0; i < r->num_owned; i++)
+    free(r->owned[i]);
+  free(r->owned);
+  r->owned = NULL;
+  r->num_owned = r->owned_alloc = 0;
+}
+
+void
+figleaf_jpeg_error_exit(j_common_ptr cinfo)
+{
+  char message[JMSG_LENGTH_MAX];
+
+  (*cinfo->err->format_message) (cinfo, message);
+  recover_or_exit(message);
+}
+
+
+void
+figleaf_failures_init(struct figleaf_failures *f)
+{
+  memset(f, 0, sizeof(struct figleaf_failures));
+  pthread_mutex_init(&f->lock, NULL);
+}
+
+void
+figleaf_failures_add(struct figleaf_failures *f, const char *name,
+                     const char *message)
+{
+  warnx("Skipping [%s]: %s", name, message);
+  if (f == NULL)
+    return;
+
+  pthread_mutex_lock(&f->lock);
+  if (f->count == f->alloc) {
+    f->alloc = f->alloc ? f->alloc * 2 : 16;
+    f->list = (struct figleaf_failure *)
+      realloc(f->list, f->alloc * sizeof(struct figleaf_failure));
+    if (f->list == NULL)
+      err(1, "Couldn't allocate memory for failure list");
+  }
+  f->list[f->count].name = strdup(name);
+  f->list[f->count].message = strdup(message);
+  if (f->list[f->count].name == NULL || f->list[f->count].message == NULL)
+    err(1, "Couldn't allocate memory for failure list");
+  f->count++;
+  pthread_mutex_unlock(&f->lock);
+}
+
+void
+figleaf_failures_report(struct figleaf_failures *f)
+{
+  size_t i;
+
+  if (f->count == 0)
+    return;
+  fflush(stdout);
+  fprintf(stderr, "%zu file%s failed:\n", f->count, f->count == 1 ? "" : "s");
+  for (i = 0; i < f->count; i++)
+    fprintf(stderr, "  %s: %s\n", f->list[i].name, f->list[i].message);
+}
+
+void
+figleaf_failures_destroy(struct figleaf_failures *f)
+{
+  size_t i;
+
+  for (i = 0; i < f->count; i++) {
+    free(f->list[i].name);
+    free(f->list[i].message);
+  }
+  free(f->list);
+  pthread_mutex_destroy(&f->lock);
+}
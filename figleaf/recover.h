@@ -0,0 +1,96 @@
+#ifndef _RECOVER_H
+#define _RECOVER_H
+
+#include <stddef.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+
+/*
+ * Per-file error recovery.
+ *
+ * While a worker is processing an image it points figleaf_recover_point
+ * at a recovery point it has set up with setjmp() (see worker.c).  Any
+ * error in that image -- libjpeg's, through figleaf_jpeg_error_exit(), or
+ * figleaf's own, through figleaf_err()/figleaf_errx() and ASSERTF -- then
+ * longjmps back there with the message, so the worker can clean up, give
+ * up on that one file and carry on with the next.  With no recovery point
+ * set, they exit like err()/errx() do.
+ *
+ * Only errors that concern the file at hand should go this way; running
+ * out of threads or failing to write the journal still ends the run.
+ *
+ * Scratch buffers that live only while an image is being worked on, like
+ * the encryption kernels' keystreams, come from figleaf_recover_malloc():
+ * the recovery point keeps a list of them, so the ones a longjmp skips
+ * past are freed by figleaf_recover_release() instead of leaking.
+ */
+
+#define FIGLEAF_ERROR_LENGTH 512
+
+struct figleaf_recover {
+  jmp_buf env;
+  char message[FIGLEAF_ERROR_LENGTH];
+  void **owned;           // Scratch buffers not yet freed
+  size_t num_owned, owned_alloc;
+};
+
+extern __thread struct figleaf_recover *figleaf_recover_point;
+
+/* Like err(1, ...) and errx(1, ...) */
+void
+figleaf_err(const char *fmt, ...)
+  __attribute__((noreturn, format(printf, 1, 2)));
+
+void
+figleaf_errx(const char *fmt, ...)
+  __attribute__((noreturn, format(printf, 1, 2)));
+
+/* Like malloc() and free(), but what's allocated while there's a recovery
+ * point is recorded there until it's freed.  Fails the image if there's
+ * no memory. */
+void *
+figleaf_recover_malloc(size_t size);
+
+void
+figleaf_recover_free(void *ptr);
+
+/* Free the scratch buffers r still has, after a longjmp to it */
+void
+figleaf_recover_release(struct figleaf_recover *r);
+
+/* An error_exit method for libjpeg's error manager */
+void
+figleaf_jpeg_error_exit(j_common_ptr cinfo);
+
+
+/* The files that failed, and why, for the report at the end of a run */
+struct figleaf_failure {
+  char *name;
+  char *message;
+};
+
+struct figleaf_failures {
+  pthread_mutex_t lock;
+  struct figleaf_failure *list;
+  size_t count, alloc;
+};
+
+void
+figleaf_failures_init(struct figleaf_failures *f);
+
+/* Record the failure and say we're skipping the file.  Does nothing if f
+ * is NULL. */
+void
+figleaf_failures_add(struct figleaf_failures *f, const char *name,
+                     const char *message);
+
+/* List the failures on stderr, if there were any */
+void
+figleaf_failures_report(struct figleaf_failures *f);
+
+void
+figleaf_failures_destroy(struct figleaf_failures *f);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+#include <jutil.h>
+
+#include "requant.h"
+#include "recover.h"
+
+/* DCT-domain requantization
+ *
+ * Each quantized coefficient c stands for the DCT value c * q_old.  To move
+ * it onto the new table we divide that by q_new, rounding half away from
+ * zero, which is the same rounding the forward DCT's quantizer uses
+ * (see jcdctmgr.c).  So a requantized image is what cjpeg would have given
+ * us from the dequantized coefficients, without the pixel round trip and
+ * its extra rounding error.
+ *
+ * Going to a finer table can push coefficients past what an 8-bit
+ * baseline JPEG can code, so we clamp to +/-1023.
+ */
+
+#define REQUANT_COEF_MAX 1023
+
+static JCOEF
+requant_coef(JCOEF coef, int q_old, int q_new)
+{
+  long v = (long) coef * q_old;
+
+  if (v < 0) {
+    v = -((-v + (q_new >> 1)) / q_new);
+    if (v < -REQUANT_COEF_MAX)
+      v = -REQUANT_COEF_MAX;
+  } else {
+    v = (v + (q_new >> 1)) / q_new;
+    if (v > REQUANT_COEF_MAX)
+      v = REQUANT_COEF_MAX;
+  }
+  return (JCOEF) v;
+}
+
+void
+requant_image(struct jeasy *je, JQUANT_TBL **new_tables)
+{
+  int c, k, blocknum, num_blocks;
+  UINT16 *q_old, *q_new;
+  short *block;
+
+  // There are only tables for the first MAX_COMPS_IN_SCAN components
+  if (je->comp > MAX_COMPS_IN_SCAN)
+    figleaf_errx("Can't requantize an image with %d components", je->comp);
+
+  for (c = 0; c < je->comp; c++) {
+    q_old = je->table[c]->quantval;
+    q_new = new_tables[c]->quantval;
+    if (!memcmp(q_old, q_new, sizeof(new_tables[c]->quantval)))
+      continue;
+
+    num_blocks = je->width[c] * je->height[c];
+    for (blocknum = 0; blocknum < num_blocks; blocknum++) {
+      block = je->blocks[c][blocknum];
+      for (k = 0; k < DCTSIZE2; k++) {
+        if (block[k] != 0 && q_old[k] != q_new[k])
+          block[k] = requant_coef(block[k], q_old[k], q_new[k]);
+      }
+    }
+  }
+}
+
+void
+requant_set_tables(j_compress_ptr cinfo, JQUANT_TBL **new_tables)
+{
+  int ci, cj, tblno;
+  jpeg_component_info *compptr;
+
+  /* Components sharing a new table share a slot, so Cb and Cr still get
+   * just the one DQT entry between them.
+   */
+  tblno = 0;
+  for (ci = 0; ci < cinfo->num_components && ci < MAX_COMPS_IN_SCAN; ci++) {
+    compptr = &cinfo->comp_info[ci];
+    for (cj = 0; cj < ci; cj++) {
+      if (new_tables[cj] == new_tables[ci])
+        break;
+    }
+    if (cj < ci) {
+      compptr->quant_tbl_no = cinfo->comp_info[cj].quant_tbl_no;
+      continue;
+    }
+    if (cinfo->quant_tbl_ptrs[tblno] == NULL)
+      cinfo->quant_tbl_ptrs[tblno] = jpeg_alloc_quant_table((j_common_ptr) cinfo);
+    memcpy(cinfo->quant_tbl_ptrs[tblno]->quantval, new_tables[ci]->quantval,
+           sizeof(new_tables[ci]->quantval));
+    cinfo->quant_tbl_ptrs[tblno]->sent_table = FALSE;
+    compptr->quant_tbl_no = tblno++;
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef _REQUANT_H
+#define _REQUANT_H
+
+#include <jpeglib.h>
+#include <jutil.h>
+
+/* Requantize every block of the image to new_tables[c], working directly
+ * on the quantized DCT coefficients -- no IDCT/FDCT round trip.
+ * There must be a table for every component; an image with more than
+ * MAX_COMPS_IN_SCAN of them fails (see recover.h).
+ */
+void
+requant_image(struct jeasy *je, JQUANT_TBL **new_tables);
+
+/* Point the encoder at the new tables, so the DQT markers it writes
+ * match the requantized coefficients.  Call this after
+ * jpeg_copy_critical_parameters().
+ */
+void
+requant_set_tables(j_compress_ptr cinfo, JQUANT_TBL **new_tables);
+
+#endif
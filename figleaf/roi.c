@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+
+#include "roi.h"
+#include "recover.h"
+
+#define ID_SIZE (sizeof FIGLEAF_ROI_ID)  // Including the NUL
+
+void
+figleaf_roi_init(struct figleaf_roi *roi)
+{
+  memset(roi, 0, sizeof(struct figleaf_roi));
+}
+
+void
+figleaf_roi_destroy(struct figleaf_roi *roi)
+{
+  free(roi->rects);
+}
+
+static void
+add_rect(struct figleaf_roi *roi, const long *v)
+{
+  if (roi->num_rects == roi->alloc) {
+    roi->alloc = roi->alloc ? 2 * roi->alloc : 8;
+    roi->rects = (struct figleaf_roi_rect *)
+                 realloc(roi->rects, roi->alloc * sizeof(struct figleaf_roi_rect));
+    if (roi->rects == NULL)
+      err(1, "Couldn't allocate memory for regions");
+  }
+  roi->rects[roi->num_rects].x = v[0];
+  roi->rects[roi->num_rects].y = v[1];
+  roi->rects[roi->num_rects].w = v[2];
+  roi->rects[roi->num_rects].h = v[3];
+  roi->num_rects++;
+}
+
+/* Read a rectangle written WxH+X+Y into v as x,y,w,h.  Returns 1, or 0
+ * if it isn't one. */
+static int
+parse_geometry(const char *spec, long *v)
+{
+  char extra;
+
+  return sscanf(spec, "%ldx%ld+%ld+%ld %c", &v[2], &v[3], &v[0], &v[1],
+                &extra) == 4 &&
+         v[2] > 0 && v[3] > 0 && v[0] >= 0 && v[1] >= 0;
+}
+
+const char *
+figleaf_roi_parse(struct figleaf_roi *roi, const char *text, size_t len)
+{
+  const char *p = text, *end = text + len;
+  long v[4];
+  int n = 0;
+
+  while (p < end) {
+    // A region with an x in it is written WxH+X+Y, as for --crop
+    size_t entry = 0;
+    while (n == 0 && p + entry < end && p[entry] != ';' &&
+           p[entry] != '\n' && p[entry] != '#')
+      entry++;
+    if (n == 0 && memchr(p, 'x', entry) != NULL) {
+      char spec[64];
+      if (entry >= sizeof spec)
+        return "A region must be x,y,w,h or WxH+X+Y, in pixels";
+      memcpy(spec, p, entry);
+      spec[entry] = '\0';
+      if (!parse_geometry(spec, v))
+        return "A region must be x,y,w,h or WxH+X+Y, in pixels";
+      add_rect(roi, v);
+      p += entry;
+    } else if (*p == '#') {
+      while (p < end && *p != '\n')
+        p++;
+    } else if (*p == ';' || *p == '\n') {
+      if (n != 0 && n != 4)
+        return "A region needs four numbers, x,y,w,h";
+      if (n == 4)
+        add_rect(roi, v);
+      n = 0;
+      p++;
+    } else if (*p == ',' || isspace((unsigned char) *p)) {
+      p++;
+    } else {
+      char digits[24], *digits_end;
+      size_t i;
+      for (i = 0; p + i < end && i < sizeof digits - 1 &&
+                  (isdigit((unsigned char) p[i]) || (i == 0 && p[i] == '-'));
+           i++)
+        digits[i] = p[i];
+      digits[i] = '\0';
+      if (n == 4)
+        return "A region needs four numbers, x,y,w,h";
+      v[n] = strtol(digits, &digits_end, 10);
+      if (i == 0 || digits_end != digits + i)
+        return "Regions must be made of integers";
+      if ((n < 2 && v[n] < 0) || (n >= 2 && v[n] <= 0))
+        return "A region must be inside the image, with a positive size";
+      n++;
+      p += i;
+    }
+  }
+  if (n != 0 && n != 4)
+    return "A region needs four numbers, x,y,w,h";
+  if (n == 4)
+    add_rect(roi, v);
+  if (roi->num_rects == 0)
+    return "No regions given";
+  return NULL;
+}
+
+const char *
+figleaf_roi_parse_crop(struct figleaf_roi *roi, const char *spec)
+{
+  long v[4];
+
+  if (!parse_geometry(spec, v))
+    return "Crop must be WxH+X+Y, in pixels";
+  add_rect(roi, v);
+  return NULL;
+}
+
+const char *
+figleaf_roi_read_file(struct figleaf_roi *roi, const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  char *text = NULL;
+  size_t len = 0, alloc = 0, n;
+
+  if (f == NULL)
+    err(1, "Couldn't open region file [%s]", filename);
+  do {
+    if (len == alloc) {
+      alloc = alloc ? 2 * alloc : 4096;
+      text = (char *) realloc(text, alloc);
+      if (text == NULL)
+        err(1, "Couldn't allocate memory for regions");
+    }
+    n = fread(text + len, 1, alloc - len, f);
+    len += n;
+  } while (n > 0);
+  if (ferror(f))
+    err(1, "Couldn't read region file [%s]", filename);
+  fclose(f);
+
+  const char *error = figleaf_roi_parse(roi, text, len);
+  free(text);
+  return error;
+}
+
+size_t
+figleaf_roi_format(const struct figleaf_roi *roi, JOCTET *buf, size_t size)
+{
+  size_t len = ID_SIZE, i;
+
+  if (size < ID_SIZE)
+    return 0;
+  memcpy(buf, FIGLEAF_ROI_ID, ID_SIZE);
+  for (i = 0; i < roi->num_rects; i++) {
+    const struct figleaf_roi_rect *r = &roi->rects[i];
+    int n = snprintf((char *) buf + len, size - len, "%s%ld,%ld,%ld,%ld",
+                     i ? ";" : "", r->x, r->y, r->w, r->h);
+    if (n < 0 || (size_t) n >= size - len)
+      return 0;
+    len += n;
+  }
+  return len;
+}
+
+int
+figleaf_roi_from_markers(struct figleaf_roi *roi, j_decompress_ptr cinfo)
+{
+  jpeg_saved_marker_ptr m;
+
+  for (m = cinfo->marker_list; m != NULL; m = m->next) {
+    if (m->marker != FIGLEAF_ROI_MARKER || m->data_length < ID_SIZE ||
+        memcmp(m->data, FIGLEAF_ROI_ID, ID_SIZE))
+      continue;
+    roi->num_rects = 0;
+    const char *error = figleaf_roi_parse(roi, (const char *) m->data + ID_SIZE,
+                                          m->data_length - ID_SIZE);
+    if (error != NULL)
+      figleaf_errx("Bad region marker: %s", error);
+    return 1;
+  }
+  return 0;
+}
+
+int
+figleaf_roi_covers(const struct figleaf_roi *roi, const struct jeasy *je,
+                   int c, int x, int y, int blocksize)
+{
+  j_decompress_ptr cinfo = je->jinfo;
+  jpeg_component_info *comp = &cinfo->comp_info[c];
+  // The pixels a block of this component covers, across and down
+  long scale_x = DCTSIZE * cinfo->max_h_samp_factor / comp->h_samp_factor;
+  long scale_y = DCTSIZE * cinfo->max_v_samp_factor / comp->v_samp_factor;
+  long tile = blocksize / DCTSIZE;
+  long left = x * scale_x, right = (x + tile) * scale_x;
+  long top = y * scale_y, bottom = (y + tile) * scale_y;
+  size_t i;
+
+  for (i = 0; i < roi->num_rects; i++) {
+    const struct figleaf_roi_rect *r = &roi->rects[i];
+    if (r->x < right && r->x + r->w > left &&
+        r->y < bottom && r->y + r->h > top)
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef _ROI_H
+#define _ROI_H
+
+#include <stddef.h>
+
+#include <jpeglib.h>
+#include <jutil.h>
+
+/*
+ * Regions of interest, for --roi and --roi-file.
+ *
+ * Often only part of an image needs protecting -- a face, or a block of
+ * text -- so rather than encrypt every tile, figleaf can be given
+ * rectangles in pixels, and then only encrypts the tiles that overlap
+ * them.  The rectangles are snapped outwards to the tile grid of each
+ * component, so a chroma tile, which covers more of the picture than a
+ * luma one with subsampling, is encrypted if any of it is in a rectangle.
+ * Everything else is left as it was, and costs nothing but its entropy
+ * coding.
+ *
+ * Rectangles are written as x,y,w,h, with the top left corner at x,y, or
+ * as WxH+X+Y like --crop, and separated by semicolons or newlines;
+ * whitespace may stand in for the commas, and # starts a comment.  The
+ * encrypted file records them in an APP9 marker (FIGLEAF_ROI_MARKER) that
+ * starts with the identifier FIGLEAF_ROI_ID, followed by the rectangles
+ * as x,y,w,h, and decryption takes them from there.
+ *
+ * Decrypting with --crop uses the same machinery for a viewport: only the
+ * tiles that overlap it are decrypted, and the output is cropped to it
+ * (see figleaf_context.crop).
+ */
+
+#define FIGLEAF_ROI_MARKER (JPEG_APP0 + 9)
+#define FIGLEAF_ROI_ID "FIGLEAF-ROI"  // With its NUL, then the rectangles
+#define FIGLEAF_ROI_MAX 65533         // The most a marker can hold
+
+struct figleaf_roi_rect {
+  long x, y, w, h;
+};
+
+struct figleaf_roi {
+  struct figleaf_roi_rect *rects;
+  size_t num_rects, alloc;
+};
+
+void
+figleaf_roi_init(struct figleaf_roi *roi);
+
+void
+figleaf_roi_destroy(struct figleaf_roi *roi);
+
+/* Add the rectangles in text, len bytes long.  Returns NULL, or what's
+ * wrong with them. */
+const char *
+figleaf_roi_parse(struct figleaf_roi *roi, const char *text, size_t len);
+
+/* Add the rectangle in a crop spec, WxH+X+Y as for jpegtran -crop.
+ * Returns NULL, or what's wrong with it. */
+const char *
+figleaf_roi_parse_crop(struct figleaf_roi *roi, const char *spec);
+
+/* Add the rectangles in a sidecar file; exits if it can't be read.
+ * Returns NULL, or what's wrong with them. */
+const char *
+figleaf_roi_read_file(struct figleaf_roi *roi, const char *filename);
+
+/* Put the contents of the marker recording roi into buf, which is size
+ * bytes long.  Returns its length, or 0 if it doesn't fit. */
+size_t
+figleaf_roi_format(const struct figleaf_roi *roi, JOCTET *buf, size_t size);
+
+/* Fill roi from the input's marker, if the decoder saved one (see
+ * jpeg_save_markers()).  Returns 1 if there was one, or 0 if not; fails
+ * the image (see recover.h) if it can't be read. */
+int
+figleaf_roi_from_markers(struct figleaf_roi *roi, j_decompress_ptr cinfo);
+
+/* Whether any of the tile of component c whose top left block is x,y
+ * falls in one of the rectangles */
+int
+figleaf_roi_covers(const struct figleaf_roi *roi, const struct jeasy *je,
+                   int c, int x, int y, int blocksize);
+
+#endif
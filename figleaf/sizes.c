@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+#include <jpegint.h>  // for jpeg_natural_order
+#include <jutil.h>
+
+#include "sizes.h"
+#include "stats.h"
+#include "recover.h"
+
+// What a symbol missing from a table is charged; only a table built for
+// some other image can be missing one
+#define MISSING_CODE_LENGTH 16
+
+/* Bits in the magnitude of v, as the Huffman coder counts them */
+static int
+magnitude_bits(int v)
+{
+  if (v < 0)
+    v = -v;
+  return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/* The code length of each symbol in the table */
+static void
+code_lengths(const JHUFF_TBL *tbl, unsigned char length[256])
+{
+  int l, i, p = 0;
+
+  memset(length, MISSING_CODE_LENGTH, 256);
+  for (l = 1; l <= 16; l++)
+    for (i = 0; i < tbl->bits[l]; i++)
+      length[tbl->huffval[p++]] = l;
+}
+
+/* Charge the bits for one block, coded after last_dc, to bands.  Returns
+ * the total. */
+static unsigned long long
+count_block(JCOEF *block, int last_dc, const unsigned char *dc_length,
+            const unsigned char *ac_length, unsigned long long *bands)
+{
+  int nbits = magnitude_bits(block[0] - last_dc);
+  unsigned long long total = dc_length[nbits] + nbits;
+  int k, run = 0;
+
+  bands[0] += total;
+
+  for (k = 1; k < DCTSIZE2; k++) {
+    int v = block[jpeg_natural_order[k]];
+    if (v == 0) {
+      run++;
+      continue;
+    }
+    unsigned long long bits = 0;
+    for (; run > 15; run -= 16)
+      bits += ac_length[0xF0];
+    nbits = magnitude_bits(v);
+    bits += ac_length[(run << 4) + nbits] + nbits;
+    bands[k] += bits;
+    total += bits;
+    run = 0;
+  }
+  if (run > 0) {
+    bands[FIGLEAF_SIZE_EOB] += ac_length[0x00];
+    total += ac_length[0x00];
+  }
+  return total;
+}
+
+
+void
+figleaf_sizes_init(struct figleaf_sizes *s)
+{
+  memset(s, 0, sizeof(struct figleaf_sizes));
+}
+
+void
+figleaf_sizes_destroy(struct figleaf_sizes *s)
+{
+  int side, c;
+
+  for (side = 0; side < 2; side++)
+    for (c = 0; c < MAX_COMPONENTS; c++)
+      free(s->tile_bits[side][c]);
+}
+
+/*
+ * The blocks are visited in the order the coder sees them: MCU by MCU
+ * for an interleaved scan, in raster order for a single component.  Where
+ * an MCU hangs off the edge of a component, the encoder codes dummy
+ * blocks with the previous block's DC and no AC (see jctrans.c); those
+ * are charged to the nearest tile.
+ */
+void
+figleaf_sizes_count(struct figleaf_sizes *s, enum figleaf_size_side side,
+                    struct jeasy *je, j_decompress_ptr geometry,
+                    JHUFF_TBL **dc_tables, JHUFF_TBL **ac_tables,
+                    unsigned int restart_interval, int restart_rows,
+                    int tile_blocks)
+{
+  unsigned char dc_length[MAX_COMPONENTS][256], ac_length[MAX_COMPONENTS][256];
+  int tiles_wide[MAX_COMPONENTS];
+  int last_dc[MAX_COMPONENTS];
+  int interleaved = je->comp > 1;
+  unsigned int mcus_per_row, mcu_rows, mcu_x, mcu_y, mcu = 0;
+  int c;
+
+  if (side == FIGLEAF_SIZE_IN)
+    memset(s->bits, 0, sizeof s->bits);
+  else
+    memset(s->bits[side], 0, sizeof s->bits[side]);
+  s->num_components = je->comp;
+
+  for (c = 0; c < je->comp; c++) {
+    int tiles_high = (je->height[c] + tile_blocks - 1) / tile_blocks;
+    size_t n;
+
+    tiles_wide[c] = (je->width[c] + tile_blocks - 1) / tile_blocks;
+    n = (size_t) tiles_wide[c] * tiles_high;
+    if (n > s->tile_alloc[side][c]) {
+      free(s->tile_bits[side][c]);
+      s->tile_bits[side][c] =
+        (unsigned long long *) malloc(n * sizeof(unsigned long long));
+      if (s->tile_bits[side][c] == NULL)
+        figleaf_err("Couldn't allocate memory for tile sizes");
+      s->tile_alloc[side][c] = n;
+    }
+    memset(s->tile_bits[side][c], 0, n * sizeof(unsigned long long));
+    s->num_tiles[c] = n;
+
+    code_lengths(dc_tables[c], dc_length[c]);
+    code_lengths(ac_tables[c], ac_length[c]);
+  }
+
+  if (interleaved) {
+    int mcu_width = geometry->max_h_samp_factor * DCTSIZE;
+    int mcu_height = geometry->max_v_samp_factor * DCTSIZE;
+    mcus_per_row = (geometry->image_width + mcu_width - 1) / mcu_width;
+    mcu_rows = (geometry->image_height + mcu_height - 1) / mcu_height;
+  } else {
+    mcus_per_row = je->width[0];
+    mcu_rows = je->height[0];
+  }
+  // As jcmaster.c works it out from restart_in_rows
+  if (restart_rows > 0) {
+    restart_interval = restart_rows * mcus_per_row;
+    if (restart_interval > 65535)
+      restart_interval = 65535;
+  }
+
+  for (mcu_y = 0; mcu_y < mcu_rows; mcu_y++) {
+    for (mcu_x = 0; mcu_x < mcus_per_row; mcu_x++, mcu++) {
+      if (mcu == 0 || (restart_interval != 0 && mcu % restart_interval == 0))
+        memset(last_dc, 0, sizeof last_dc);
+
+      for (c = 0; c < je->comp; c++) {
+        int h = interleaved ? geometry->comp_info[c].h_samp_factor : 1;
+        int v = interleaved ? geometry->comp_info[c].v_samp_factor : 1;
+        unsigned long long *bands = s->bits[side][c];
+        int xx, yy;
+
+        for (yy = 0; yy < v; yy++) {
+          for (xx = 0; xx < h; xx++) {
+            int bx = mcu_x * h + xx, by = mcu_y * v + yy;
+            unsigned long long bits;
+
+            if (bx < je->width[c] && by < je->height[c]) {
+              JCOEF *block = je->blocks[c][by * je->width[c] + bx];
+              bits = count_block(block, last_dc[c], dc_length[c],
+                                 ac_length[c], bands);
+              last_dc[c] = block[0];
+            } else {
+              bits = dc_length[c][0] + ac_length[c][0x00];
+              bands[0] += dc_length[c][0];
+              bands[FIGLEAF_SIZE_EOB] += ac_length[c][0x00];
+              if (bx >= je->width[c])
+                bx = je->width[c] - 1;
+              if (by >= je->height[c])
+                by = je->height[c] - 1;
+            }
+            s->tile_bits[side][c][(by / tile_blocks) * tiles_wide[c] +
+                                  bx / tile_blocks] += bits;
+          }
+        }
+      }
+    }
+  }
+}
+
+
+void
+figleaf_sizes_log_open(struct figleaf_sizes_log *log, const char *filename,
+                       const char *module, int arg, int blocksize)
+{
+  memset(log, 0, sizeof(struct figleaf_sizes_log));
+  log->file = fopen(filename, "w");
+  if (log->file == NULL)
+    err(1, "Couldn't open size report [%s]", filename);
+  pthread_mutex_init(&log->lock, NULL);
+  log->module = module;
+  log->arg = arg;
+  log->blocksize = blocksize;
+}
+
+static void
+json_bits(FILE *f, const char *key, const unsigned long long *bands)
+{
+  int k;
+
+  fprintf(f, "\"%s\":[", key);
+  for (k = 0; k < FIGLEAF_SIZE_BANDS; k++)
+    fprintf(f, "%s%llu", k ? "," : "", bands[k]);
+  putc(']', f);
+}
+
+static unsigned long long
+sum_bits(const unsigned long long *bands)
+{
+  unsigned long long total = 0;
+  int k;
+
+  for (k = 0; k < FIGLEAF_SIZE_BANDS; k++)
+    total += bands[k];
+  return total;
+}
+
+static int
+compare_long_long(const void *a, const void *b)
+{
+  long long x = *(const long long *) a, y = *(const long long *) b;
+  return (x > y) - (x < y);
+}
+
+void
+figleaf_sizes_log_file(struct figleaf_sizes_log *log, const char *name,
+                       const struct figleaf_sizes *s,
+                       unsigned long long bytes_in,
+                       unsigned long long bytes_out)
+{
+  int c, k;
+
+  if (log == NULL)
+    return;
+
+  pthread_mutex_lock(&log->lock);
+  fputs("{\"file\":", log->file);
+  figleaf_json_string(log->file, name);
+  fprintf(log->file, ",\"bytes_in\":%llu,\"bytes_out\":%llu,\"components\":[",
+          bytes_in, bytes_out);
+  for (c = 0; c < s->num_components; c++) {
+    size_t n = s->num_tiles[c], i;
+    long long *added = (long long *) malloc((n ? n : 1) * sizeof(long long));
+
+    if (added == NULL)
+      err(1, "Couldn't allocate memory for the size report");
+    fputs(c ? ",{" : "{", log->file);
+    json_bits(log->file, "bits_in", s->bits[FIGLEAF_SIZE_IN][c]);
+    putc(',', log->file);
+    json_bits(log->file, "bits_out", s->bits[FIGLEAF_SIZE_OUT][c]);
+
+    // How much each tile grew, as the median, 90th percentile and most
+    for (i = 0; i < n; i++)
+      added[i] = (long long) s->tile_bits[FIGLEAF_SIZE_OUT][c][i] -
+                 (long long) s->tile_bits[FIGLEAF_SIZE_IN][c][i];
+    qsort(added, n, sizeof(long long), compare_long_long);
+    fprintf(log->file, ",\"tiles\":%zu,\"tile_bits_added\":[%lld,%lld,%lld]}",
+            n, n ? added[n / 2] : 0, n ? added[n * 9 / 10] : 0,
+            n ? added[n - 1] : 0);
+    free(added);
+
+    for (k = 0; k < FIGLEAF_SIZE_BANDS; k++) {
+      log->bits[FIGLEAF_SIZE_IN][c][k] += s->bits[FIGLEAF_SIZE_IN][c][k];
+      log->bits[FIGLEAF_SIZE_OUT][c][k] += s->bits[FIGLEAF_SIZE_OUT][c][k];
+    }
+  }
+  fputs("]}\n", log->file);
+
+  if (s->num_components > log->num_components)
+    log->num_components = s->num_components;
+  log->num_files++;
+  log->bytes_in += bytes_in;
+  log->bytes_out += bytes_out;
+  pthread_mutex_unlock(&log->lock);
+}
+
+void
+figleaf_sizes_log_close(struct figleaf_sizes_log *log)
+{
+  int c;
+
+  fputs("{\"run\":{\"module\":", log->file);
+  figleaf_json_string(log->file, log->module);
+  fprintf(log->file, ",\"arg\":%d,\"blocksize\":%d,\"files\":%llu,"
+                     "\"bytes_in\":%llu,\"bytes_out\":%llu,"
+                     "\"expansion\":%.4f,\"components\":[",
+          log->arg, log->blocksize, log->num_files,
+          log->bytes_in, log->bytes_out,
+          log->bytes_in ? (double) log->bytes_out / log->bytes_in : 0);
+  for (c = 0; c < log->num_components; c++) {
+    unsigned long long in = sum_bits(log->bits[FIGLEAF_SIZE_IN][c]);
+    unsigned long long out = sum_bits(log->bits[FIGLEAF_SIZE_OUT][c]);
+
+    fprintf(log->file, "%s{\"bytes_in\":%llu,\"bytes_out\":%llu,"
+                       "\"expansion\":%.4f,",
+            c ? "," : "", in / 8, out / 8, in ? (double) out / in : 0);
+    json_bits(log->file, "bits_in", log->bits[FIGLEAF_SIZE_IN][c]);
+    putc(',', log->file);
+    json_bits(log->file, "bits_out", log->bits[FIGLEAF_SIZE_OUT][c]);
+    putc('}', log->file);
+  }
+  fputs("]}}\n", log->file);
+  if (fclose(log->file) != 0)
+    err(1, "Couldn't write size report");
+  pthread_mutex_destroy(&log->lock);
+}
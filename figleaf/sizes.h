@@ -0,0 +1,100 @@
+#ifndef _SIZES_H
+#define _SIZES_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+#include <jutil.h>
+
+/*
+ * Where the bytes go, for --size-report.
+ *
+ * Encryption grows the file by very different amounts depending on the
+ * module: lsb fills in AC coefficients that were zero, the -nz variants
+ * leave them alone.  To see where, each image's coefficients are run
+ * through the baseline Huffman coder's arithmetic twice, as they came in
+ * and as they're about to be encoded, and every bit is charged to its
+ * component, zigzag band and TPE tile.  A coefficient's band is charged
+ * with the code for it and for the run of zeros before it; end-of-block
+ * codes have a column of their own.
+ *
+ * The output side uses the encoder's own tables and restart interval, so
+ * its count is what jchuff.c writes, less markers, byte stuffing and
+ * padding.  The input side uses the input's tables if it's a baseline
+ * file, and the standard ones otherwise, in which case it's an estimate.
+ *
+ * This costs a pass over the coefficients for each side, so it's only
+ * done when asked for.
+ */
+
+// The 64 zigzag bands, then end-of-block codes
+#define FIGLEAF_SIZE_BANDS (DCTSIZE2 + 1)
+#define FIGLEAF_SIZE_EOB DCTSIZE2
+
+enum figleaf_size_side { FIGLEAF_SIZE_IN, FIGLEAF_SIZE_OUT };
+
+struct figleaf_sizes {
+  int num_components;
+  unsigned long long bits[2][MAX_COMPONENTS][FIGLEAF_SIZE_BANDS];
+
+  // Bits per TPE tile, in raster order on each component's block grid;
+  // kept between images
+  unsigned long long *tile_bits[2][MAX_COMPONENTS];
+  size_t num_tiles[MAX_COMPONENTS], tile_alloc[2][MAX_COMPONENTS];
+};
+
+/* The --size-report output, shared by all the workers */
+struct figleaf_sizes_log {
+  FILE *file;
+  pthread_mutex_t lock;
+
+  // The settings being measured, for the totals
+  const char *module;
+  int arg, blocksize;
+
+  unsigned long long num_files, bytes_in, bytes_out;
+  int num_components;
+  unsigned long long bits[2][MAX_COMPONENTS][FIGLEAF_SIZE_BANDS];
+};
+
+void
+figleaf_sizes_init(struct figleaf_sizes *s);
+
+void
+figleaf_sizes_destroy(struct figleaf_sizes *s);
+
+/*
+ * Count the bits it takes to code the image's coefficients in je.
+ * geometry is the decoder the image was read with, for its sampling
+ * factors; dc_tables and ac_tables are the Huffman tables for each
+ * component.  Restarts are every restart_interval MCUs, or every
+ * restart_rows MCU rows if that's nonzero, as with libjpeg's fields of
+ * those names; neither means none.  Tiles are tile_blocks blocks a side.
+ * Counting the input side starts a new image.
+ */
+void
+figleaf_sizes_count(struct figleaf_sizes *s, enum figleaf_size_side side,
+                    struct jeasy *je, j_decompress_ptr geometry,
+                    JHUFF_TBL **dc_tables, JHUFF_TBL **ac_tables,
+                    unsigned int restart_interval, int restart_rows,
+                    int tile_blocks);
+
+void
+figleaf_sizes_log_open(struct figleaf_sizes_log *log, const char *filename,
+                       const char *module, int arg, int blocksize);
+
+/* Record a finished image, bytes_in and bytes_out long.  Does nothing if
+ * log is NULL. */
+void
+figleaf_sizes_log_file(struct figleaf_sizes_log *log, const char *name,
+                       const struct figleaf_sizes *s,
+                       unsigned long long bytes_in,
+                       unsigned long long bytes_out);
+
+/* Write out the totals, with the expansion for the module and arg, and
+ * close the log */
+void
+figleaf_sizes_log_close(struct figleaf_sizes_log *log);
+
+#endif
@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime(), getline() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+static const char *stage_names[FIGLEAF_NUM_STAGES] = {
+  "header", "coef_read", "prepare_blocks", "requant",
+  "kdf", "tpe", "return_blocks", "encode"
+};
+
+
+double
+figleaf_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void
+figleaf_stats_lap(struct figleaf_stats *stats, enum figleaf_stage stage,
+                  double *since)
+{
+  double t = figleaf_now();
+  stats->time[stage] += t - *since;
+  *since = t;
+}
+
+void
+figleaf_stats_add(struct figleaf_stats *total, const struct figleaf_stats *s)
+{
+  int i;
+
+  for (i = 0; i < FIGLEAF_NUM_STAGES; i++)
+    total->time[i] += s->time[i];
+  total->bytes_in += s->bytes_in;
+  total->bytes_out += s->bytes_out;
+  total->tiles += s->tiles;
+  total->tiles_skipped += s->tiles_skipped;
+  total->freqs += s->freqs;
+  total->freqs_skipped += s->freqs_skipped;
+  total->clamped += s->clamped;
+}
+
+
+void
+figleaf_json_string(FILE *f, const char *s)
+{
+  putc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char) *s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      putc(c, f);
+  }
+  putc('"', f);
+}
+
+static void
+json_stats(FILE *f, const struct figleaf_stats *s)
+{
+  int i;
+
+  fprintf(f, "\"bytes_in\":%llu,\"bytes_out\":%llu,"
+             "\"tiles\":%llu,\"tiles_skipped\":%llu,"
+             "\"freqs\":%llu,\"freqs_skipped\":%llu,\"clamped\":%llu,"
+             "\"time\":{",
+          s->bytes_in, s->bytes_out, s->tiles, s->tiles_skipped,
+          s->freqs, s->freqs_skipped, s->clamped);
+  for (i = 0; i < FIGLEAF_NUM_STAGES; i++)
+    fprintf(f, "%s\"%s\":%.6f", i ? "," : "", stage_names[i], s->time[i]);
+  putc('}', f);
+}
+
+
+void
+figleaf_stats_log_open(struct figleaf_stats_log *log, const char *filename)
+{
+  memset(log, 0, sizeof(struct figleaf_stats_log));
+  log->file = fopen(filename, "w");
+  if (log->file == NULL)
+    err(1, "Couldn't open stats file [%s]", filename);
+  pthread_mutex_init(&log->lock, NULL);
+  log->start = figleaf_now();
+}
+
+void
+figleaf_stats_log_file(struct figleaf_stats_log *log, const char *name,
+                       const struct figleaf_stats *stats)
+{
+  if (log == NULL)
+    return;
+
+  pthread_mutex_lock(&log->lock);
+  fputs("{\"file\":", log->file);
+  figleaf_json_string(log->file, name);
+  putc(',', log->file);
+  json_stats(log->file, stats);
+  fputs("}\n", log->file);
+  figleaf_stats_add(&log->total, stats);
+  log->num_files++;
+  pthread_mutex_unlock(&log->lock);
+}
+
+void
+figleaf_stats_log_close(struct figleaf_stats_log *log,
+                        const struct figleaf_failures *failures)
+{
+  size_t i;
+
+  fprintf(log->file, "{\"run\":{\"files\":%llu,\"wall\":%.6f,",
+          log->num_files, figleaf_now() - log->start);
+  if (log->shard_count > 0)
+    fprintf(log->file, "\"shard\":[%u,%u],",
+            log->shard_index, log->shard_count);
+  json_stats(log->file, &log->total);
+  fputs(",\"failed\":[", log->file);
+  for (i = 0; failures != NULL && i < failures->count; i++) {
+    fputs(i ? ",{\"file\":" : "{\"file\":", log->file);
+    figleaf_json_string(log->file, failures->list[i].name);
+    fputs(",\"error\":", log->file);
+    figleaf_json_string(log->file, failures->list[i].message);
+    putc('}', log->file);
+  }
+  fputs("]}}\n", log->file);
+  if (fclose(log->file) != 0)
+    err(1, "Couldn't write stats file");
+  pthread_mutex_destroy(&log->lock);
+}
+
+
+/*
+ * Merging.  The logs are our own output, so rather than parse JSON in
+ * general, the numbers are picked out of the totals line by key.  Keys are
+ * only looked for ahead of the "failed" list, so an error message can't
+ * be mistaken for one; the list itself is copied through as it is.
+ */
+
+#define FAILED_KEY ",\"failed\":["
+
+static double
+json_number(const char *line, const char *end, const char *key)
+{
+  size_t len = strlen(key);
+  const char *p;
+
+  for (p = line; (p = strstr(p, key)) != NULL && p < end; p += len) {
+    if (p > line && p[-1] == '"' && p[len] == '"' && p[len + 1] == ':')
+      return strtod(p + len + 2, NULL);
+  }
+  return 0;
+}
+
+static void
+merge_totals(struct figleaf_stats *total, const char *line, const char *end)
+{
+  struct figleaf_stats s;
+  int i;
+
+  memset(&s, 0, sizeof(struct figleaf_stats));
+  s.bytes_in = json_number(line, end, "bytes_in");
+  s.bytes_out = json_number(line, end, "bytes_out");
+  s.tiles = json_number(line, end, "tiles");
+  s.tiles_skipped = json_number(line, end, "tiles_skipped");
+  s.freqs = json_number(line, end, "freqs");
+  s.freqs_skipped = json_number(line, end, "freqs_skipped");
+  s.clamped = json_number(line, end, "clamped");
+  for (i = 0; i < FIGLEAF_NUM_STAGES; i++)
+    s.time[i] = json_number(line, end, stage_names[i]);
+  figleaf_stats_add(total, &s);
+}
+
+void
+figleaf_stats_merge(const char *output_filename, char **input_filenames,
+                    int num_inputs)
+{
+  struct figleaf_stats total;
+  unsigned long long num_files = 0;
+  double wall = 0;
+  unsigned shard_count = 0;
+  unsigned char *seen = NULL;
+  int num_failed = 0;
+  char *line = NULL;
+  size_t alloc = 0;
+  int i;
+
+  FILE *out = fopen(output_filename, "w");
+  if (out == NULL)
+    err(1, "Couldn't open stats file [%s]", output_filename);
+
+  // The per-image lines go straight through, and the failures are held
+  // back to go at the end with the totals
+  FILE *failed = tmpfile();
+  if (failed == NULL)
+    err(1, "Couldn't create temporary file");
+
+  memset(&total, 0, sizeof(struct figleaf_stats));
+  for (i = 0; i < num_inputs; i++) {
+    FILE *in = fopen(input_filenames[i], "r");
+    int found_run = 0;
+    if (in == NULL)
+      err(1, "Couldn't open stats file [%s]", input_filenames[i]);
+
+    while (getline(&line, &alloc, in) > 0) {
+      if (strncmp(line, "{\"run\":", 7) != 0) {
+        fputs(line, out);
+        continue;
+      }
+      found_run = 1;
+
+      char *end = strstr(line, FAILED_KEY);
+      if (end == NULL)
+        errx(1, "No list of failures in the totals in [%s]",
+             input_filenames[i]);
+      num_files += json_number(line, end, "files");
+      merge_totals(&total, line, end);
+      // The shards ran side by side, so the longest is the run's wall time
+      double w = json_number(line, end, "wall");
+      if (w > wall)
+        wall = w;
+
+      // The list runs up to the "]}}" that closes the line
+      char *list = end + strlen(FAILED_KEY);
+      char *list_end = strrchr(list, ']');
+      if (list_end != NULL && list_end > list) {
+        fprintf(failed, "%s%.*s", num_failed ? "," : "",
+                (int) (list_end - list), list);
+        num_failed++;
+      }
+
+      unsigned index, count;
+      char *shard = strstr(line, "\"shard\":[");
+      if (shard != NULL && shard < end &&
+          sscanf(shard, "\"shard\":[%u,%u]", &index, &count) == 2 &&
+          count > 0 && index < count) {
+        if (shard_count == 0) {
+          shard_count = count;
+          seen = (unsigned char *) calloc(count, 1);
+          if (seen == NULL)
+            err(1, "Couldn't allocate memory for shards");
+        }
+        if (count != shard_count)
+          warnx("[%s] is shard %u of %u, not of %u", input_filenames[i],
+                index, count, shard_count);
+        else if (seen[index]++)
+          warnx("Shard %u of %u given more than once", index, count);
+      }
+    }
+    if (ferror(in))
+      err(1, "Couldn't read stats file [%s]", input_filenames[i]);
+    if (!found_run)
+      warnx("No totals in [%s]; was that run finished?", input_filenames[i]);
+    fclose(in);
+  }
+
+  unsigned s;
+  for (s = 0; s < shard_count; s++) {
+    if (!seen[s])
+      warnx("Shard %u of %u is missing", s, shard_count);
+  }
+
+  fprintf(out, "{\"run\":{\"files\":%llu,\"wall\":%.6f,", num_files, wall);
+  json_stats(out, &total);
+  fputs(FAILED_KEY, out);
+  rewind(failed);
+  int c;
+  while ((c = getc(failed)) != EOF)
+    putc(c, out);
+  fputs("]}}\n", out);
+
+  fclose(failed);
+  free(line);
+  free(seen);
+  if (fclose(out) != 0)
+    err(1, "Couldn't write stats file [%s]", output_filename);
+}
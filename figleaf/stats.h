@@ -0,0 +1,93 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "recover.h"
+
+/*
+ * Where the time goes, and how much work was done, for each image.
+ *
+ * Every worker keeps a figleaf_stats for the image it's on; the stages in
+ * worker.c time themselves and tpe_process_image() does the counting.
+ * That's a few clock reads per image and a few increments per tile, so
+ * it's always on.  With --stats, each image's numbers are written out as
+ * one line of JSON as it's finished, followed by a line of totals for the
+ * run when it's over.
+ *
+ * A run split into shards (walk.h) leaves one such log per shard;
+ * figleaf_stats_merge() puts them back together into what a single run
+ * over the whole tree would have written.
+ */
+
+enum figleaf_stage {
+  FIGLEAF_STAGE_HEADER,         // jpeg_read_header()
+  FIGLEAF_STAGE_COEF_READ,      // Entropy decoding the coefficients
+  FIGLEAF_STAGE_PREPARE,        // jpeg_prepare_blocks()
+  FIGLEAF_STAGE_REQUANT,        // requant_image(), with -q
+  FIGLEAF_STAGE_KDF,            // Deriving the image's key
+  FIGLEAF_STAGE_TPE,            // tpe_process_image()
+  FIGLEAF_STAGE_RETURN,         // jpeg_return_blocks()
+  FIGLEAF_STAGE_ENCODE,         // Entropy encoding the output
+  FIGLEAF_NUM_STAGES
+};
+
+struct figleaf_stats {
+  double time[FIGLEAF_NUM_STAGES];      // Seconds in each stage
+
+  unsigned long long bytes_in, bytes_out;
+  unsigned long long tiles, tiles_skipped;
+  unsigned long long freqs, freqs_skipped;  // Per tile and component
+  unsigned long long clamped;   // Coefficients the minmax functions moved
+};
+
+/* The --stats output, shared by all the workers */
+struct figleaf_stats_log {
+  FILE *file;
+  pthread_mutex_t lock;
+
+  struct figleaf_stats total;
+  unsigned long long num_files;
+  double start;
+  unsigned shard_index, shard_count;  // Recorded in the totals if count > 0
+};
+
+/* Seconds on a monotonic clock, for timing stages */
+double
+figleaf_now(void);
+
+/* Add the time since *since to the stage, and move *since up to now */
+void
+figleaf_stats_lap(struct figleaf_stats *stats, enum figleaf_stage stage,
+                  double *since);
+
+void
+figleaf_stats_add(struct figleaf_stats *total, const struct figleaf_stats *s);
+
+/* Write s out as a JSON string, quoted and escaped */
+void
+figleaf_json_string(FILE *f, const char *s);
+
+void
+figleaf_stats_log_open(struct figleaf_stats_log *log, const char *filename);
+
+/* Record a finished image.  Does nothing if log is NULL. */
+void
+figleaf_stats_log_file(struct figleaf_stats_log *log, const char *name,
+                       const struct figleaf_stats *stats);
+
+/* Write out the run's totals, and the files that failed, if any, and
+ * close the log */
+void
+figleaf_stats_log_close(struct figleaf_stats_log *log,
+                        const struct figleaf_failures *failures);
+
+/* Combine the logs of a sharded run into one, with the per-image lines of
+ * all of them and a single line of totals.  Warns about shards that are
+ * missing or given twice. */
+void
+figleaf_stats_merge(const char *output_filename, char **input_filenames,
+                    int num_inputs);
+
+#endif
@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L  // for strtok_r(), strdup() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/stat.h>
+
+#include "sweep.h"
+#include "tpe.h"
+#include "recover.h"
+
+/* Split list on commas, in place, into a malloc'd array */
+static size_t
+split_list(char *list, char ***items)
+{
+  size_t n = 1, i = 0;
+  char *p, *save = NULL;
+
+  for (p = list; *p; p++)
+    if (*p == ',')
+      n++;
+  *items = (char **) malloc(n * sizeof(char *));
+  if (*items == NULL)
+    err(1, "Couldn't allocate memory for --sweep");
+  for (p = strtok_r(list, ",", &save); p != NULL; p = strtok_r(NULL, ",", &save))
+    (*items)[i++] = p;
+  return i;
+}
+
+/* Parse a list of integers; returns how many, or 0 if any isn't one */
+static size_t
+parse_ints(const char *list, int **values)
+{
+  char *copy = strdup(list), **items;
+  size_t n, i;
+
+  if (copy == NULL)
+    err(1, "Couldn't allocate memory for --sweep");
+  n = split_list(copy, &items);
+  *values = (int *) malloc((n ? n : 1) * sizeof(int));
+  if (*values == NULL)
+    err(1, "Couldn't allocate memory for --sweep");
+  for (i = 0; i < n; i++) {
+    char *end;
+    long v = strtol(items[i], &end, 10);
+    if (end == items[i] || *end != '\0') {
+      n = 0;
+      break;
+    }
+    (*values)[i] = (int) v;
+  }
+  free(items);
+  free(copy);
+  return n;
+}
+
+const char *
+figleaf_sweep_init(struct figleaf_sweep *s, const char *modules,
+                   const char *blocksizes, const char *args)
+{
+  size_t i;
+
+  memset(s, 0, sizeof(struct figleaf_sweep));
+  s->num_modules = s->num_blocksizes = s->num_args = 1;
+
+  if (modules != NULL) {
+    s->modules = strdup(modules);
+    if (s->modules == NULL)
+      err(1, "Couldn't allocate memory for --sweep");
+    s->num_modules = split_list(s->modules, &s->module_names);
+    if (s->num_modules == 0)
+      return "No modules given to -m";
+  }
+  if (blocksizes != NULL) {
+    s->num_blocksizes = parse_ints(blocksizes, &s->blocksizes);
+    if (s->num_blocksizes == 0)
+      return "-b takes a comma-separated list of blocksizes with --sweep";
+    for (i = 0; i < s->num_blocksizes; i++)
+      if (s->blocksizes[i] <= 0 || s->blocksizes[i] % 8)
+        return "Blocksize must be a multiple of eight";
+  }
+  if (args != NULL) {
+    s->num_args = parse_ints(args, &s->args);
+    if (s->num_args == 0)
+      return "-a takes a comma-separated list of integers with --sweep";
+  }
+  s->num_configs = s->num_modules * s->num_blocksizes * s->num_args;
+  return NULL;
+}
+
+void
+figleaf_sweep_destroy(struct figleaf_sweep *s)
+{
+  free(s->modules);
+  free(s->module_names);
+  free(s->blocksizes);
+  free(s->args);
+}
+
+const char *
+figleaf_sweep_check_template(const struct figleaf_sweep *s,
+                             const char *output_template)
+{
+  int has_m = 0, has_b = 0, has_a = 0;
+  const char *p;
+
+  for (p = output_template; *p; p++) {
+    if (*p != '%' || p[1] == '\0')
+      continue;
+    p++;
+    has_m |= (*p == 'm');
+    has_b |= (*p == 'b');
+    has_a |= (*p == 'a');
+  }
+  if (s->num_modules > 1 && !has_m)
+    return "With more than one module, the output path needs a %m";
+  if (s->num_blocksizes > 1 && !has_b)
+    return "With more than one blocksize, the output path needs a %b";
+  if (s->num_args > 1 && !has_a)
+    return "With more than one argument, the output path needs a %a";
+  return NULL;
+}
+
+const char *
+figleaf_sweep_apply(const struct figleaf_sweep *s, size_t i,
+                    struct figleaf_context *ctx)
+{
+  // The argument varies fastest, then the blocksize, then the module
+  size_t a = i % s->num_args;
+  size_t b = (i / s->num_args) % s->num_blocksizes;
+  size_t m = i / s->num_args / s->num_blocksizes;
+
+  if (s->module_names != NULL)
+    ctx->tpe_method_name = s->module_names[m];
+  if (s->blocksizes != NULL)
+    ctx->blocksize = s->blocksizes[b];
+  if (s->args != NULL)
+    ctx->fcn_user_arg = s->args[a];
+  return tpe_select_module(ctx);
+}
+
+/* Create the directories leading up to filename, like mkdir -p */
+static void
+make_parent_dirs(char *filename)
+{
+  char *p;
+
+  for (p = filename + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(filename, 0777) != 0 && errno != EEXIST)
+      figleaf_err("Couldn't create output directory [%s]", filename);
+    *p = '/';
+  }
+}
+
+void
+figleaf_sweep_output(const struct figleaf_context *ctx,
+                     const char *output_template, const char *relative,
+                     char *name, size_t size)
+{
+  size_t len = 0;
+  const char *p;
+
+  for (p = output_template; *p; p++) {
+    char str[16] = { *p, '\0' };
+    const char *insert = str;
+    if (*p == '%') {
+      switch (p[1]) {
+      case 'm': insert = ctx->tpe_method_name; p++; break;
+      case 'b': snprintf(str, sizeof str, "%d", ctx->blocksize); p++; break;
+      case 'a': snprintf(str, sizeof str, "%d", ctx->fcn_user_arg); p++; break;
+      case '%': p++; break;
+      }
+    }
+    size_t n = strlen(insert);
+    if (len + n >= size)
+      figleaf_errx("Output filename made from [%s] is too long", output_template);
+    memcpy(name + len, insert, n);
+    len += n;
+  }
+  if (len + strlen(relative) >= size)
+    figleaf_errx("Output filename made from [%s] is too long", output_template);
+  strcpy(name + len, relative);
+  make_parent_dirs(name);
+}
@@ -0,0 +1,66 @@
+#ifndef _SWEEP_H
+#define _SWEEP_H
+
+#include <stddef.h>
+
+#include "figleaf.h"
+
+/*
+ * Encrypting each input under many settings in one go, for --sweep.
+ *
+ * Building an evaluation dataset means encrypting the same images under
+ * every combination of module, blocksize and argument.  Rather than run
+ * figleaf once per combination, which reads, decodes and derives the key
+ * for every image each time, a sweep takes comma-separated lists for -m,
+ * -b and -a and does all of their combinations per image: it's decoded
+ * and its key derived once, and each combination then works on a fresh
+ * copy of the coefficients (see figleaf_sweep_image() in worker.h).  The
+ * outputs are the same as separate runs would write.
+ *
+ * Output names are made from the output path by replacing %m, %b and %a
+ * with the module, blocksize and argument (and %% with %), and the
+ * directories they're in are created as needed.  When the input is a
+ * directory, each file's path under it is added to the end as it is, so
+ * a % in a filename is left alone.
+ */
+
+struct figleaf_sweep {
+  char *modules;            // The -m list, split in place, or NULL
+  char **module_names;
+  int *blocksizes, *args;   // Or NULL, to keep the run's setting
+  size_t num_modules, num_blocksizes, num_args;
+  size_t num_configs;       // Every combination of the three
+  const char *output_template;  // The output path, -o
+};
+
+/* Parse the lists given to -m, -b and -a; NULL keeps the run's setting.
+ * Returns NULL, or what's wrong with them. */
+const char *
+figleaf_sweep_init(struct figleaf_sweep *s, const char *modules,
+                   const char *blocksizes, const char *args);
+
+void
+figleaf_sweep_destroy(struct figleaf_sweep *s);
+
+/* Returns NULL if names made from output_template tell every combination
+ * apart, or else what's missing from it */
+const char *
+figleaf_sweep_check_template(const struct figleaf_sweep *s,
+                             const char *output_template);
+
+/* Make ctx, a copy of the run's context, the i'th combination.  Returns
+ * NULL, or tpe_select_module()'s complaint about its module. */
+const char *
+figleaf_sweep_apply(const struct figleaf_sweep *s, size_t i,
+                    struct figleaf_context *ctx);
+
+/* Put the output filename for the combination in ctx into name, which
+ * is size bytes long: output_template expanded, then relative as it is.
+ * Creates the directories leading up to it, and fails the image on error
+ * (see recover.h). */
+void
+figleaf_sweep_output(const struct figleaf_context *ctx,
+                     const char *output_template, const char *relative,
+                     char *name, size_t size);
+
+#endif
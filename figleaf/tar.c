@@ -0,0 +1,535 @@
+#define _POSIX_C_SOURCE 200809L  // for fdopen(), strndup(), mkstemp() in c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "figleaf.h"
+#include "worker.h"
+#include "fileio.h"
+#include "queue.h"
+#include "walk.h"
+#include "tar.h"
+#include "stats.h"
+#include "sizes.h"
+#include "recover.h"
+
+#define TAR_BLOCK  512
+#define TAR_RECORD (20 * TAR_BLOCK)     // tar pads archives to whole records
+
+// Offsets of the ustar header fields we use
+#define TAR_NAME      0
+#define TAR_SIZE      124
+#define TAR_CHKSUM    148
+#define TAR_TYPEFLAG  156
+#define TAR_MAGIC     257
+#define TAR_PREFIX    345
+
+// Members in memory at once, per worker thread
+#define TAR_WINDOW_PER_THREAD 8
+
+#define TAR_IO_BUFFER (1 << 20)
+
+struct tar_member {
+  unsigned char *head;        // Extended headers, then the member's header
+  size_t head_size, head_alloc;
+  size_t header_offset;       // Where the member's own header is in head
+
+  unsigned char *data;        // The member's contents, without padding
+  size_t data_size;
+  char *name;
+
+  int is_jpeg;
+  struct figleaf_outbuf out;  // New contents of a JPEG member
+  int failed;                 // Couldn't be processed, so is left out
+
+  // Guarded by tar_state.lock
+  int in_use;                 // Read in, and not yet written out
+  int ready;                  // Ready to be written out
+};
+
+struct tar_state {
+  FILE *in, *out;
+  const char *input_path;
+
+  char *passphrase;
+  struct figleaf_context *ctx;
+
+  // Member n goes in window[n % window_size]
+  struct tar_member *window;
+  size_t window_size;
+
+  struct figleaf_queue work;  // JPEG members for the workers; NULL to stop
+  int num_workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;     // Signalled whenever a member changes state
+  size_t num_read;            // Members read in so far
+  int eof;                    // All members have been read in
+};
+
+
+static unsigned long long
+tar_parse_number(const unsigned char *field, int len)
+{
+  unsigned long long n = 0;
+  int i = 0;
+
+  // GNU base-256, for sizes too big for the octal field
+  if (field[0] & 0x80) {
+    n = field[0] & 0x7f;
+    for (i = 1; i < len; i++)
+      n = (n << 8) | field[i];
+    return n;
+  }
+
+  while (i < len && field[i] == ' ')
+    i++;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    n = n * 8 + (field[i] - '0');
+  return n;
+}
+
+static unsigned int
+tar_checksum(const unsigned char *header)
+{
+  unsigned int sum = 0;
+  int i;
+
+  // The checksum field itself counts as spaces
+  for (i = 0; i < TAR_BLOCK; i++)
+    sum += (i >= TAR_CHKSUM && i < TAR_CHKSUM + 8) ? ' ' : header[i];
+  return sum;
+}
+
+static void
+tar_set_size(unsigned char *header, unsigned long long size)
+{
+  char field[13];
+
+  if (size > 077777777777ULL)
+    errx(1, "Tar member too large");
+  snprintf(field, sizeof field, "%011llo", size);
+  memcpy(header + TAR_SIZE, field, 12);
+  snprintf(field, sizeof field, "%06o", tar_checksum(header));
+  memcpy(header + TAR_CHKSUM, field, 7);
+  header[TAR_CHKSUM + 7] = ' ';
+}
+
+/* Returns how much was read, which is less than len only at the end of
+ * the archive */
+static size_t
+tar_read_fully(struct tar_state *state, void *buf, size_t len)
+{
+  size_t n = fread(buf, 1, len, state->in);
+  if (n != len && ferror(state->in))
+    err(1, "Couldn't read archive [%s]", state->input_path);
+  return n;
+}
+
+/* Append len bytes read from the archive to the member's headers */
+static unsigned char *
+tar_read_head(struct tar_state *state, struct tar_member *m, size_t len)
+{
+  if (m->head_size + len > m->head_alloc) {
+    m->head_alloc = (m->head_size + len) * 2;
+    m->head = (unsigned char *) realloc(m->head, m->head_alloc);
+    if (m->head == NULL)
+      err(1, "Couldn't allocate memory for tar header");
+  }
+  if (tar_read_fully(state, m->head + m->head_size, len) != len)
+    errx(1, "Archive [%s] is truncated", state->input_path);
+  m->head_size += len;
+  return m->head + m->head_size - len;
+}
+
+/* Pick the path and size out of a pax extended header's records, each
+ * of which is "length keyword=value\n".
+ */
+static void
+tar_parse_pax(const unsigned char *data, size_t size,
+              char **path, int *has_size)
+{
+  size_t pos = 0;
+
+  while (pos < size) {
+    const char *rec = (const char *) data + pos;
+    size_t len = strtoul(rec, NULL, 10);
+    const char *kw = memchr(rec, ' ', size - pos);
+    if (len == 0 || pos + len > size || kw == NULL)
+      break;
+    kw++;
+    size_t kw_len = rec + len - 1 - kw;   // Without the newline
+    if (kw_len > 5 && !strncmp(kw, "path=", 5)) {
+      free(*path);
+      *path = strndup(kw + 5, kw_len - 5);
+    } else if (kw_len > 5 && !strncmp(kw, "size=", 5)) {
+      *has_size = 1;
+    }
+    pos += len;
+  }
+}
+
+/* Read the next member, along with any extended headers in front of it.
+ * Returns 0 at the end of the archive.
+ */
+static int
+tar_read_member(struct tar_state *state, struct tar_member *m)
+{
+  char *long_name = NULL;
+  int pax_size = 0;
+  int i;
+
+  m->head_size = 0;
+  for (;;) {
+    size_t start = m->head_size;
+    if (m->head_alloc < start + TAR_BLOCK) {
+      m->head_alloc = start + TAR_BLOCK;
+      m->head = (unsigned char *) realloc(m->head, m->head_alloc);
+      if (m->head == NULL)
+        err(1, "Couldn't allocate memory for tar header");
+    }
+    unsigned char *header = m->head + start;
+    size_t got = tar_read_fully(state, header, TAR_BLOCK);
+    if (got != TAR_BLOCK) {
+      // Tolerate a missing end-of-archive marker, but not half a header
+      if (got == 0 && start == 0)
+        return 0;
+      errx(1, "Archive [%s] is truncated", state->input_path);
+    }
+
+    for (i = 0; i < TAR_BLOCK && header[i] == 0; i++)
+      ;
+    if (i == TAR_BLOCK) {
+      if (start != 0)
+        errx(1, "Archive [%s] is truncated", state->input_path);
+      return 0;
+    }
+    if (tar_checksum(header) != tar_parse_number(header + TAR_CHKSUM, 8))
+      errx(1, "Bad tar header checksum in [%s]", state->input_path);
+    m->head_size += TAR_BLOCK;
+
+    unsigned long long size = tar_parse_number(header + TAR_SIZE, 12);
+    size_t padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    char type = header[TAR_TYPEFLAG];
+
+    // Extended headers describe the member after them, and are copied
+    // through along with it
+    if (type == 'L' || type == 'K' || type == 'x') {
+      unsigned char *data = tar_read_head(state, m, padded);
+      if (type == 'L') {
+        free(long_name);
+        long_name = strndup((char *) data, size);
+      } else if (type == 'x') {
+        tar_parse_pax(data, size, &long_name, &pax_size);
+      }
+      continue;
+    }
+
+    m->header_offset = start;
+    if (long_name != NULL) {
+      m->name = long_name;
+    } else {
+      char name[TAR_PREFIX + 155 + 2] = "";
+      if (!memcmp(header + TAR_MAGIC, "ustar", 5) && header[TAR_PREFIX]) {
+        snprintf(name, sizeof name, "%.155s/", (char *) header + TAR_PREFIX);
+      }
+      strncat(name, (char *) header + TAR_NAME, 100);
+      m->name = strdup(name);
+    }
+    if (m->name == NULL)
+      err(1, "Couldn't allocate memory for tar member name");
+
+    // A pax size record would override the size we write for a JPEG
+    // member, so those are passed through as they are
+    m->is_jpeg = (type == '0' || type == '\0' || type == '7') &&
+                 !pax_size && figleaf_is_jpeg_filename(m->name);
+
+    m->data_size = size;
+    m->data = (unsigned char *) malloc(padded ? padded : 1);
+    if (m->data == NULL)
+      err(1, "Couldn't allocate memory for tar member [%s]", m->name);
+    if (tar_read_fully(state, m->data, padded) != padded)
+      errx(1, "Archive [%s] is truncated", state->input_path);
+    return 1;
+  }
+}
+
+// The new archive is written to a temporary file next to it, which is
+// renamed into place once it's complete; until then, this is its name, for
+// remove_partial_output() to clean up if the run fails
+static char *partial_output;
+
+static void
+remove_partial_output(void)
+{
+  if (partial_output != NULL)
+    unlink(partial_output);
+}
+
+/* Open the new archive for writing.  Like figleaf_write_file(), a path
+ * that exists but isn't a regular file is written straight through. */
+static FILE *
+tar_open_output(const char *output_path)
+{
+  size_t len = strlen(output_path);
+  struct stat st;
+  int fd;
+
+  if (lstat(output_path, &st) == 0 && !S_ISREG(st.st_mode))
+    return fopen(output_path, "wb");
+
+  partial_output = (char *) malloc(len + sizeof ".XXXXXX");
+  if (partial_output == NULL)
+    err(1, "Couldn't allocate memory");
+  memcpy(partial_output, output_path, len);
+  memcpy(partial_output + len, ".XXXXXX", sizeof ".XXXXXX");
+  fd = mkstemp(partial_output);
+  if (fd < 0) {
+    free(partial_output);
+    partial_output = NULL;
+    return NULL;
+  }
+  atexit(remove_partial_output);
+  // mkstemp() creates files 0600; give the archive the usual permissions
+  if (fchmod(fd, figleaf_output_mode()) != 0)
+    err(1, "Couldn't set permissions on [%s]", partial_output);
+  return fdopen(fd, "wb");
+}
+
+static void
+tar_write(struct tar_state *state, const void *data, size_t len)
+{
+  if (fwrite(data, 1, len, state->out) != len)
+    err(1, "Couldn't write archive");
+}
+
+/* Returns the number of bytes written */
+static size_t
+tar_write_member(struct tar_state *state, struct tar_member *m)
+{
+  static const unsigned char zeros[TAR_BLOCK];
+  const unsigned char *data = m->data;
+  size_t size = m->data_size;
+
+  if (m->is_jpeg) {
+    data = m->out.data;
+    size = m->out.size;
+    tar_set_size(m->head + m->header_offset, size);
+  }
+  tar_write(state, m->head, m->head_size);
+  tar_write(state, data, size);
+  if (size % TAR_BLOCK)
+    tar_write(state, zeros, TAR_BLOCK - size % TAR_BLOCK);
+  return m->head_size + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+}
+
+
+static void *
+tar_worker_main(void *arg)
+{
+  struct tar_state *state = (struct tar_state *) arg;
+  struct figleaf_worker worker;
+  struct tar_member *m;
+
+  figleaf_worker_init(&worker, 1);
+  figleaf_worker_share_spare(&worker, state->num_workers);
+
+  while ((m = figleaf_queue_pop(&state->work)) != NULL) {
+    printf("Found archive member [%s]\n", m->name);
+    if (figleaf_decode_image(&worker, m->data, m->data_size, state->ctx) != 0 ||
+        figleaf_crypt_image(&worker, m->name, state->passphrase,
+                            state->ctx) != 0 ||
+        figleaf_encode_image(&worker) != 0 ||
+        figleaf_export_image(&worker, state->ctx->dataset, m->name) != 0) {
+      // Copying it through as it was could leak the very image we were
+      // asked to encrypt, so it's dropped from the archive instead
+      figleaf_failures_add(state->ctx->failures, m->name,
+                           worker.recover.message);
+      m->failed = 1;
+    } else {
+      figleaf_stats_log_file(state->ctx->stats_log, m->name, &worker.stats);
+      figleaf_sizes_log_file(state->ctx->size_log, m->name, &worker.sizes,
+                             worker.stats.bytes_in, worker.stats.bytes_out);
+
+      // The member takes the output buffer; the worker starts a new one
+      m->out = worker.outbuf;
+      memset(&worker.outbuf, 0, sizeof(struct figleaf_outbuf));
+    }
+
+    pthread_mutex_lock(&state->lock);
+    m->ready = 1;
+    pthread_cond_broadcast(&state->changed);
+    pthread_mutex_unlock(&state->lock);
+  }
+
+  figleaf_worker_destroy(&worker);
+  return NULL;
+}
+
+/* Write the members out in order, as they become ready */
+static void *
+tar_writer_main(void *arg)
+{
+  struct tar_state *state = (struct tar_state *) arg;
+  static const unsigned char zeros[TAR_BLOCK];
+  unsigned long long written = 0;
+  size_t n;
+
+  for (n = 0; ; n++) {
+    struct tar_member *m = &state->window[n % state->window_size];
+
+    pthread_mutex_lock(&state->lock);
+    while (!(n < state->num_read && m->ready) &&
+           !(state->eof && n >= state->num_read))
+      pthread_cond_wait(&state->changed, &state->lock);
+    int done = (n >= state->num_read);
+    pthread_mutex_unlock(&state->lock);
+    if (done)
+      break;
+
+    if (!m->failed)
+      written += tar_write_member(state, m);
+
+    free(m->data);
+    free(m->name);
+    figleaf_outbuf_free(&m->out);
+    m->data = NULL;
+    m->name = NULL;
+    m->failed = 0;
+
+    pthread_mutex_lock(&state->lock);
+    m->in_use = 0;
+    m->ready = 0;
+    pthread_cond_broadcast(&state->changed);
+    pthread_mutex_unlock(&state->lock);
+  }
+
+  // End-of-archive marker, then pad out the last record
+  tar_write(state, zeros, TAR_BLOCK);
+  tar_write(state, zeros, TAR_BLOCK);
+  written += 2 * TAR_BLOCK;
+  while (written % TAR_RECORD) {
+    tar_write(state, zeros, TAR_BLOCK);
+    written += TAR_BLOCK;
+  }
+  return NULL;
+}
+
+
+void
+figleaf_run_tar(const char *input_path, const char *output_path,
+                char *passphrase, struct figleaf_context *ctx)
+{
+  struct tar_state state;
+  pthread_t writer;
+  pthread_t *workers;
+  size_t n;
+  int t;
+
+  memset(&state, 0, sizeof(struct tar_state));
+  state.input_path = input_path;
+  state.passphrase = passphrase;
+  state.ctx = ctx;
+  state.num_workers = ctx->num_threads > 1 ? ctx->num_threads : 1;
+
+  if (!strcmp(input_path, "-")) {
+    state.in = stdin;
+    state.input_path = "stdin";
+  } else {
+    state.in = fopen(input_path, "rb");
+    if (state.in == NULL)
+      err(1, "Couldn't open archive [%s] for reading", input_path);
+  }
+  if (!strcmp(output_path, "-")) {
+    // Keep the archive on the real stdout, and send everything else
+    // that's printed to stderr
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+      err(1, "Couldn't set up stdout");
+    state.out = fdopen(fd, "wb");
+  } else {
+    state.out = tar_open_output(output_path);
+  }
+  if (state.out == NULL)
+    err(1, "Couldn't open archive [%s] for writing", output_path);
+  setvbuf(state.in, NULL, _IOFBF, TAR_IO_BUFFER);
+  setvbuf(state.out, NULL, _IOFBF, TAR_IO_BUFFER);
+
+  state.window_size = TAR_WINDOW_PER_THREAD * state.num_workers;
+  state.window = (struct tar_member *)
+    calloc(state.window_size, sizeof(struct tar_member));
+  workers = (pthread_t *) calloc(state.num_workers, sizeof(pthread_t));
+  if (state.window == NULL || workers == NULL)
+    err(1, "Couldn't allocate memory for archive");
+  figleaf_queue_init(&state.work, state.window_size + state.num_workers);
+  pthread_mutex_init(&state.lock, NULL);
+  pthread_cond_init(&state.changed, NULL);
+
+  for (t = 0; t < state.num_workers; t++) {
+    int rc = pthread_create(&workers[t], NULL, tar_worker_main, &state);
+    if (rc != 0)
+      errx(1, "Couldn't start worker thread %d; rc = %d", t, rc);
+  }
+  int rc = pthread_create(&writer, NULL, tar_writer_main, &state);
+  if (rc != 0)
+    errx(1, "Couldn't start writer thread; rc = %d", rc);
+
+  // Read members in on this thread, waiting whenever the window is full
+  for (n = 0; ; n++) {
+    struct tar_member *m = &state.window[n % state.window_size];
+
+    pthread_mutex_lock(&state.lock);
+    while (m->in_use)
+      pthread_cond_wait(&state.changed, &state.lock);
+    pthread_mutex_unlock(&state.lock);
+
+    if (!tar_read_member(&state, m))
+      break;
+
+    pthread_mutex_lock(&state.lock);
+    m->in_use = 1;
+    m->ready = !m->is_jpeg;
+    state.num_read = n + 1;
+    pthread_cond_broadcast(&state.changed);
+    pthread_mutex_unlock(&state.lock);
+
+    if (m->is_jpeg)
+      figleaf_queue_push(&state.work, m);
+  }
+
+  pthread_mutex_lock(&state.lock);
+  state.eof = 1;
+  pthread_cond_broadcast(&state.changed);
+  pthread_mutex_unlock(&state.lock);
+  for (t = 0; t < state.num_workers; t++)
+    figleaf_queue_push(&state.work, NULL);
+
+  for (t = 0; t < state.num_workers; t++)
+    pthread_join(workers[t], NULL);
+  pthread_join(writer, NULL);
+
+  if (fclose(state.out) != 0)
+    err(1, "Couldn't write archive");
+  if (partial_output != NULL) {
+    if (rename(partial_output, output_path) != 0)
+      err(1, "Couldn't rename archive into place as [%s]", output_path);
+    free(partial_output);
+    partial_output = NULL;
+  }
+  if (state.in != stdin)
+    fclose(state.in);
+
+  for (n = 0; n < state.window_size; n++)
+    free(state.window[n].head);
+  free(state.window);
+  free(workers);
+  figleaf_queue_destroy(&state.work);
+  pthread_cond_destroy(&state.changed);
+  pthread_mutex_destroy(&state.lock);
+}
@@ -0,0 +1,29 @@
+#ifndef _TAR_H
+#define _TAR_H
+
+#include "figleaf.h"
+
+/*
+ * Encrypt/decrypt the JPEG members of a tar archive, writing a new
+ * archive, without extracting anything to disk.
+ *
+ * The input archive is read as a stream, one member at a time, and each
+ * JPEG member (by name, as in walk.h) is handed to one of
+ * ctx->num_threads worker threads, which process it in memory.  Members
+ * are written out in their original order, JPEG members with their new
+ * size and everything else byte for byte as it was, extended (pax and
+ * GNU long name) headers included.  A JPEG member that can't be
+ * processed is left out of the new archive and listed in the failures
+ * (see recover.h).  Only a bounded window of members is held in memory at
+ * once.
+ *
+ * Either path may be "-" for stdin/stdout.  When the archive goes to
+ * stdout, figleaf's own messages go to stderr instead.  A named output
+ * archive is written to a temporary file and renamed into place at the
+ * end, so a run that fails doesn't leave half an archive behind.
+ */
+void
+figleaf_run_tar(const char *input_path, const char *output_path,
+                char *passphrase, struct figleaf_context *ctx);
+
+#endif
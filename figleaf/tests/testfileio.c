@@ -0,0 +1,98 @@
+/*
+ * Tests for figleaf_write_file()
+ *
+ * A regular file is replaced through a temporary file and a rename, but a
+ * symlink has to be written through, so that it's still a symlink
+ * afterwards and the file it points at has the new contents; likewise a
+ * dangling one, which creates the file it points at.
+ *
+ * Usage: tests/testfileio
+ *
+ * Works in a fresh directory under $TMPDIR (default /tmp), and exits
+ * nonzero if anything fails.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for mkdtemp(), symlink() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jpeglib.h"
+#include "fileio.h"
+
+static int num_failed;
+
+static void
+check(int ok, const char *what)
+{
+  printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    num_failed++;
+}
+
+/* Whether the file holds exactly contents */
+static int
+has_contents(const char *filename, const char *contents)
+{
+  char buf[256];
+  FILE *f = fopen(filename, "rb");
+  size_t n;
+
+  if (f == NULL)
+    return 0;
+  n = fread(buf, 1, sizeof buf, f);
+  fclose(f);
+  return n == strlen(contents) && !memcmp(buf, contents, n);
+}
+
+static int
+is_symlink(const char *filename)
+{
+  struct stat st;
+
+  return lstat(filename, &st) == 0 && S_ISLNK(st.st_mode);
+}
+
+int
+main(void)
+{
+  const char *tmpdir = getenv("TMPDIR");
+  char dir[FILENAME_MAX], target[FILENAME_MAX], link[FILENAME_MAX];
+  char dangling[FILENAME_MAX], missing[FILENAME_MAX];
+
+  figleaf_save_umask();
+  snprintf(dir, sizeof dir, "%s/figleaf-fileio-XXXXXX",
+           tmpdir != NULL ? tmpdir : "/tmp");
+  if (mkdtemp(dir) == NULL)
+    err(1, "Couldn't create a directory to test in");
+  snprintf(target, sizeof target, "%s/target", dir);
+  snprintf(link, sizeof link, "%s/link", dir);
+  snprintf(dangling, sizeof dangling, "%s/dangling", dir);
+  snprintf(missing, sizeof missing, "%s/missing", dir);
+
+  figleaf_write_file(target, "first", 5);
+  check(has_contents(target, "first"), "new regular file");
+  figleaf_write_file(target, "second", 6);
+  check(has_contents(target, "second"), "regular file replaced");
+
+  if (symlink("target", link) != 0 || symlink("missing", dangling) != 0)
+    err(1, "Couldn't create symlinks");
+  figleaf_write_file(link, "third", 5);
+  check(is_symlink(link), "symlink left as a symlink");
+  check(has_contents(target, "third"), "written through the symlink");
+
+  figleaf_write_file(dangling, "fourth", 6);
+  check(is_symlink(dangling), "dangling symlink left as a symlink");
+  check(has_contents(missing, "fourth"), "written through the dangling symlink");
+
+  unlink(link);
+  unlink(dangling);
+  unlink(target);
+  unlink(missing);
+  rmdir(dir);
+  return num_failed ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Tests for the manifest's journal
+ *
+ * A job whose output the journal says is up to date is skipped, but only
+ * while the settings that go into the output stay the same.  This runs
+ * one manifest job several times, writing a stand-in output for it each
+ * time it's handed out, and checks it's skipped when nothing has changed
+ * and redone when the regions of interest or the crop have.
+ *
+ * Usage: tests/testmanifest
+ *
+ * Works in a fresh directory under $TMPDIR (default /tmp), and exits
+ * nonzero if anything fails.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for mkdtemp(), fdopen() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+#include "jpeglib.h"
+#include "figleaf.h"
+#include "fileio.h"
+#include "manifest.h"
+#include "roi.h"
+
+static int num_failed;
+static FILE *out;       // Results, kept apart from the manifest's chatter
+
+static void
+check(int ok, const char *what)
+{
+  fprintf(out, "%-4s %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    num_failed++;
+}
+
+static void
+write_text(const char *filename, const char *text)
+{
+  FILE *f = fopen(filename, "w");
+
+  if (f == NULL || fputs(text, f) == EOF || fclose(f) != 0)
+    err(1, "Couldn't write [%s]", filename);
+}
+
+/* Go through the manifest with ctx's settings, as a run would, and return
+ * how many jobs weren't up to date */
+static int
+run_manifest(const char *manifest, const char *journal,
+             struct figleaf_context *ctx)
+{
+  struct figleaf_manifest m;
+  struct figleaf_job job;
+  int n = 0;
+
+  figleaf_manifest_init(&m, manifest, journal, 0, ctx);
+  while (m.pub.next(&m.pub, &job)) {
+    figleaf_write_file(job.output_filename, "output", 6);
+    m.pub.done(&m.pub, &job, "output", 6);
+    n++;
+  }
+  figleaf_manifest_destroy(&m);
+  return n;
+}
+
+int
+main(void)
+{
+  const char *tmpdir = getenv("TMPDIR");
+  char dir[FILENAME_MAX], input[FILENAME_MAX], output[FILENAME_MAX];
+  char manifest[FILENAME_MAX], journal[FILENAME_MAX], line[3 * FILENAME_MAX];
+  struct figleaf_context ctx;
+  struct figleaf_roi roi, other_roi, crop;
+
+  if (sodium_init() == -1)
+    errx(1, "Failed to initialize libsodium");
+  // The manifest says what it's doing on stdout; send that to /dev/null
+  // and the results to the real stdout
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL)
+    err(1, "Couldn't duplicate stdout");
+  setvbuf(out, NULL, _IOLBF, 0);
+  if (freopen("/dev/null", "w", stdout) == NULL)
+    err(1, "Couldn't open /dev/null");
+
+  figleaf_save_umask();
+  snprintf(dir, sizeof dir, "%s/figleaf-manifest-XXXXXX",
+           tmpdir != NULL ? tmpdir : "/tmp");
+  if (mkdtemp(dir) == NULL)
+    err(1, "Couldn't create a directory to test in");
+  snprintf(input, sizeof input, "%s/in.jpg", dir);
+  snprintf(output, sizeof output, "%s/out.jpg", dir);
+  snprintf(manifest, sizeof manifest, "%s/manifest", dir);
+  snprintf(journal, sizeof journal, "%s/journal", dir);
+  write_text(input, "input");
+  snprintf(line, sizeof line, "%s\t%s\n", input, output);
+  write_text(manifest, line);
+
+  memset(&ctx, 0, sizeof(struct figleaf_context));
+  ctx.tpe_method_name = "noop";
+  ctx.mode = FIGLEAF_MODE_ENCRYPT;
+  ctx.blocksize = 16;
+
+  figleaf_roi_init(&roi);
+  figleaf_roi_init(&other_roi);
+  figleaf_roi_init(&crop);
+  if (figleaf_roi_parse(&roi, "0,0,16,16", 9) != NULL ||
+      figleaf_roi_parse(&other_roi, "16,16,16,16", 11) != NULL ||
+      figleaf_roi_parse_crop(&crop, "32x32+0+0") != NULL)
+    errx(1, "Couldn't parse the test regions");
+
+  check(run_manifest(manifest, journal, &ctx) == 1, "new job done");
+  check(run_manifest(manifest, journal, &ctx) == 0, "unchanged job skipped");
+  ctx.roi = &roi;
+  check(run_manifest(manifest, journal, &ctx) == 1, "job with --roi redone");
+  check(run_manifest(manifest, journal, &ctx) == 0,
+        "unchanged job with --roi skipped");
+  ctx.roi = &other_roi;
+  check(run_manifest(manifest, journal, &ctx) == 1,
+        "job with different --roi redone");
+  ctx.roi = NULL;
+  check(run_manifest(manifest, journal, &ctx) == 1, "job without --roi redone");
+
+  ctx.mode = FIGLEAF_MODE_DECRYPT;
+  check(run_manifest(manifest, journal, &ctx) == 1, "decrypting job done");
+  ctx.crop = &crop;
+  check(run_manifest(manifest, journal, &ctx) == 1, "job with --crop redone");
+  check(run_manifest(manifest, journal, &ctx) == 0,
+        "unchanged job with --crop skipped");
+  crop.rects[0].x = 16;
+  check(run_manifest(manifest, journal, &ctx) == 1,
+        "job with different --crop redone");
+
+  figleaf_roi_destroy(&roi);
+  figleaf_roi_destroy(&other_roi);
+  figleaf_roi_destroy(&crop);
+  unlink(input);
+  unlink(output);
+  unlink(manifest);
+  unlink(journal);
+  rmdir(dir);
+  return num_failed ? 1 : 0;
+}
@@ -0,0 +1,732 @@
+/*
+ * Round-trip property tests for the TPE modules
+ *
+ * For every module, blocksize and module argument worth trying, this
+ * checks two things:
+ *
+ *   - decrypt(encrypt(x)) == x, coefficient for coefficient
+ *   - encryption leaves the sum of the DC coefficients in each thumbnail
+ *     block alone, which is what keeps the thumbnail
+ *
+ * first on arrays of random coefficients run straight through
+ * tpe_process_image(), then on JPEGs generated here and run through the
+ * worker the way figleaf does it.  The JPEGs are also encrypted with and
+ * without threads and restart intervals, which must come out with the
+ * same coefficients, and with regions of interest (see roi.h), which must
+ * leave the tiles outside them alone and do the same to the ones inside
+ * as encrypting the whole image does; decrypting a viewport with a crop
+ * must give the same blocks as decrypting everything and cropping.
+ * Where a minmax function has to clamp coefficients to fit the module's
+ * range, the clamped ones can't come back, so the round trip is only
+ * checked when nothing was clamped (the count is in the stats).
+ *
+ * Some modules are known not to have some of these properties yet, and
+ * are listed in known_failures[] below with the cases it happens in and
+ * why.  Those failures are counted and reported as "known" but don't
+ * fail the run, so that anything else breaking stands out.  A known
+ * failure that doesn't happen fails the run too, so the table is kept up
+ * to date as modules are fixed.  mosaic can't be decrypted, so it's only
+ * encrypted.
+ *
+ * Usage: tests/testroundtrip [-v] [seed]
+ *
+ * -v lets the modules' own output through.  Exits nonzero if anything
+ * fails that isn't known to, or a known failure passes.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for fdopen(), dup() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+#include "jpeglib.h"
+#include "jutil.h"
+#include "figleaf.h"
+#include "tpe.h"
+#include "kdf.h"
+#include "worker.h"
+#include "roi.h"
+
+// The properties checked
+#define ROUND_TRIP  0x01
+#define THUMBNAIL   0x02
+#define THREADS     0x04
+#define REGIONS     0x08
+
+struct module {
+  const char *name;
+  int decrypts;         // Can it be decrypted at all?
+  int args[4];          // Values of -a to try, ending with ARGS_END
+};
+
+#define ARGS_END -1000
+
+static const struct module modules[] = {
+  { "noop",        1, { 0, ARGS_END } },
+  { "lsb",         1, { -1, 0, 2, ARGS_END } },
+  { "drpe",        1, { 0, ARGS_END } },
+  { "drpe-nz",     1, { 0, ARGS_END } },
+  { "drpe-lsb",    1, { 0, ARGS_END } },
+  { "drpe-lsb-nz", 1, { 0, ARGS_END } },
+  { "shuffle",     1, { 0, ARGS_END } },
+  { "gibbs",       1, { 0, ARGS_END } },
+  { "mosaic",      0, { 0, 3, ARGS_END } },
+};
+#define NUM_MODULES (sizeof modules / sizeof modules[0])
+
+static const int blocksizes[] = { 8, 16, 32 };
+#define NUM_BLOCKSIZES (sizeof blocksizes / sizeof blocksizes[0])
+
+struct known_failure {
+  const char *name;
+  int blocksize;        // Or ANY
+  int arg;              // Or ANY
+  int properties;       // The properties it doesn't have there
+};
+
+#define ANY -999
+
+// Every module keeps the thumbnail at -b 8 because the DC coefficients
+// are left alone there, and the only ones listed at -b 8 are those whose
+// AC coefficients don't come back
+static const struct known_failure known_failures[] = {
+  // minmax_poweroftwo() picks the range from the coefficients, and on
+  // decryption from the encrypted ones, which can fit in fewer bits
+  { "lsb",         ANY, ANY, ROUND_TRIP },
+  // The DC bits flipped to bring the average back only get it to within
+  // half the last one flipped, and with -a 0 none are
+  { "lsb",         16,  ANY, THUMBNAIL },
+  { "lsb",         32,  ANY, THUMBNAIL },
+  // minmax_raw() takes the range from the tile's coefficients, which
+  // encryption moves, and the encrypted low bits change the DC sum.
+  // With one block to a tile every range is a single value, so nothing
+  // is encrypted at -b 8
+  { "drpe",        16,  ANY, ROUND_TRIP | THUMBNAIL },
+  { "drpe",        32,  ANY, ROUND_TRIP | THUMBNAIL },
+  { "drpe-nz",     16,  ANY, ROUND_TRIP | THUMBNAIL },
+  { "drpe-nz",     32,  ANY, ROUND_TRIP | THUMBNAIL },
+  // As drpe; the DC sum is put back as lsb does, to within a bit
+  { "drpe-lsb",    16,  ANY, ROUND_TRIP | THUMBNAIL },
+  { "drpe-lsb",    32,  ANY, ROUND_TRIP | THUMBNAIL },
+  { "drpe-lsb-nz", 16,  ANY, ROUND_TRIP | THUMBNAIL },
+  { "drpe-lsb-nz", 32,  ANY, ROUND_TRIP | THUMBNAIL },
+  // There's no AC minmax function, so fpe_decrypt_nonzero() gets an
+  // empty range and zeroes every AC coefficient
+  { "shuffle",     ANY, ANY, ROUND_TRIP },
+  // The AC range comes from minmax_poweroftwo(), as with lsb
+  { "gibbs",       ANY, ANY, ROUND_TRIP },
+  // Flattening a tile sets every DC coefficient to the average rounded to
+  // a whole number, and -a 3 then randomizes them around it
+  { "mosaic",      16,  ANY, THUMBNAIL },
+  { "mosaic",      32,  ANY, THUMBNAIL },
+};
+#define NUM_KNOWN_FAILURES (sizeof known_failures / sizeof known_failures[0])
+
+static int num_run, num_failed, num_known;
+static int known_failed;  // The known failures seen in the case in progress
+static int verbose;
+static FILE *out;       // Results, kept apart from the modules' chatter
+
+
+/* xorshift64*, so a seed gives the same cases everywhere */
+static unsigned long long rng_state;
+
+static unsigned int
+rng(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (unsigned int) ((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+/* Uniform in [lo, hi] */
+static int
+rng_range(int lo, int hi)
+{
+  return lo + (int) (rng() % (unsigned int) (hi - lo + 1));
+}
+
+/* The properties m is known not to have with this blocksize and -a */
+static int
+known(const struct module *m, int blocksize, int arg)
+{
+  int properties = 0;
+  size_t i;
+
+  for (i = 0; i < NUM_KNOWN_FAILURES; i++) {
+    const struct known_failure *k = &known_failures[i];
+    if (!strcmp(k->name, m->name) &&
+        (k->blocksize == ANY || k->blocksize == blocksize) &&
+        (k->arg == ANY || k->arg == arg))
+      properties |= k->properties;
+  }
+  return properties;
+}
+
+static void
+fail(int property, const char *what, const struct module *m,
+     int blocksize, int arg, const char *detail)
+{
+  if (known(m, blocksize, arg) & property) {
+    if (verbose)
+      fprintf(out, "known %s: %s -b %d -a %d: %s\n", what, m->name,
+              blocksize, arg, detail);
+    num_known++;
+    known_failed |= property;
+    return;
+  }
+  fprintf(out, "FAIL %s: %s -b %d -a %d: %s\n", what, m->name, blocksize,
+          arg, detail);
+  num_failed++;
+}
+
+static void
+set_module(struct figleaf_context *ctx, const char *name, crypto_op mode,
+           int blocksize, int arg)
+{
+  ctx->tpe_method_name = (char *) name;
+  ctx->mode = mode;
+  ctx->blocksize = blocksize;
+  ctx->fcn_user_arg = arg;
+  const char *error = tpe_select_module(ctx);
+  if (error != NULL)
+    errx(1, "%s: %s", name, error);
+}
+
+
+/*
+ * Random coefficient arrays
+ */
+
+static struct jeasy *
+random_blocks(int comp, int width, int height)
+{
+  struct jeasy *je = (struct jeasy *) calloc(1, sizeof(struct jeasy));
+  int c, b, k;
+
+  if (je == NULL)
+    err(1, "Couldn't allocate memory");
+  je->comp = comp;
+  je->blocks = (short ***) calloc(comp, sizeof(short **));
+  for (c = 0; c < comp; c++) {
+    // Chroma at half size, as with 4:2:0
+    je->width[c] = c ? (width + 1) / 2 : width;
+    je->height[c] = c ? (height + 1) / 2 : height;
+    int n = je->width[c] * je->height[c];
+    je->blocks[c] = (short **) calloc(n, sizeof(short *));
+    // DC drifts across the image like a real one; AC is mostly small and
+    // often zero, with the odd big one
+    int dc = rng_range(-600, 600);
+    for (b = 0; b < n; b++) {
+      je->blocks[c][b] = (short *) calloc(DCTSIZE2, sizeof(short));
+      dc += rng_range(-24, 24);
+      if (dc < -1000 || dc > 1000)
+        dc = rng_range(-600, 600);
+      je->blocks[c][b][0] = dc;
+      for (k = 1; k < DCTSIZE2; k++) {
+        unsigned int r = rng() % 100;
+        if (r < 55)
+          continue;
+        else if (r < 95)
+          je->blocks[c][b][k] = rng_range(-3, 3);
+        else
+          je->blocks[c][b][k] = rng_range(-60, 60);
+      }
+    }
+  }
+  return je;
+}
+
+static struct jeasy *
+copy_blocks(const struct jeasy *src)
+{
+  struct jeasy *je = (struct jeasy *) malloc(sizeof(struct jeasy));
+  int c, b;
+
+  if (je == NULL)
+    err(1, "Couldn't allocate memory");
+  *je = *src;
+  je->blocks = (short ***) calloc(je->comp, sizeof(short **));
+  for (c = 0; c < je->comp; c++) {
+    int n = je->width[c] * je->height[c];
+    je->blocks[c] = (short **) calloc(n, sizeof(short *));
+    for (b = 0; b < n; b++) {
+      je->blocks[c][b] = (short *) malloc(DCTSIZE2 * sizeof(short));
+      memcpy(je->blocks[c][b], src->blocks[c][b], DCTSIZE2 * sizeof(short));
+    }
+  }
+  return je;
+}
+
+static void
+free_blocks(struct jeasy *je)
+{
+  int c, b;
+
+  for (c = 0; c < je->comp; c++) {
+    for (b = 0; b < je->width[c] * je->height[c]; b++)
+      free(je->blocks[c][b]);
+    free(je->blocks[c]);
+  }
+  free(je->blocks);
+  free(je);
+}
+
+/* Whether the DC sums of every blocksize x blocksize tile match */
+static int
+same_thumbnail(const struct jeasy *a, const struct jeasy *b, int blocksize)
+{
+  int step = blocksize / 8;
+  int c, x, y, i, j;
+
+  for (c = 0; c < a->comp; c++) {
+    for (y = 0; y < a->height[c]; y += step) {
+      for (x = 0; x < a->width[c]; x += step) {
+        long sum_a = 0, sum_b = 0;
+        for (j = y; j < y + step && j < a->height[c]; j++) {
+          for (i = x; i < x + step && i < a->width[c]; i++) {
+            sum_a += a->blocks[c][j * a->width[c] + i][0];
+            sum_b += b->blocks[c][j * a->width[c] + i][0];
+          }
+        }
+        if (sum_a != sum_b)
+          return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static int
+same_blocks(const struct jeasy *a, const struct jeasy *b)
+{
+  int c, n;
+
+  for (c = 0; c < a->comp; c++) {
+    for (n = 0; n < a->width[c] * a->height[c]; n++) {
+      if (memcmp(a->blocks[c][n], b->blocks[c][n], DCTSIZE2 * sizeof(short)))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static void
+test_arrays(const struct module *m, int blocksize, int arg)
+{
+  struct figleaf_context ctx;
+  struct figleaf_stats stats;
+  unsigned char key[crypto_stream_KEYBYTES];
+  int width, height;
+
+  // Odd sizes too, so the tiles at the edges come up short
+  for (width = 1; width <= 41; width += 20) {
+    for (height = 1; height <= 41; height += 20) {
+      struct jeasy *plain = random_blocks(3, width, height);
+      struct jeasy *je = copy_blocks(plain);
+      for (size_t i = 0; i < sizeof key; i++)
+        key[i] = rng();
+
+      memset(&ctx, 0, sizeof ctx);
+      memset(&stats, 0, sizeof stats);
+      set_module(&ctx, m->name, FIGLEAF_MODE_ENCRYPT, blocksize, arg);
+      tpe_process_image(key, je, &ctx, &stats);
+      num_run++;
+
+      char detail[64];
+      snprintf(detail, sizeof detail, "%dx%d blocks", width, height);
+      if (stats.clamped == 0 && !same_thumbnail(plain, je, blocksize))
+        fail(THUMBNAIL, "thumbnail", m, blocksize, arg, detail);
+
+      if (m->decrypts) {
+        set_module(&ctx, m->name, FIGLEAF_MODE_DECRYPT, blocksize, arg);
+        tpe_process_image(key, je, &ctx, &stats);
+        if (stats.clamped == 0 && !same_blocks(plain, je))
+          fail(ROUND_TRIP, "round trip", m, blocksize, arg, detail);
+      }
+      free_blocks(plain);
+      free_blocks(je);
+    }
+  }
+}
+
+
+/*
+ * Generated JPEGs, through the worker
+ */
+
+/* A smooth picture with some noise and a few hard edges, as a JPEG */
+static void
+make_jpeg(struct figleaf_outbuf *out, int width, int height, int components,
+          int h_samp, int v_samp, int quality)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  JSAMPLE *row = (JSAMPLE *) malloc(width * components);
+  int x, y, c;
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  figleaf_mem_dest(&cinfo, out);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = components;
+  cinfo.in_color_space = components == 3 ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.comp_info[0].h_samp_factor = h_samp;
+  cinfo.comp_info[0].v_samp_factor = v_samp;
+  jpeg_start_compress(&cinfo, TRUE);
+
+  int phase = rng_range(0, 255);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    y = cinfo.next_scanline;
+    for (x = 0; x < width; x++) {
+      for (c = 0; c < components; c++) {
+        int v = (x * 255 / width + y * (c + 1) + phase) & 255;
+        if ((x / 37 + y / 29) % 3 == 0)
+          v = 255 - v;
+        v += rng_range(-12, 12);
+        row[x * components + c] = v < 0 ? 0 : v > 255 ? 255 : v;
+      }
+    }
+    JSAMPROW rows[1] = { row };
+    jpeg_write_scanlines(&cinfo, rows, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  free(row);
+}
+
+/* Run a JPEG through the worker, leaving the result in w->outbuf */
+static int
+process_jpeg(struct figleaf_worker *w, struct figleaf_context *ctx,
+             const struct figleaf_outbuf *in)
+{
+  if (figleaf_decode_image(w, in->data, in->size, ctx) != 0 ||
+      figleaf_crypt_image(w, "test.jpg", "passphrase", ctx) != 0 ||
+      figleaf_encode_image(w) != 0) {
+    fprintf(out, "  %s\n", w->recover.message);
+    return -1;
+  }
+  return 0;
+}
+
+/* Entropy-decode a JPEG into a jeasy, for comparing */
+static struct jeasy *
+read_blocks(const struct figleaf_outbuf *in)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  figleaf_mem_src(&cinfo, in->data, in->size);
+  (void) jpeg_read_header(&cinfo, TRUE);
+  struct jeasy *live = jpeg_prepare_blocks(&cinfo);
+  struct jeasy *je = copy_blocks(live);
+  jpeg_free_blocks(live);
+  jpeg_destroy_decompress(&cinfo);
+  return je;
+}
+
+static void
+copy_outbuf(struct figleaf_outbuf *dst, const struct figleaf_outbuf *src)
+{
+  dst->data = (JOCTET *) malloc(src->size);
+  if (dst->data == NULL)
+    err(1, "Couldn't allocate memory");
+  memcpy(dst->data, src->data, src->size);
+  dst->size = dst->alloc = src->size;
+}
+
+static void
+test_jpegs(const struct module *m, int blocksize, int arg)
+{
+  static const struct {
+    int width, height, components, h_samp, v_samp, quality;
+  } shapes[] = {
+    { 64, 64, 3, 2, 2, 75 },    // 4:2:0
+    { 123, 77, 3, 2, 1, 90 },   // 4:2:2, partial MCUs
+    { 96, 40, 3, 1, 1, 50 },    // 4:4:4
+    { 45, 130, 1, 1, 1, 95 },   // Grayscale
+  };
+  // The first is the reference the others are compared with
+  static const struct { int threads, restart_rows; } runs[] = {
+    { 1, 0 }, { 3, 1 }, { 2, 2 },
+  };
+  size_t s, r;
+
+  for (s = 0; s < sizeof shapes / sizeof shapes[0]; s++) {
+    struct figleaf_outbuf plain_jpeg;
+    struct jeasy *plain, *reference = NULL;
+
+    memset(&plain_jpeg, 0, sizeof plain_jpeg);
+    make_jpeg(&plain_jpeg, shapes[s].width, shapes[s].height,
+              shapes[s].components, shapes[s].h_samp, shapes[s].v_samp,
+              shapes[s].quality);
+    plain = read_blocks(&plain_jpeg);
+
+    for (r = 0; r < sizeof runs / sizeof runs[0]; r++) {
+      struct figleaf_outbuf encrypted;
+      struct figleaf_worker w;
+      struct figleaf_context ctx;
+      struct jeasy *je;
+      char detail[64];
+
+      snprintf(detail, sizeof detail, "%dx%d, %d components, %d threads",
+               shapes[s].width, shapes[s].height, shapes[s].components,
+               runs[r].threads);
+
+      memset(&ctx, 0, sizeof ctx);
+      ctx.num_threads = runs[r].threads;
+      ctx.restart_rows = runs[r].restart_rows;
+      if (kdf_select("hash", &ctx.kdf) != NULL)
+        errx(1, "No hash KDF");
+      figleaf_worker_init(&w, runs[r].threads);
+      num_run++;
+
+      set_module(&ctx, m->name, FIGLEAF_MODE_ENCRYPT, blocksize, arg);
+      if (process_jpeg(&w, &ctx, &plain_jpeg) != 0) {
+        fail(0, "encrypt", m, blocksize, arg, detail);
+        figleaf_worker_destroy(&w);
+        continue;
+      }
+      int clamped = w.stats.clamped != 0;
+      copy_outbuf(&encrypted, &w.outbuf);
+
+      je = read_blocks(&encrypted);
+      if (!clamped && !same_thumbnail(plain, je, blocksize))
+        fail(THUMBNAIL, "jpeg thumbnail", m, blocksize, arg, detail);
+      if (reference == NULL)
+        reference = je;
+      else if (!same_blocks(reference, je))
+        fail(THREADS, "threads", m, blocksize, arg, detail);
+      if (je != reference)
+        free_blocks(je);
+
+      if (m->decrypts) {
+        set_module(&ctx, m->name, FIGLEAF_MODE_DECRYPT, blocksize, arg);
+        if (process_jpeg(&w, &ctx, &encrypted) != 0) {
+          fail(0, "decrypt", m, blocksize, arg, detail);
+        } else {
+          je = read_blocks(&w.outbuf);
+          if (!clamped && !same_blocks(plain, je))
+            fail(ROUND_TRIP, "jpeg round trip", m, blocksize, arg, detail);
+          free_blocks(je);
+        }
+      }
+      figleaf_outbuf_free(&encrypted);
+      figleaf_worker_destroy(&w);
+    }
+
+    if (reference != NULL)
+      free_blocks(reference);
+    free_blocks(plain);
+    figleaf_outbuf_free(&plain_jpeg);
+  }
+}
+
+/* Whether the block at x,y in component c is in a tile that overlaps roi,
+ * for a 4:2:0 image */
+static int
+in_roi(const struct figleaf_roi *roi, int c, int x, int y, int blocksize)
+{
+  int scale = c ? 16 : 8;
+  int step = blocksize / 8;
+  long left = (x / step) * step * scale, top = (y / step) * step * scale;
+  size_t i;
+
+  for (i = 0; i < roi->num_rects; i++) {
+    const struct figleaf_roi_rect *r = &roi->rects[i];
+    if (r->x < left + blocksize / 8 * scale && r->x + r->w > left &&
+        r->y < top + blocksize / 8 * scale && r->y + r->h > top)
+      return 1;
+  }
+  return 0;
+}
+
+/* Whether je is cropped from whole at x0,y0 in pixels, for a 4:2:0 image */
+static int
+same_crop(const struct jeasy *je, const struct jeasy *whole, int x0, int y0)
+{
+  int c, x, y;
+
+  for (c = 0; c < je->comp; c++) {
+    int scale = c ? 16 : 8;
+    for (y = 0; y < je->height[c]; y++) {
+      for (x = 0; x < je->width[c]; x++) {
+        int n = (y + y0 / scale) * whole->width[c] + x + x0 / scale;
+        if (memcmp(je->blocks[c][y * je->width[c] + x], whole->blocks[c][n],
+                   DCTSIZE2 * sizeof(short)))
+          return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/* Blocks in the regions must match inside, and outside, those in outside */
+static int
+same_regions(const struct jeasy *je, const struct jeasy *inside,
+             const struct jeasy *outside, const struct figleaf_roi *roi,
+             int blocksize)
+{
+  int c, x, y;
+
+  for (c = 0; c < je->comp; c++) {
+    for (y = 0; y < je->height[c]; y++) {
+      for (x = 0; x < je->width[c]; x++) {
+        int n = y * je->width[c] + x;
+        const struct jeasy *want =
+          in_roi(roi, c, x, y, blocksize) ? inside : outside;
+        if (memcmp(je->blocks[c][n], want->blocks[c][n],
+                   DCTSIZE2 * sizeof(short)))
+          return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static void
+test_regions(const struct module *m, int blocksize, int arg)
+{
+  struct figleaf_outbuf plain_jpeg, whole, part;
+  struct figleaf_worker w;
+  struct figleaf_context ctx;
+  struct figleaf_roi roi, crop;
+  struct jeasy *plain, *je, *ref;
+  const char *detail = "regions in 100x90, 4:2:0";
+  // Leave the other tests' cases as they were
+  unsigned long long saved_rng = rng_state;
+
+  figleaf_roi_init(&roi);
+  figleaf_roi_init(&crop);
+  if (figleaf_roi_parse(&roi, "3,5,20,9;1x1+70+60", 19) != NULL ||
+      figleaf_roi_parse_crop(&crop, "40x30+21+37") != NULL)
+    errx(1, "Couldn't parse the test regions");
+  memset(&plain_jpeg, 0, sizeof plain_jpeg);
+  make_jpeg(&plain_jpeg, 100, 90, 3, 2, 2, 80);
+  plain = read_blocks(&plain_jpeg);
+
+  memset(&ctx, 0, sizeof ctx);
+  if (kdf_select("hash", &ctx.kdf) != NULL)
+    errx(1, "No hash KDF");
+  figleaf_worker_init(&w, 1);
+  num_run++;
+
+  // The whole image, then just the regions
+  set_module(&ctx, m->name, FIGLEAF_MODE_ENCRYPT, blocksize, arg);
+  if (process_jpeg(&w, &ctx, &plain_jpeg) != 0)
+    errx(1, "Couldn't encrypt the test image with %s", m->name);
+  copy_outbuf(&whole, &w.outbuf);
+  ctx.roi = &roi;
+  if (process_jpeg(&w, &ctx, &plain_jpeg) != 0)
+    errx(1, "Couldn't encrypt the test image's regions with %s", m->name);
+  copy_outbuf(&part, &w.outbuf);
+
+  ref = read_blocks(&whole);
+  je = read_blocks(&part);
+  if (!same_regions(je, ref, plain, &roi, blocksize))
+    fail(REGIONS, "regions", m, blocksize, arg, detail);
+  free_blocks(je);
+  free_blocks(ref);
+
+  // Decrypting finds the regions in the file
+  if (m->decrypts) {
+    ctx.roi = NULL;
+    set_module(&ctx, m->name, FIGLEAF_MODE_DECRYPT, blocksize, arg);
+    if (process_jpeg(&w, &ctx, &whole) != 0)
+      errx(1, "Couldn't decrypt the test image with %s", m->name);
+    ref = read_blocks(&w.outbuf);
+    if (process_jpeg(&w, &ctx, &part) != 0)
+      errx(1, "Couldn't decrypt the test image's regions with %s", m->name);
+    je = read_blocks(&w.outbuf);
+    if (!same_regions(je, ref, plain, &roi, blocksize))
+      fail(REGIONS, "regions round trip", m, blocksize, arg, detail);
+    free_blocks(je);
+
+    // The crop moves to 16,32, the nearest MCU
+    ctx.crop = &crop;
+    if (process_jpeg(&w, &ctx, &whole) != 0)
+      errx(1, "Couldn't decrypt a crop of the test image with %s", m->name);
+    je = read_blocks(&w.outbuf);
+    if (je->width[0] != 6 || je->height[0] != 5 || !same_crop(je, ref, 16, 32))
+      fail(REGIONS, "crop", m, blocksize, arg, detail);
+    free_blocks(je);
+    free_blocks(ref);
+  }
+
+  figleaf_worker_destroy(&w);
+  figleaf_outbuf_free(&whole);
+  figleaf_outbuf_free(&part);
+  figleaf_outbuf_free(&plain_jpeg);
+  free_blocks(plain);
+  figleaf_roi_destroy(&roi);
+  figleaf_roi_destroy(&crop);
+  rng_state = saved_rng;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  size_t m, b;
+  int a, i;
+
+  rng_state = 0x5eed;
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v"))
+      verbose = 1;
+    else
+      rng_state = strtoull(argv[i], NULL, 0);
+  }
+  if (rng_state == 0)
+    rng_state = 1;
+
+  // The worker and modules print as they go; unless asked for, that goes
+  // to /dev/null and the results to the real stdout
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL)
+    err(1, "Couldn't duplicate stdout");
+  setvbuf(out, NULL, _IOLBF, 0);
+  if (!verbose && freopen("/dev/null", "w", stdout) == NULL)
+    err(1, "Couldn't open /dev/null");
+
+  if (sodium_init() == -1)
+    errx(1, "Failed to initialize libsodium");
+
+  for (m = 0; m < NUM_MODULES; m++) {
+    for (b = 0; b < NUM_BLOCKSIZES; b++) {
+      for (a = 0; modules[m].args[a] != ARGS_END; a++) {
+        int failed = num_failed, was_known = num_known;
+        known_failed = 0;
+        test_arrays(&modules[m], blocksizes[b], modules[m].args[a]);
+        test_jpegs(&modules[m], blocksizes[b], modules[m].args[a]);
+        test_regions(&modules[m], blocksizes[b], modules[m].args[a]);
+        // A known failure that didn't happen means the table is out of date
+        if (known(&modules[m], blocksizes[b], modules[m].args[a]) &
+            ~known_failed) {
+          fprintf(out, "FAIL known failure passed: %s -b %d -a %d\n",
+                  modules[m].name, blocksizes[b], modules[m].args[a]);
+          num_failed++;
+        }
+        fprintf(out, "%-5s %s -b %d -a %d\n",
+                num_failed != failed ? "FAIL" :
+                num_known != was_known ? "known" : "ok",
+                modules[m].name, blocksizes[b], modules[m].args[a]);
+      }
+    }
+  }
+
+  fprintf(out, "%d cases, %d failed, %d known failures\n",
+          num_run, num_failed, num_known);
+  return num_failed ? 1 : 0;
+}
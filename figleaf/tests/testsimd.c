@@ -0,0 +1,165 @@
+/*
+ * Differential test of the SIMD routines in jpeg-6b/jsimd.c
+ *
+ * Compresses and decompresses a set of generated images through the
+ * bundled libjpeg, covering every path that has a SIMD version: the islow
+ * FDCT and IDCT, the reduced-size IDCTs, RGB<->YCbCr conversion, 2:1
+ * downsampling, and fancy and merged upsampling, at sizes that leave
+ * partial blocks and MCUs.  For each case it prints a hash of the JPEG
+ * and of the decoded pixels.
+ *
+ * The SIMD routines are chosen once per process, so the comparison is
+ * done by running this three times, as "make check" does:
+ *
+ *   tests/testsimd > simd.out
+ *   JSIMD_FORCESSE2=1 tests/testsimd | diff simd.out -
+ *   JSIMD_FORCENONE=1 tests/testsimd | diff simd.out -
+ *
+ * Any difference is a SIMD routine that doesn't match the C code.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "jpeglib.h"
+#include "fileio.h"
+
+/* 64-bit FNV-1a */
+static unsigned long long
+hash_bytes(unsigned long long h, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data;
+
+  while (len-- > 0) {
+    h ^= *p++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+/* A picture with gradients, edges and noise, from a fixed seed */
+static void
+make_image(JSAMPLE *image, int width, int height, int components)
+{
+  unsigned int seed = width * 7919 + height;
+  int x, y, c;
+
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      for (c = 0; c < components; c++) {
+        seed = seed * 1103515245 + 12345;
+        int v = (x * 4 + y * (c + 2)) & 255;
+        if (((x >> 3) ^ (y >> 2)) & 1)
+          v = 255 - v;
+        v += (int) ((seed >> 16) & 31) - 16;
+        image[(y * width + x) * components + c] =
+          v < 0 ? 0 : v > 255 ? 255 : v;
+      }
+    }
+  }
+}
+
+static void
+compress(struct figleaf_outbuf *out, const JSAMPLE *image, int width,
+         int height, int components, int h_samp, int v_samp)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  figleaf_mem_dest(&cinfo, out);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = components;
+  cinfo.in_color_space = components == 3 ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 90, TRUE);
+  cinfo.comp_info[0].h_samp_factor = h_samp;
+  cinfo.comp_info[0].v_samp_factor = v_samp;
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = (JSAMPROW) image + cinfo.next_scanline * width * components;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+}
+
+static unsigned long long
+decompress(const struct figleaf_outbuf *in, int scale_denom, boolean fancy)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned long long h = HASH_INIT;
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  figleaf_mem_src(&cinfo, in->data, in->size);
+  (void) jpeg_read_header(&cinfo, TRUE);
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale_denom;
+  cinfo.do_fancy_upsampling = fancy;
+  jpeg_start_decompress(&cinfo);
+
+  int row_stride = cinfo.output_width * cinfo.output_components;
+  JSAMPARRAY row = (*cinfo.mem->alloc_sarray)
+    ((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    jpeg_read_scanlines(&cinfo, row, 1);
+    h = hash_bytes(h, row[0], row_stride);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return h;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const struct { int width, height; } sizes[] = {
+    { 1, 1 }, { 7, 5 }, { 16, 16 }, { 33, 17 }, { 129, 67 }, { 300, 200 },
+  };
+  static const struct { int components, h_samp, v_samp; } layouts[] = {
+    { 1, 1, 1 },    // Grayscale
+    { 3, 1, 1 },    // 4:4:4
+    { 3, 2, 1 },    // 4:2:2
+    { 3, 2, 2 },    // 4:2:0
+  };
+  size_t s, l;
+  int scale, fancy;
+
+  for (s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+    for (l = 0; l < sizeof layouts / sizeof layouts[0]; l++) {
+      int width = sizes[s].width, height = sizes[s].height;
+      int components = layouts[l].components;
+      JSAMPLE *image = (JSAMPLE *) malloc(width * height * components);
+      struct figleaf_outbuf jpeg;
+
+      if (image == NULL)
+        err(1, "Couldn't allocate memory");
+      make_image(image, width, height, components);
+      memset(&jpeg, 0, sizeof jpeg);
+      compress(&jpeg, image, width, height, components,
+               layouts[l].h_samp, layouts[l].v_samp);
+      printf("%dx%d %d:%dx%d jpeg %016llx\n", width, height, components,
+             layouts[l].h_samp, layouts[l].v_samp,
+             hash_bytes(HASH_INIT, jpeg.data, jpeg.size));
+
+      for (scale = 1; scale <= 8; scale *= 2) {
+        for (fancy = 0; fancy <= 1; fancy++) {
+          printf("%dx%d %d:%dx%d 1/%d%s %016llx\n", width, height,
+                 components, layouts[l].h_samp, layouts[l].v_samp, scale,
+                 fancy ? " fancy" : "", decompress(&jpeg, scale, fancy));
+        }
+      }
+      figleaf_outbuf_free(&jpeg);
+      free(image);
+    }
+  }
+  return 0;
+}
@@ -13,6 +13,15 @@
 #include "tpe.h"
 #include "minmax.h"
 #include "gibbs.h"
+#include "fpe.h"
+#include "drpe.h"
+#include "lsb.h"
+#include "drpe_lsb.h"
+#include "noop.h"
+#include "shuffle.h"
+#include "mosaic.h"
+#include "roi.h"
+#include "recover.h"
 
 #define GIBBS_CRAZY_DEBUGGING 0
 
@@ -20,7 +29,8 @@ void
 tpe_process_block(unsigned char *key,
                   struct jeasy *je, int color,
                   int xmin, int ymin, 
-                  struct figleaf_context *ctx)
+                  struct figleaf_context *ctx,
+                  struct figleaf_stats *stats)
 {
   int xmax = min(xmin + ctx->blocksize/8 - 1, je->width[color]-1);
   int ymax = min(ymin + ctx->blocksize/8 - 1, je->height[color]-1);
@@ -29,7 +39,7 @@ tpe_process_block(unsigned char *key,
   int bw = xmax - xmin + 1;
   int bh = ymax - ymin + 1;
   int blocklen = bw * bh;
-  JCOEF *block = (JCOEF *) malloc(blocklen * sizeof(JCOEF));
+  JCOEF *block = (JCOEF *) figleaf_recover_malloc(blocklen * sizeof(JCOEF));
   //uint16_t *table = je->table[color]->quantval;
 
   //printf("Processing block at\tc=%d\ty=%d\tx=%d\n", color, ymin, xmin);
@@ -105,7 +115,10 @@ tpe_process_block(unsigned char *key,
 
   }
 
-  free(block);
+  figleaf_recover_free(block);
+
+  stats->tiles++;
+  stats->freqs += DCTSIZE2;
 
 } // end tpe_process_block()
 
@@ -114,8 +127,11 @@ tpe_process_block(unsigned char *key,
 void
 tpe_process_image(unsigned char *key,
                   struct jeasy *je,
-                  struct figleaf_context *ctx)
+                  struct figleaf_context *ctx,
+                  struct figleaf_stats *stats)
 {
+  unsigned long long clamped = minmax_clamp_count();
+
   // Work on each color component c (ie c is either Y, Cb, or Cr)
   int c = 0;
   for(c=0; c < je->comp; c++)
@@ -133,15 +149,163 @@ tpe_process_image(unsigned char *key,
     for(y=0; y < je->height[c]; y += ctx->blocksize/8) {
       int x;
       for(x=0; x < je->width[c]; x += ctx->blocksize/8) {
-        tpe_process_block(key, je, c, x, y, ctx);
+        // Tiles outside the regions of interest, or outside the viewport
+        // being decrypted, are left as they are
+        if ((ctx->roi != NULL &&
+             !figleaf_roi_covers(ctx->roi, je, c, x, y, ctx->blocksize)) ||
+            (ctx->crop != NULL &&
+             !figleaf_roi_covers(ctx->crop, je, c, x, y, ctx->blocksize))) {
+          stats->tiles++;
+          stats->tiles_skipped++;
+          stats->freqs += DCTSIZE2;
+          stats->freqs_skipped += DCTSIZE2;
+          continue;
+        }
+        tpe_process_block(key, je, c, x, y, ctx, stats);
       }
     }
 
 
   } // end for c
 
+  stats->clamped += minmax_clamp_count() - clamped;
 
 
 }
 
 
+const char *
+tpe_select_module(struct figleaf_context *ctx)
+{
+  // Are we encrypting or decrypting?
+  if (ctx->mode == FIGLEAF_MODE_ENCRYPT) {
+    //ctx->DC_crypto_fcn = cascade_encrypt_block;
+    //ctx->DC_crypto_fcn = bounce_encrypt_block;
+    if (!strcmp(ctx->tpe_method_name, "lsb")) {
+      ctx->DC_crypto_fcn = lsb_encrypt_dc;
+      ctx->AC_crypto_fcn = lsb_encrypt_ac;
+      ctx->DC_minmax_fcn = minmax_poweroftwo;
+      ctx->AC_minmax_fcn = minmax_poweroftwo;
+    } else if (!strcmp(ctx->tpe_method_name, "noop")) {
+      ctx->DC_crypto_fcn = noop_encrypt_block;
+      ctx->AC_crypto_fcn = noop_encrypt_block;
+      ctx->DC_minmax_fcn = NULL;
+      ctx->AC_minmax_fcn = NULL;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe")) {
+      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe-nz")) {
+      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb")) {
+      ctx->DC_crypto_fcn = drpe_lsb_encrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb-nz")) {
+      ctx->DC_crypto_fcn = drpe_lsb_encrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "mosaic")) {
+      ctx->DC_crypto_fcn = mosaic_fuzzy_block;
+      ctx->AC_crypto_fcn = mosaic_zero_block;
+      //ctx->AC_crypto_fcn = fpe_encrypt_all;
+      ctx->DC_minmax_fcn = NULL;
+      ctx->AC_minmax_fcn = NULL;
+    } else if (!strcmp(ctx->tpe_method_name, "shuffle")) {
+      ctx->DC_crypto_fcn = shuffle_encrypt_block;
+      ctx->AC_crypto_fcn = fpe_encrypt_nonzero;
+      //ctx->AC_crypto_fcn = fpe_encrypt_all;
+      ctx->DC_minmax_fcn = NULL;
+      ctx->AC_minmax_fcn = NULL;
+    } else if (!strcmp(ctx->tpe_method_name, "gibbs")) {
+      ctx->DC_crypto_fcn = gibbs_encrypt_block;
+      ctx->AC_crypto_fcn = fpe_encrypt_nonzero;
+      //ctx->AC_crypto_fcn = fpe_encrypt_all;
+      ctx->DC_minmax_fcn = minmax_bitmask;
+      ctx->AC_minmax_fcn = minmax_poweroftwo;
+    } else {
+      return "Invalid TPE module name, or no encryption module specified";
+    }
+    // One more sanity check:
+    // If we're working on 8x8 blocks, we should really
+    // just leave the DC coefficients alone.
+    if (ctx->blocksize == 8) {
+      ctx->DC_crypto_fcn = noop_encrypt_block;
+      ctx->DC_minmax_fcn = NULL;
+      // FIXME - What should we do about the AC's?
+      // Here's one idea: preseve the first 1 bit,
+      // and encrypt all lower bits.  So it leaks
+      // a bit more, but it's always repeatable.
+    }
+  } else if (ctx->mode == FIGLEAF_MODE_DECRYPT) {
+    //ctx->DC_crypto_fcn = cascade_decrypt_block;
+    //ctx->DC_crypto_fcn = bounce_decrypt_block;
+    if (!strcmp(ctx->tpe_method_name, "lsb")) {
+      ctx->DC_crypto_fcn = lsb_decrypt_dc;
+      ctx->AC_crypto_fcn = lsb_decrypt_ac;
+      ctx->DC_minmax_fcn = minmax_poweroftwo;
+      ctx->AC_minmax_fcn = minmax_poweroftwo;
+    } else if (!strcmp(ctx->tpe_method_name, "noop")) {
+      ctx->DC_crypto_fcn = noop_decrypt_block;
+      ctx->AC_crypto_fcn = noop_decrypt_block;
+      ctx->DC_minmax_fcn = NULL;
+      ctx->AC_minmax_fcn = NULL;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe")) {
+      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe-nz")) {
+      ctx->DC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb")) {
+      ctx->DC_crypto_fcn = drpe_lsb_decrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_all;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "drpe-lsb-nz")) {
+      ctx->DC_crypto_fcn = drpe_lsb_decrypt_all;
+      ctx->AC_crypto_fcn = drpe_encrypt_decrypt_nonzero;
+      ctx->DC_minmax_fcn = minmax_raw;
+      ctx->AC_minmax_fcn = minmax_raw;
+    } else if (!strcmp(ctx->tpe_method_name, "mosaic")) {
+      return "Can't decrypt mosaiced images";
+    } else if (!strcmp(ctx->tpe_method_name, "shuffle")) {
+      ctx->DC_crypto_fcn = shuffle_decrypt_block;
+      ctx->AC_crypto_fcn = fpe_decrypt_nonzero;
+      //ctx->AC_crypto_fcn = fpe_decrypt_all;
+      ctx->DC_minmax_fcn = NULL;
+      ctx->AC_minmax_fcn = NULL;
+    } else if (!strcmp(ctx->tpe_method_name, "gibbs")) {
+      ctx->DC_crypto_fcn = gibbs_decrypt_block;
+      ctx->AC_crypto_fcn = fpe_decrypt_nonzero;
+      //ctx->AC_crypto_fcn = fpe_decrypt_all;
+      ctx->DC_minmax_fcn = minmax_bitmask;
+      ctx->AC_minmax_fcn = minmax_poweroftwo;
+    } else {
+      return "Invalid TPE module name, or no decryption module specified";
+    }
+    // One more sanity check:
+    // If we're working on 8x8 blocks, we should really
+    // just leave the DC coefficients alone.
+    if (ctx->blocksize == 8) {
+      ctx->DC_crypto_fcn = noop_decrypt_block;
+      ctx->DC_minmax_fcn = NULL;
+      // FIXME - What should we do about the AC's?
+      // Here's one idea: preseve the first 1 bit,
+      // and encrypt all lower bits.  So it leaks
+      // a bit more, but it's always repeatable.
+    }
+  } else {
+    return "Invalid mode -- Mode must be either ENCRYPT (-e) or DECRYPT (-d)";
+  }
+  return NULL;
+}
@@ -5,17 +5,27 @@
 #include <jutil.h>
 
 #include "figleaf.h"
+#include "stats.h"
 
 
 void
 tpe_process_block(unsigned char *key,
                   struct jeasy *je, int color,
                   int xmin, int ymin,
-                  struct figleaf_context *ctx);
+                  struct figleaf_context *ctx,
+                  struct figleaf_stats *stats);
 
 void
 tpe_process_image(unsigned char *key,
                   struct jeasy *je,
-                  struct figleaf_context *ctx);
+                  struct figleaf_context *ctx,
+                  struct figleaf_stats *stats);
+
+/* Point ctx's DC/AC crypto and minmax functions at the module named by
+ * ctx->tpe_method_name, for ctx->mode and ctx->blocksize.  Returns NULL
+ * on success, or a message saying what's wrong.
+ */
+const char *
+tpe_select_module(struct figleaf_context *ctx);
 
 #endif
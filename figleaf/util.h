@@ -4,25 +4,27 @@
 #include <assert.h>
 #include <jpeglib.h>
 
+#include "recover.h"
+
 #define min(x, y) ((x) < (y) ? (x) : (y))
 #define max(x, y) ((x) > (y) ? (x) : (y))
 #define abs(x) ((x) > (0) ? (x) : (((typeof(x))(-1))*(x)))
 
-/** Tripping one of these asserts means there is a bug someplace */
+/** Tripping one of these asserts means there is a bug someplace.
+ *  It only fails the image being worked on, though (see recover.h), so
+ *  one odd file doesn't take a whole batch down with it. */
 #define ASSERTF(condition, fmt, ...)                                          \
   do {                                                                        \
     if (!(condition))                                                         \
-      printf("%s:%d %s() " fmt "\n", __FILE__, __LINE__,                      \
-             __func__, ##__VA_ARGS__);                                        \
-    assert(condition);                                                        \
+      figleaf_errx("%s:%d %s() " fmt, __FILE__, __LINE__,                     \
+                   __func__, ##__VA_ARGS__);                                  \
   } while (0)
 
 #define ASSERT(condition)                                                     \
   do {                                                                        \
     if (!(condition))                                                         \
-      printf("%s:%d %s(): expression '" #condition "' evaluated to 0\n",      \
-             __FILE__, __LINE__, __func__);                                   \
-    assert(condition);                                                        \
+      figleaf_errx("%s:%d %s(): expression '" #condition "' evaluated to 0",  \
+                   __FILE__, __LINE__, __func__);                             \
   } while (0)
 
 unsigned int
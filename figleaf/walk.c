@@ -0,0 +1,262 @@
+#define _DEFAULT_SOURCE  // for d_type, strdup() and lstat() under -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <err.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "walk.h"
+
+struct walk_dir {
+  DIR *dir;
+  size_t in_len, out_len;   // Length of the directory's path in each tree
+};
+
+
+int
+figleaf_is_jpeg_filename(const char *name)
+{
+  const char *dot = strrchr(name, '.');
+  return dot != NULL && dot != name &&
+         (!strcasecmp(dot, ".jpg") || !strcasecmp(dot, ".jpeg"));
+}
+
+unsigned
+figleaf_shard_of(const char *relative_path, unsigned count)
+{
+  // 64-bit FNV-1a: simple, and the same on every machine
+  unsigned long long h = 14695981039346656037ULL;
+  const unsigned char *p;
+
+  for (p = (const unsigned char *) relative_path; *p; p++) {
+    h ^= *p;
+    h *= 1099511628211ULL;
+  }
+  return (unsigned) (h % count);
+}
+
+/* Put "/name" at *path + len, growing the buffer if need be */
+static void
+path_append(char **path, size_t *alloc, size_t len, const char *name)
+{
+  size_t name_len = strlen(name);
+
+  if (len + name_len + 2 > *alloc) {
+    *alloc = (len + name_len + 2) * 2;
+    *path = (char *) realloc(*path, *alloc);
+    if (*path == NULL)
+      err(1, "Couldn't allocate memory for path");
+  }
+  (*path)[len] = '/';
+  memcpy(*path + len + 1, name, name_len + 1);
+}
+
+/* Open the directory named by w->in_path and make it the innermost one */
+static int
+walk_push(struct figleaf_walk *w, size_t in_len, size_t out_len)
+{
+  DIR *dir = opendir(w->in_path);
+
+  if (dir == NULL) {
+    warn("Couldn't open directory [%s]; skipping it", w->in_path);
+    return 0;
+  }
+  if (w->depth == w->stack_alloc) {
+    w->stack_alloc = w->stack_alloc ? w->stack_alloc * 2 : 16;
+    w->stack = (struct walk_dir *)
+      realloc(w->stack, w->stack_alloc * sizeof(struct walk_dir));
+    if (w->stack == NULL)
+      err(1, "Couldn't allocate memory for directory walk");
+  }
+  w->stack[w->depth].dir = dir;
+  w->stack[w->depth].in_len = in_len;
+  w->stack[w->depth].out_len = out_len;
+  w->depth++;
+  return 1;
+}
+
+/* Enter the subdirectory whose path is in w->in_path, unless it's the
+ * output tree, creating its counterpart in the output tree.
+ */
+static void
+walk_enter(struct figleaf_walk *w, struct walk_dir *parent, const char *name)
+{
+  struct stat st;
+  size_t in_len = parent->in_len + 1 + strlen(name);
+
+  if (stat(w->in_path, &st) == 0 &&
+      st.st_dev == w->out_dev && st.st_ino == w->out_ino)
+    return;
+
+  path_append(&w->out_path, &w->out_alloc, parent->out_len, name);
+  if (!w->skip_output_dirs && mkdir(w->out_path, 0777) != 0 &&
+      errno != EEXIST)
+    err(1, "Couldn't create output directory [%s]", w->out_path);
+
+  walk_push(w, in_len, parent->out_len + 1 + strlen(name));
+}
+
+static int
+walk_next_locked(struct figleaf_walk *w, struct figleaf_job *job)
+{
+  while (w->depth > 0) {
+    struct walk_dir *top = &w->stack[w->depth - 1];
+
+    errno = 0;
+    struct dirent *ent = readdir(top->dir);
+    if (ent == NULL) {
+      if (errno != 0)
+        warn("Couldn't read directory [%.*s]", (int) top->in_len, w->in_path);
+      closedir(top->dir);
+      w->depth--;
+      continue;
+    }
+
+    const char *name = ent->d_name;
+    if (!strcmp(name, ".") || !strcmp(name, ".."))
+      continue;
+    path_append(&w->in_path, &w->in_alloc, top->in_len, name);
+
+    // Don't follow symlinks to directories, which could loop; symlinks
+    // to files are fine
+    int is_dir = (ent->d_type == DT_DIR);
+    int is_file = (ent->d_type == DT_REG);
+    if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) {
+      struct stat lst, st;
+      if (lstat(w->in_path, &lst) != 0)
+        continue;
+      st = lst;
+      if (S_ISLNK(lst.st_mode) && stat(w->in_path, &st) != 0)
+        continue;
+      is_dir = S_ISDIR(lst.st_mode);
+      is_file = S_ISREG(st.st_mode);
+    }
+
+    if (is_dir) {
+      walk_enter(w, top, name);
+    } else if (is_file && figleaf_is_jpeg_filename(name)) {
+      if (w->shard_count > 1 &&
+          figleaf_shard_of(w->in_path + w->root_len + 1, w->shard_count)
+            != w->shard_index) {
+        w->num_other_shards++;
+        continue;
+      }
+      path_append(&w->out_path, &w->out_alloc, top->out_len, name);
+      job->input_filename = strdup(w->in_path);
+      job->output_filename = strdup(w->out_path);
+      if (job->input_filename == NULL || job->output_filename == NULL)
+        err(1, "Couldn't allocate memory for job");
+      printf("Found input file [%s]\n", job->input_filename);
+      printf("\tOutput file will be [%s]\n", job->output_filename);
+      job->ctx = NULL;
+      w->num_found++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int
+walk_next(struct figleaf_jobs *jobs, struct figleaf_job *job)
+{
+  struct figleaf_walk *w = (struct figleaf_walk *) jobs;
+  int found = 1;
+
+  pthread_mutex_lock(&w->lock);
+  if (w->ahead_start < w->ahead_count)
+    *job = w->ahead[w->ahead_start++];
+  else
+    found = walk_next_locked(w, job);
+  pthread_mutex_unlock(&w->lock);
+  return found;
+}
+
+static size_t
+walk_prefetch(struct figleaf_jobs *jobs, size_t n)
+{
+  struct figleaf_walk *w = (struct figleaf_walk *) jobs;
+
+  w->ahead = (struct figleaf_job *) calloc(n, sizeof(struct figleaf_job));
+  if (w->ahead == NULL)
+    err(1, "Couldn't allocate memory for jobs");
+  while (w->ahead_count < n && walk_next_locked(w, &w->ahead[w->ahead_count]))
+    w->ahead_count++;
+  return w->ahead_count;
+}
+
+static void
+walk_done(struct figleaf_jobs *jobs, struct figleaf_job *job,
+          const void *output, size_t output_size)
+{
+  figleaf_job_free(job);
+}
+
+
+void
+figleaf_walk_init(struct figleaf_walk *w, const char *input_root,
+                  const char *output_root)
+{
+  struct stat st;
+
+  memset(w, 0, sizeof(struct figleaf_walk));
+  w->pub.next = walk_next;
+  w->pub.prefetch = walk_prefetch;
+  w->pub.done = walk_done;
+  pthread_mutex_init(&w->lock, NULL);
+
+  w->in_path = strdup(input_root);
+  w->out_path = strdup(output_root);
+  if (w->in_path == NULL || w->out_path == NULL)
+    err(1, "Couldn't allocate memory for path");
+  w->in_alloc = strlen(input_root) + 1;
+  w->root_len = strlen(input_root);
+  w->out_alloc = strlen(output_root) + 1;
+
+  // An output root that doesn't exist yet can't be inside the input
+  if (stat(output_root, &st) == 0) {
+    w->out_dev = st.st_dev;
+    w->out_ino = st.st_ino;
+  } else if (errno != ENOENT) {
+    err(1, "Couldn't stat output directory [%s]", output_root);
+  }
+
+  if (!walk_push(w, strlen(input_root), strlen(output_root)))
+    errx(1, "Couldn't read input directory");
+}
+
+void
+figleaf_walk_set_shard(struct figleaf_walk *w, unsigned index, unsigned count)
+{
+  w->shard_index = index;
+  w->shard_count = count;
+}
+
+void
+figleaf_walk_destroy(struct figleaf_walk *w)
+{
+  while (w->ahead_start < w->ahead_count)
+    figleaf_job_free(&w->ahead[w->ahead_start++]);
+  while (w->depth > 0)
+    closedir(w->stack[--w->depth].dir);
+  free(w->ahead);
+  free(w->stack);
+  free(w->in_path);
+  free(w->out_path);
+  pthread_mutex_destroy(&w->lock);
+}
+
+void
+figleaf_job_free(struct figleaf_job *job)
+{
+  free(job->input_filename);
+  free(job->output_filename);
+  job->input_filename = NULL;
+  job->output_filename = NULL;
+}
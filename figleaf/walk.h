@@ -0,0 +1,84 @@
+#ifndef _WALK_H
+#define _WALK_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "batch.h"
+
+/*
+ * Streaming enumeration of the JPEG files under a directory tree.
+ *
+ * The tree is walked depth first with readdir(), one open directory per
+ * level, and jobs are handed out as the files are found: nothing is
+ * collected up front, so workers start straight away and memory use
+ * doesn't grow with the number of files.  Files ending in .jpg or .jpeg
+ * (in any case) are matched.  The output tree mirrors the input tree;
+ * output subdirectories are created as the walk reaches them.
+ *
+ * The walk is a job source (see batch.h); pass &walk.pub to the batch.
+ *
+ * A walk can be limited to one shard of the tree, so that several
+ * machines sharing a filesystem can split it between them without
+ * talking to each other: each file goes to the shard picked by a hash of
+ * its path relative to the input root, which every machine computes the
+ * same way whatever order it finds the files in.
+ *
+ * With skip_output_dirs set, the output root needn't exist and nothing is
+ * created under it, for jobs that make up their own output names from the
+ * ones they're given (see sweep.h).
+ */
+
+struct walk_dir;
+
+struct figleaf_walk {
+  struct figleaf_jobs pub;
+  pthread_mutex_t lock;
+
+  struct walk_dir *stack;   // Open directories, innermost last
+  size_t depth, stack_alloc;
+
+  // Path of the innermost directory, in the input and output trees
+  char *in_path, *out_path;
+  size_t in_alloc, out_alloc;
+
+  // Identifies the output root, so it's skipped if it's inside the input
+  unsigned long long out_dev, out_ino;
+
+  // Jobs read ahead by prefetch, handed out first
+  struct figleaf_job *ahead;
+  size_t ahead_start, ahead_count;
+
+  size_t root_len;          // Length of the input root, for relative paths
+  unsigned shard_index, shard_count;  // This walk's shard; count 0 means all
+  size_t num_found;         // Files found so far, in this shard
+  size_t num_other_shards;  // Files found that belong to other shards
+  int skip_output_dirs;     // Leave creating the output tree to the jobs
+};
+
+void
+figleaf_walk_init(struct figleaf_walk *w, const char *input_root,
+                  const char *output_root);
+
+/* Only hand out the files in shard index (counting from 0) of count.
+ * Call before the walk is used. */
+void
+figleaf_walk_set_shard(struct figleaf_walk *w, unsigned index, unsigned count);
+
+/* The shard, of count, that the file at this path relative to the input
+ * root belongs to */
+unsigned
+figleaf_shard_of(const char *relative_path, unsigned count);
+
+void
+figleaf_walk_destroy(struct figleaf_walk *w);
+
+/* Whether the name ends in .jpg or .jpeg, in any case */
+int
+figleaf_is_jpeg_filename(const char *name);
+
+/* Free a job's filenames */
+void
+figleaf_job_free(struct figleaf_job *job);
+
+#endif
@@ -0,0 +1,591 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include <sodium.h>
+
+#include <libgen.h>  // for basename()
+
+#include <jpeglib.h>
+#include <jutil.h>
+
+#include "figleaf.h"
+#include "tpe.h"
+#include "kdf.h"
+#include "worker.h"
+#include "requant.h"
+#include "fileio.h"
+#include "recover.h"
+#include "budget.h"
+#include "sweep.h"
+#include "dataset.h"
+
+
+void
+figleaf_worker_init(struct figleaf_worker *w, int num_threads)
+{
+  memset(w, 0, sizeof(struct figleaf_worker));
+  figleaf_sizes_init(&w->sizes);
+
+  // libjpeg's own error_exit would exit(); ours gives up on the image
+  // instead (see recover.h)
+  //puts("Creating JPEG decompression object");
+  w->jpegdec.err = jpeg_std_error(&w->jerr_dec);
+  w->jerr_dec.error_exit = figleaf_jpeg_error_exit;
+  jpeg_create_decompress(&w->jpegdec);
+  // Encrypted files say which tiles were encrypted in a marker of their own
+  jpeg_save_markers(&w->jpegdec, FIGLEAF_ROI_MARKER, 0xFFFF);
+  figleaf_roi_init(&w->roi_read);
+
+  //puts("Creating JPEG compression object");
+  w->jpegenc.err = jpeg_std_error(&w->jerr_enc);
+  w->jerr_enc.error_exit = figleaf_jpeg_error_exit;
+  jpeg_create_compress(&w->jpegenc);
+
+  // The sweep still has the input open in jpegdec when it decodes its
+  // outputs for --dataset, so they get a decoder of their own
+  w->jpegpix.err = jpeg_std_error(&w->jerr_pix);
+  w->jerr_pix.error_exit = figleaf_jpeg_error_exit;
+  jpeg_create_decompress(&w->jpegpix);
+
+  // jpeg_create_* clear the parallel hook, so set it up afterwards
+  if (num_threads > 1) {
+    figleaf_parallel_init(&w->parallel, num_threads);
+    w->jpegdec.parallel = &w->parallel.pub;
+    w->jpegenc.parallel = &w->parallel.pub;
+  }
+}
+
+void
+figleaf_worker_share_spare(struct figleaf_worker *w, int num_workers)
+{
+  // Split evenly between its three codec objects
+  long share = FIGLEAF_SPARE_SPACE / (num_workers > 1 ? num_workers : 1) / 3;
+
+  w->jpegdec.mem->max_spare_space = share;
+  w->jpegenc.mem->max_spare_space = share;
+  w->jpegpix.mem->max_spare_space = share;
+}
+
+static void
+worker_release_budget(struct figleaf_worker *w)
+{
+  if (w->budget != NULL) {
+    // Memory the codec objects keep for the next image isn't covered by
+    // the budget once it's released, so hand it back now
+    jpeg_release_spare((j_common_ptr) &w->jpegdec);
+    jpeg_release_spare((j_common_ptr) &w->jpegenc);
+    figleaf_budget_release(w->budget, w->budget_held);
+    w->budget = NULL;
+    w->budget_held = 0;
+  }
+}
+
+/* Throw away whatever's left of an image that failed part way through,
+ * leaving the worker ready for the next one */
+static void
+worker_recover(struct figleaf_worker *w)
+{
+  jpeg_abort_decompress(&w->jpegdec);
+  jpeg_abort_compress(&w->jpegenc);
+  jpeg_abort_decompress(&w->jpegpix);
+  if (w->je != NULL) {
+    jpeg_free_blocks(w->je);
+    w->je = NULL;
+  }
+  if (w->je_orig != NULL) {
+    jpeg_free_blocks(w->je_orig);
+    w->je_orig = NULL;
+  }
+  figleaf_input_close(&w->input);
+  figleaf_recover_release(&w->recover);
+  w->outbuf.size = 0;
+  worker_release_budget(w);
+}
+
+// Set up a recovery point in the calling stage function: an error in the
+// image returns -1 from it, with the message in w->recover.message.
+// Stage functions calling other stage functions use the static versions,
+// so there's only ever one recovery point at a time.
+#define WORKER_TRY(w)                                                   \
+  do {                                                                  \
+    if (setjmp((w)->recover.env) != 0) {                                \
+      worker_recover(w);                                                \
+      return -1;                                                        \
+    }                                                                   \
+    figleaf_recover_point = &(w)->recover;                              \
+  } while (0)
+
+#define WORKER_DONE() \
+  do { figleaf_recover_point = NULL; return 0; } while (0)
+
+void
+figleaf_worker_destroy(struct figleaf_worker *w)
+{
+  jpeg_destroy_compress(&w->jpegenc);
+  jpeg_destroy_decompress(&w->jpegdec);
+  jpeg_destroy_decompress(&w->jpegpix);
+  figleaf_outbuf_free(&w->outbuf);
+  figleaf_sizes_destroy(&w->sizes);
+  figleaf_roi_destroy(&w->roi_read);
+  figleaf_recover_release(&w->recover);
+  free(w->pixels);
+}
+
+/* Count how many bits the coefficients in w->je take to code, for
+ * --size-report.  The output is counted with the encoder's tables, which
+ * are the standard ones; so is an input that doesn't have its own. */
+static void
+count_sizes(struct figleaf_worker *w, enum figleaf_size_side side,
+            struct figleaf_context *ctx)
+{
+  struct jpeg_decompress_struct *jpegdec = &w->jpegdec;
+  struct jpeg_compress_struct *jpegenc = &w->jpegenc;
+  JHUFF_TBL *dc[MAX_COMPONENTS], *ac[MAX_COMPONENTS];
+  int c;
+
+  for (c = 0; c < jpegdec->num_components; c++) {
+    dc[c] = jpegenc->dc_huff_tbl_ptrs[jpegenc->comp_info[c].dc_tbl_no];
+    ac[c] = jpegenc->ac_huff_tbl_ptrs[jpegenc->comp_info[c].ac_tbl_no];
+    if (side == FIGLEAF_SIZE_IN && !jpegdec->progressive_mode) {
+      jpeg_component_info *comp = &jpegdec->comp_info[c];
+      if (jpegdec->dc_huff_tbl_ptrs[comp->dc_tbl_no] != NULL)
+        dc[c] = jpegdec->dc_huff_tbl_ptrs[comp->dc_tbl_no];
+      if (jpegdec->ac_huff_tbl_ptrs[comp->ac_tbl_no] != NULL)
+        ac[c] = jpegdec->ac_huff_tbl_ptrs[comp->ac_tbl_no];
+    }
+  }
+  if (side == FIGLEAF_SIZE_IN)
+    figleaf_sizes_count(&w->sizes, side, w->je, jpegdec, dc, ac,
+                        jpegdec->restart_interval, 0, ctx->blocksize / 8);
+  else
+    figleaf_sizes_count(&w->sizes, side, w->je, jpegdec, dc, ac,
+                        0, ctx->restart_rows, ctx->blocksize / 8);
+}
+
+
+/* Set up the crop for the image whose header has just been read, and
+ * work out which part of it will be kept */
+static void
+start_crop(struct figleaf_worker *w, const struct figleaf_roi *crop)
+{
+  struct jpeg_decompress_struct *jpegdec = &w->jpegdec;
+  const struct figleaf_roi_rect *r = &crop->rects[0];
+
+  if (r->x >= jpegdec->image_width || r->y >= jpegdec->image_height)
+    figleaf_errx("Crop is outside the %ux%u image",
+                 jpegdec->image_width, jpegdec->image_height);
+  memset(&w->transform, 0, sizeof(jpeg_transform_info));
+  w->transform.transform = JXFORM_NONE;
+  w->transform.crop = TRUE;
+  w->transform.crop_width = r->w;
+  w->transform.crop_height = r->h;
+  w->transform.crop_xoffset = r->x;
+  w->transform.crop_yoffset = r->y;
+  jtransform_request_workspace(jpegdec, &w->transform);
+
+  w->viewport_rect.x = (long) w->transform.x_crop_offset *
+                       jpegdec->max_h_samp_factor * DCTSIZE;
+  w->viewport_rect.y = (long) w->transform.y_crop_offset *
+                       jpegdec->max_v_samp_factor * DCTSIZE;
+  w->viewport_rect.w = w->transform.output_width;
+  w->viewport_rect.h = w->transform.output_height;
+  w->viewport.rects = &w->viewport_rect;
+  w->viewport.num_rects = w->viewport.alloc = 1;
+}
+
+static void
+decode_image(struct figleaf_worker *w, const JOCTET *data, size_t size,
+             struct figleaf_context *ctx)
+{
+  struct jpeg_decompress_struct *jpegdec = &w->jpegdec;
+  struct jpeg_compress_struct *jpegenc = &w->jpegenc;
+  double t = figleaf_now();
+
+  memset(&w->stats, 0, sizeof(struct figleaf_stats));
+  w->stats.bytes_in = size;
+
+  //puts("Setting JPEG input to be the input data");
+  figleaf_mem_src(jpegdec, data, size);
+
+  // The previous image's output has been written out by now; under a
+  // budget, don't carry its buffer (sized for that image) into this one
+  if (ctx->mem_budget != NULL)
+    figleaf_outbuf_free(&w->outbuf);
+
+  //puts("Setting JPEG output to be our output buffer");
+  figleaf_mem_dest(jpegenc, &w->outbuf);
+
+  //puts("Reading JPEG header");
+  (void) jpeg_read_header(jpegdec, TRUE);
+  // A file encrypted with regions of interest is decrypted with the same
+  // ones, whatever the command line says
+  w->roi = ctx->roi;
+  if (ctx->mode == FIGLEAF_MODE_DECRYPT &&
+      figleaf_roi_from_markers(&w->roi_read, jpegdec))
+    w->roi = &w->roi_read;
+  w->record_roi = (ctx->mode == FIGLEAF_MODE_ENCRYPT && w->roi != NULL);
+  // The crop's workspace has to be asked for before the coefficients are
+  // read in
+  w->cropping = (ctx->crop != NULL);
+  if (w->cropping)
+    start_crop(w, ctx->crop);
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_HEADER, &t);
+
+  // The header says how big the coefficient arrays will be; wait until
+  // there's room for them before reading them in
+  if (ctx->mem_budget != NULL) {
+    w->budget_held = figleaf_budget_estimate(jpegdec, size);
+    // A sweep keeps a second copy of the blocks (see figleaf_sweep_image())
+    if (ctx->sweep != NULL)
+      w->budget_held += figleaf_budget_estimate(jpegdec, 0) / 2;
+    figleaf_budget_acquire(ctx->mem_budget, w->budget_held);
+    w->budget = ctx->mem_budget;
+    t = figleaf_now();
+  }
+
+  // Copy all the JPEG params from the decoder struct into the encoder struct
+  //puts("Copying JPEG parameters");
+  jpeg_copy_critical_parameters(jpegdec, jpegenc);
+  // Restart markers let the next reader split up the entropy decoding
+  jpegenc->restart_in_rows = ctx->restart_rows;
+
+  // Use Provos's easy interface to get at the DCT block data
+  // jpeg_prepare_blocks() reads the coefficients itself, but doing it
+  // first lets the entropy decoding be timed on its own
+  (void) jpeg_read_coefficients(jpegdec);
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_COEF_READ, &t);
+  //puts("Creating JPEG Easy struct");
+  w->je = jpeg_prepare_blocks(jpegdec);
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_PREPARE, &t);
+  // Before requantizing, so the input is counted as it came
+  if (ctx->size_log != NULL)
+    count_sizes(w, FIGLEAF_SIZE_IN, ctx);
+
+  // Bring uploads down to the house quantization before encrypting, so the
+  // encrypted file is only as big as it needs to be.  Decrypting leaves the
+  // tables alone, since the encrypted file already carries the new ones.
+  if (ctx->mode == FIGLEAF_MODE_ENCRYPT && ctx->quant_tables[0] != NULL) {
+    requant_image(w->je, ctx->quant_tables);
+    requant_set_tables(jpegenc, ctx->quant_tables);
+    figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_REQUANT, &t);
+  }
+}
+
+/* Derive the image's key, from the passphrase or the master key */
+static void
+derive_key(struct figleaf_worker *w, char *input_filename, char *passphrase,
+           struct figleaf_context *ctx, unsigned char *key)
+{
+  if (passphrase == NULL) {
+    figleaf_errx("Empty passphrase");
+  }
+
+  double t = figleaf_now();
+  char *key_salt = NULL;
+  int salt_length = 0;
+  if (ctx->salt_source != NULL && !strcmp(ctx->salt_source, "filename")) {
+    key_salt = basename(input_filename);
+    salt_length = strlen(key_salt);
+  } else if (ctx->salt_source != NULL) {
+    // A manifest can give each job a salt of its own
+    key_salt = ctx->salt_source;
+    salt_length = strlen(key_salt);
+  }
+
+  if (ctx->master_key != NULL) {
+    if (kdf_subkey(key, crypto_stream_KEYBYTES,
+                   ctx->master_key, crypto_generichash_KEYBYTES,
+                   (unsigned char *)key_salt, salt_length)
+        != 0)
+      figleaf_errx("Key derivation failed");
+  } else if (ctx->kdf(key, crypto_stream_KEYBYTES,
+                      (unsigned char *)passphrase, strlen(passphrase),
+                      (unsigned char *)key_salt, salt_length)
+             != 0) {
+    figleaf_errx("Key derivation failed");
+  }
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_KDF, &t);
+
+#if 0
+  char buf[65];
+  sodium_bin2hex(buf, sizeof buf, key, crypto_stream_KEYBYTES);
+  printf("Derived key is [%s]\n", buf);
+#endif
+}
+
+/* Run the TPE construction over w->je and hand the result back to the
+ * decoder's coefficient arrays, for encode_coefficients() to pick up */
+static void
+transform_image(struct figleaf_worker *w, const unsigned char *key,
+                struct figleaf_context *ctx)
+{
+  struct figleaf_context image_ctx = *ctx;
+  double t = figleaf_now();
+
+  // Now run whichever operation we've decided to do
+  puts("Running crypto functions on the input image");
+  image_ctx.roi = w->roi;
+  image_ctx.crop = w->cropping ? &w->viewport : NULL;
+  tpe_process_image((unsigned char *) key, w->je, &image_ctx, &w->stats);
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_TPE, &t);
+  if (ctx->size_log != NULL)
+    count_sizes(w, FIGLEAF_SIZE_OUT, ctx);
+
+  // Copy DCT coefficients into the output image (that is, the JPEG compression object)
+  //puts("Writing JPEG blocks back into JEasy");
+  jpeg_return_blocks(w->je, &w->jpegdec);
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_RETURN, &t);
+}
+
+static void
+crypt_image(struct figleaf_worker *w, char *input_filename,
+            char *passphrase, struct figleaf_context *ctx)
+{
+  // And for a sanity check, let's have a look at one of the blocks
+  //puts("Here's block (0,0)");
+  //print_block(w->je->blocks[0][0]);
+
+  unsigned char key[crypto_stream_KEYBYTES];
+  derive_key(w, input_filename, passphrase, ctx, key);
+  transform_image(w, key, ctx);
+
+  double t = figleaf_now();
+  //puts("Freeing JEasy structure");
+  jpeg_free_blocks(w->je);
+  w->je = NULL;
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_RETURN, &t);
+}
+
+/* Entropy-encode the coefficients the decoder holds into w->outbuf.  The
+ * decoder's arrays are left alone, so this can be done again after
+ * putting different blocks in them. */
+static void
+encode_coefficients(struct figleaf_worker *w)
+{
+  struct jpeg_decompress_struct *jpegdec = &w->jpegdec;
+  struct jpeg_compress_struct *jpegenc = &w->jpegenc;
+
+  // Copy the actual DCT coefficients from the decoder to the encoder
+  //puts("Copying DCT coefficients");
+  jvirt_barray_ptr *coeffs = jpeg_read_coefficients(jpegdec);
+  if (w->cropping) {
+    // Only the blocks in the crop are copied over and entropy-coded
+    jpeg_write_coefficients(jpegenc,
+                            jtransform_adjust_parameters(jpegdec, jpegenc,
+                                                         coeffs, &w->transform));
+    jtransform_execute_transformation(jpegdec, jpegenc, coeffs, &w->transform);
+  } else {
+    jpeg_write_coefficients(jpegenc, coeffs);
+  }
+  if (w->record_roi) {
+    JOCTET marker[FIGLEAF_ROI_MAX];
+    size_t len = figleaf_roi_format(w->roi, marker, sizeof marker);
+    if (len == 0)
+      figleaf_errx("Too many regions to record in the output");
+    jpeg_write_marker(jpegenc, FIGLEAF_ROI_MARKER, marker, len);
+  }
+
+  // Finish encoding the output image into the buffer.
+  // jpeg_finish_compress() leaves the compression object ready for
+  // the next image, so we don't destroy it here.
+  //puts("Finishing JPEG compression with entropy coding");
+  jpeg_finish_compress(jpegenc);
+}
+
+static void
+encode_image(struct figleaf_worker *w)
+{
+  double t = figleaf_now();
+
+  encode_coefficients(w);
+  // Likewise for the decompression object
+  (void) jpeg_finish_decompress(&w->jpegdec);
+  figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_ENCODE, &t);
+  w->stats.bytes_out = w->outbuf.size;
+  worker_release_budget(w);
+}
+
+/* Decode the image in w->outbuf to pixels and add them to the dataset */
+static void
+export_image(struct figleaf_worker *w, struct figleaf_dataset *ds,
+             const char *name)
+{
+  struct jpeg_decompress_struct *jpegdec = &w->jpegpix;
+
+  figleaf_mem_src(jpegdec, w->outbuf.data, w->outbuf.size);
+  (void) jpeg_read_header(jpegdec, TRUE);
+  (void) jpeg_start_decompress(jpegdec);
+
+  int channels = jpegdec->output_components;
+  size_t row_size = (size_t) jpegdec->output_width * channels;
+  size_t plane_size = (size_t) jpegdec->output_width * jpegdec->output_height;
+  // The planes, then a row as it comes out of libjpeg
+  size_t size = plane_size * channels + row_size;
+  if (size > w->pixels_alloc) {
+    free(w->pixels);
+    w->pixels = (unsigned char *) malloc(size);
+    if (w->pixels == NULL)
+      figleaf_err("Couldn't allocate memory for pixels");
+    w->pixels_alloc = size;
+  }
+
+  JSAMPROW row = w->pixels + plane_size * channels;
+  while (jpegdec->output_scanline < jpegdec->output_height) {
+    size_t y = jpegdec->output_scanline, x;
+    int c;
+    (void) jpeg_read_scanlines(jpegdec, &row, 1);
+    for (c = 0; c < channels; c++) {
+      unsigned char *plane = w->pixels + c * plane_size + y * jpegdec->output_width;
+      for (x = 0; x < jpegdec->output_width; x++)
+        plane[x] = row[x * channels + c];
+    }
+  }
+  (void) jpeg_finish_decompress(jpegdec);
+
+  figleaf_dataset_add(ds, name, w->pixels, channels,
+                      jpegdec->output_height, jpegdec->output_width);
+}
+
+
+int
+figleaf_read_image(struct figleaf_worker *w, char *input_filename,
+                   struct figleaf_context *ctx)
+{
+  WORKER_TRY(w);
+  // The output file isn't touched until the whole image has been encoded,
+  // so a failure never leaves a truncated file behind
+  figleaf_input_open(&w->input, input_filename);
+  decode_image(w, w->input.data, w->input.size, ctx);
+  WORKER_DONE();
+}
+
+int
+figleaf_decode_image(struct figleaf_worker *w,
+                     const JOCTET *data, size_t size,
+                     struct figleaf_context *ctx)
+{
+  WORKER_TRY(w);
+  decode_image(w, data, size, ctx);
+  WORKER_DONE();
+}
+
+int
+figleaf_crypt_image(struct figleaf_worker *w, char *input_filename,
+                    char *passphrase, struct figleaf_context *ctx)
+{
+  WORKER_TRY(w);
+  crypt_image(w, input_filename, passphrase, ctx);
+  WORKER_DONE();
+}
+
+int
+figleaf_write_image(struct figleaf_worker *w, char *output_filename)
+{
+  WORKER_TRY(w);
+  encode_image(w);
+  figleaf_input_close(&w->input);
+
+  figleaf_write_file(output_filename, w->outbuf.data, w->outbuf.size);
+  //printf("Done writing output file [%s]\n", output_filename);
+  WORKER_DONE();
+}
+
+int
+figleaf_encode_image(struct figleaf_worker *w)
+{
+  WORKER_TRY(w);
+  encode_image(w);
+  WORKER_DONE();
+}
+
+int
+figleaf_export_image(struct figleaf_worker *w, struct figleaf_dataset *ds,
+                     const char *name)
+{
+  if (ds == NULL)
+    return 0;
+  WORKER_TRY(w);
+  export_image(w, ds, name);
+  WORKER_DONE();
+}
+
+
+int
+figleaf_process_image(struct figleaf_worker *w,
+                      char *input_filename, char *output_filename,
+                      char *passphrase, struct figleaf_context *ctx)
+{
+  if (figleaf_read_image(w, input_filename, ctx) != 0 ||
+      figleaf_crypt_image(w, input_filename, passphrase, ctx) != 0 ||
+      figleaf_write_image(w, output_filename) != 0)
+    return -1;
+  return 0;
+}
+
+
+int
+figleaf_sweep_image(struct figleaf_worker *w, char *input_filename,
+                    const char *output_filename, char *passphrase,
+                    const struct figleaf_sweep *sweep,
+                    struct figleaf_context *ctx)
+{
+  unsigned char key[crypto_stream_KEYBYTES];
+  char sweep_filename[FILENAME_MAX];
+  const char *output_template = sweep->output_template;
+  size_t template_len = strlen(output_template);
+  const char *relative = "";
+  size_t i;
+
+  // Only the template is expanded; the rest is a name from the input tree
+  if (strncmp(output_filename, output_template, template_len) == 0)
+    relative = output_filename + template_len;
+  else
+    output_template = output_filename;
+  WORKER_TRY(w);
+  figleaf_input_open(&w->input, input_filename);
+  decode_image(w, w->input.data, w->input.size, ctx);
+  // Nothing the sweep varies goes into the key
+  derive_key(w, input_filename, passphrase, ctx, key);
+
+  // Keep the coefficients as they were decoded, and encrypt a copy of
+  // them each time round
+  w->je_orig = w->je;
+  w->je = NULL;
+  for (i = 0; i < sweep->num_configs; i++) {
+    struct figleaf_context config = *ctx;
+    const char *module_error = figleaf_sweep_apply(sweep, i, &config);
+    if (module_error != NULL)
+      figleaf_errx("%s", module_error);
+
+    double t = figleaf_now();
+    if (w->je == NULL)
+      w->je = jpeg_clone_blocks(w->je_orig);
+    else
+      jpeg_copy_blocks(w->je, w->je_orig);
+    figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_PREPARE, &t);
+
+    transform_image(w, key, &config);
+    t = figleaf_now();
+    encode_coefficients(w);
+    figleaf_stats_lap(&w->stats, FIGLEAF_STAGE_ENCODE, &t);
+    w->stats.bytes_out += w->outbuf.size;
+
+    figleaf_sweep_output(&config, output_template, relative,
+                         sweep_filename, sizeof sweep_filename);
+    figleaf_write_file(sweep_filename, w->outbuf.data, w->outbuf.size);
+    // Each combination has a dataset of its own
+    if (ctx->dataset != NULL)
+      export_image(w, &ctx->dataset[i], input_filename);
+  }
+
+  jpeg_free_blocks(w->je);
+  w->je = NULL;
+  jpeg_free_blocks(w->je_orig);
+  w->je_orig = NULL;
+  (void) jpeg_finish_decompress(&w->jpegdec);
+  worker_release_budget(w);
+  figleaf_input_close(&w->input);
+  WORKER_DONE();
+}
@@ -0,0 +1,168 @@
+#ifndef _WORKER_H
+#define _WORKER_H
+
+#include <stdio.h>
+#include <jpeglib.h>
+#include <jutil.h>
+#include <transupp.h>
+
+#include "figleaf.h"
+#include "parallel.h"
+#include "fileio.h"
+#include "stats.h"
+#include "sizes.h"
+#include "recover.h"
+#include "budget.h"
+#include "roi.h"
+
+struct figleaf_sweep;
+struct figleaf_dataset;
+
+/*
+ * Per-thread JPEG codec state.
+ *
+ * The decompress and compress objects are created once and reused for every
+ * image the worker processes.  libjpeg resets them with jpeg_abort() when an
+ * image is finished, and the memory manager keeps its large buffers around
+ * between images, so a batch of small files doesn't pay for setting up the
+ * codec from scratch each time.
+ *
+ * The output buffer is kept as well, so it only has to grow to fit the
+ * largest image once.
+ *
+ * With more than one thread, both objects also share a task executor so
+ * that the entropy coding of each image is split across its restart
+ * intervals.
+ */
+struct figleaf_worker {
+  struct jpeg_decompress_struct jpegdec;
+  struct jpeg_compress_struct jpegenc;
+  struct jpeg_error_mgr jerr_dec, jerr_enc;
+  struct jpeg_decompress_struct jpegpix;  // For --dataset's pixels
+  struct jpeg_error_mgr jerr_pix;
+  struct figleaf_parallel parallel;
+  struct figleaf_outbuf outbuf;
+
+  // The image in progress, between figleaf_read_image() and
+  // figleaf_write_image()
+  struct figleaf_input input;
+  struct jeasy *je;
+  struct jeasy *je_orig;    // What je is copied from, with --sweep
+
+  // The tiles to work on in the image in progress (see roi.h), or NULL
+  // for all of them: the run's regions, or when decrypting, the ones in
+  // the input's marker.  Encrypting records them in the output.
+  struct figleaf_roi *roi;
+  struct figleaf_roi roi_read;  // From the input's marker
+  int record_roi;
+
+  // With --crop, the crop, and the part of the image it keeps once
+  // moved to an iMCU boundary, which is what gets decrypted
+  jpeg_transform_info transform;
+  struct figleaf_roi viewport;  // Of just viewport_rect
+  struct figleaf_roi_rect viewport_rect;
+  int cropping;
+
+  // Timings and counts for the image in progress, reset when it's read
+  struct figleaf_stats stats;
+
+  // Where its bytes go, with --size-report
+  struct figleaf_sizes sizes;
+
+  // The last image exported to a dataset, as planes of pixels
+  unsigned char *pixels;
+  size_t pixels_alloc;
+
+  // Where an error in the image in progress ends up, with its message
+  struct figleaf_recover recover;
+
+  // The share of the memory budget (see budget.h) the image in progress
+  // holds, from reading its header until it's encoded
+  struct figleaf_budget *budget;
+  size_t budget_held;
+};
+
+void
+figleaf_worker_init(struct figleaf_worker *w, int num_threads);
+
+// The most memory the codec objects of all the workers in a run keep
+// between images, altogether (see max_spare_space in jpeglib.h)
+#define FIGLEAF_SPARE_SPACE 64000000L
+
+/* Give the worker its share of FIGLEAF_SPARE_SPACE, when it's one of
+ * num_workers working at once */
+void
+figleaf_worker_share_spare(struct figleaf_worker *w, int num_workers);
+
+void
+figleaf_worker_destroy(struct figleaf_worker *w);
+
+/*
+ * The three stages of processing one image.  They must be called in this
+ * order, but needn't all be called from the same thread, so the pipelined
+ * batch mode (see pipeline.h) can hand the worker from stage to stage.
+ *
+ *   read:  map the input file and entropy-decode its DCT coefficients
+ *   crypt: derive the key and run the TPE construction over the blocks
+ *   write: entropy-encode the result and write out the output file
+ *
+ * Each returns 0, or -1 if the image is corrupt or something else went
+ * wrong with it, with the reason in w->recover.message.  The worker is
+ * then ready for the next image, and the remaining stages for this one
+ * must be skipped.
+ */
+int
+figleaf_read_image(struct figleaf_worker *w, char *input_filename,
+                   struct figleaf_context *ctx);
+
+int
+figleaf_crypt_image(struct figleaf_worker *w, char *input_filename,
+                    char *passphrase, struct figleaf_context *ctx);
+
+int
+figleaf_write_image(struct figleaf_worker *w, char *output_filename);
+
+/*
+ * The in-memory halves of the read and write stages, for images that
+ * don't come from or go to a file of their own (see tar.h).  The data
+ * passed to figleaf_decode_image() must stay valid until
+ * figleaf_encode_image() returns, which leaves the result in w->outbuf.
+ */
+int
+figleaf_decode_image(struct figleaf_worker *w,
+                     const JOCTET *data, size_t size,
+                     struct figleaf_context *ctx);
+
+int
+figleaf_encode_image(struct figleaf_worker *w);
+
+/*
+ * After the write or encode stage, decode the output to pixels and add it
+ * to the dataset (see dataset.h) under the input's name.  Does nothing if
+ * ds is NULL.  Returns 0, or -1 as above.
+ */
+int
+figleaf_export_image(struct figleaf_worker *w, struct figleaf_dataset *ds,
+                     const char *name);
+
+/* All three stages, one after the other, stopping at the first failure */
+int
+figleaf_process_image(struct figleaf_worker *w,
+                      char *input_filename, char *output_filename,
+                      char *passphrase, struct figleaf_context *ctx);
+
+/*
+ * Read an image once and encrypt it under each of the sweep's
+ * combinations of settings (see sweep.h), writing each result to the
+ * filename made for it from output_filename, which is the sweep's output
+ * template with the file's path under the input directory, if any, after
+ * it.  The stats cover all of them, with bytes_out their total.  Returns
+ * 0, or -1 as above.
+ */
+int
+figleaf_sweep_image(struct figleaf_worker *w, char *input_filename,
+                    const char *output_filename, char *passphrase,
+                    const struct figleaf_sweep *sweep,
+                    struct figleaf_context *ctx);
+
+#endif